@@ -0,0 +1,142 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: CAPFMT.h
+
+    PURPOSE: Timestamped capture file format, shared by MTTTY and the
+             capture tools.
+
+             A timestamped capture (.MTC) is
+
+                CAPFMT_HEADER
+                blocks      CAPFMT_BLOCK, then its records, packed
+                            with LzCompress unless that didn't help
+                index       CAPFMT_INDEX for each block
+                CAPFMT_TRAILER
+
+             A record is a CAPFMT_RECORD followed by wLength bytes:
+             data received or sent, or a comm event mask.  Times are
+             microseconds since ftStart from the performance counter.
+             Records don't span blocks, and blocks hold at most
+             CAPFMT_BLOCK_SIZE bytes of records.
+
+             The index gives the time range of each block, so a
+             reader finds a time with a binary search.  A capture
+             that wasn't closed has no index; the blocks can still be
+             found from the block headers.
+
+             All values are little endian; 64 bit values are stored
+             as two DWORDs so no structure has padding.
+
+    FUNCTIONS (CapRead.c):
+        CapReadOpen  - opens a capture and loads its index
+        CapReadClose - closes a capture
+        CapReadSeek  - positions at the first record at or after a time
+        CapReadNext  - returns the next record
+
+-----------------------------------------------------------------------------*/
+
+#ifndef CAPFMT_H
+#define CAPFMT_H
+
+#define CAPFMT_EXT          ".MTC"
+
+#define CAPFMT_MAGIC        0x3143544D      // "MTC1"
+#define CAPFMT_BLOCK_MAGIC  0x4243544D      // "MTCB"
+#define CAPFMT_END_MAGIC    0x4543544D      // "MTCE"
+#define CAPFMT_VERSION      1
+
+#define CAPFMT_BLOCK_SIZE   0x10000         // records per block, bytes
+#define CAPFMT_RECORD_MAX   0x1000          // longer data is split
+
+#define CAPREC_RX           1               // data received
+#define CAPREC_TX           2               // data sent
+#define CAPREC_EVENT        3               // DWORD, EV_* from WaitCommEvent
+
+#define CAPFMT_MAKE64(lo, hi)   ((ULONGLONG) (hi) << 32 | (lo))
+
+typedef struct CAPFMT_HEADER
+{
+    DWORD    dwMagic;                       // CAPFMT_MAGIC
+    DWORD    dwVersion;
+    FILETIME ftStart;                       // UTC at time 0
+    DWORD    dwBaudRate;                    // port settings
+    BYTE     bByteSize;
+    BYTE     bParity;
+    BYTE     bStopBits;
+    BYTE     bReserved;
+    DWORD    dwReserved[2];
+} CAPFMT_HEADER;
+
+typedef struct CAPFMT_BLOCK
+{
+    DWORD    dwMagic;                       // CAPFMT_BLOCK_MAGIC
+    DWORD    dwRawSize;                     // records, unpacked
+    DWORD    dwPackedSize;                  // bytes following, stored if
+                                            // equal to dwRawSize
+    DWORD    dwRecords;
+} CAPFMT_BLOCK;
+
+typedef struct CAPFMT_RECORD
+{
+    DWORD    dwTimeLow;                     // us since ftStart
+    DWORD    dwTimeHigh;
+    WORD     wLength;                       // data bytes following
+    BYTE     bType;                         // CAPREC_*
+    BYTE     bReserved;
+} CAPFMT_RECORD;
+
+typedef struct CAPFMT_INDEX
+{
+    DWORD    dwOffsetLow;                   // of the CAPFMT_BLOCK
+    DWORD    dwOffsetHigh;
+    DWORD    dwFirstLow;                    // time of the first record
+    DWORD    dwFirstHigh;
+    DWORD    dwLastLow;                     // and of the last
+    DWORD    dwLastHigh;
+} CAPFMT_INDEX;
+
+typedef struct CAPFMT_TRAILER
+{
+    DWORD    dwIndexLow;                    // offset of the index
+    DWORD    dwIndexHigh;
+    DWORD    dwBlocks;                      // index entries
+    DWORD    dwMagic;                       // CAPFMT_END_MAGIC
+} CAPFMT_TRAILER;
+
+//
+//  Capture reader; look in CapRead.c for more info
+//
+typedef struct CAPREADER
+{
+    HANDLE         hFile;
+    CAPFMT_HEADER  Header;
+    CAPFMT_INDEX * pIndex;                  // process heap
+    DWORD          dwBlocks;
+    BOOL           fIndexed;                // FALSE if rebuilt by scanning
+    DWORD          dwNextBlock;             // block CapReadNext loads next
+    BYTE *         lpRaw;                   // records of the loaded block
+    BYTE *         lpPacked;
+    DWORD          dwRawSize;
+    DWORD          dwPos;                   // next record in lpRaw
+} CAPREADER;
+
+typedef struct CAPRECORD
+{
+    ULONGLONG      ullTime;                 // us since Header.ftStart
+    DWORD          dwType;                  // CAPREC_*
+    DWORD          dwLength;
+    const BYTE *   lpData;                  // valid until the next call
+} CAPRECORD;
+
+BOOL CapReadOpen( LPCTSTR, CAPREADER * );
+void CapReadClose( CAPREADER * );
+BOOL CapReadSeek( CAPREADER *, ULONGLONG );
+BOOL CapReadNext( CAPREADER *, CAPRECORD * );
+
+//
+//  Block compression; look in Compress.c for more info
+//
+DWORD LzCompress( const BYTE *, DWORD, BYTE *, DWORD );
+DWORD LzDecompress( const BYTE *, DWORD, BYTE *, DWORD );
+
+#endif
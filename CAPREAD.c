@@ -0,0 +1,359 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: CapRead.c
+
+    PURPOSE: Reads timestamped captures, see CAPFMT.h.
+
+             The index is loaded when a capture is opened; if the
+             capture wasn't closed the block headers are walked to
+             rebuild it.  Records are returned one at a time from the
+             loaded block.  Seeking by time is a binary search of the
+             index, then a scan of one block.
+
+             Only needs the Win32 file functions and Compress.c, so
+             the capture tools build it too.
+
+    FUNCTIONS:
+        CapReadOpen       - opens a capture and loads its index
+        CapReadClose      - closes a capture
+        CapReadSeek       - positions at the first record at or after a time
+        CapReadNext       - returns the next record
+        CapReadAt         - reads at a file offset
+        CapReadScan       - rebuilds the index from the block headers
+        CapReadLoadBlock  - reads and unpacks a block
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "CAPFMT.h"
+
+//
+// Prototypes for functions called only within this file
+//
+BOOL CapReadAt( CAPREADER *, ULONGLONG, void *, DWORD );
+BOOL CapReadScan( CAPREADER *, ULONGLONG );
+BOOL CapReadLoadBlock( CAPREADER *, DWORD );
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapReadOpen(LPCTSTR, CAPREADER *)
+
+PURPOSE: Opens a capture and loads its index
+
+PARAMETERS:
+    lpFName - capture file
+    pCap    - reader to set up
+
+RETURN: TRUE if the file is a capture; positioned at the first record
+
+-----------------------------------------------------------------------------*/
+BOOL CapReadOpen(LPCTSTR lpFName, CAPREADER * pCap)
+{
+    CAPFMT_TRAILER Trailer;
+    LARGE_INTEGER liSize;
+    ULONGLONG ullIndex;
+    DWORD dwIndexSize;
+
+    ZeroMemory(pCap, sizeof(CAPREADER));
+
+    pCap->hFile = CreateFile(lpFName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (pCap->hFile == INVALID_HANDLE_VALUE) {
+        pCap->hFile = NULL;
+        return FALSE;
+    }
+
+    if (!GetFileSizeEx(pCap->hFile, &liSize) ||
+        !CapReadAt(pCap, 0, &pCap->Header, sizeof(CAPFMT_HEADER)) ||
+        pCap->Header.dwMagic != CAPFMT_MAGIC || pCap->Header.dwVersion != CAPFMT_VERSION)
+        goto fail;
+
+    pCap->lpRaw = (BYTE *) HeapAlloc(GetProcessHeap(), 0, CAPFMT_BLOCK_SIZE);
+    pCap->lpPacked = (BYTE *) HeapAlloc(GetProcessHeap(), 0, CAPFMT_BLOCK_SIZE);
+    if (pCap->lpRaw == NULL || pCap->lpPacked == NULL)
+        goto fail;
+
+    //
+    // the index, if the trailer is there and makes sense
+    //
+    if ((ULONGLONG) liSize.QuadPart >= sizeof(CAPFMT_HEADER) + sizeof(CAPFMT_TRAILER) &&
+        CapReadAt(pCap, liSize.QuadPart - sizeof(CAPFMT_TRAILER), &Trailer, sizeof(Trailer)) &&
+        Trailer.dwMagic == CAPFMT_END_MAGIC) {
+        ullIndex = CAPFMT_MAKE64(Trailer.dwIndexLow, Trailer.dwIndexHigh);
+        dwIndexSize = Trailer.dwBlocks * sizeof(CAPFMT_INDEX);
+        if (ullIndex + dwIndexSize + sizeof(CAPFMT_TRAILER) == (ULONGLONG) liSize.QuadPart) {
+            pCap->pIndex = (CAPFMT_INDEX *) HeapAlloc(GetProcessHeap(), 0, dwIndexSize + 1);
+            if (pCap->pIndex && CapReadAt(pCap, ullIndex, pCap->pIndex, dwIndexSize)) {
+                pCap->dwBlocks = Trailer.dwBlocks;
+                pCap->fIndexed = TRUE;
+            }
+        }
+    }
+
+    if (!pCap->fIndexed) {
+        if (pCap->pIndex) {
+            HeapFree(GetProcessHeap(), 0, pCap->pIndex);
+            pCap->pIndex = NULL;
+        }
+        if (!CapReadScan(pCap, liSize.QuadPart))
+            goto fail;
+    }
+
+    return TRUE;
+
+fail:
+    CapReadClose(pCap);
+    return FALSE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapReadClose(CAPREADER *)
+
+PURPOSE: Closes a capture and frees its buffers
+
+PARAMETERS:
+    pCap - reader from CapReadOpen
+
+-----------------------------------------------------------------------------*/
+void CapReadClose(CAPREADER * pCap)
+{
+    if (pCap->hFile)
+        CloseHandle(pCap->hFile);
+    if (pCap->pIndex)
+        HeapFree(GetProcessHeap(), 0, pCap->pIndex);
+    if (pCap->lpRaw)
+        HeapFree(GetProcessHeap(), 0, pCap->lpRaw);
+    if (pCap->lpPacked)
+        HeapFree(GetProcessHeap(), 0, pCap->lpPacked);
+
+    ZeroMemory(pCap, sizeof(CAPREADER));
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapReadSeek(CAPREADER *, ULONGLONG)
+
+PURPOSE: Positions at the first record at or after a time
+
+PARAMETERS:
+    pCap    - reader from CapReadOpen
+    ullTime - us since the capture start
+
+RETURN: FALSE if there is no such record
+
+COMMENTS: Binary search for the first block that ends at or after
+          the time, then its earlier records are skipped.
+
+-----------------------------------------------------------------------------*/
+BOOL CapReadSeek(CAPREADER * pCap, ULONGLONG ullTime)
+{
+    CAPFMT_RECORD Rec;
+    DWORD dwLow = 0, dwHigh = pCap->dwBlocks, dwMid;
+
+    while (dwLow < dwHigh) {
+        dwMid = (dwLow + dwHigh) / 2;
+        if (CAPFMT_MAKE64(pCap->pIndex[dwMid].dwLastLow, pCap->pIndex[dwMid].dwLastHigh) < ullTime)
+            dwLow = dwMid + 1;
+        else
+            dwHigh = dwMid;
+    }
+
+    if (dwLow == pCap->dwBlocks || !CapReadLoadBlock(pCap, dwLow))
+        return FALSE;
+
+    while (pCap->dwPos + sizeof(CAPFMT_RECORD) <= pCap->dwRawSize) {
+        CopyMemory(&Rec, pCap->lpRaw + pCap->dwPos, sizeof(Rec));
+        if (CAPFMT_MAKE64(Rec.dwTimeLow, Rec.dwTimeHigh) >= ullTime)
+            break;
+        pCap->dwPos += sizeof(Rec) + Rec.wLength;
+    }
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapReadNext(CAPREADER *, CAPRECORD *)
+
+PURPOSE: Returns the next record
+
+PARAMETERS:
+    pCap    - reader from CapReadOpen
+    pRecord - filled in; the data stays valid until the next call
+
+RETURN: FALSE at the end of the capture or if a block is damaged
+
+-----------------------------------------------------------------------------*/
+BOOL CapReadNext(CAPREADER * pCap, CAPRECORD * pRecord)
+{
+    CAPFMT_RECORD Rec;
+
+    while (pCap->dwPos >= pCap->dwRawSize) {
+        if (pCap->dwNextBlock >= pCap->dwBlocks || !CapReadLoadBlock(pCap, pCap->dwNextBlock))
+            return FALSE;
+    }
+
+    if (pCap->dwPos + sizeof(CAPFMT_RECORD) > pCap->dwRawSize)
+        return FALSE;
+    CopyMemory(&Rec, pCap->lpRaw + pCap->dwPos, sizeof(Rec));
+    if (pCap->dwPos + sizeof(Rec) + Rec.wLength > pCap->dwRawSize)
+        return FALSE;
+
+    pRecord->ullTime  = CAPFMT_MAKE64(Rec.dwTimeLow, Rec.dwTimeHigh);
+    pRecord->dwType   = Rec.bType;
+    pRecord->dwLength = Rec.wLength;
+    pRecord->lpData   = pCap->lpRaw + pCap->dwPos + sizeof(Rec);
+
+    pCap->dwPos += sizeof(Rec) + Rec.wLength;
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapReadAt(CAPREADER *, ULONGLONG, void *, DWORD)
+
+PURPOSE: Reads from a file offset
+
+RETURN: TRUE if all bytes were read
+
+-----------------------------------------------------------------------------*/
+BOOL CapReadAt(CAPREADER * pCap, ULONGLONG ullOffset, void * lpBuf, DWORD dwLen)
+{
+    LARGE_INTEGER liPos;
+    DWORD dwRead;
+
+    liPos.QuadPart = ullOffset;
+    if (!SetFilePointerEx(pCap->hFile, liPos, NULL, FILE_BEGIN))
+        return FALSE;
+
+    return ReadFile(pCap->hFile, lpBuf, dwLen, &dwRead, NULL) && dwRead == dwLen;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapReadScan(CAPREADER *, ULONGLONG)
+
+PURPOSE: Rebuilds the index of a capture that wasn't closed
+
+PARAMETERS:
+    pCap   - reader, header read
+    ullEnd - file size
+
+RETURN: FALSE if out of memory
+
+COMMENTS: Walks the block headers from the file header on and
+          stops at the first one that is damaged or cut short, the
+          end of what was written.  The time range of each block
+          comes from unpacking it.
+
+-----------------------------------------------------------------------------*/
+BOOL CapReadScan(CAPREADER * pCap, ULONGLONG ullEnd)
+{
+    CAPFMT_BLOCK Block;
+    CAPFMT_RECORD Rec;
+    CAPFMT_INDEX * pIndex;
+    ULONGLONG ullOffset = sizeof(CAPFMT_HEADER);
+    ULONGLONG ullFirst;
+    DWORD dwMax = 0;
+    DWORD dwPos;
+
+    for (;;) {
+        if (ullOffset + sizeof(Block) > ullEnd ||
+            !CapReadAt(pCap, ullOffset, &Block, sizeof(Block)) ||
+            Block.dwMagic != CAPFMT_BLOCK_MAGIC ||
+            Block.dwRawSize > CAPFMT_BLOCK_SIZE || Block.dwPackedSize > Block.dwRawSize ||
+            ullOffset + sizeof(Block) + Block.dwPackedSize > ullEnd)
+            break;
+
+        if (pCap->dwBlocks == dwMax) {
+            dwMax = dwMax ? 2 * dwMax : 256;
+            pIndex = pCap->pIndex ?
+                (CAPFMT_INDEX *) HeapReAlloc(GetProcessHeap(), 0, pCap->pIndex, dwMax * sizeof(CAPFMT_INDEX)) :
+                (CAPFMT_INDEX *) HeapAlloc(GetProcessHeap(), 0, dwMax * sizeof(CAPFMT_INDEX));
+            if (pIndex == NULL)
+                return FALSE;
+            pCap->pIndex = pIndex;
+        }
+
+        pIndex = &pCap->pIndex[pCap->dwBlocks];
+        pIndex->dwOffsetLow = (DWORD) ullOffset;
+        pIndex->dwOffsetHigh = (DWORD) (ullOffset >> 32);
+        pCap->dwBlocks++;
+
+        if (!CapReadLoadBlock(pCap, pCap->dwBlocks - 1)) {
+            pCap->dwBlocks--;
+            break;
+        }
+
+        //
+        // time range, first and last record
+        //
+        ullFirst = 0;
+        ZeroMemory(&Rec, sizeof(Rec));
+        for (dwPos = 0; dwPos + sizeof(Rec) <= pCap->dwRawSize; dwPos += sizeof(Rec) + Rec.wLength) {
+            CopyMemory(&Rec, pCap->lpRaw + dwPos, sizeof(Rec));
+            if (dwPos == 0)
+                ullFirst = CAPFMT_MAKE64(Rec.dwTimeLow, Rec.dwTimeHigh);
+        }
+        pIndex->dwFirstLow = (DWORD) ullFirst;
+        pIndex->dwFirstHigh = (DWORD) (ullFirst >> 32);
+        pIndex->dwLastLow = Rec.dwTimeLow;
+        pIndex->dwLastHigh = Rec.dwTimeHigh;
+
+        ullOffset += sizeof(Block) + Block.dwPackedSize;
+    }
+
+    pCap->dwNextBlock = 0;
+    pCap->dwRawSize = pCap->dwPos = 0;
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapReadLoadBlock(CAPREADER *, DWORD)
+
+PURPOSE: Reads and unpacks a block
+
+PARAMETERS:
+    pCap    - reader
+    dwBlock - index entry
+
+RETURN: FALSE if the block is damaged
+
+COMMENTS: Positions at the block's first record.
+
+-----------------------------------------------------------------------------*/
+BOOL CapReadLoadBlock(CAPREADER * pCap, DWORD dwBlock)
+{
+    CAPFMT_BLOCK Block;
+    ULONGLONG ullOffset;
+
+    pCap->dwRawSize = pCap->dwPos = 0;
+
+    ullOffset = CAPFMT_MAKE64(pCap->pIndex[dwBlock].dwOffsetLow, pCap->pIndex[dwBlock].dwOffsetHigh);
+    if (!CapReadAt(pCap, ullOffset, &Block, sizeof(Block)) ||
+        Block.dwMagic != CAPFMT_BLOCK_MAGIC ||
+        Block.dwRawSize > CAPFMT_BLOCK_SIZE || Block.dwPackedSize > Block.dwRawSize ||
+        !CapReadAt(pCap, ullOffset + sizeof(Block), pCap->lpPacked, Block.dwPackedSize))
+        return FALSE;
+
+    if (Block.dwPackedSize == Block.dwRawSize)
+        CopyMemory(pCap->lpRaw, pCap->lpPacked, Block.dwRawSize);
+    else if (LzDecompress(pCap->lpPacked, Block.dwPackedSize, pCap->lpRaw, CAPFMT_BLOCK_SIZE) != Block.dwRawSize)
+        return FALSE;
+
+    pCap->dwRawSize = Block.dwRawSize;
+    pCap->dwNextBlock = dwBlock + 1;
+
+    return TRUE;
+}
@@ -0,0 +1,1246 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: CapSink.c
+
+    PURPOSE: Write-behind sink for captured data.
+
+             Capturing used to call WriteFile on the reader thread
+             for every read, so a slow disk or a virus scanner held up
+             the serial reads.  The reader now only copies the data
+             into one of CAPSINK_BUFFERS buffers of CAPSINK_BUFFER_SIZE
+             bytes; a sink thread writes the filled buffers to the
+             file.  If every buffer is still waiting for the disk the
+             data is dropped and counted, the reader never waits.
+
+             The file is opened for overlapped, unbuffered writes, so
+             the capture doesn't push other files out of the cache.
+             Unbuffered writes must be whole sectors from aligned
+             memory: the buffers come from VirtualAlloc and are written
+             in whole pages.  Data left in the buffer being filled is
+             queued once it has waited CAPSINK_FLUSH_MS, whole pages of
+             it, the rest moves to the next buffer.  The last partial
+             page is written padded when the capture closes and the
+             file is cut back to its length.
+
+             A timestamped capture (CAPFMT.h) fills the buffers with
+             records instead: received data from the reader, sent
+             data from the writer thread and comm events.  A record
+             never spans buffers, so a queued buffer is whole records;
+             the sink thread cuts it into blocks, packs them and
+             collects them in an output buffer, which is written in
+             whole pages like the plain capture.  The index of the
+             blocks is kept in memory and written when the capture
+             closes.
+
+             The sink thread also steps the progress bar, at most
+             every CAPSINK_PROGRESS_MS, instead of a message per read.
+
+             With ROTATEMB or ROTATEMIN set the capture goes to
+             segments, name.000001.ext, name.000002.ext and so on.
+             The sink thread starts the next segment once the open
+             one has ROTATEMB of data or is ROTATEMIN old, between
+             two queued buffers: a queued buffer is whole pages or
+             whole records, so each byte goes to exactly one segment
+             and the segments join up.  A timestamped segment has
+             its own header and index; all of them keep the time base
+             of the first, so times go on across segments.
+
+             Closed segments are handed to a rotation thread running
+             at background priority.  It compresses plain segments
+             with NTFS compression, which readers don't notice, and
+             deletes the oldest segments while the closed ones take
+             more than ROTATEBUDGETMB on disk.  Timestamped segments
+             are packed already and are left as they are.  The
+             rotation thread goes on after the capture closes, until
+             the last segment is done.
+
+    FUNCTIONS:
+        CapSinkCreate   - creates the buffer lock
+        CapSinkDestroy  - frees the buffer lock
+        CapSinkOpen     - creates the file and starts the sink thread
+        CapSinkClose    - writes the rest and closes the file
+        CapSinkWrite    - captures received data
+        CapSinkRecord   - adds a record to a timestamped capture
+        CapSinkGetStats - capture statistics
+        CapSinkProc     - sink thread, writes the filled buffers
+        CapSinkRotate   - closes the segment and opens the next
+        CapSinkRotProc  - rotation thread, compresses and deletes
+                          closed segments
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include <winioctl.h>
+#include <commctrl.h>
+#include <string.h>
+#include "MTTTY.h"
+
+#define CAPSINK_BUFFER_SIZE     0x100000    // bytes per buffer
+#define CAPSINK_BUFFERS         3
+#define CAPSINK_FLUSH_MS        1000        // longest data waits in memory
+#define CAPSINK_PROGRESS_MS     250
+
+#ifndef THREAD_MODE_BACKGROUND_BEGIN
+#define THREAD_MODE_BACKGROUND_BEGIN 0x00010000 // Vista, not in older headers
+#endif
+
+#define CAPBUF_FREE             0           // reader may fill it
+#define CAPBUF_QUEUED           1           // waiting for or being written
+
+typedef struct CAPBUF
+{
+    char *        lpData;               // VirtualAlloc, page aligned
+    DWORD         dwFill;
+    LONG volatile lState;
+} CAPBUF;
+
+static struct
+{
+    CRITICAL_SECTION csFill;            // the buffer being filled
+    BOOL          fOpen;                // reader may write
+    BOOL          fFormat;              // timestamped capture
+    HANDLE        hFile;
+    HANDLE        hThread;
+    HANDLE        hQueuedEvent;         // auto reset, a buffer was queued
+    HANDLE        hStopEvent;           // manual reset
+    HANDLE        hWriteEvent;          // overlapped write completion
+    HWND          hWndProgress;
+    CAPBUF        Bufs[CAPSINK_BUFFERS];
+    DWORD         dwFillBuf;            // buffer the reader fills
+    DWORD         dwWriteBuf;           // next buffer the thread writes
+    DWORD         dwPageSize;
+    DWORD         dwQueueTime;          // tick of the last queued buffer
+    DWORD volatile dwReads;             // CapSinkWrite calls, for progress
+    LONG volatile lQueued;
+    ULONGLONG     ullOffset;            // file offset of the next write
+    LARGE_INTEGER liFreq;               // record times
+    LONGLONG      llStart;
+    char *        lpOut;                // packed blocks, page aligned
+    DWORD         dwOut;
+    CAPFMT_INDEX * pIndex;              // process heap
+    DWORD         dwMaxBlocks;
+    BOOL          fIndexLost;           // out of memory, no index written
+    CAPFMT_HEADER Header;               // starts each segment
+    BOOL          fRotate;              // segments
+    ULONGLONG     ullRotateSize;        // bytes, 0 if no size limit
+    DWORD         dwRotateTime;         // ms, 0 if no time limit
+    DWORD         dwSegment;            // number of the open segment
+    DWORD         dwSegmentTime;        // tick it was opened
+    char          szBase[MAX_PATH];     // segment name up to the number
+    char          szExt[MAX_PATH];      // and after it
+    HANDLE        hRotThread;
+    HANDLE        hRotEvent;            // auto reset, a segment was closed
+    DWORD volatile dwClosed;            // segments closed
+    BOOL volatile fRotDone;             // capture closed, dwClosed is final
+    BOOL volatile fRotAbort;            // program exit, stop rotating
+    BOOL          fCompress;            // ROTATECOMPRESS, plain captures
+    ULONGLONG     ullBudget;            // bytes, 0 if no limit
+    ULONGLONG     ullCaptured;          // statistics
+    ULONGLONG     ullWritten;           // closed segments
+    DWORD         dwDropped;
+    DWORD         dwQueuedPeak;
+    DWORD         dwWrites;
+    DWORD         dwMaxWriteTime;
+    DWORD         dwErrors;
+    DWORD         dwBlocks;
+    DWORD         dwCompressed;
+    DWORD         dwDeleted;
+} gCapSink;
+
+static BYTE gCapPacked[CAPFMT_BLOCK_SIZE];      // LzCompress output
+
+//
+// Prototypes for functions called only within this file
+//
+void CapSinkAppend( DWORD, const char *, DWORD );
+void CapSinkQueue( DWORD );
+BOOL CapSinkFlush( char *, DWORD );
+void CapSinkTail( char *, DWORD );
+void CapSinkPack( const char *, DWORD );
+void CapSinkOut( const void *, DWORD );
+void CapSinkFinish( void );
+BOOL CapSinkSegment( LPCTSTR );
+void CapSinkSegmentName( DWORD, char * );
+BOOL CapSinkRotateDue( void );
+void CapSinkRotate( void );
+void CapSinkRotWait( void );
+BOOL CapSinkCompress( LPCTSTR );
+DWORD WINAPI CapSinkProc( LPVOID );
+DWORD WINAPI CapSinkRotProc( LPVOID );
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkCreate
+
+PURPOSE: Creates the buffer lock
+
+COMMENTS: The lock lives as long as the program, the reader thread
+          may still be in CapSinkWrite when a capture closes.
+
+-----------------------------------------------------------------------------*/
+void CapSinkCreate()
+{
+    InitializeCriticalSection(&gCapSink.csFill);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkDestroy
+
+PURPOSE: Frees the buffer lock
+
+COMMENTS: A rotation thread still at work stops after the segment
+          it is on.
+
+-----------------------------------------------------------------------------*/
+void CapSinkDestroy()
+{
+    gCapSink.fRotAbort = TRUE;
+    if (gCapSink.hRotEvent)
+        SetEvent(gCapSink.hRotEvent);
+    CapSinkRotWait();
+
+    DeleteCriticalSection(&gCapSink.csFill);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkOpen(LPCTSTR, HWND, BOOL)
+
+PURPOSE: Creates the capture file and starts the sink thread
+
+PARAMETERS:
+    lpFName      - name of file to create
+    hWndProgress - progress bar stepped while data arrives
+    fFormat      - TRUE for a timestamped capture, FALSE for plain data
+
+RETURN: TRUE if CapSinkWrite may be called
+
+COMMENTS: Rotating, lpFName names the segments and the first one is
+          created.  A rotation thread of the last capture is waited
+          for, the segment names may be the same.
+
+-----------------------------------------------------------------------------*/
+BOOL CapSinkOpen(LPCTSTR lpFName, HWND hWndProgress, BOOL fFormat)
+{
+    LARGE_INTEGER liNow;
+    SYSTEM_INFO sysInfo;
+    DWORD dwThreadId;
+    char szSegment[MAX_PATH];
+    char * pDot;
+    int i;
+
+    CapSinkRotWait();
+
+    //
+    // statistics start over with each capture
+    //
+    gCapSink.fFormat = fFormat;
+    gCapSink.dwFillBuf = gCapSink.dwWriteBuf = 0;
+    gCapSink.lQueued = 0;
+    gCapSink.ullOffset = gCapSink.ullCaptured = gCapSink.ullWritten = 0;
+    gCapSink.dwDropped = gCapSink.dwQueuedPeak = 0;
+    gCapSink.dwWrites = gCapSink.dwMaxWriteTime = gCapSink.dwErrors = 0;
+    gCapSink.dwReads = 0;
+    gCapSink.dwOut = gCapSink.dwBlocks = gCapSink.dwMaxBlocks = 0;
+    gCapSink.fIndexLost = FALSE;
+    gCapSink.dwQueueTime = GetTickCount();
+    gCapSink.hWndProgress = hWndProgress;
+
+    //
+    // rotation settings are taken when the capture starts
+    //
+    gCapSink.ullRotateSize = ROTATEMB(TTYInfo) * (ULONGLONG) 0x100000;
+    gCapSink.dwRotateTime = ROTATEMIN(TTYInfo) * 60000;
+    gCapSink.fRotate = gCapSink.ullRotateSize || gCapSink.dwRotateTime;
+    gCapSink.ullBudget = ROTATEBUDGETMB(TTYInfo) * (ULONGLONG) 0x100000;
+    gCapSink.fCompress = ROTATECOMPRESS(TTYInfo) && !fFormat;
+    gCapSink.dwSegment = 1;
+    gCapSink.dwClosed = 0;
+    gCapSink.fRotDone = gCapSink.fRotAbort = FALSE;
+    gCapSink.dwCompressed = gCapSink.dwDeleted = 0;
+
+    GetSystemInfo(&sysInfo);
+    gCapSink.dwPageSize = sysInfo.dwPageSize;
+
+    for (i = 0; i < CAPSINK_BUFFERS; i++) {
+        gCapSink.Bufs[i].dwFill = 0;
+        gCapSink.Bufs[i].lState = CAPBUF_FREE;
+        gCapSink.Bufs[i].lpData = (char *) VirtualAlloc(NULL, CAPSINK_BUFFER_SIZE,
+                                                        MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (gCapSink.Bufs[i].lpData == NULL) {
+            ErrorReporter("VirtualAlloc (capture buffer)");
+            CapSinkClose();
+            return FALSE;
+        }
+    }
+
+    gCapSink.hQueuedEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    gCapSink.hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    gCapSink.hWriteEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (gCapSink.hQueuedEvent == NULL || gCapSink.hStopEvent == NULL || gCapSink.hWriteEvent == NULL) {
+        ErrorReporter("CreateEvent (capture sink)");
+        CapSinkClose();
+        return FALSE;
+    }
+
+    //
+    // timestamped capture, the header starts each segment
+    //
+    if (fFormat) {
+        gCapSink.lpOut = (char *) VirtualAlloc(NULL, CAPSINK_BUFFER_SIZE,
+                                               MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (gCapSink.lpOut == NULL) {
+            ErrorReporter("VirtualAlloc (capture output)");
+            CapSinkClose();
+            return FALSE;
+        }
+
+        ZeroMemory(&gCapSink.Header, sizeof(gCapSink.Header));
+        gCapSink.Header.dwMagic    = CAPFMT_MAGIC;
+        gCapSink.Header.dwVersion  = CAPFMT_VERSION;
+        gCapSink.Header.dwBaudRate = BAUDRATE(TTYInfo);
+        gCapSink.Header.bByteSize  = BYTESIZE(TTYInfo);
+        gCapSink.Header.bParity    = PARITY(TTYInfo);
+        gCapSink.Header.bStopBits  = STOPBITS(TTYInfo);
+
+        QueryPerformanceFrequency(&gCapSink.liFreq);
+        QueryPerformanceCounter(&liNow);
+        GetSystemTimeAsFileTime(&gCapSink.Header.ftStart);
+        gCapSink.llStart = liNow.QuadPart;
+    }
+
+    //
+    // rotating, name.ext gives name.000001.ext and on
+    //
+    if (gCapSink.fRotate) {
+        lstrcpyn(gCapSink.szBase, lpFName, MAX_PATH - 16);
+        pDot = strrchr(gCapSink.szBase, '.');
+        if (pDot && strchr(pDot, '\\') == NULL) {
+            lstrcpy(gCapSink.szExt, pDot);
+            *pDot = 0;
+        }
+        else
+            gCapSink.szExt[0] = 0;
+        gCapSink.szExt[MAX_PATH - 16 - lstrlen(gCapSink.szBase)] = 0;
+
+        CapSinkSegmentName(1, szSegment);
+        lpFName = szSegment;
+    }
+
+    if (!CapSinkSegment(lpFName)) {
+        CapSinkClose();
+        return FALSE;
+    }
+
+    if (gCapSink.fRotate) {
+        gCapSink.hRotEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (gCapSink.hRotEvent == NULL) {
+            ErrorReporter("CreateEvent (capture rotation)");
+            CapSinkClose();
+            return FALSE;
+        }
+
+        gCapSink.hRotThread = CreateThread(NULL, 0, CapSinkRotProc, NULL, 0, &dwThreadId);
+        if (gCapSink.hRotThread == NULL) {
+            ErrorReporter("CreateThread (capture rotation)");
+            CapSinkClose();
+            return FALSE;
+        }
+    }
+
+    gCapSink.hThread = CreateThread(NULL, 0, CapSinkProc, NULL, 0, &dwThreadId);
+    if (gCapSink.hThread == NULL) {
+        ErrorReporter("CreateThread (capture sink)");
+        CapSinkClose();
+        return FALSE;
+    }
+
+    EnterCriticalSection(&gCapSink.csFill);
+    gCapSink.fOpen = TRUE;
+    LeaveCriticalSection(&gCapSink.csFill);
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkClose
+
+PURPOSE: Writes the captured data still buffered and closes the file
+
+COMMENTS: Stops the sink thread after it has written the queued
+          buffers.  The rest of the buffer being filled is written,
+          for a timestamped capture followed by the index and the
+          trailer.  The last segment goes to the rotation thread,
+          which isn't waited for.
+
+-----------------------------------------------------------------------------*/
+void CapSinkClose()
+{
+    CAPBUF * pBuf;
+    int i;
+
+    EnterCriticalSection(&gCapSink.csFill);
+    gCapSink.fOpen = FALSE;
+    LeaveCriticalSection(&gCapSink.csFill);
+
+    if (gCapSink.hThread) {
+        SetEvent(gCapSink.hStopEvent);
+        WaitForSingleObject(gCapSink.hThread, INFINITE);
+        CloseHandle(gCapSink.hThread);
+        gCapSink.hThread = NULL;
+
+        pBuf = &gCapSink.Bufs[gCapSink.dwFillBuf];
+        if (!gCapSink.fFormat)
+            CapSinkTail(pBuf->lpData, pBuf->dwFill);
+        else
+            CapSinkPack(pBuf->lpData, pBuf->dwFill);
+        CapSinkFinish();
+        pBuf->dwFill = 0;
+    }
+
+    if (gCapSink.hFile) {
+        CloseHandle(gCapSink.hFile);
+        gCapSink.hFile = NULL;
+    }
+
+    //
+    // dwClosed is final before the rotation thread sees fRotDone
+    //
+    if (gCapSink.hRotThread) {
+        gCapSink.dwClosed = gCapSink.dwSegment;
+        MemoryBarrier();
+        gCapSink.fRotDone = TRUE;
+        SetEvent(gCapSink.hRotEvent);
+    }
+
+    for (i = 0; i < CAPSINK_BUFFERS; i++) {
+        if (gCapSink.Bufs[i].lpData) {
+            VirtualFree(gCapSink.Bufs[i].lpData, 0, MEM_RELEASE);
+            gCapSink.Bufs[i].lpData = NULL;
+        }
+    }
+
+    if (gCapSink.lpOut) {
+        VirtualFree(gCapSink.lpOut, 0, MEM_RELEASE);
+        gCapSink.lpOut = NULL;
+    }
+    if (gCapSink.pIndex) {
+        HeapFree(GetProcessHeap(), 0, gCapSink.pIndex);
+        gCapSink.pIndex = NULL;
+    }
+
+    if (gCapSink.hQueuedEvent) {
+        CloseHandle(gCapSink.hQueuedEvent);
+        gCapSink.hQueuedEvent = NULL;
+    }
+    if (gCapSink.hStopEvent) {
+        CloseHandle(gCapSink.hStopEvent);
+        gCapSink.hStopEvent = NULL;
+    }
+    if (gCapSink.hWriteEvent) {
+        CloseHandle(gCapSink.hWriteEvent);
+        gCapSink.hWriteEvent = NULL;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkWrite(const char *, DWORD)
+
+PURPOSE: Captures received data
+
+PARAMETERS:
+    lpBuf    - data
+    dwBufLen - its length
+
+COMMENTS: Reader thread.  Only copies; a full buffer is queued for
+          the sink thread.  Data that finds the next buffer still
+          queued is dropped.
+
+-----------------------------------------------------------------------------*/
+void CapSinkWrite(const char * lpBuf, DWORD dwBufLen)
+{
+    CAPBUF * pBuf;
+    DWORD dwCopy;
+
+    EnterCriticalSection(&gCapSink.csFill);
+
+    if (!gCapSink.fOpen) {
+        LeaveCriticalSection(&gCapSink.csFill);
+        return;
+    }
+
+    gCapSink.dwReads++;
+
+    if (gCapSink.fFormat) {
+        CapSinkAppend(CAPREC_RX, lpBuf, dwBufLen);
+        LeaveCriticalSection(&gCapSink.csFill);
+        return;
+    }
+
+    gCapSink.ullCaptured += dwBufLen;
+
+    while (dwBufLen) {
+        pBuf = &gCapSink.Bufs[gCapSink.dwFillBuf];
+        if (pBuf->lState != CAPBUF_FREE) {
+            gCapSink.dwDropped += dwBufLen;
+            break;
+        }
+
+        dwCopy = min(dwBufLen, CAPSINK_BUFFER_SIZE - pBuf->dwFill);
+        CopyMemory(pBuf->lpData + pBuf->dwFill, lpBuf, dwCopy);
+        pBuf->dwFill += dwCopy;
+        lpBuf += dwCopy;
+        dwBufLen -= dwCopy;
+
+        if (pBuf->dwFill == CAPSINK_BUFFER_SIZE)
+            CapSinkQueue(CAPSINK_BUFFER_SIZE);
+    }
+
+    LeaveCriticalSection(&gCapSink.csFill);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkRecord(DWORD, const char *, DWORD)
+
+PURPOSE: Adds a record to a timestamped capture
+
+PARAMETERS:
+    dwType   - CAPREC_TX or CAPREC_EVENT
+    lpData   - data sent, or the event mask
+    dwLength - its length
+
+COMMENTS: Any thread.  Does nothing unless a timestamped capture
+          is open; that is checked without the lock first, so the
+          writer thread doesn't take it for every write otherwise.
+
+-----------------------------------------------------------------------------*/
+void CapSinkRecord(DWORD dwType, const char * lpData, DWORD dwLength)
+{
+    if (!gCapSink.fOpen || !gCapSink.fFormat)
+        return;
+
+    EnterCriticalSection(&gCapSink.csFill);
+    if (gCapSink.fOpen && gCapSink.fFormat)
+        CapSinkAppend(dwType, lpData, dwLength);
+    LeaveCriticalSection(&gCapSink.csFill);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkAppend(DWORD, const char *, DWORD)
+
+PURPOSE: Copies a record into the buffer being filled
+
+PARAMETERS:
+    dwType   - CAPREC_*
+    lpData   - record data
+    dwLength - its length, split in records of CAPFMT_RECORD_MAX
+
+COMMENTS: csFill held.  A record that doesn't fit queues the buffer,
+          so buffers hold whole records.
+
+-----------------------------------------------------------------------------*/
+void CapSinkAppend(DWORD dwType, const char * lpData, DWORD dwLength)
+{
+    CAPFMT_RECORD Rec;
+    LARGE_INTEGER liNow;
+    ULONGLONG ullTicks, ullTime;
+    CAPBUF * pBuf;
+    DWORD dwPiece;
+
+    QueryPerformanceCounter(&liNow);
+    ullTicks = liNow.QuadPart - gCapSink.llStart;
+    ullTime = ullTicks / gCapSink.liFreq.QuadPart * 1000000 +
+              ullTicks % gCapSink.liFreq.QuadPart * 1000000 / gCapSink.liFreq.QuadPart;
+
+    Rec.dwTimeLow = (DWORD) ullTime;
+    Rec.dwTimeHigh = (DWORD) (ullTime >> 32);
+    Rec.bType = (BYTE) dwType;
+    Rec.bReserved = 0;
+
+    gCapSink.ullCaptured += dwLength;
+
+    while (dwLength) {
+        pBuf = &gCapSink.Bufs[gCapSink.dwFillBuf];
+        if (pBuf->lState != CAPBUF_FREE) {
+            gCapSink.dwDropped += dwLength;
+            break;
+        }
+
+        dwPiece = min(dwLength, CAPFMT_RECORD_MAX);
+        if (pBuf->dwFill + sizeof(Rec) + dwPiece > CAPSINK_BUFFER_SIZE) {
+            CapSinkQueue(pBuf->dwFill);
+            continue;
+        }
+
+        Rec.wLength = (WORD) dwPiece;
+        CopyMemory(pBuf->lpData + pBuf->dwFill, &Rec, sizeof(Rec));
+        CopyMemory(pBuf->lpData + pBuf->dwFill + sizeof(Rec), lpData, dwPiece);
+        pBuf->dwFill += sizeof(Rec) + dwPiece;
+        lpData += dwPiece;
+        dwLength -= dwPiece;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkQueue(DWORD)
+
+PURPOSE: Queues the buffer being filled to the sink thread
+
+PARAMETERS:
+    dwBytes - bytes to write, whole pages for a plain capture
+
+COMMENTS: csFill held.  Bytes past dwBytes move to the next buffer,
+          which must be free if there are any.
+
+-----------------------------------------------------------------------------*/
+void CapSinkQueue(DWORD dwBytes)
+{
+    CAPBUF * pBuf = &gCapSink.Bufs[gCapSink.dwFillBuf];
+    DWORD dwNext = (gCapSink.dwFillBuf + 1) % CAPSINK_BUFFERS;
+    DWORD dwRest = pBuf->dwFill - dwBytes;
+    DWORD dwQueued;
+
+    if (dwRest) {
+        CopyMemory(gCapSink.Bufs[dwNext].lpData, pBuf->lpData + dwBytes, dwRest);
+        gCapSink.Bufs[dwNext].dwFill = dwRest;
+    }
+
+    pBuf->dwFill = dwBytes;
+    InterlockedExchange(&pBuf->lState, CAPBUF_QUEUED);
+
+    dwQueued = (DWORD) InterlockedIncrement(&gCapSink.lQueued);
+    gCapSink.dwQueuedPeak = max(gCapSink.dwQueuedPeak, dwQueued);
+
+    gCapSink.dwFillBuf = dwNext;
+    gCapSink.dwQueueTime = GetTickCount();
+    SetEvent(gCapSink.hQueuedEvent);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkFlush(char *, DWORD)
+
+PURPOSE: Writes a buffer at the end of the file
+
+PARAMETERS:
+    lpData  - page aligned data
+    dwBytes - whole pages
+
+RETURN: TRUE if written
+
+COMMENTS: Overlapped write, waited for here; the sink thread has
+          nothing else to do meanwhile.  The file offset moves on
+          even if the write fails, so the block offsets of a
+          timestamped capture stay right.  Without a file, a segment
+          that couldn't be created, the data is counted as an error
+          until the next segment.
+
+-----------------------------------------------------------------------------*/
+BOOL CapSinkFlush(char * lpData, DWORD dwBytes)
+{
+    OVERLAPPED ov = {0};
+    DWORD dwWritten;
+    DWORD dwStart;
+
+    ov.Offset = (DWORD) gCapSink.ullOffset;
+    ov.OffsetHigh = (DWORD) (gCapSink.ullOffset >> 32);
+    ov.hEvent = gCapSink.hWriteEvent;
+
+    dwStart = GetTickCount();
+    gCapSink.ullOffset += dwBytes;
+
+    if (gCapSink.hFile == NULL) {
+        gCapSink.dwErrors++;
+        return FALSE;
+    }
+
+    if ((!WriteFile(gCapSink.hFile, lpData, dwBytes, NULL, &ov) && GetLastError() != ERROR_IO_PENDING) ||
+        !GetOverlappedResult(gCapSink.hFile, &ov, &dwWritten, TRUE) || dwWritten != dwBytes) {
+        ErrorReporter("WriteFile in file capture");
+        gCapSink.dwErrors++;
+        return FALSE;
+    }
+
+    gCapSink.dwWrites++;
+    gCapSink.dwMaxWriteTime = max(gCapSink.dwMaxWriteTime, GetTickCount() - dwStart);
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkTail(char *, DWORD)
+
+PURPOSE: Writes the last partial page and cuts the file to length
+
+PARAMETERS:
+    lpData - page aligned buffer, room for the padding
+    dwFill - bytes in it
+
+COMMENTS: Unbuffered writes are whole pages, the padding is cut off
+          afterwards.
+
+-----------------------------------------------------------------------------*/
+void CapSinkTail(char * lpData, DWORD dwFill)
+{
+    LARGE_INTEGER liEnd;
+    DWORD dwBytes;
+
+    if (dwFill == 0)
+        return;
+
+    dwBytes = (dwFill + gCapSink.dwPageSize - 1) & ~(gCapSink.dwPageSize - 1);
+    ZeroMemory(lpData + dwFill, dwBytes - dwFill);
+
+    if (CapSinkFlush(lpData, dwBytes)) {
+        liEnd.QuadPart = gCapSink.ullOffset - dwBytes + dwFill;
+        if (!SetFilePointerEx(gCapSink.hFile, liEnd, NULL, FILE_BEGIN) ||
+            !SetEndOfFile(gCapSink.hFile))
+            ErrorReporter("SetEndOfFile (capture)");
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkPack(const char *, DWORD)
+
+PURPOSE: Packs whole records into blocks and writes them
+
+PARAMETERS:
+    lpData - records
+    dwLen  - their length
+
+COMMENTS: Sink thread, or CapSinkClose once it has stopped.  Blocks
+          take up to CAPFMT_BLOCK_SIZE bytes of records and are
+          stored unpacked if LzCompress doesn't make them smaller.
+          The whole pages of the output are written.
+
+-----------------------------------------------------------------------------*/
+void CapSinkPack(const char * lpData, DWORD dwLen)
+{
+    CAPFMT_BLOCK Block;
+    CAPFMT_RECORD Rec;
+    CAPFMT_INDEX * pIndex;
+    ULONGLONG ullOffset;
+    DWORD dwSize, dwNext, dwBytes;
+
+    while (dwLen) {
+        //
+        // whole records up to the block size
+        //
+        ZeroMemory(&Block, sizeof(Block));
+        CopyMemory(&Rec, lpData, sizeof(Rec));
+        ullOffset = gCapSink.ullOffset + gCapSink.dwOut;
+
+        if (gCapSink.dwBlocks == gCapSink.dwMaxBlocks && !gCapSink.fIndexLost) {
+            dwNext = gCapSink.dwMaxBlocks ? 2 * gCapSink.dwMaxBlocks : 256;
+            pIndex = gCapSink.pIndex ?
+                (CAPFMT_INDEX *) HeapReAlloc(GetProcessHeap(), 0, gCapSink.pIndex, dwNext * sizeof(CAPFMT_INDEX)) :
+                (CAPFMT_INDEX *) HeapAlloc(GetProcessHeap(), 0, dwNext * sizeof(CAPFMT_INDEX));
+            if (pIndex) {
+                gCapSink.pIndex = pIndex;
+                gCapSink.dwMaxBlocks = dwNext;
+            }
+            else
+                gCapSink.fIndexLost = TRUE;
+        }
+
+        pIndex = gCapSink.fIndexLost ? NULL : &gCapSink.pIndex[gCapSink.dwBlocks];
+        if (pIndex) {
+            pIndex->dwOffsetLow  = (DWORD) ullOffset;
+            pIndex->dwOffsetHigh = (DWORD) (ullOffset >> 32);
+            pIndex->dwFirstLow   = Rec.dwTimeLow;
+            pIndex->dwFirstHigh  = Rec.dwTimeHigh;
+        }
+
+        for (dwSize = 0; dwSize < dwLen; dwSize = dwNext) {
+            CopyMemory(&Rec, lpData + dwSize, sizeof(Rec));
+            dwNext = dwSize + sizeof(Rec) + Rec.wLength;
+            if (dwNext > CAPFMT_BLOCK_SIZE)
+                break;
+            if (pIndex) {
+                pIndex->dwLastLow  = Rec.dwTimeLow;
+                pIndex->dwLastHigh = Rec.dwTimeHigh;
+            }
+            Block.dwRecords++;
+        }
+
+        Block.dwMagic = CAPFMT_BLOCK_MAGIC;
+        Block.dwRawSize = dwSize;
+        Block.dwPackedSize = LzCompress((const BYTE *) lpData, dwSize, gCapPacked, dwSize - 1);
+
+        if (Block.dwPackedSize) {
+            CapSinkOut(&Block, sizeof(Block));
+            CapSinkOut(gCapPacked, Block.dwPackedSize);
+        }
+        else {
+            Block.dwPackedSize = dwSize;
+            CapSinkOut(&Block, sizeof(Block));
+            CapSinkOut(lpData, dwSize);
+        }
+
+        gCapSink.dwBlocks++;
+        lpData += dwSize;
+        dwLen -= dwSize;
+    }
+
+    //
+    // whole pages to the file, the rest stays at the start
+    //
+    dwBytes = gCapSink.dwOut & ~(gCapSink.dwPageSize - 1);
+    if (dwBytes) {
+        CapSinkFlush(gCapSink.lpOut, dwBytes);
+        gCapSink.dwOut -= dwBytes;
+        MoveMemory(gCapSink.lpOut, gCapSink.lpOut + dwBytes, gCapSink.dwOut);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkOut(const void *, DWORD)
+
+PURPOSE: Adds bytes to the timestamped capture output
+
+PARAMETERS:
+    lpData - bytes
+    dwLen  - their length
+
+COMMENTS: A full output buffer is written right away.
+
+-----------------------------------------------------------------------------*/
+void CapSinkOut(const void * lpData, DWORD dwLen)
+{
+    const char * lpIn = (const char *) lpData;
+    DWORD dwCopy;
+
+    while (dwLen) {
+        dwCopy = min(dwLen, CAPSINK_BUFFER_SIZE - gCapSink.dwOut);
+        CopyMemory(gCapSink.lpOut + gCapSink.dwOut, lpIn, dwCopy);
+        gCapSink.dwOut += dwCopy;
+        lpIn += dwCopy;
+        dwLen -= dwCopy;
+
+        if (gCapSink.dwOut == CAPSINK_BUFFER_SIZE) {
+            CapSinkFlush(gCapSink.lpOut, CAPSINK_BUFFER_SIZE);
+            gCapSink.dwOut = 0;
+        }
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkFinish
+
+PURPOSE: Ends a timestamped segment with its index and trailer
+
+COMMENTS: Sink thread, or CapSinkClose once it has stopped.  All
+          records are packed; the output left is written padded and
+          the file cut to length.  A plain segment ends with its
+          last buffer and needs nothing.
+
+-----------------------------------------------------------------------------*/
+void CapSinkFinish()
+{
+    CAPFMT_TRAILER Trailer;
+    ULONGLONG ullIndex;
+
+    if (!gCapSink.fFormat)
+        return;
+
+    //
+    // without the index a reader finds the blocks by scanning
+    //
+    if (!gCapSink.fIndexLost) {
+        ullIndex = gCapSink.ullOffset + gCapSink.dwOut;
+        CapSinkOut(gCapSink.pIndex, gCapSink.dwBlocks * sizeof(CAPFMT_INDEX));
+
+        Trailer.dwIndexLow  = (DWORD) ullIndex;
+        Trailer.dwIndexHigh = (DWORD) (ullIndex >> 32);
+        Trailer.dwBlocks    = gCapSink.dwBlocks;
+        Trailer.dwMagic     = CAPFMT_END_MAGIC;
+        CapSinkOut(&Trailer, sizeof(Trailer));
+    }
+
+    CapSinkTail(gCapSink.lpOut, gCapSink.dwOut);
+    gCapSink.dwOut = 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkSegment(LPCTSTR)
+
+PURPOSE: Creates a capture file, or a segment, and starts it
+
+PARAMETERS:
+    lpFName - name of file to create
+
+RETURN: TRUE if created
+
+COMMENTS: A timestamped segment starts with the capture header and
+          an empty index.
+
+-----------------------------------------------------------------------------*/
+BOOL CapSinkSegment(LPCTSTR lpFName)
+{
+    gCapSink.ullOffset = 0;
+    gCapSink.dwSegmentTime = GetTickCount();
+
+    gCapSink.hFile = CreateFile(lpFName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING, NULL);
+    if (gCapSink.hFile == INVALID_HANDLE_VALUE) {
+        ErrorReporter("CreateFile");
+        gCapSink.hFile = NULL;
+        return FALSE;
+    }
+
+    if (gCapSink.fFormat) {
+        gCapSink.dwBlocks = 0;
+        gCapSink.fIndexLost = FALSE;
+        CapSinkOut(&gCapSink.Header, sizeof(gCapSink.Header));
+    }
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkSegmentName(DWORD, char *)
+
+PURPOSE: Makes the name of a segment
+
+PARAMETERS:
+    dwSegment - its number, from 1
+    szName    - MAX_PATH buffer for the name
+
+-----------------------------------------------------------------------------*/
+void CapSinkSegmentName(DWORD dwSegment, char * szName)
+{
+    wsprintf(szName, "%s.%06lu%s", gCapSink.szBase, dwSegment, gCapSink.szExt);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkProc(LPVOID)
+
+PURPOSE: Sink thread, writes the queued buffers in order
+
+COMMENTS: When nothing was queued for CAPSINK_PROGRESS_MS the thread
+          queues the data that has waited CAPSINK_FLUSH_MS, whole
+          pages of it for a plain capture, and steps the progress bar
+          if data came in.  Exits once the stop event is set and the
+          queued buffers are written.  Rotates segments after a
+          buffer is written, or after the wait for a time limit.
+
+-----------------------------------------------------------------------------*/
+DWORD WINAPI CapSinkProc(LPVOID lpV)
+{
+    HANDLE hWait[2];
+    CAPBUF * pBuf;
+    DWORD dwWait;
+    DWORD dwBytes;
+    DWORD dwReads = 0;
+    DWORD dwProgressTime = GetTickCount();
+
+    hWait[0] = gCapSink.hQueuedEvent;
+    hWait[1] = gCapSink.hStopEvent;
+
+    for (;;) {
+        dwWait = WaitForMultipleObjects(2, hWait, FALSE, CAPSINK_PROGRESS_MS);
+
+        //
+        // everything queued, in the order it was filled
+        //
+        while ((pBuf = &gCapSink.Bufs[gCapSink.dwWriteBuf])->lState == CAPBUF_QUEUED) {
+            if (gCapSink.fFormat)
+                CapSinkPack(pBuf->lpData, pBuf->dwFill);
+            else
+                CapSinkFlush(pBuf->lpData, pBuf->dwFill);
+            pBuf->dwFill = 0;
+            InterlockedDecrement(&gCapSink.lQueued);
+            InterlockedExchange(&pBuf->lState, CAPBUF_FREE);
+            gCapSink.dwWriteBuf = (gCapSink.dwWriteBuf + 1) % CAPSINK_BUFFERS;
+
+            //
+            // segments change between buffers only
+            //
+            if (CapSinkRotateDue())
+                CapSinkRotate();
+        }
+
+        if (dwWait == WAIT_OBJECT_0 + 1)
+            break;
+
+        if (dwWait == WAIT_TIMEOUT && CapSinkRotateDue())
+            CapSinkRotate();
+
+        //
+        // data waiting too long in the buffer being filled
+        //
+        if (dwWait == WAIT_TIMEOUT) {
+            EnterCriticalSection(&gCapSink.csFill);
+            pBuf = &gCapSink.Bufs[gCapSink.dwFillBuf];
+            dwBytes = gCapSink.fFormat ? pBuf->dwFill : pBuf->dwFill & ~(gCapSink.dwPageSize - 1);
+            if (dwBytes && pBuf->lState == CAPBUF_FREE &&
+                GetTickCount() - gCapSink.dwQueueTime >= CAPSINK_FLUSH_MS &&
+                gCapSink.Bufs[(gCapSink.dwFillBuf + 1) % CAPSINK_BUFFERS].lState == CAPBUF_FREE)
+                CapSinkQueue(dwBytes);
+            LeaveCriticalSection(&gCapSink.csFill);
+        }
+
+        if (dwReads != gCapSink.dwReads && GetTickCount() - dwProgressTime >= CAPSINK_PROGRESS_MS) {
+            dwReads = gCapSink.dwReads;
+            dwProgressTime = GetTickCount();
+            PostMessage(gCapSink.hWndProgress, PBM_STEPIT, 0, 0);
+        }
+    }
+
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkRotateDue
+
+PURPOSE: Tells if the open segment is full or old enough to close
+
+RETURN: TRUE if the next segment should be started
+
+COMMENTS: Sink thread.  A segment without data isn't closed, a quiet
+          line doesn't leave a trail of empty segments.
+
+-----------------------------------------------------------------------------*/
+BOOL CapSinkRotateDue()
+{
+    ULONGLONG ullSize = gCapSink.ullOffset + gCapSink.dwOut;
+
+    if (!gCapSink.fRotate)
+        return FALSE;
+
+    if (gCapSink.fFormat ? gCapSink.dwBlocks == 0 : ullSize == 0)
+        return FALSE;
+
+    return (gCapSink.ullRotateSize && ullSize >= gCapSink.ullRotateSize) ||
+           (gCapSink.dwRotateTime && GetTickCount() - gCapSink.dwSegmentTime >= gCapSink.dwRotateTime);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkRotate
+
+PURPOSE: Closes the open segment and starts the next
+
+COMMENTS: Sink thread, between buffers, so the closed segment ends
+          with the last byte of a buffer and the next starts with the
+          first byte of the following one.  The closed segment goes
+          to the rotation thread.  If the next can't be created its
+          data is lost and counted, the one after is tried at the
+          next limit.
+
+-----------------------------------------------------------------------------*/
+void CapSinkRotate()
+{
+    char szName[MAX_PATH];
+
+    CapSinkFinish();
+
+    if (gCapSink.hFile) {
+        CloseHandle(gCapSink.hFile);
+        gCapSink.hFile = NULL;
+    }
+    gCapSink.ullWritten += gCapSink.ullOffset;
+
+    gCapSink.dwClosed = gCapSink.dwSegment;
+    SetEvent(gCapSink.hRotEvent);
+
+    gCapSink.dwSegment++;
+    CapSinkSegmentName(gCapSink.dwSegment, szName);
+    CapSinkSegment(szName);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkRotWait
+
+PURPOSE: Waits for the rotation thread of the last capture
+
+COMMENTS: The capture is closed, so the thread only has the last
+          segments left to do.
+
+-----------------------------------------------------------------------------*/
+void CapSinkRotWait()
+{
+    if (gCapSink.hRotThread) {
+        WaitForSingleObject(gCapSink.hRotThread, INFINITE);
+        CloseHandle(gCapSink.hRotThread);
+        gCapSink.hRotThread = NULL;
+    }
+
+    if (gCapSink.hRotEvent) {
+        CloseHandle(gCapSink.hRotEvent);
+        gCapSink.hRotEvent = NULL;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkRotProc(LPVOID)
+
+PURPOSE: Rotation thread, compresses closed segments and keeps them
+         within the disk budget
+
+COMMENTS: Runs in background mode, which lowers its disk priority as
+          well, or at idle priority where that isn't there; the reader
+          and sink threads never wait for it.  Segments are taken in
+          order.  Their size on disk, compressed, counts against the
+          budget; the oldest are deleted while over it, the newest
+          closed segment is always kept.  A segment that can't be
+          deleted, open in a viewer, still counts and is tried again
+          each time a segment closes; newer ones are deleted meanwhile.
+
+-----------------------------------------------------------------------------*/
+DWORD WINAPI CapSinkRotProc(LPVOID lpV)
+{
+    char szName[MAX_PATH];
+    ULONGLONG ullTotal = 0;
+    ULONGLONG ullSize;
+    DWORD dwDone = 0;
+    DWORD dwOldest = 1;                 // oldest segment not deleted yet
+    DWORD dwSeg;
+    DWORD dwLow, dwHigh;
+    BOOL fLast;
+
+    if (!SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN))
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+
+    do {
+        WaitForSingleObject(gCapSink.hRotEvent, INFINITE);
+
+        fLast = gCapSink.fRotDone;
+        MemoryBarrier();                // dwClosed is final once fRotDone is seen
+
+        while (dwDone < gCapSink.dwClosed && !gCapSink.fRotAbort) {
+            CapSinkSegmentName(++dwDone, szName);
+
+            if (gCapSink.fCompress && CapSinkCompress(szName))
+                gCapSink.dwCompressed++;
+
+            dwLow = GetCompressedFileSize(szName, &dwHigh);
+            if (dwLow != INVALID_FILE_SIZE || GetLastError() == NO_ERROR)
+                ullTotal += CAPFMT_MAKE64(dwLow, dwHigh);
+
+            for (dwSeg = dwOldest;
+                 gCapSink.ullBudget && ullTotal > gCapSink.ullBudget && dwSeg < dwDone;
+                 dwSeg++) {
+                CapSinkSegmentName(dwSeg, szName);
+                dwLow = GetCompressedFileSize(szName, &dwHigh);
+                if (dwLow == INVALID_FILE_SIZE && GetLastError() != NO_ERROR) {
+                    // deleted on an earlier pass
+                    if (dwSeg == dwOldest)
+                        dwOldest++;
+                    continue;
+                }
+                ullSize = CAPFMT_MAKE64(dwLow, dwHigh);
+                if (!DeleteFile(szName))
+                    continue;
+                ullTotal -= min(ullSize, ullTotal);
+                gCapSink.dwDeleted++;
+                if (dwSeg == dwOldest)
+                    dwOldest++;
+            }
+        }
+    } while (!fLast && !gCapSink.fRotAbort);
+
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkCompress(LPCTSTR)
+
+PURPOSE: Compresses a closed segment with NTFS compression
+
+PARAMETERS:
+    lpFName - segment name
+
+RETURN: TRUE if compressed
+
+COMMENTS: FSCTL_SET_COMPRESSION compresses the data already in the
+          file before it returns, on this thread.  Fails quietly on
+          file systems without compression.
+
+-----------------------------------------------------------------------------*/
+BOOL CapSinkCompress(LPCTSTR lpFName)
+{
+    USHORT usFormat = COMPRESSION_FORMAT_DEFAULT;
+    HANDLE hFile;
+    DWORD dwRet;
+    BOOL fRes;
+
+    hFile = CreateFile(lpFName, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                       OPEN_EXISTING, 0, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    fRes = DeviceIoControl(hFile, FSCTL_SET_COMPRESSION, &usFormat, sizeof(usFormat),
+                           NULL, 0, &dwRet, NULL);
+
+    CloseHandle(hFile);
+
+    return fRes;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkGetStats(CAPSINKSTATS *)
+
+PURPOSE: Returns capture statistics for the status dialog
+
+PARAMETERS:
+    pStats - structure to fill in
+
+COMMENTS: The counts of the last capture stay until the next one.
+
+-----------------------------------------------------------------------------*/
+void CapSinkGetStats(CAPSINKSTATS * pStats)
+{
+    pStats->dwBuffers      = gCapSink.dwPageSize ? CAPSINK_BUFFERS : 0;
+    pStats->dwCapturedKB   = (DWORD) (gCapSink.ullCaptured / 1024);
+    pStats->dwWrittenKB    = (DWORD) ((gCapSink.ullWritten + gCapSink.ullOffset) / 1024);
+    pStats->dwDropped      = gCapSink.dwDropped;
+    pStats->dwQueuedPeak   = gCapSink.dwQueuedPeak;
+    pStats->dwWrites       = gCapSink.dwWrites;
+    pStats->dwMaxWriteTime = gCapSink.dwMaxWriteTime;
+    pStats->dwErrors       = gCapSink.dwErrors;
+    pStats->dwBlocks       = gCapSink.dwBlocks;
+    pStats->dwSegments     = gCapSink.fRotate ? gCapSink.dwSegment : 0;
+    pStats->dwCompressed   = gCapSink.dwCompressed;
+    pStats->dwDeleted      = gCapSink.dwDeleted;
+}
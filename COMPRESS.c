@@ -0,0 +1,251 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: Compress.c
+
+    PURPOSE: Small, fast LZ77 block compressor used for scrollback and
+             capture storage.  Speed matters more than ratio, terminal
+             text still compresses several times.
+
+             A compressed block is a list of sequences:
+
+                token       high nibble literal count, low nibble
+                            match length - LZ_MINMATCH (15 = more follows)
+                [count]     extra literal count bytes, 255 = more follows
+                literals
+                offset      2 bytes little endian, distance back to match
+                [count]     extra match length bytes, 255 = more follows
+
+             The last sequence has literals only.
+
+    FUNCTIONS:
+        LzCompress   - compresses a block
+        LzDecompress - decompresses a block
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "MTTTY.h"
+
+#define LZ_MINMATCH         4
+#define LZ_MAXOFFSET        0xFFFF
+#define LZ_HASHBITS         12
+#define LZ_HASH(x)          ((DWORD) ((x) * 2654435761U) >> (32 - LZ_HASHBITS))
+
+/*
+    Prototypes for functions called only within this file
+*/
+BYTE * LzPutCount( BYTE *, BYTE *, DWORD );
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: LzPutCount(BYTE *, BYTE *, DWORD)
+
+PURPOSE: Writes the extra count bytes of a literal or match length
+
+RETURN: next output position, NULL if output is full
+
+-----------------------------------------------------------------------------*/
+BYTE * LzPutCount(BYTE * lpOut, BYTE * lpOutEnd, DWORD dwCount)
+{
+    while (dwCount >= 255) {
+        if (lpOut >= lpOutEnd)
+            return NULL;
+        *lpOut++ = 255;
+        dwCount -= 255;
+    }
+
+    if (lpOut >= lpOutEnd)
+        return NULL;
+    *lpOut++ = (BYTE) dwCount;
+
+    return lpOut;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: LzCompress(const BYTE *, DWORD, BYTE *, DWORD)
+
+PURPOSE: Compresses a block
+
+PARAMETERS:
+    lpSrc     - data to compress
+    dwSrcLen  - size of data
+    lpDst     - output buffer
+    dwDstSize - size of output buffer
+
+RETURN: size of compressed data,
+        0 if it doesn't fit in the output buffer
+
+COMMENTS: Greedy matching with a one entry per slot hash table.
+          LZ_BOUND(n) is always enough output space.
+
+-----------------------------------------------------------------------------*/
+DWORD LzCompress(const BYTE * lpSrc, DWORD dwSrcLen, BYTE * lpDst, DWORD dwDstSize)
+{
+    DWORD dwTable[1 << LZ_HASHBITS];
+    const BYTE * lpIn = lpSrc;
+    const BYTE * lpAnchor = lpSrc;
+    const BYTE * lpEnd = lpSrc + dwSrcLen;
+    const BYTE * lpMatchLimit = dwSrcLen > LZ_MINMATCH ? lpEnd - LZ_MINMATCH : lpSrc;
+    const BYTE * lpRef;
+    BYTE * lpOut = lpDst;
+    BYTE * lpOutEnd = lpDst + dwDstSize;
+    BYTE * lpToken;
+    DWORD dwSeq, dwHash, dwLiterals, dwMatch;
+
+    FillMemory(dwTable, sizeof(dwTable), 0xFF);
+
+    while (lpIn < lpMatchLimit)
+    {
+        CopyMemory(&dwSeq, lpIn, sizeof(DWORD));
+        dwHash = LZ_HASH(dwSeq);
+        lpRef = dwTable[dwHash] == 0xFFFFFFFF ? NULL : lpSrc + dwTable[dwHash];
+        dwTable[dwHash] = (DWORD) (lpIn - lpSrc);
+
+        if (lpRef == NULL || lpIn - lpRef > LZ_MAXOFFSET ||
+            memcmp(lpRef, lpIn, LZ_MINMATCH) != 0)
+        {
+            lpIn++;
+            continue;
+        }
+
+        //
+        // extend the match as far as it goes
+        //
+        dwMatch = LZ_MINMATCH;
+        while (lpIn + dwMatch < lpEnd && lpRef[dwMatch] == lpIn[dwMatch])
+            dwMatch++;
+
+        //
+        // emit literals since the last match, then the match
+        //
+        dwLiterals = (DWORD) (lpIn - lpAnchor);
+        if (lpOut + 1 + dwLiterals + 2 > lpOutEnd)
+            return 0;
+
+        lpToken = lpOut++;
+        *lpToken = (BYTE) ((min(dwLiterals, 15) << 4) | min(dwMatch - LZ_MINMATCH, 15));
+
+        if (dwLiterals >= 15)
+            if ((lpOut = LzPutCount(lpOut, lpOutEnd, dwLiterals - 15)) == NULL)
+                return 0;
+
+        if (lpOut + dwLiterals + 2 > lpOutEnd)
+            return 0;
+        CopyMemory(lpOut, lpAnchor, dwLiterals);
+        lpOut += dwLiterals;
+
+        *lpOut++ = (BYTE) ((lpIn - lpRef) & 0xFF);
+        *lpOut++ = (BYTE) ((lpIn - lpRef) >> 8);
+
+        if (dwMatch - LZ_MINMATCH >= 15)
+            if ((lpOut = LzPutCount(lpOut, lpOutEnd, dwMatch - LZ_MINMATCH - 15)) == NULL)
+                return 0;
+
+        lpIn += dwMatch;
+        lpAnchor = lpIn;
+    }
+
+    //
+    // last sequence, literals only
+    //
+    dwLiterals = (DWORD) (lpEnd - lpAnchor);
+    if (lpOut + 1 > lpOutEnd)
+        return 0;
+
+    *lpOut++ = (BYTE) (min(dwLiterals, 15) << 4);
+    if (dwLiterals >= 15)
+        if ((lpOut = LzPutCount(lpOut, lpOutEnd, dwLiterals - 15)) == NULL)
+            return 0;
+
+    if (lpOut + dwLiterals > lpOutEnd)
+        return 0;
+    CopyMemory(lpOut, lpAnchor, dwLiterals);
+    lpOut += dwLiterals;
+
+    return (DWORD) (lpOut - lpDst);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: LzDecompress(const BYTE *, DWORD, BYTE *, DWORD)
+
+PURPOSE: Decompresses a block made by LzCompress
+
+PARAMETERS:
+    lpSrc     - compressed data
+    dwSrcLen  - size of compressed data
+    lpDst     - output buffer
+    dwDstSize - size of output buffer
+
+RETURN: size of decompressed data, 0 if the data is corrupt
+        or doesn't fit in the output buffer
+
+-----------------------------------------------------------------------------*/
+DWORD LzDecompress(const BYTE * lpSrc, DWORD dwSrcLen, BYTE * lpDst, DWORD dwDstSize)
+{
+    const BYTE * lpIn = lpSrc;
+    const BYTE * lpEnd = lpSrc + dwSrcLen;
+    BYTE * lpOut = lpDst;
+    BYTE * lpOutEnd = lpDst + dwDstSize;
+    const BYTE * lpRef;
+    DWORD dwLiterals, dwMatch, dwOffset;
+    BYTE  bToken, b;
+
+    while (lpIn < lpEnd)
+    {
+        bToken = *lpIn++;
+
+        dwLiterals = bToken >> 4;
+        if (dwLiterals == 15)
+            do {
+                if (lpIn >= lpEnd)
+                    return 0;
+                b = *lpIn++;
+                dwLiterals += b;
+            } while (b == 255);
+
+        if (dwLiterals > (DWORD) (lpEnd - lpIn) || dwLiterals > (DWORD) (lpOutEnd - lpOut))
+            return 0;
+        CopyMemory(lpOut, lpIn, dwLiterals);
+        lpIn += dwLiterals;
+        lpOut += dwLiterals;
+
+        //
+        // last sequence has no match
+        //
+        if (lpIn == lpEnd)
+            break;
+
+        if (lpEnd - lpIn < 2)
+            return 0;
+        dwOffset = lpIn[0] | (lpIn[1] << 8);
+        lpIn += 2;
+
+        dwMatch = (bToken & 0x0F);
+        if (dwMatch == 15)
+            do {
+                if (lpIn >= lpEnd)
+                    return 0;
+                b = *lpIn++;
+                dwMatch += b;
+            } while (b == 255);
+        dwMatch += LZ_MINMATCH;
+
+        if (dwOffset == 0 || dwOffset > (DWORD) (lpOut - lpDst) ||
+            dwMatch > (DWORD) (lpOutEnd - lpOut))
+            return 0;
+
+        //
+        // byte copy, source and destination may overlap
+        //
+        lpRef = lpOut - dwOffset;
+        while (dwMatch--)
+            *lpOut++ = *lpRef++;
+    }
+
+    return (DWORD) (lpOut - lpDst);
+}
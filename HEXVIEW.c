@@ -0,0 +1,923 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: HexView.c
+
+    PURPOSE: Hex dump view of received data.
+
+             While the view is open, every byte drained from the
+             receive ring is appended to a byte log.  Nothing is
+             logged while it is closed; the bytes are only counted,
+             so offsets shown are stream offsets all the same.
+
+             The log is an append-only temporary file, deleted when
+             the view closes, so everything received since the view
+             opened can be scrolled to; it takes as much disk as
+             that.  Appends collect in one of HEXLOG_BUFFERS memory
+             buffers; a full buffer is queued to a log thread,
+             which writes it to the file, so the UI thread doesn't
+             wait for the disk.  If every buffer is still waiting,
+             the data is dropped and counted, and the log goes on
+             from the next row.  A write error is reported once and
+             the log starts over the same way.
+
+             The view is a separate window showing 16 bytes per row
+             with the stream offset, hex and ASCII columns.  Only the
+             rows in the update region are read from the log and
+             formatted, so the size of the log doesn't matter for
+             scrolling.  Bytes still in the memory buffers are read
+             from there.  When scrolled to the end, the view follows
+             new data.  Past MAXLONG rows, over 32 GB, scroll bar
+             positions are rows scaled down by a power of two.
+
+    FUNCTIONS:
+        HexLogOpen       - creates the log file and starts the log thread
+        HexLogClose      - stops the log thread and deletes the log
+        HexLogDestroy    - closes the view and the log
+        HexLogClear      - starts the log and offsets over
+        HexLogRestart    - drops the log, goes on at the next row
+        HexLogQueue      - queues the buffer being filled
+        HexLogWrite      - appends received bytes
+        HexLogFileIO     - reads or writes the log file
+        HexLogRead       - reads bytes from the log
+        HexLogProc       - log thread, writes queued buffers
+        HexFormatRow     - formats one dump row
+        CmdHexView       - opens the hex view window
+        HexViewProc      - hex view window procedure
+        HexViewRange     - first row and number of rows in the log
+        HexViewScrollShift - scroll bar scale for a number of rows
+        HexViewPaint     - paints the visible rows
+        HexViewScroll    - scrolls the view
+        HexViewSetScroll - sets scroll bar range and position
+        HexViewUpdate    - shows newly logged data
+        HexViewGetStats  - hex view statistics
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "MTTTY.h"
+
+#define HEXLOG_BUFFER       0x10000         // bytes collected per file write
+#define HEXLOG_BUFFERS      4
+#define HEXVIEW_CLASS       "MTTTYHexClass"
+
+#define HEXBUF_FREE         0               // UI thread may fill it
+#define HEXBUF_QUEUED       1               // waiting for or being written
+
+#define HEXLOG_ROWUP(x)     (((x) + HEXVIEW_ROWBYTES - 1) & ~(DWORDLONG) (HEXVIEW_ROWBYTES - 1))
+
+typedef struct HEXBUF
+{
+    DWORDLONG     dwlPos;               // log position of the first byte
+    DWORD         dwFill;
+    LONG volatile lState;
+    BYTE          bData[HEXLOG_BUFFER];
+} HEXBUF;
+
+/*
+    Prototypes for functions called only within this file
+*/
+BOOL HexLogOpen( void );
+void HexLogClose( void );
+void HexLogRestart( void );
+void HexLogQueue( void );
+BOOL HexLogFileIO( HANDLE, DWORDLONG, BYTE *, DWORD, BOOL );
+DWORD HexLogRead( DWORDLONG, BYTE *, DWORD );
+DWORD WINAPI HexLogProc( LPVOID );
+LRESULT CALLBACK HexViewProc( HWND, UINT, WPARAM, LPARAM );
+void HexViewRange( DWORDLONG *, DWORDLONG * );
+int HexViewScrollShift( DWORDLONG );
+void HexViewPaint( HWND );
+void HexViewScroll( HWND, int, int );
+void HexViewSetScroll( HWND );
+
+static struct
+{
+    HANDLE    hFile;                // written by the log thread
+    HANDLE    hReadFile;            // read by the view, own file pointer
+    HANDLE    hThread;
+    HANDLE    hQueuedEvent;         // auto reset, a buffer was queued
+    HANDLE    hStopEvent;
+    HEXBUF *  pBufs;                // NULL while the view is closed
+    DWORD     dwFillBuf;            // buffer the UI thread fills
+    DWORD     dwWriteBuf;           // next buffer the log thread writes
+    BOOL      fNewBuf;              // fill buffer not started yet
+    BOOL      fGap;                 // bytes dropped, go on at the next row
+    DWORDLONG dwlStream;            // bytes received, logged or not
+    DWORDLONG dwlBase;              // stream offset of log position 0
+    DWORDLONG dwlFirst;             // oldest position shown, row aligned
+    DWORDLONG dwlSize;              // positions appended
+    DWORDLONG dwlDropped;           // statistics
+    LONG volatile lErrors;          // write errors, log thread
+    LONG      lErrorsSeen;          // the ones the log started over for
+} gHexLog;
+
+static struct
+{
+    HWND      hWnd;
+    DWORDLONG dwlTopRow;            // first row shown
+    int       nRows;                // rows fitting in the window
+    int       yChar;
+    DWORD     dwRowsFormatted;      // statistics
+    LONGLONG  llFormatTicks;
+} gHexView;
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexLogOpen
+
+PURPOSE: Creates the log file and starts the log thread
+
+RETURN: FALSE if the log can't be started, the view then stays empty
+
+COMMENTS: The file is opened twice, so the view reads with its own
+          file pointer while the log thread writes.
+
+-----------------------------------------------------------------------------*/
+BOOL HexLogOpen()
+{
+    char  szPath[MAX_PATH], szFile[MAX_PATH];
+    DWORD dwThreadId;
+
+    gHexLog.hFile = gHexLog.hReadFile = INVALID_HANDLE_VALUE;
+
+    gHexLog.pBufs = (HEXBUF *) VirtualAlloc(NULL, HEXLOG_BUFFERS * sizeof(HEXBUF),
+                                            MEM_COMMIT, PAGE_READWRITE);
+    if (gHexLog.pBufs == NULL) {
+        ErrorReporter("VirtualAlloc (hex log)");
+        return FALSE;
+    }
+
+    if (!GetTempPath(sizeof(szPath), szPath) ||
+        !GetTempFileName(szPath, "MTY", 0, szFile)) {
+        ErrorReporter("GetTempFileName (hex log)");
+        HexLogClose();
+        return FALSE;
+    }
+
+    gHexLog.hFile = CreateFile(szFile, GENERIC_WRITE,
+                               FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, CREATE_ALWAYS,
+                               FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+                               NULL);
+    if (gHexLog.hFile != INVALID_HANDLE_VALUE)
+        gHexLog.hReadFile = CreateFile(szFile, GENERIC_READ,
+                                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                       NULL, OPEN_EXISTING, 0, NULL);
+    if (gHexLog.hReadFile == INVALID_HANDLE_VALUE) {
+        ErrorReporter("CreateFile (hex log)");
+        HexLogClose();
+        return FALSE;
+    }
+
+    gHexLog.hQueuedEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    gHexLog.hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (gHexLog.hQueuedEvent == NULL || gHexLog.hStopEvent == NULL) {
+        ErrorReporter("CreateEvent (hex log)");
+        HexLogClose();
+        return FALSE;
+    }
+
+    gHexLog.dwFillBuf = gHexLog.dwWriteBuf = 0;
+    gHexLog.fNewBuf = TRUE;
+    gHexLog.fGap = FALSE;
+    gHexLog.dwlBase = gHexLog.dwlStream;
+    gHexLog.dwlFirst = gHexLog.dwlSize = 0;
+    gHexLog.dwlDropped = 0;
+    gHexLog.lErrors = gHexLog.lErrorsSeen = 0;
+
+    gHexLog.hThread = CreateThread(NULL, 0, HexLogProc, NULL, 0, &dwThreadId);
+    if (gHexLog.hThread == NULL) {
+        ErrorReporter("CreateThread (hex log)");
+        HexLogClose();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexLogClose
+
+PURPOSE: Stops the log thread and closes the log, which deletes the file
+
+COMMENTS: Buffers still queued aren't written, the file goes anyway.
+
+-----------------------------------------------------------------------------*/
+void HexLogClose()
+{
+    if (gHexLog.hThread) {
+        SetEvent(gHexLog.hStopEvent);
+        WaitForSingleObject(gHexLog.hThread, INFINITE);
+        CloseHandle(gHexLog.hThread);
+        gHexLog.hThread = NULL;
+    }
+
+    if (gHexLog.hQueuedEvent)
+        CloseHandle(gHexLog.hQueuedEvent);
+    if (gHexLog.hStopEvent)
+        CloseHandle(gHexLog.hStopEvent);
+    gHexLog.hQueuedEvent = gHexLog.hStopEvent = NULL;
+
+    if (gHexLog.hReadFile != INVALID_HANDLE_VALUE)
+        CloseHandle(gHexLog.hReadFile);
+    if (gHexLog.hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(gHexLog.hFile);
+    gHexLog.hFile = gHexLog.hReadFile = INVALID_HANDLE_VALUE;
+
+    if (gHexLog.pBufs)
+        VirtualFree(gHexLog.pBufs, 0, MEM_RELEASE);
+    gHexLog.pBufs = NULL;
+
+    gHexLog.dwlFirst = gHexLog.dwlSize = 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexLogDestroy
+
+PURPOSE: Closes the hex view, which closes the log
+
+-----------------------------------------------------------------------------*/
+void HexLogDestroy()
+{
+    if (gHexView.hWnd)
+        DestroyWindow(gHexView.hWnd);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexLogClear
+
+PURPOSE: Empties the log, stream offsets start over at zero
+
+-----------------------------------------------------------------------------*/
+void HexLogClear()
+{
+    gHexLog.dwlStream = 0;
+
+    if (gHexLog.pBufs) {
+        HexLogRestart();
+        gHexLog.dwlBase = 0 - gHexLog.dwlSize;
+    }
+
+    gHexView.dwlTopRow = gHexLog.dwlFirst / HEXVIEW_ROWBYTES;
+    if (gHexView.hWnd) {
+        HexViewSetScroll(gHexView.hWnd);
+        InvalidateRect(gHexView.hWnd, NULL, TRUE);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexLogRestart
+
+PURPOSE: Drops what is in the log, it goes on at the next row
+
+COMMENTS: Log positions only grow, so a buffer the log thread is
+          still writing can't land on the new data in the file.
+          The buffer being filled is started over.
+
+-----------------------------------------------------------------------------*/
+void HexLogRestart()
+{
+    gHexLog.fNewBuf = TRUE;
+    gHexLog.fGap = FALSE;
+    gHexLog.dwlSize = gHexLog.dwlFirst = HEXLOG_ROWUP(gHexLog.dwlSize);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexLogQueue
+
+PURPOSE: Queues the buffer being filled to the log thread
+
+-----------------------------------------------------------------------------*/
+void HexLogQueue()
+{
+    InterlockedExchange(&gHexLog.pBufs[gHexLog.dwFillBuf].lState, HEXBUF_QUEUED);
+    SetEvent(gHexLog.hQueuedEvent);
+
+    gHexLog.dwFillBuf = (gHexLog.dwFillBuf + 1) % HEXLOG_BUFFERS;
+    gHexLog.fNewBuf = TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexLogWrite(const BYTE *, DWORD)
+
+PURPOSE: Appends received bytes to the log
+
+PARAMETERS:
+    lpBuf    - received bytes
+    dwBufLen - number of bytes
+
+COMMENTS: Called from RxRingDrain for every chunk shown in
+          the tty window.  With the view closed it only counts.
+
+-----------------------------------------------------------------------------*/
+void HexLogWrite(const BYTE * lpBuf, DWORD dwBufLen)
+{
+    HEXBUF * pBuf;
+    DWORD    dwCopy;
+
+    gHexLog.dwlStream += dwBufLen;
+
+    if (gHexLog.pBufs == NULL)
+        return;
+
+    //
+    // a buffer couldn't be written, what is in the file is off
+    //
+    if (gHexLog.lErrors != gHexLog.lErrorsSeen) {
+        gHexLog.lErrorsSeen = gHexLog.lErrors;
+        HexLogRestart();
+    }
+
+    while (dwBufLen) {
+        pBuf = &gHexLog.pBufs[gHexLog.dwFillBuf];
+
+        if (pBuf->lState != HEXBUF_FREE) {
+            //
+            // every buffer waits for the disk
+            //
+            gHexLog.dwlDropped += dwBufLen;
+            gHexLog.dwlSize += dwBufLen;
+            gHexLog.fGap = TRUE;
+            break;
+        }
+
+        if (gHexLog.fNewBuf) {
+            if (gHexLog.fGap)
+                HexLogRestart();
+            pBuf->dwlPos = gHexLog.dwlSize;
+            pBuf->dwFill = 0;
+            gHexLog.fNewBuf = FALSE;
+        }
+
+        dwCopy = min(dwBufLen, HEXLOG_BUFFER - pBuf->dwFill);
+        CopyMemory(pBuf->bData + pBuf->dwFill, lpBuf, dwCopy);
+        pBuf->dwFill += dwCopy;
+        gHexLog.dwlSize += dwCopy;
+        lpBuf += dwCopy;
+        dwBufLen -= dwCopy;
+
+        if (pBuf->dwFill == HEXLOG_BUFFER)
+            HexLogQueue();
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexLogFileIO(HANDLE, DWORDLONG, BYTE *, DWORD, BOOL)
+
+PURPOSE: Reads or writes log bytes in the log file
+
+PARAMETERS:
+    hFile  - hFile to write, hReadFile to read
+    dwlPos - log position of the first byte
+    lpBuf  - the bytes
+    dwLen  - number of bytes
+    fWrite - TRUE to write
+
+RETURN: FALSE if not all bytes were read or written
+
+COMMENTS: A log position is the file offset.  Positions skipped
+          after dropped data are never written, reading them
+          gives zeros.
+
+-----------------------------------------------------------------------------*/
+BOOL HexLogFileIO(HANDLE hFile, DWORDLONG dwlPos, BYTE * lpBuf, DWORD dwLen, BOOL fWrite)
+{
+    LARGE_INTEGER liPos;
+    DWORD dwDone;
+    BOOL  fRes;
+
+    liPos.QuadPart = (LONGLONG) dwlPos;
+    if (!SetFilePointerEx(hFile, liPos, NULL, FILE_BEGIN))
+        return FALSE;
+
+    if (fWrite)
+        fRes = WriteFile(hFile, lpBuf, dwLen, &dwDone, NULL);
+    else
+        fRes = ReadFile(hFile, lpBuf, dwLen, &dwDone, NULL);
+
+    return fRes && dwDone == dwLen;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexLogRead(DWORDLONG, BYTE *, DWORD)
+
+PURPOSE: Reads bytes from the log
+
+PARAMETERS:
+    dwlPos - log position of first byte
+    lpBuf  - where to put the bytes
+    dwLen  - number of bytes wanted
+
+RETURN: number of bytes read, less than dwLen at the end of the log,
+        0 if dwlPos isn't in the log
+
+COMMENTS: Bytes still in memory buffers are copied from there over
+          what was read from the file.  Which buffers those are is
+          looked at before the file is read: a buffer the log
+          thread frees after that is in the file by then.
+
+-----------------------------------------------------------------------------*/
+DWORD HexLogRead(DWORDLONG dwlPos, BYTE * lpBuf, DWORD dwLen)
+{
+    BOOL      fInMemory[HEXLOG_BUFFERS];
+    HEXBUF *  pBuf;
+    DWORDLONG dwlStart, dwlEnd;
+    int       i;
+
+    if (gHexLog.pBufs == NULL || dwlPos < gHexLog.dwlFirst || dwlPos >= gHexLog.dwlSize)
+        return 0;
+
+    dwLen = (DWORD) min((DWORDLONG) dwLen, gHexLog.dwlSize - dwlPos);
+
+    for (i = 0; i < HEXLOG_BUFFERS; i++)
+        fInMemory[i] = gHexLog.pBufs[i].lState == HEXBUF_QUEUED ||
+                       (i == (int) gHexLog.dwFillBuf && !gHexLog.fNewBuf);
+
+    ZeroMemory(lpBuf, dwLen);
+    HexLogFileIO(gHexLog.hReadFile, dwlPos, lpBuf, dwLen, FALSE);
+
+    for (i = 0; i < HEXLOG_BUFFERS; i++) {
+        if (!fInMemory[i])
+            continue;
+
+        pBuf = &gHexLog.pBufs[i];
+        dwlStart = max(dwlPos, pBuf->dwlPos);
+        dwlEnd = min(dwlPos + dwLen, pBuf->dwlPos + pBuf->dwFill);
+        if (dwlStart < dwlEnd)
+            CopyMemory(lpBuf + (DWORD) (dwlStart - dwlPos),
+                       pBuf->bData + (DWORD) (dwlStart - pBuf->dwlPos),
+                       (DWORD) (dwlEnd - dwlStart));
+    }
+
+    return dwLen;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexLogProc(LPVOID)
+
+PURPOSE: Log thread, writes queued buffers to the log file
+
+COMMENTS: The first write error is reported, later ones only
+          counted, so a full disk gives one message per log.
+
+-----------------------------------------------------------------------------*/
+DWORD WINAPI HexLogProc(LPVOID lpV)
+{
+    HANDLE   hEvents[2];
+    HEXBUF * pBuf;
+
+    hEvents[0] = gHexLog.hQueuedEvent;
+    hEvents[1] = gHexLog.hStopEvent;
+
+    for (;;) {
+        pBuf = &gHexLog.pBufs[gHexLog.dwWriteBuf];
+        while (pBuf->lState == HEXBUF_QUEUED) {
+            if (!HexLogFileIO(gHexLog.hFile, pBuf->dwlPos, pBuf->bData, pBuf->dwFill, TRUE))
+                if (InterlockedIncrement(&gHexLog.lErrors) == 1)
+                    ErrorReporter("WriteFile (hex log)");
+
+            InterlockedExchange(&pBuf->lState, HEXBUF_FREE);
+            gHexLog.dwWriteBuf = (gHexLog.dwWriteBuf + 1) % HEXLOG_BUFFERS;
+            pBuf = &gHexLog.pBufs[gHexLog.dwWriteBuf];
+        }
+
+        if (WaitForMultipleObjects(2, hEvents, FALSE, INFINITE) != WAIT_OBJECT_0)
+            break;
+    }
+
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexFormatRow(DWORDLONG, const BYTE *, int, char *)
+
+PURPOSE: Formats one row of the hex dump
+
+PARAMETERS:
+    dwlOffset - stream offset of the row
+    lpData    - bytes of the row
+    nBytes    - number of bytes, up to HEXVIEW_ROWBYTES
+    lpOut     - output, HEXVIEW_ROWLEN characters
+
+COMMENTS: Layout is a 12 digit offset, two groups of 8 hex
+          pairs and the bytes as ASCII.  Hex digits come from
+          the gHexPairs table.  Missing bytes are blank.
+
+-----------------------------------------------------------------------------*/
+void HexFormatRow(DWORDLONG dwlOffset, const BYTE * lpData, int nBytes, char * lpOut)
+{
+    char * lpHex = lpOut + 14;
+    char * lpAscii = lpOut + HEXVIEW_ROWLEN - HEXVIEW_ROWBYTES;
+    int    i;
+    BYTE   c;
+
+    FillMemory(lpOut, HEXVIEW_ROWLEN, ' ');
+
+    for (i = 0; i < 6; i++)
+        CopyMemory(lpOut + 2 * i, gHexPairs + 2 * (BYTE) (dwlOffset >> (40 - 8 * i)), 2);
+
+    for (i = 0; i < nBytes; i++) {
+        c = lpData[i];
+        CopyMemory(lpHex + 3 * i + (i >= 8), gHexPairs + 2 * c, 2);
+        lpAscii[i] = (c >= ' ' && c <= '~') ? (char) c : '.';
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CmdHexView(HWND)
+
+PURPOSE: Opens the hex view window, or brings it to the top
+
+PARAMETERS:
+    hWnd - owner window
+
+COMMENTS: Logging starts with the window, bytes received before
+          aren't in the view.
+
+-----------------------------------------------------------------------------*/
+void CmdHexView(HWND hWnd)
+{
+    static BOOL fRegistered = FALSE;
+    WNDCLASS wc;
+
+    if (gHexView.hWnd) {
+        SetForegroundWindow(gHexView.hWnd);
+        return;
+    }
+
+    if (!fRegistered) {
+        ZeroMemory(&wc, sizeof(wc));
+        wc.lpfnWndProc      = (WNDPROC) HexViewProc;
+        wc.hInstance        = ghInst;
+        wc.hCursor          = LoadCursor(NULL, IDC_ARROW);
+        wc.hbrBackground    = (HBRUSH) (COLOR_WINDOW + 1);
+        wc.lpszClassName    = HEXVIEW_CLASS;
+
+        if (!RegisterClass(&wc)) {
+            ErrorReporter("RegisterClass (hex view)");
+            return;
+        }
+        fRegistered = TRUE;
+    }
+
+    HexLogOpen();
+    gHexView.dwlTopRow = 0;
+
+    gHexView.hWnd = CreateWindow(HEXVIEW_CLASS, "Hex View",
+                                 WS_OVERLAPPEDWINDOW | WS_VSCROLL,
+                                 CW_USEDEFAULT, CW_USEDEFAULT,
+                                 MAXXWINDOW, MAXYWINDOW,
+                                 hWnd, NULL, ghInst, NULL);
+    if (gHexView.hWnd == NULL) {
+        ErrorReporter("CreateWindow (hex view)");
+        HexLogClose();
+        return;
+    }
+
+    ShowWindow(gHexView.hWnd, SW_SHOW);
+    HexViewSetScroll(gHexView.hWnd);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexViewProc(HWND, UINT, WPARAM, LPARAM)
+
+PURPOSE: Hex view window procedure
+
+-----------------------------------------------------------------------------*/
+LRESULT CALLBACK HexViewProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+    TEXTMETRIC tm;
+    HDC        hDC;
+
+    switch (uMsg)
+    {
+        case WM_CREATE:
+            hDC = GetDC(hWnd);
+            SelectObject(hDC, HTTYFONT( TTYInfo ));
+            GetTextMetrics(hDC, &tm);
+            ReleaseDC(hWnd, hDC);
+            gHexView.yChar = tm.tmHeight + tm.tmExternalLeading;
+            break;
+
+        case WM_SIZE:
+            gHexView.nRows = max(1, HIWORD(lParam) / gHexView.yChar);
+            HexViewSetScroll(hWnd);
+            InvalidateRect(hWnd, NULL, TRUE);
+            break;
+
+        case WM_PAINT:
+            HexViewPaint(hWnd);
+            break;
+
+        case WM_VSCROLL:
+            HexViewScroll(hWnd, LOWORD(wParam), 0);
+            break;
+
+        case WM_MOUSEWHEEL:
+            HexViewScroll(hWnd, SB_THUMBPOSITION,
+                          -3 * (short) HIWORD(wParam) / WHEEL_DELTA);
+            break;
+
+        case WM_KEYDOWN:
+            switch (wParam)
+            {
+                case VK_PRIOR:  HexViewScroll(hWnd, SB_PAGEUP, 0);      break;
+                case VK_NEXT:   HexViewScroll(hWnd, SB_PAGEDOWN, 0);    break;
+                case VK_UP:     HexViewScroll(hWnd, SB_LINEUP, 0);      break;
+                case VK_DOWN:   HexViewScroll(hWnd, SB_LINEDOWN, 0);    break;
+                case VK_HOME:   HexViewScroll(hWnd, SB_TOP, 0);         break;
+                case VK_END:    HexViewScroll(hWnd, SB_BOTTOM, 0);      break;
+            }
+            break;
+
+        case WM_DESTROY:
+            gHexView.hWnd = NULL;
+            HexLogClose();
+            break;
+
+        default:
+            return DefWindowProc(hWnd, uMsg, wParam, lParam);
+    }
+
+    return 0L;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexViewRange(DWORDLONG *, DWORDLONG *)
+
+PURPOSE: Returns the rows the log holds
+
+PARAMETERS:
+    pdwlFirstRow - receives the oldest row, rows count from log position 0
+    pdwlRows     - receives the number of rows, the last may be partial
+
+-----------------------------------------------------------------------------*/
+void HexViewRange(DWORDLONG * pdwlFirstRow, DWORDLONG * pdwlRows)
+{
+    *pdwlFirstRow = gHexLog.dwlFirst / HEXVIEW_ROWBYTES;
+    *pdwlRows = (gHexLog.dwlSize + HEXVIEW_ROWBYTES - 1) / HEXVIEW_ROWBYTES - *pdwlFirstRow;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexViewScrollShift(DWORDLONG)
+
+PURPOSE: Returns the scroll bar scale for a number of rows
+
+PARAMETERS:
+    dwlRows - rows in the log
+
+RETURN: shift from rows to scroll bar positions, 0 up to MAXLONG rows
+
+COMMENTS: Scroll bar positions are ints.  A larger log is scaled
+          down by a power of two; dragging the thumb then lands on
+          every 2nd, 4th, ... row, the keys still move row by row.
+
+-----------------------------------------------------------------------------*/
+int HexViewScrollShift(DWORDLONG dwlRows)
+{
+    int nShift = 0;
+
+    while ((dwlRows >> nShift) > MAXLONG)
+        nShift++;
+
+    return nShift;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexViewPaint(HWND)
+
+PURPOSE: Paints the rows in the update region
+
+COMMENTS: The bytes of all rows to paint are read from the log
+          at once.  All rows are formatted before any is drawn, so
+          the rate in the statistics times formatting only.
+
+-----------------------------------------------------------------------------*/
+void HexViewPaint(HWND hWnd)
+{
+    PAINTSTRUCT ps;
+    HDC         hDC;
+    HFONT       hOldFont;
+    BYTE        bData[HEXVIEW_MAXROWS * HEXVIEW_ROWBYTES];
+    char        szRows[HEXVIEW_MAXROWS][HEXVIEW_ROWLEN];
+    int         nFirst, nEnd, nLast, nRow, nBytes;
+    DWORD       dwRead;
+    DWORDLONG   dwlOffset;
+    LARGE_INTEGER liStart, liEnd;
+
+    hDC = BeginPaint(hWnd, &ps);
+    hOldFont = (HFONT) SelectObject(hDC, HTTYFONT( TTYInfo ));
+    SetTextColor(hDC, FGCOLOR( TTYInfo ));
+    SetBkColor(hDC, GetSysColor(COLOR_WINDOW));
+
+    nFirst = ps.rcPaint.top / gHexView.yChar;
+    nEnd = min(HEXVIEW_MAXROWS, (ps.rcPaint.bottom + gHexView.yChar - 1) / gHexView.yChar);
+
+    dwlOffset = (gHexView.dwlTopRow + nFirst) * HEXVIEW_ROWBYTES;
+    dwRead = nEnd > nFirst ?
+             HexLogRead(dwlOffset, bData, (nEnd - nFirst) * HEXVIEW_ROWBYTES) : 0;
+
+    nLast = nFirst + (int) ((dwRead + HEXVIEW_ROWBYTES - 1) / HEXVIEW_ROWBYTES);
+
+    QueryPerformanceCounter(&liStart);
+    for (nRow = nFirst; nRow < nLast; nRow++)
+    {
+        nBytes = (int) min(HEXVIEW_ROWBYTES, dwRead - (nRow - nFirst) * HEXVIEW_ROWBYTES);
+        HexFormatRow(gHexLog.dwlBase + dwlOffset + (nRow - nFirst) * HEXVIEW_ROWBYTES,
+                     bData + (nRow - nFirst) * HEXVIEW_ROWBYTES, nBytes, szRows[nRow - nFirst]);
+    }
+    QueryPerformanceCounter(&liEnd);
+    gHexView.llFormatTicks += liEnd.QuadPart - liStart.QuadPart;
+    gHexView.dwRowsFormatted += nLast - nFirst;
+
+    for (nRow = nFirst; nRow < nLast; nRow++)
+        TextOut(hDC, 0, nRow * gHexView.yChar, szRows[nRow - nFirst], HEXVIEW_ROWLEN);
+
+    SelectObject(hDC, hOldFont);
+    EndPaint(hWnd, &ps);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexViewScroll(HWND, int, int)
+
+PURPOSE: Scrolls the view
+
+PARAMETERS:
+    hWnd       - hex view window
+    nScrollCmd - SB_ scroll bar command
+    nRows      - rows to move for SB_THUMBPOSITION from the mouse wheel
+
+-----------------------------------------------------------------------------*/
+void HexViewScroll(HWND hWnd, int nScrollCmd, int nRows)
+{
+    SCROLLINFO si;
+    DWORDLONG dwlFirstRow, dwlRows, dwlMaxTop;
+    LONGLONG llTop;
+    int nShift;
+
+    HexViewRange(&dwlFirstRow, &dwlRows);
+    dwlMaxTop = dwlRows > (DWORDLONG) gHexView.nRows ? dwlRows - gHexView.nRows : 0;
+    nShift = HexViewScrollShift(dwlRows);
+    llTop = (LONGLONG) (gHexView.dwlTopRow - dwlFirstRow);
+
+    switch (nScrollCmd)
+    {
+        case SB_TOP:        llTop = 0;                       break;
+        case SB_BOTTOM:     llTop = (LONGLONG) dwlMaxTop;    break;
+        case SB_LINEUP:     llTop--;                         break;
+        case SB_LINEDOWN:   llTop++;                         break;
+        case SB_PAGEUP:     llTop -= gHexView.nRows;         break;
+        case SB_PAGEDOWN:   llTop += gHexView.nRows;         break;
+        case SB_THUMBPOSITION:          // scroll bar sends 0, mouse wheel rows
+            llTop += nRows;
+            break;
+        case SB_THUMBTRACK:
+            si.cbSize = sizeof(si);
+            si.fMask = SIF_TRACKPOS;
+            GetScrollInfo(hWnd, SB_VERT, &si);
+            llTop = (LONGLONG) si.nTrackPos << nShift;
+            break;
+        default:
+            return;
+    }
+
+    llTop = max(0, min((LONGLONG) dwlMaxTop, llTop));
+    if (dwlFirstRow + llTop == gHexView.dwlTopRow)
+        return;
+
+    gHexView.dwlTopRow = dwlFirstRow + llTop;
+    SetScrollPos(hWnd, SB_VERT, (int) (llTop >> nShift), TRUE);
+    InvalidateRect(hWnd, NULL, TRUE);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexViewSetScroll(HWND)
+
+PURPOSE: Sets scroll bar range from the log size
+
+COMMENTS: Keeps the top row in range, it moves down when the log
+          started over.  Scroll bar positions count from the oldest
+          row, scaled by HexViewScrollShift.
+
+-----------------------------------------------------------------------------*/
+void HexViewSetScroll(HWND hWnd)
+{
+    SCROLLINFO si;
+    DWORDLONG dwlFirstRow, dwlRows, dwlMaxTop;
+    int nShift;
+
+    HexViewRange(&dwlFirstRow, &dwlRows);
+    dwlMaxTop = dwlRows > (DWORDLONG) gHexView.nRows ? dwlRows - gHexView.nRows : 0;
+    nShift = HexViewScrollShift(dwlRows);
+
+    gHexView.dwlTopRow = max(gHexView.dwlTopRow, dwlFirstRow);
+    gHexView.dwlTopRow = min(gHexView.dwlTopRow, dwlFirstRow + dwlMaxTop);
+
+    si.cbSize = sizeof(si);
+    si.fMask = SIF_RANGE | SIF_PAGE | SIF_POS;
+    si.nMin = 0;
+    si.nMax = (int) ((max(dwlRows, 1) - 1) >> nShift);
+    si.nPage = max(1, gHexView.nRows >> nShift);
+    si.nPos = (int) ((gHexView.dwlTopRow - dwlFirstRow) >> nShift);
+    SetScrollInfo(hWnd, SB_VERT, &si, TRUE);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexViewUpdate
+
+PURPOSE: Shows newly logged data in the hex view
+
+COMMENTS: Called after data is logged.  If the view was at the
+          end, it moves along; else only the scroll bar changes.
+
+-----------------------------------------------------------------------------*/
+void HexViewUpdate()
+{
+    DWORDLONG dwlFirstRow, dwlOldTop;
+    DWORDLONG dwlRows, dwlMaxTop, dwlTop;
+    RECT  rect;
+
+    if (gHexView.hWnd == NULL)
+        return;
+
+    HexViewRange(&dwlFirstRow, &dwlRows);
+    dwlMaxTop = dwlRows > (DWORDLONG) gHexView.nRows ? dwlRows - gHexView.nRows : 0;
+
+    //
+    // the last row, partly filled before, is always repainted
+    //
+    dwlOldTop = gHexView.dwlTopRow;
+    if (dwlOldTop + gHexView.nRows + 1 >= dwlFirstRow + dwlRows)
+        gHexView.dwlTopRow = dwlFirstRow + dwlMaxTop;
+
+    HexViewSetScroll(gHexView.hWnd);
+
+    dwlTop = gHexView.dwlTopRow - dwlFirstRow;
+    if (gHexView.dwlTopRow != dwlOldTop)
+        InvalidateRect(gHexView.hWnd, NULL, FALSE);
+    else if (dwlRows > dwlTop && dwlRows - dwlTop <= (DWORDLONG) gHexView.nRows + 1) {
+        GetClientRect(gHexView.hWnd, &rect);
+        rect.top = (int) (dwlRows - 1 - dwlTop) * gHexView.yChar;
+        InvalidateRect(gHexView.hWnd, &rect, FALSE);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: HexViewGetStats(HEXVIEWSTATS *)
+
+PURPOSE: Returns log size, losses and row formatting rate
+
+-----------------------------------------------------------------------------*/
+void HexViewGetStats(HEXVIEWSTATS * pStats)
+{
+    LARGE_INTEGER liFreq;
+
+    pStats->dwLogKB = (DWORD) ((gHexLog.dwlSize - gHexLog.dwlFirst) / 1024);
+    pStats->dwDroppedKB = (DWORD) (gHexLog.dwlDropped / 1024);
+    pStats->dwErrors = (DWORD) gHexLog.lErrors;
+    pStats->dwRows = gHexView.dwRowsFormatted;
+    pStats->dwRowsPerSec = 0;
+
+    if (gHexView.llFormatTicks && QueryPerformanceFrequency(&liFreq))
+        pStats->dwRowsPerSec = (DWORD) min(0xFFFFFFFF,
+            (LONGLONG) gHexView.dwRowsFormatted * liFreq.QuadPart / gHexView.llFormatTicks);
+}
@@ -67,11 +67,11 @@ void GlobalInitialize()
     int cyMenuHeight, cyCaptionHeight, cyFrameHeight;
 
     //
-    // critical sections in status reporting & node management
+    // critical section in node management
     //
-    InitializeCriticalSection(&gStatusCritical);
-    InitializeCriticalSection(&gcsWriterHeap);
     InitializeCriticalSection(&gcsDataHeap);
+    WrPoolCreate();
+    CapSinkCreate();
 
     //
     // status message event
@@ -97,6 +97,16 @@ void GlobalInitialize()
     //
     ghFontStatus = CreateStatusEditFont();
 
+    //
+    // scrollback history heap
+    //
+    SbCreate();
+    SearchCreate();
+
+    //
+    // VT100/ANSI parser state table
+    //
+    VtInit();
     //
     // the following are used for sizing the tty window and dialog windows
     //
@@ -126,13 +136,21 @@ HISTORY:   Date:      Author:     Comment:
 -----------------------------------------------------------------------------*/
 void GlobalCleanup()
 {
-    DeleteCriticalSection(&gStatusCritical);
-    DeleteCriticalSection(&gcsWriterHeap);
+    //
+    // a paste or replay may still be running while disconnected
+    //
+    PasteStop();
+    ReplayStop();
+
     DeleteCriticalSection(&gcsDataHeap);
+    WrPoolDestroy();
+    CapSinkDestroy();
     DeleteObject(ghFontStatus);
     CloseHandle(ghStatusMessageEvent);
     CloseHandle(ghThreadExitEvent);
-    HeapDestroy(ghStatusMessageHeap);
+    SearchDestroy();
+    SbDestroy();
+    HexLogDestroy();
     return;
 }
 
@@ -141,7 +159,7 @@ void GlobalCleanup()
 
 FUNCTION: ClearTTYContents
 
-PURPOSE: Clears the tty buffer
+PURPOSE: Clears the tty buffer and the scrollback history
 
 RETURN: always TRUE
 
@@ -152,8 +170,24 @@ HISTORY:   Date:      Author:     Comment:
 BOOL ClearTTYContents()
 {
     FillMemory(SCREEN(TTYInfo), MAXCOLS*MAXROWS, ' ');
+    FillMemory(TTYInfo.Fg, MAXCOLS*MAXROWS, ATTR_DEFCOLOR);
+    FillMemory(TTYInfo.Bg, MAXCOLS*MAXROWS, ATTR_DEFCOLOR);
+    ZeroMemory(TTYInfo.Flags, MAXCOLS*MAXROWS);
+    SCREENTOP( TTYInfo ) = 0;
+    ZeroMemory(DIRTYROWS( TTYInfo ), sizeof(DIRTYROWS( TTYInfo )));
+    DAMAGELEFT( TTYInfo ) = MAXCOLS;
+    DAMAGERIGHT( TTYInfo ) = 0;
+    SCROLLPENDING( TTYInfo ) = 0;
     COLUMN( TTYInfo ) = 0;
     ROW( TTYInfo ) = MAXROWS - 1;
+    VtReset();
+
+    SearchReset();
+    SbClear();
+    HexLogClear();
+    if (ghWndTTY)
+        UpdateTTYVertScroll(ghWndTTY);
+
     return TRUE;
 }
 
@@ -185,11 +219,19 @@ void InitNewFont(LOGFONT LogFont, COLORREF rgbColor)
     //
     if (HTTYFONT(TTYInfo))
         DeleteObject(HTTYFONT(TTYInfo));
+    if (HTTYFONTUL(TTYInfo))
+        DeleteObject(HTTYFONTUL(TTYInfo));
 
     LFTTYFONT(TTYInfo) = LogFont;
     HTTYFONT(TTYInfo) = CreateFontIndirect(&(LFTTYFONT(TTYInfo)));
     FGCOLOR(TTYInfo) = rgbColor;
 
+    //
+    // same font underlined, for underlined ANSI text
+    //
+    LogFont.lfUnderline = TRUE;
+    HTTYFONTUL(TTYInfo) = CreateFontIndirect(&LogFont);
+
     hDC = GetDC( ghwndMain ) ;
     SelectObject( hDC, HTTYFONT( TTYInfo ) ) ;
     GetTextMetrics( hDC, &tm ) ;
@@ -238,6 +280,7 @@ BOOL InitTTYInfo()
     NEWLINE( TTYInfo )       = TRUE;
     NONPRINTHEX( TTYInfo )   = TRUE;
     DISPLAYHEX( TTYInfo )    = FALSE;
+    ANSI( TTYInfo )          = FALSE;
     XSIZE( TTYInfo )         = 0 ;
     YSIZE( TTYInfo )         = 0 ;
     XSCROLL( TTYInfo )       = 0 ;
@@ -245,6 +288,22 @@ BOOL InitTTYInfo()
     COLUMN( TTYInfo )        = 0 ;
     ROW( TTYInfo )           = MAXROWS - 1 ;
     DISPLAYERRORS( TTYInfo ) = TRUE ;
+    REPAINTRATE( TTYInfo )   = REPAINTRATE_DEFAULT ;
+    HISTORYMB( TTYInfo )     = HISTORYMB_DEFAULT ;
+    TXHIGHKB( TTYInfo )      = TXHIGHKB_DEFAULT ;
+    TXLOWKB( TTYInfo )       = TXLOWKB_DEFAULT ;
+    COALESCEMS( TTYInfo )    = COALESCEMS_DEFAULT ;
+    COALESCEBYTES( TTYInfo ) = COALESCEBYTES_DEFAULT ;
+    PASTEDELAY( TTYInfo )    = PASTEDELAY_DEFAULT ;
+    PACERATE( TTYInfo )      = PACERATE_DEFAULT ;
+    PACECHARGAP( TTYInfo )   = PACECHARGAP_DEFAULT ;
+    PACELINEDELAY( TTYInfo ) = PACELINEDELAY_DEFAULT ;
+    READAHEADKB( TTYInfo )   = READAHEADKB_DEFAULT ;
+    REPLAYSPEED( TTYInfo )   = REPLAYSPEED_DEFAULT ;
+    ROTATEMB( TTYInfo )      = ROTATEMB_DEFAULT ;
+    ROTATEMIN( TTYInfo )     = ROTATEMIN_DEFAULT ;
+    ROTATEBUDGETMB( TTYInfo ) = ROTATEBUDGETMB_DEFAULT ;
+    ROTATECOMPRESS( TTYInfo ) = ROTATECOMPRESS_DEFAULT ;
 
     //
     // timeouts
@@ -319,6 +378,7 @@ HISTORY:   Date:      Author:     Comment:
 void DestroyTTYInfo()
 {
     DeleteObject(HTTYFONT(TTYInfo));
+    DeleteObject(HTTYFONTUL(TTYInfo));
 }
 
 /*-----------------------------------------------------------------------------
@@ -336,6 +396,8 @@ void StartThreads(void)
     DWORD dwReadStatId;
     DWORD dwWriterId;
 
+    RxRingClearStats();
+
     READSTATTHREAD(TTYInfo) =
             CreateThread( NULL,
                           0,
@@ -420,6 +482,17 @@ HANDLE SetupCommPort()
     if (!EscapeCommFunction(COMDEV(TTYInfo), SETDTR))
         ErrorReporter("EscapeCommFunction (SETDTR)");
 
+    //
+    // new connection, throughput measured from here
+    //
+    MetricsReset();
+
+    //
+    // a replay into the tty window feeds the receive ring,
+    // which takes one producer, the reader
+    //
+    ReplayStop();
+
     //
     // start threads and set initial thread state to not done
     //
@@ -520,6 +593,12 @@ BOOL BreakDownCommPort()
 
     CONNECTED( TTYInfo ) = FALSE;
 
+    //
+    // a paste or a replay feeds the writer, stop them first
+    //
+    PasteStop();
+    ReplayStop();
+
     //
     // wait for the threads for a small period
     //
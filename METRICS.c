@@ -0,0 +1,299 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: Metrics.c
+
+    PURPOSE: Throughput measurement and the throughput graph.
+
+             The status dialog calls MetricsSample every
+             METRICS_SAMPLE_MS.  Each sample takes the bytes written
+             (writer statistics) and received (rx ring statistics)
+             since the last one and divides by the time between the
+             samples from the performance counter, so a late timer
+             doesn't skew the rate.  Nothing is added to the reader
+             or writer paths.
+
+             For each direction the module keeps the rate of the last
+             window, the peak and the average over active windows
+             (those that moved data), and METRICS_HISTORY rates for
+             the sparkline drawn in the status dialog.  Rates are
+             compared with the line rate, the bytes per second the
+             port settings allow: start bit, data bits, parity and
+             stop bits per character.
+
+    FUNCTIONS:
+        MetricsReset        - starts the measurements over
+        MetricsSample       - takes a sample
+        MetricsGetStats     - throughput statistics
+        MetricsLineRate     - bytes per second the line can carry
+        MetricsMicroseconds - performance counter time, us
+        MetricsDrawGraph    - draws the throughput sparkline
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "MTTTY.h"
+
+#define METRICS_HISTORY     64          // samples in the graph
+
+typedef struct METRICSDIR
+{
+    DWORD     dwLast;                   // byte counter at the last sample
+    DWORD     dwRate;                   // last window, B/s
+    DWORD     dwPeak;
+    ULONGLONG ullActiveBytes;           // bytes and time of active windows
+    LONGLONG  llActiveTicks;
+    DWORD     dwHistory[METRICS_HISTORY];
+} METRICSDIR;
+
+static struct
+{
+    LARGE_INTEGER liFreq;
+    LONGLONG      llLast;               // counter at the last sample, 0 if none
+    DWORD         dwNext;               // next history slot
+    METRICSDIR    Tx;
+    METRICSDIR    Rx;
+} gMetrics;
+
+//
+// Prototypes for functions called only within this file
+//
+void MetricsUpdate( METRICSDIR *, DWORD, LONGLONG );
+void MetricsDrawLine( HDC, RECT *, METRICSDIR *, DWORD, COLORREF );
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: MetricsReset
+
+PURPOSE: Clears the rates, the peaks and the graph
+
+COMMENTS: The next sample only sets the starting counts.
+
+-----------------------------------------------------------------------------*/
+void MetricsReset()
+{
+    ZeroMemory(&gMetrics, sizeof(gMetrics));
+    QueryPerformanceFrequency(&gMetrics.liFreq);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: MetricsSample
+
+PURPOSE: Takes a throughput sample
+
+COMMENTS: UI thread, from the status dialog timer.
+
+-----------------------------------------------------------------------------*/
+void MetricsSample()
+{
+    LARGE_INTEGER liNow;
+    LONGLONG llTicks;
+    WRITERSTATS Writer;
+    RXRINGSTATS RxRing;
+    DWORD dwTx, dwRx;
+
+    if (gMetrics.liFreq.QuadPart == 0)
+        MetricsReset();
+
+    QueryPerformanceCounter(&liNow);
+    WriterGetStats(&Writer);
+    RxRingGetStats(&RxRing);
+    dwTx = Writer.dwBytes;
+    dwRx = RxRing.dwReceived + RxRing.dwDropped;
+
+    llTicks = liNow.QuadPart - gMetrics.llLast;
+    if (gMetrics.llLast && llTicks > 0) {
+        MetricsUpdate(&gMetrics.Tx, dwTx, llTicks);
+        MetricsUpdate(&gMetrics.Rx, dwRx, llTicks);
+        gMetrics.dwNext = (gMetrics.dwNext + 1) % METRICS_HISTORY;
+    }
+
+    gMetrics.Tx.dwLast = dwTx;
+    gMetrics.Rx.dwLast = dwRx;
+    gMetrics.llLast = liNow.QuadPart;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: MetricsUpdate(METRICSDIR *, DWORD, LONGLONG)
+
+PURPOSE: Updates one direction for a window
+
+PARAMETERS:
+    pDir    - direction
+    dwCount - its byte counter now
+    llTicks - window length, performance counter ticks
+
+COMMENTS: The counters are 32 bits and wrap; the unsigned difference
+          is still the byte count of the window. A new connection
+          clears them, and MetricsReset makes its first sample the
+          starting point.
+
+-----------------------------------------------------------------------------*/
+void MetricsUpdate(METRICSDIR * pDir, DWORD dwCount, LONGLONG llTicks)
+{
+    DWORD dwBytes;
+
+    dwBytes = dwCount - pDir->dwLast;
+
+    pDir->dwRate = (DWORD) ((LONGLONG) dwBytes * gMetrics.liFreq.QuadPart / llTicks);
+    pDir->dwPeak = max(pDir->dwPeak, pDir->dwRate);
+    pDir->dwHistory[gMetrics.dwNext] = pDir->dwRate;
+
+    if (dwBytes) {
+        pDir->ullActiveBytes += dwBytes;
+        pDir->llActiveTicks += llTicks;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: MetricsGetStats(METRICSSTATS *)
+
+PURPOSE: Returns the throughput statistics
+
+PARAMETERS:
+    pStats - structure to fill in
+
+-----------------------------------------------------------------------------*/
+void MetricsGetStats(METRICSSTATS * pStats)
+{
+    LONGLONG llFreq = gMetrics.liFreq.QuadPart;
+
+    pStats->dwLineRate = MetricsLineRate();
+
+    pStats->dwTxRate = gMetrics.Tx.dwRate;
+    pStats->dwTxPeak = gMetrics.Tx.dwPeak;
+    pStats->dwTxAvg = gMetrics.Tx.llActiveTicks == 0 ? 0 :
+        (DWORD) (gMetrics.Tx.ullActiveBytes * llFreq / gMetrics.Tx.llActiveTicks);
+
+    pStats->dwRxRate = gMetrics.Rx.dwRate;
+    pStats->dwRxPeak = gMetrics.Rx.dwPeak;
+    pStats->dwRxAvg = gMetrics.Rx.llActiveTicks == 0 ? 0 :
+        (DWORD) (gMetrics.Rx.ullActiveBytes * llFreq / gMetrics.Rx.llActiveTicks);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: MetricsLineRate
+
+PURPOSE: Returns the bytes per second the port settings allow
+
+RETURN: characters per second, 0 if the baud rate is not set
+
+COMMENTS: A character is a start bit, BYTESIZE data bits, a parity
+          bit unless NOPARITY, and 1, 1.5 or 2 stop bits; counted
+          in half bits.
+
+-----------------------------------------------------------------------------*/
+DWORD MetricsLineRate()
+{
+    DWORD dwHalfBits;
+
+    dwHalfBits = 2 * (1 + BYTESIZE(TTYInfo) + (PARITY(TTYInfo) != NOPARITY));
+    switch (STOPBITS(TTYInfo))
+    {
+        case ONE5STOPBITS:  dwHalfBits += 3;    break;
+        case TWOSTOPBITS:   dwHalfBits += 4;    break;
+        default:            dwHalfBits += 2;    break;
+    }
+
+    return BAUDRATE(TTYInfo) * 2 / dwHalfBits;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: MetricsMicroseconds
+
+PURPOSE: Returns the performance counter time in microseconds
+
+COMMENTS: For timing transfers, only differences are meaningful.
+
+-----------------------------------------------------------------------------*/
+ULONGLONG MetricsMicroseconds()
+{
+    LARGE_INTEGER liNow, liFreq;
+
+    QueryPerformanceFrequency(&liFreq);
+    QueryPerformanceCounter(&liNow);
+
+    return (ULONGLONG) (liNow.QuadPart / liFreq.QuadPart * 1000000 +
+                        liNow.QuadPart % liFreq.QuadPart * 1000000 / liFreq.QuadPart);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: MetricsDrawGraph(DRAWITEMSTRUCT *)
+
+PURPOSE: Draws the throughput sparkline, an owner drawn static
+
+PARAMETERS:
+    pDis - from WM_DRAWITEM
+
+COMMENTS: Transmit and receive rates, oldest on the left.  The top
+          is the line rate, or the highest rate shown if that is
+          higher or the line rate is unknown.
+
+-----------------------------------------------------------------------------*/
+void MetricsDrawGraph(DRAWITEMSTRUCT * pDis)
+{
+    RECT rc = pDis->rcItem;
+    DWORD dwScale, i;
+
+    dwScale = MetricsLineRate();
+    for (i = 0; i < METRICS_HISTORY; i++)
+        dwScale = max(dwScale, max(gMetrics.Tx.dwHistory[i], gMetrics.Rx.dwHistory[i]));
+
+    FillRect(pDis->hDC, &rc, (HBRUSH) (COLOR_WINDOW + 1));
+    FrameRect(pDis->hDC, &rc, (HBRUSH) GetStockObject(GRAY_BRUSH));
+    InflateRect(&rc, -1, -1);
+
+    if (dwScale == 0)
+        return;
+
+    MetricsDrawLine(pDis->hDC, &rc, &gMetrics.Rx, dwScale, RGB(0, 128, 0));
+    MetricsDrawLine(pDis->hDC, &rc, &gMetrics.Tx, dwScale, RGB(0, 0, 192));
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: MetricsDrawLine(HDC, RECT *, METRICSDIR *, DWORD, COLORREF)
+
+PURPOSE: Draws one direction's history as a polyline
+
+PARAMETERS:
+    hdc     - device context
+    prc     - graph area
+    pDir    - direction
+    dwScale - rate at the top of the area
+    cr      - line colour
+
+-----------------------------------------------------------------------------*/
+void MetricsDrawLine(HDC hdc, RECT * prc, METRICSDIR * pDir, DWORD dwScale, COLORREF cr)
+{
+    POINT pts[METRICS_HISTORY];
+    int cx = prc->right - prc->left - 1;
+    int cy = prc->bottom - prc->top - 1;
+    HPEN hPen, hOldPen;
+    DWORD i, dwRate;
+
+    for (i = 0; i < METRICS_HISTORY; i++) {
+        dwRate = pDir->dwHistory[(gMetrics.dwNext + i) % METRICS_HISTORY];
+        pts[i].x = prc->left + (int) (i * cx / (METRICS_HISTORY - 1));
+        pts[i].y = prc->bottom - 1 - (int) ((ULONGLONG) dwRate * cy / dwScale);
+    }
+
+    hPen = CreatePen(PS_SOLID, 1, cr);
+    hOldPen = (HPEN) SelectObject(hdc, hPen);
+    Polyline(hdc, pts, METRICS_HISTORY);
+    SelectObject(hdc, hOldPen);
+    DeleteObject(hPen);
+}
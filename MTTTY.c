@@ -26,6 +26,8 @@
         SetTTYFocus        - responds to tty window getting focus
         KillTTYFocus       - responds to tty window losing focus
         SizeTTY            - responds to tty window size changes
+        UpdateTTYVertScroll - sets vertical scroll bar for history
+        ScrollbackRows     - history lines the window can scroll over
         TTYChildProc       - window procedure for TTY child window
 
 -----------------------------------------------------------------------------*/
@@ -383,7 +385,7 @@ void CmdDispatch(int iMenuChoice, HWND hwnd, LPARAM lParam)
 
         case ID_TRANSFER_RECEIVEFILETEXT:
             {
-                const char * szFilter = "Text Files\0*.TXT\0";
+                const char * szFilter = "Text Files\0*.TXT\0Timestamped Captures\0*.MTC\0";
                 OPENFILENAME ofn;
                 memset(&ofn, 0, sizeof(OPENFILENAME));
 
@@ -392,6 +394,7 @@ void CmdDispatch(int iMenuChoice, HWND hwnd, LPARAM lParam)
                 ofn.lpstrFilter = szFilter;
                 ofn.lpstrFile = szFileName;
                 ofn.nMaxFile = MAX_PATH;
+                ofn.lpstrDefExt = "TXT";        // or the chosen filter's
                 ofn.lpstrTitle = "Receive File";
                 ofn.Flags = OFN_OVERWRITEPROMPT;
 
@@ -453,11 +456,34 @@ void CmdDispatch(int iMenuChoice, HWND hwnd, LPARAM lParam)
             InvalidateRect(ghWndTTY, NULL, TRUE);
             break;
 
+        case ID_TTY_FIND:
+            CmdFind(hwnd);
+            break;
+
+        case ID_TTY_FINDNEXT:
+        case ID_TTY_FINDPREV:
+            if (!SearchNext(ghWndTTY, iMenuChoice == ID_TTY_FINDPREV))
+                CmdFind(hwnd);
+            break;
+
+        case ID_TTY_HEXVIEW:
+            CmdHexView(hwnd);
+            break;
+
+        case ID_TTY_PASTE:
+            CmdPaste(hwnd);
+            break;
+
+        case ID_TRANSFER_REPLAY:
+            CmdReplay(hwnd);
+            break;
+
         // The following correspond to menu choices and buttons in the settings dlog
         case IDC_FONTBTN:
         case IDC_COMMEVENTSBTN:
         case IDC_FLOWCONTROLBTN:
         case IDC_TIMEOUTSBTN:
+        case IDC_OPTIONSBTN:
             SendMessage(ghWndToolbarDlg, WM_COMMAND, (WPARAM) iMenuChoice, (LPARAM) GetDlgItem(ghWndToolbarDlg, iMenuChoice));
             break;
 
@@ -528,15 +554,22 @@ void OpenTTYChildWindow(HWND hWnd)
 //              5/ 8/91   BryanW      Wrote it.
 //             10/27/95   AllenD      Included it for MTTTY Sample.
 //
+//     Negative offsets show the scrollback history above row 0.
+//     The thumb position is read with GetScrollInfo, since the
+//     history can be taller than a WORD position allows.
+//
 //---------------------------------------------------------------------------
 BOOL NEAR ScrollTTYVert( HWND hWnd, WORD wScrollCmd, WORD wScrollPos )
 {
-   int  nScrollAmt ;
+   SCROLLINFO si ;
+   int  nScrollAmt, nHistory ;
+
+   nHistory = ScrollbackRows() * YCHAR( TTYInfo ) ;
 
    switch (wScrollCmd)
    {
       case SB_TOP:
-         nScrollAmt = -YOFFSET( TTYInfo ) ;
+         nScrollAmt = -nHistory - YOFFSET( TTYInfo ) ;
          break ;
 
       case SB_BOTTOM:
@@ -560,7 +593,11 @@ BOOL NEAR ScrollTTYVert( HWND hWnd, WORD wScrollCmd, WORD wScrollPos )
          break ;
 
       case SB_THUMBPOSITION:
-         nScrollAmt = wScrollPos - YOFFSET( TTYInfo ) ;
+         si.cbSize = sizeof( si ) ;
+         si.fMask = SIF_TRACKPOS ;
+         if (!GetScrollInfo( hWnd, SB_VERT, &si ))
+            si.nTrackPos = wScrollPos ;
+         nScrollAmt = si.nTrackPos - nHistory - YOFFSET( TTYInfo ) ;
          break ;
 
       default:
@@ -570,14 +607,14 @@ BOOL NEAR ScrollTTYVert( HWND hWnd, WORD wScrollCmd, WORD wScrollPos )
    if ((YOFFSET( TTYInfo ) + nScrollAmt) > YSCROLL( TTYInfo ))
       nScrollAmt = YSCROLL( TTYInfo ) - YOFFSET( TTYInfo ) ;
 
-   if ((YOFFSET( TTYInfo ) + nScrollAmt) < 0)
-      nScrollAmt = -YOFFSET( TTYInfo ) ;
+   if ((YOFFSET( TTYInfo ) + nScrollAmt) < -nHistory)
+      nScrollAmt = -nHistory - YOFFSET( TTYInfo ) ;
 
    ScrollWindowEx( hWnd, 0, -nScrollAmt, NULL, NULL, NULL, NULL, SW_INVALIDATE | SW_ERASE) ;
 
    YOFFSET( TTYInfo ) = YOFFSET( TTYInfo ) + nScrollAmt ;
 
-   SetScrollPos( hWnd, SB_VERT, YOFFSET( TTYInfo ), TRUE ) ;
+   SetScrollPos( hWnd, SB_VERT, nHistory + YOFFSET( TTYInfo ), TRUE ) ;
 
    return ( TRUE ) ;
 
@@ -676,6 +713,13 @@ BOOL NEAR ScrollTTYHorz( HWND hWnd, WORD wScrollCmd, WORD wScrollPos )
 //
 //             10/27/95   AllenD      Included it for MTTTY Sample.
 //
+//     Rows outside the update region are skipped, so a repaint
+//     of a few dirty rows doesn't redraw the whole window.
+//     Negative rows come from the scrollback history.  The line
+//     of the current search hit is painted highlighted.  Each row
+//     is drawn as runs of cells with the same attributes; history
+//     keeps only text, so its rows have default attributes.
+//
 //---------------------------------------------------------------------------
 BOOL NEAR PaintTTY( HWND hWnd )
 {
@@ -684,19 +728,38 @@ BOOL NEAR PaintTTY( HWND hWnd )
    RECT         rect ;
    HDC          hDC ;
    int          nRow, nCol, nEndRow, nEndCol;
-   int          nCount, nHorzPos, nVertPos ;
+   int          nCount, nHorzPos, nVertPos, nHistory, nLen ;
+   int          i, nRun ;
+   DWORD        dwLine, dwLines, dwHit ;
+   char         szLine[MAXCOLS] ;
+   BYTE         bDefColor[MAXCOLS], bDefFlags[MAXCOLS] ;
+   LPSTR        lpText ;
+   BYTE         *lpFg, *lpBg, *lpFlags ;
+   COLORREF     crFg, crBg ;
 
    hDC = BeginPaint( hWnd, &ps ) ;
    hOldFont = (HFONT) SelectObject( hDC, HTTYFONT( TTYInfo ) ) ;
    SetTextColor( hDC, FGCOLOR( TTYInfo ) ) ;
    SetBkColor( hDC, GetSysColor( COLOR_WINDOW ) ) ;
    rect = ps.rcPaint ;
+   nHistory = ScrollbackRows() ;
+   dwLines = SbGetLineCount() ;
+   dwHit = SearchGetCurrent() ;
+   FillMemory( bDefColor, MAXCOLS, ATTR_DEFCOLOR ) ;
+   ZeroMemory( bDefFlags, MAXCOLS ) ;
+
+   //
+   // rows are counted from the oldest history line while dividing,
+   // so that rows above row 0 round down too
+   //
    nRow =
       min( MAXROWS - 1,
-           max( 0, (rect.top + YOFFSET( TTYInfo )) / YCHAR( TTYInfo ) ) ) ;
+           max( 0, (rect.top + YOFFSET( TTYInfo ) + nHistory * YCHAR( TTYInfo )) /
+                   YCHAR( TTYInfo ) ) - nHistory ) ;
    nEndRow =
       min( MAXROWS - 1,
-           ((rect.bottom + YOFFSET( TTYInfo ) - 1) / YCHAR( TTYInfo ) ) ) ;
+           ((rect.bottom + YOFFSET( TTYInfo ) + nHistory * YCHAR( TTYInfo ) - 1) /
+             YCHAR( TTYInfo ) ) - nHistory ) ;
    nCol =
       min( MAXCOLS - 1,
            max( 0, (rect.left + XOFFSET( TTYInfo )) / XCHAR( TTYInfo ) ) ) ;
@@ -704,6 +767,7 @@ BOOL NEAR PaintTTY( HWND hWnd )
       min( MAXCOLS - 1,
            ((rect.right + XOFFSET( TTYInfo ) - 1) / XCHAR( TTYInfo ) ) ) ;
    nCount = nEndCol - nCol + 1 ;
+   gRepaintStats.dwPaints++ ;
    for (; nRow <= nEndRow; nRow++)
    {
       nVertPos = (nRow * YCHAR( TTYInfo )) - YOFFSET( TTYInfo ) ;
@@ -712,10 +776,58 @@ BOOL NEAR PaintTTY( HWND hWnd )
       rect.bottom = nVertPos + YCHAR( TTYInfo ) ;
       rect.left = nHorzPos ;
       rect.right = nHorzPos + XCHAR( TTYInfo ) * nCount ;
+
+      //
+      // only dirty rows are in the update region, skip the others
+      //
+      if (!RectVisible( hDC, &rect ))
+         continue ;
+
+      if (nRow < 0)
+      {
+         nLen = SbGetLine( dwLines + nRow, szLine ) ;
+         FillMemory( szLine + nLen, MAXCOLS - nLen, ' ' ) ;
+         lpText = szLine + nCol ;
+         lpFg = lpBg = bDefColor + nCol ;
+         lpFlags = bDefFlags + nCol ;
+      }
+      else
+      {
+         lpText = (LPSTR)( SCREENROW( TTYInfo, nRow ) + nCol ) ;
+         lpFg = FGROW( TTYInfo, nRow ) + nCol ;
+         lpBg = BGROW( TTYInfo, nRow ) + nCol ;
+         lpFlags = FLAGSROW( TTYInfo, nRow ) + nCol ;
+      }
+
+      dwLine = SbGetFirstLine() + dwLines + nRow ;
       SetBkMode( hDC, OPAQUE ) ;
-      ExtTextOut( hDC, nHorzPos, nVertPos, ETO_OPAQUE | ETO_CLIPPED, &rect,
-                  (LPSTR)( SCREEN( TTYInfo ) + nRow * MAXCOLS + nCol ),
-                  nCount, NULL ) ;
+
+      for (i = 0; i < nCount; i += nRun)
+      {
+         for (nRun = 1; i + nRun < nCount &&
+                        lpFg[i + nRun] == lpFg[i] &&
+                        lpBg[i + nRun] == lpBg[i] &&
+                        lpFlags[i + nRun] == lpFlags[i]; nRun++)
+            ;
+
+         if (dwLine == dwHit)
+         {
+            crFg = GetSysColor( COLOR_HIGHLIGHTTEXT ) ;
+            crBg = GetSysColor( COLOR_HIGHLIGHT ) ;
+         }
+         else
+            VtCellColors( lpFg[i], lpBg[i], lpFlags[i], &crFg, &crBg ) ;
+
+         SetTextColor( hDC, crFg ) ;
+         SetBkColor( hDC, crBg ) ;
+         SelectObject( hDC, (lpFlags[i] & ATTR_UNDERLINE) && HTTYFONTUL( TTYInfo ) ?
+                            HTTYFONTUL( TTYInfo ) : HTTYFONT( TTYInfo ) ) ;
+
+         rect.left = nHorzPos + i * XCHAR( TTYInfo ) ;
+         rect.right = rect.left + nRun * XCHAR( TTYInfo ) ;
+         ExtTextOut( hDC, rect.left, nVertPos, ETO_OPAQUE | ETO_CLIPPED, &rect,
+                     lpText + i, nRun, NULL ) ;
+      }
    }
    SelectObject( hDC, hOldFont ) ;
    EndPaint( hWnd, &ps ) ;
@@ -844,8 +956,7 @@ BOOL NEAR SizeTTY( HWND hWnd, WORD wWidth, WORD wHeight )
    ScrollWindow( hWnd, 0, -nScrollAmt, NULL, NULL ) ;
 
    YOFFSET( TTYInfo ) = YOFFSET( TTYInfo ) + nScrollAmt ;
-   SetScrollPos( hWnd, SB_VERT, YOFFSET( TTYInfo ), FALSE ) ;
-   SetScrollRange( hWnd, SB_VERT, 0, YSCROLL( TTYInfo ), TRUE ) ;
+   UpdateTTYVertScroll( hWnd ) ;
 
    //
    // adjust horz settings
@@ -866,6 +977,74 @@ BOOL NEAR SizeTTY( HWND hWnd, WORD wWidth, WORD wHeight )
 
 } // end of SizeTTY()
 
+//---------------------------------------------------------------------------
+//  void UpdateTTYVertScroll( HWND hWnd )
+//
+//  Description:
+//     Sets the vertical scroll bar range to cover the scrollback
+//     history and the screen.  Scroll bar position 0 is the
+//     oldest history line, so it is YOFFSET plus the history height.
+//
+//  Parameters:
+//     HWND hWnd
+//        handle to TTY window
+//
+//  Comments:
+//     Called when the history grows or is cleared.  If old history
+//     was dropped under the window, the window moves to the oldest
+//     line that is left.
+//
+//---------------------------------------------------------------------------
+void UpdateTTYVertScroll( HWND hWnd )
+{
+   SCROLLINFO si ;
+   int        nHistory ;
+
+   nHistory = ScrollbackRows() * YCHAR( TTYInfo ) ;
+
+   if (YOFFSET( TTYInfo ) < -nHistory)
+   {
+      YOFFSET( TTYInfo ) = -nHistory ;
+      InvalidateRect( hWnd, NULL, FALSE ) ;
+   }
+
+   si.cbSize = sizeof( si ) ;
+   si.fMask = SIF_RANGE | SIF_POS ;
+   si.nMin = 0 ;
+   si.nMax = nHistory + YSCROLL( TTYInfo ) ;
+   si.nPos = nHistory + YOFFSET( TTYInfo ) ;
+   SetScrollInfo( hWnd, SB_VERT, &si, TRUE ) ;
+
+   return ;
+
+} // end of UpdateTTYVertScroll()
+
+//---------------------------------------------------------------------------
+//  int ScrollbackRows( void )
+//
+//  Description:
+//     Returns the number of history lines the window can scroll
+//     over, the newest ones.
+//
+//  Comments:
+//     Offsets and scroll positions are in pixels and are ints, so
+//     a large history is cut to what fits in half of MAXLONG;
+//     the other half leaves room for the screen and the window.
+//     Lines above it stay in the history and can be found by
+//     search, but can't be scrolled to.
+//
+//---------------------------------------------------------------------------
+int ScrollbackRows( void )
+{
+   DWORD dwLines, dwMax ;
+
+   dwLines = SbGetLineCount() ;
+   dwMax = (MAXLONG / 2) / YCHAR( TTYInfo ) ;
+
+   return ( (int) min( dwLines, dwMax ) ) ;
+
+} // end of ScrollbackRows()
+
 /*-----------------------------------------------------------------------------
 
 FUNCTION: TTYChildProc(HWND, UINT, WPARAM, LPARAM)
@@ -902,6 +1081,18 @@ int WINAPI TTYChildProc(HWND hWnd, UINT uMessage, WPARAM wParam, LPARAM lParam)
             PaintTTY(hWnd);
             break;
 
+        case WM_TTYRXDATA:
+            RxRingDrain(hWnd);
+            break;
+
+        case WM_TIMER:
+            TTYRepaint(hWnd);
+            break;
+
+        case WM_TTYSEARCH:
+            SearchResults(hWnd);
+            break;
+
         case WM_CHAR:
             {
                 //
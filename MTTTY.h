@@ -20,6 +20,16 @@
 
 #include "resource.h"
 #include "ttyinfo.h"
+#include "capfmt.h"
+
+//
+// thread local storage, spelled differently by MSVC and GCC
+//
+#ifdef _MSC_VER
+#define THREAD_LOCAL            __declspec(thread)
+#else
+#define THREAD_LOCAL            __thread
+#endif
 
 //
 // GLOBAL DEFINES
@@ -27,6 +37,9 @@
 #define TTY_BUFFER_SIZE         MAXROWS * MAXCOLS
 #define MAX_STATUS_BUFFER       20000
 #define MAX_WRITE_BUFFER        1024
+#define WRITE_SLOTS             8               // overlapped writes in flight
+#define WRITE_SLOT_SIZE         0x1000          // bytes per write slot
+#define WRPOOL_NODES            512             // write request packets
 #define MAX_READ_BUFFER         2048
 #define READ_TIMEOUT            500
 #define STATUS_CHECK_TIMEOUT    500
@@ -34,6 +47,44 @@
 #define PURGE_FLAGS             PURGE_TXABORT | PURGE_TXCLEAR | PURGE_RXABORT | PURGE_RXCLEAR
 #define EVENTFLAGS_DEFAULT      EV_BREAK | EV_CTS | EV_DSR | EV_ERR | EV_RING | EV_RLSD
 #define FLAGCHAR_DEFAULT        '\n'
+#define RX_RING_SIZE            0x100000        // must be a power of two
+#define REPAINTRATE_DEFAULT     60              // tty repaints per second
+#define HISTORYMB_DEFAULT       64              // scrollback memory, MB
+#define HISTORYMB_MAX           1024
+#define TXHIGHKB_DEFAULT        64              // write queue watermarks, KB
+#define TXLOWKB_DEFAULT         16
+#define TXQUEUEKB_MAX           4096
+#define COALESCEMS_DEFAULT      0               // typed chars sent at once
+#define COALESCEMS_MAX          1000
+#define COALESCEBYTES_DEFAULT   64
+#define PASTEDELAY_DEFAULT      0               // ms after each pasted line
+#define PASTEDELAY_MAX          10000
+#define PACERATE_DEFAULT        0               // transmit pacing off
+#define PACECHARGAP_DEFAULT     0
+#define PACELINEDELAY_DEFAULT   0
+#define PACEDELAY_MAX           10000           // gap and line delay, ms
+#define READAHEADKB_DEFAULT     256             // file send read-ahead
+#define READAHEADKB_MIN         64
+#define READAHEADKB_MAX         3072            // three mapped views
+#define REPLAYSPEED_DEFAULT     100             // % of the captured timing
+#define REPLAYSPEED_MAX         10000
+#define ROTATEMB_DEFAULT        0               // capture segment size, off
+#define ROTATEMB_MAX            4096
+#define ROTATEMIN_DEFAULT       0               // capture segment age, off
+#define ROTATEMIN_MAX           10080           // a week
+#define ROTATEBUDGETMB_DEFAULT  0               // closed segments, no limit
+#define ROTATECOMPRESS_DEFAULT  TRUE
+#define SB_BLOCK_LINES          256             // history lines per block
+#define SB_TABLE_SIZE           ((SB_BLOCK_LINES + 1) * sizeof(WORD))
+#define SB_RAW_SIZE             (SB_TABLE_SIZE + SB_BLOCK_LINES * MAXCOLS)
+#define SB_BLOOM_BITS           8192            // trigram filter per block
+#define SB_READ_GONE            (-1)
+#define LZ_BOUND( n )           ((n) + (n) / 255 + 16)
+#define ASCII_FOLD( c )         (((c) >= 'A' && (c) <= 'Z') ? (c) + ('a' - 'A') : (c))
+#define MAX_FIND_LENGTH         80
+#define HEXVIEW_ROWBYTES        16              // bytes per hex view row
+#define HEXVIEW_ROWLEN          80              // characters per hex view row
+#define HEXVIEW_MAXROWS         256             // rows painted at most
 
 //
 // Write request types
@@ -45,6 +96,13 @@
 #define WRITE_ABORT         0x05
 #define WRITE_BLOCK         0x06
 
+//
+// Special byte scan modes
+//
+#define SCAN_CONTROL        0       // BEL, BS, CR, LF
+#define SCAN_NONPRINT       1       // anything outside ' '..'~'
+#define SCAN_C0             2       // any C0 control, for the ANSI parser
+
 //
 // Read states
 //
@@ -68,6 +126,18 @@
 // window timer ids
 //
 #define TIMERID             1
+#define METRICS_TIMERID     2
+
+//
+// throughput sample window, ms
+//
+#define METRICS_SAMPLE_MS   100
+
+//
+// private window messages
+//
+#define WM_TTYRXDATA        (WM_USER + 1)       // data waiting in rx ring
+#define WM_TTYSEARCH        (WM_USER + 2)       // search found more lines
 
 //
 // GLOBAL VARIABLES
@@ -86,6 +156,11 @@ HWND          ghWndHidden;
 //
 extern COMMTIMEOUTS gTimeoutsDefault;
 
+//
+// hex digit pairs of all byte values, in Reader.c
+//
+extern const char gHexPairs[];
+
 //
 //  Window placement variables
 //
@@ -103,51 +178,209 @@ BOOL gfAbortTransfer;
 //
 DWORD  gdwFileTransferLeft;
 DWORD  gdwReceiveState;
-HANDLE ghFileCapture;
 
 //
 //  Status updating
 //
-CRITICAL_SECTION gStatusCritical;
 HANDLE ghStatusMessageEvent;
-HANDLE ghStatusMessageHeap;
 HFONT ghFontStatus;
 int   gnStatusIndex;
 
-//typedef struct STATUS_MESSAGE;
+//
+//  Status log message ids; the text is made when the message is
+//  shown, look in Status.c for more info
+//
+#define STATUSLOG_TEXT              0       // text copied by UpdateStatus
+#define STATUSLOG_EVENT             1       // EV_* mask
+#define STATUSLOG_READIMMEDIATE     2
+#define STATUSLOG_READOVERLAPPED    3
+#define STATUSLOG_WRITEIMMEDIATE    4
+#define STATUSLOG_WRITEOVERLAPPED   5
+#define STATUSLOG_INQUEUE           6       // bytes
+#define STATUSLOG_OUTQUEUE          7       // bytes
+
 
-struct STATUS_MESSAGE * glpStatusMessageHead;
-struct STATUS_MESSAGE * glpStatusMessageTail;
+//
+//  Port name
+//
+char gszPort[10];
 
-typedef struct STATUS_MESSAGE
+//
+//  Receive ring statistics; look in RxRing.c for more info
+//
+typedef struct RXRINGSTATS
 {
-    struct STATUS_MESSAGE * lpNext;     // pointer to next node
-    char chMessageStart;                // variable length string start here
-} STATUS_MESSAGE;
+  DWORD      dwSize;             // ring capacity
+  DWORD      dwUsed;             // bytes waiting for the tty window
+  DWORD      dwHighWater;        // highest occupancy seen
+  DWORD      dwDropped;          // bytes lost because ring was full
+  DWORD      dwReceived;         // bytes accepted into the ring
+} RXRINGSTATS;
 
+//
+//  Repaint statistics, updated by the tty window thread
+//
+typedef struct REPAINTSTATS
+{
+  DWORD      dwUpdates;          // screen changes (runs, scrolls)
+  DWORD      dwRepaints;         // scheduled repaints
+  DWORD      dwPaints;           // WM_PAINT messages handled
+} REPAINTSTATS;
+
+REPAINTSTATS gRepaintStats;
 
 //
-//  Port name
+//  Scrollback history statistics; look in ScrollBk.c for more info
 //
-char gszPort[10];
+typedef struct SBSTATS
+{
+  DWORD      dwLines;            // lines in history
+  DWORD      dwBlocks;           // compressed blocks
+  DWORD      dwBytes;            // memory used by compressed blocks
+  DWORD      dwRawBytes;         // same blocks, uncompressed
+  DWORD      dwBudget;           // memory limit
+} SBSTATS;
+
+//
+//  Search statistics; look in Search.c for more info
+//
+typedef struct SEARCHSTATS
+{
+  DWORD      dwHits;             // lines found
+  DWORD      dwBlocks;           // history blocks looked at
+  DWORD      dwSkipped;          // blocks ruled out by bloom filter
+  DWORD      dwTime;             // search time, ms
+  BOOL       fDone;
+} SEARCHSTATS;
+
+//
+//  Hex view statistics; look in HexView.c for more info
+//
+typedef struct HEXVIEWSTATS
+{
+  DWORD      dwLogKB;            // bytes in the byte log, KB
+  DWORD      dwDroppedKB;        // not logged, disk too slow
+  DWORD      dwErrors;           // log file write errors
+  DWORD      dwRows;             // rows formatted
+  DWORD      dwRowsPerSec;       // formatting rate
+} HEXVIEWSTATS;
+
+//
+//  Repeated send statistics; look in Transfer.c for more info
+//
+#define REPEAT_HIST_BINS    6
+
+typedef struct REPEATSTATS
+{
+  DWORD      dwPeriod;           // target period, us; 0 if never run
+  DWORD      dwAvgPeriod;        // measured between releases, us
+  DWORD      dwSent;             // blocks queued
+  DWORD      dwOverruns;         // skipped, previous block still sending
+  DWORD      dwMissed;           // deadlines passed while busy
+  DWORD      dwMaxLate;          // wakeup after deadline, us
+  DWORD      dwLate[REPEAT_HIST_BINS];  // lateness histogram
+} REPEATSTATS;
+
+//
+//  Throughput statistics; look in Metrics.c for more info
+//
+typedef struct METRICSSTATS
+{
+  DWORD      dwLineRate;         // bytes per second the line can carry
+  DWORD      dwTxRate;           // last sample window, B/s
+  DWORD      dwTxAvg;            // over windows that sent data
+  DWORD      dwTxPeak;
+  DWORD      dwRxRate;
+  DWORD      dwRxAvg;
+  DWORD      dwRxPeak;
+} METRICSSTATS;
+
+//
+//  Capture statistics; look in CapSink.c for more info
+//
+typedef struct CAPSINKSTATS
+{
+  DWORD      dwBuffers;          // capture buffers; 0 if never run
+  DWORD      dwCapturedKB;       // received while capturing
+  DWORD      dwWrittenKB;        // written to the file
+  DWORD      dwDropped;          // bytes, all buffers waiting for the disk
+  DWORD      dwQueuedPeak;       // buffers waiting or being written
+  DWORD      dwWrites;
+  DWORD      dwMaxWriteTime;     // ms
+  DWORD      dwErrors;           // failed writes
+  DWORD      dwBlocks;           // timestamped, in the open segment
+  DWORD      dwSegments;         // rotating, segments started; else 0
+  DWORD      dwCompressed;       // closed segments compressed
+  DWORD      dwDeleted;          // oldest segments deleted for the budget
+} CAPSINKSTATS;
+
+//
+//  Replay statistics; look in Replay.c for more info
+//
+typedef struct REPLAYSTATS
+{
+  DWORD      dwBytes;            // data replayed
+  DWORD      dwRecords;          // capture records replayed
+  DWORD      dwRate;             // B/s, when finished
+  DWORD      dwLagAvg;           // into the tty, us until rendered
+  DWORD      dwLagMax;
+  DWORD      dwLateMax;          // behind the capture timing, us
+} REPLAYSTATS;
+
+//
+//  Write statistics; look in Writer.c for more info
+//
+typedef struct WRITERSTATS
+{
+  DWORD      dwWrites;           // writes completed
+  DWORD      dwBytes;            // bytes written
+  DWORD      dwInFlight;         // writes issued, not completed
+  DWORD      dwLastLatency;      // issue to completion, us
+  DWORD      dwAvgLatency;
+  DWORD      dwMaxLatency;
+  DWORD      dwQueued;           // data bytes waiting in the queue
+  DWORD      dwQueuedPeak;
+  DWORD      dwFull;             // times the high watermark was hit
+  DWORD      dwWriteCalls;       // WriteFile calls
+  DWORD      dwCallsSaved;       // by coalescing typed chars
+  DWORD      dwPaceRate;         // paced bytes per second achieved
+  DWORD      dwPaceLate;         // mean pacing wait lateness, us
+  DWORD      dwPaceJitter;       // its standard deviation, us
+} WRITERSTATS;
+
+//
+//  Write request pool statistics; look in WrPool.c for more info
+//
+typedef struct WRPOOLSTATS
+{
+  DWORD      dwNodes;            // packets in the pool
+  DWORD      dwInUse;            // packets allocated
+  DWORD      dwPeak;
+  DWORD      dwFailures;         // allocations failed, pool empty
+} WRPOOLSTATS;
 
 //
 //  Writer heap variables
 //
-CRITICAL_SECTION gcsWriterHeap;
 CRITICAL_SECTION gcsDataHeap;
-HANDLE ghWriterHeap;
 HANDLE ghWriterEvent;
+HANDLE ghWriterRoomEvent;
 HANDLE ghTransferCompleteEvent;
 
+//
+//  References to a mapped file view held by write requests; the
+//  writer sets hEvent when the last one is released
+//
+typedef struct MAPREF
+{
+  LONG volatile lRefs;
+  HANDLE     hEvent;
+} MAPREF;
+
 //
 //  Write request data structure; look in Writer.c for more info
 //
 // typedef struct WRITEREQUEST;
-
-struct WRITEREQUEST *gpWriterHead;
-struct WRITEREQUEST *gpWriterTail;
-
 typedef struct WRITEREQUEST
 {
   DWORD      dwWriteType;        // char, file start, file abort, file packet
@@ -156,8 +389,8 @@ typedef struct WRITEREQUEST
   char *     lpBuf;              // address of buffer to send
   HANDLE     hHeap;              // heap containing buffer
   HWND       hWndProgress;       // status bar window handle
-  struct WRITEREQUEST *pNext;    // next node in the list
-  struct WRITEREQUEST *pPrev;    // prev node in the list
+  MAPREF *   pMapRef;            // mapped view of lpBuf, or NULL
+  struct WRITEREQUEST *pNext;    // next node in the queue
 } WRITEREQUEST, *PWRITEREQUEST;
 
 
@@ -201,6 +434,8 @@ BOOL MoveTTYCursor( HWND );
 BOOL KillTTYFocus( HWND );
 BOOL SetTTYFocus( HWND );
 BOOL SizeTTY( HWND, WORD, WORD );
+void UpdateTTYVertScroll( HWND );
+int ScrollbackRows( void );
 
 //
 //  Thread procedures
@@ -211,9 +446,9 @@ DWORD WINAPI WriterProc( LPVOID );
 //
 //  File transfer functions
 //
-void CALLBACK TransferRepeatDo( UINT, UINT, DWORD, DWORD, DWORD );
 void TransferRepeatCreate( LPCSTR, DWORD );
 void TransferRepeatDestroy( void );
+void TransferRepeatGetStats( REPEATSTATS * );
 void TransferFileTextStart( LPCSTR );
 void TransferFileTextEnd( void );
 // void TransferFileText( LPCTSTR );
@@ -226,6 +461,111 @@ DWORD GetAFrequency( void );
 void OutputABufferToWindow( HWND, char *, DWORD );
 void OutputABuffer( HWND, char *, DWORD );
 BOOL ClearTTYContents( void );
+void TTYRepaint( HWND );
+DWORD TTYScanSpecial( const BYTE *, DWORD, int );
+void TTYMarkDirty( int, int, int );
+void TTYLineFeed( HWND );
+void TTYEraseCells( int, int, int, BYTE );
+void TTYPutRun( HWND, const char *, int );
+void TTYPutHex( HWND, const BYTE *, DWORD, BOOL );
+void TTYControl( HWND, BYTE );
+
+//
+//  VT100/ANSI parser functions
+//
+void VtInit( void );
+void VtReset( void );
+void VtParse( HWND, const BYTE *, DWORD );
+void VtCellColors( BYTE, BYTE, BYTE, COLORREF *, COLORREF * );
+
+//
+//  Receive ring functions
+//
+void RxRingClearStats( void );
+void RxRingWrite( HWND, char *, DWORD );
+void RxRingDrain( HWND );
+void RxRingGetStats( RXRINGSTATS * );
+
+//
+//  Scrollback history functions
+//
+void SbCreate( void );
+void SbDestroy( void );
+void SbClear( void );
+void SbSetBudget( DWORD );
+void SbAddLine( const char *, int );
+DWORD SbGetLineCount( void );
+int SbGetLine( DWORD, char * );
+DWORD SbGetFirstLine( void );
+const char * SbBlockLine( const BYTE *, DWORD, int * );
+int SbTrigramBits( const char *, int, DWORD *, int );
+int SbReadBlock( DWORD, const DWORD *, int, BYTE *, BYTE * );
+void SbGetStats( SBSTATS * );
+
+//
+//  Search functions
+//
+void SearchCreate( void );
+void SearchDestroy( void );
+void CmdFind( HWND );
+void SearchStart( const char *, BOOL );
+void SearchStop( void );
+void SearchReset( void );
+BOOL SearchNext( HWND, BOOL );
+void SearchResults( HWND );
+DWORD SearchGetCurrent( void );
+void SearchGetStats( SEARCHSTATS * );
+
+//
+//  Compression functions
+//
+DWORD LzCompress( const BYTE *, DWORD, BYTE *, DWORD );
+DWORD LzDecompress( const BYTE *, DWORD, BYTE *, DWORD );
+
+//
+//  Hex view functions
+//
+void HexLogDestroy( void );
+void HexLogClear( void );
+void HexLogWrite( const BYTE *, DWORD );
+void HexFormatRow( DWORDLONG, const BYTE *, int, char * );
+void CmdHexView( HWND );
+void HexViewUpdate( void );
+void HexViewGetStats( HEXVIEWSTATS * );
+
+//
+//  Capture sink functions
+//
+void CapSinkCreate( void );
+void CapSinkDestroy( void );
+BOOL CapSinkOpen( LPCTSTR, HWND, BOOL );
+void CapSinkClose( void );
+void CapSinkWrite( const char *, DWORD );
+void CapSinkRecord( DWORD, const char *, DWORD );
+void CapSinkGetStats( CAPSINKSTATS * );
+
+//
+//  Metrics functions
+//
+void MetricsReset( void );
+void MetricsSample( void );
+void MetricsGetStats( METRICSSTATS * );
+DWORD MetricsLineRate( void );
+ULONGLONG MetricsMicroseconds( void );
+void MetricsDrawGraph( DRAWITEMSTRUCT * );
+
+//
+//  Paste functions
+//
+void CmdPaste( HWND );
+void PasteStop( void );
+
+//
+//  Replay functions
+//
+void CmdReplay( HWND );
+void ReplayStop( void );
+void ReplayGetStats( REPLAYSTATS * );
 
 //
 //  Status functions
@@ -236,16 +576,32 @@ void CheckModemStatus( BOOL );
 void ReportCommError( void );
 void ReportComStat( COMSTAT );
 void StatusMessage( void );
+void StatusLog( DWORD, DWORD, DWORD );
 void UpdateStatus( const char * );
 void CheckComStat( BOOL );
+void ReportStatistics( void );
 
 //
 //  Writer heap functions
 //
 BOOL WriterAddNewNode( DWORD, DWORD, char, char *, HANDLE, HWND );
 BOOL WriterAddExistingNode( PWRITEREQUEST, DWORD, DWORD, char, char *, HANDLE, HWND );
+BOOL WriterAddMappedNode( PWRITEREQUEST, DWORD, DWORD, char *, MAPREF *, HWND );
 BOOL WriterAddNewNodeTimeout( DWORD, DWORD, char, char *, HANDLE, HWND, DWORD );
-BOOL WriterAddFirstNodeTimeout( DWORD, DWORD, char, char *, HANDLE, HWND, DWORD );
+BOOL WriterAddUrgentNodeTimeout( DWORD, DWORD, char, char *, HANDLE, HWND, DWORD );
+BOOL WriterWouldBlock( void );
+BOOL WriterBusy( void );
+void WriterGetStats( WRITERSTATS * );
+
+//
+//  Write request pool functions
+//
+void WrPoolCreate( void );
+void WrPoolDestroy( void );
+PWRITEREQUEST WrPoolAlloc( void );
+void WrPoolFree( PWRITEREQUEST );
+void WrPoolThreadExit( void );
+void WrPoolGetStats( WRPOOLSTATS * );
 
 // other functions
 BOOL CmdHelp(HWND hwnd);
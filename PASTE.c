@@ -0,0 +1,245 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: Paste.c
+
+    PURPOSE: Sends clipboard text to the port.
+
+             Pasting used to arrive as one WM_CHAR per byte, each a
+             write request and a local echo of its own.  CmdPaste
+             reads the clipboard once, echoes it with one screen
+             update and hands the text to a paste thread, which
+             queues it to the writer as WRITE_BLOCK requests of up
+             to WRITE_SLOT_SIZE bytes.  The thread waits on the
+             write queue watermarks, so a long paste never fills
+             the queue.
+
+             Line ends are sent as CR, like the Enter key.  With a
+             paste line delay (PASTEDELAY) each line is its own
+             request and the thread waits that long after queueing
+             it, for devices that need time to process a line.
+
+    FUNCTIONS:
+        CmdPaste        - starts, or stops, a paste
+        PasteStop       - stops a paste and waits for the thread
+        PasteThreadProc - queues the pasted text
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "MTTTY.h"
+
+DWORD WINAPI PasteThreadProc( LPVOID );
+
+static struct
+{
+    HANDLE  hThread;
+    HANDLE  hStopEvent;             // manual reset, ends the paste
+    char *  lpText;                 // converted text, process heap
+    DWORD   dwSize;
+    DWORD   dwDelay;                // PASTEDELAY when started
+} gPaste;
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CmdPaste(HWND)
+
+PURPOSE: Pastes the clipboard text to the port
+
+PARAMETERS:
+    hwnd - main window, clipboard owner while reading
+
+COMMENTS: Choosing paste while a paste runs stops it.
+
+-----------------------------------------------------------------------------*/
+void CmdPaste(HWND hwnd)
+{
+    HANDLE hData;
+    char * lpClip;
+    DWORD  dwLen, i;
+    char * p;
+
+    if (gPaste.hThread) {
+        if (WaitForSingleObject(gPaste.hThread, 0) == WAIT_TIMEOUT) {
+            PasteStop();
+            return;
+        }
+        PasteStop();            // finished, clean up
+    }
+
+    if (!CONNECTED(TTYInfo) || !IsClipboardFormatAvailable(CF_TEXT)) {
+        MessageBeep(MB_OK);
+        return;
+    }
+
+    if (!OpenClipboard(hwnd)) {
+        ErrorReporter("OpenClipboard");
+        return;
+    }
+
+    hData = GetClipboardData(CF_TEXT);
+    lpClip = hData ? (char *) GlobalLock(hData) : NULL;
+    if (lpClip == NULL) {
+        CloseClipboard();
+        return;
+    }
+
+    //
+    // copy, sending CR LF and LF as CR
+    //
+    dwLen = lstrlen(lpClip);
+    gPaste.lpText = (char *) HeapAlloc(GetProcessHeap(), 0, dwLen + 1);
+    if (gPaste.lpText == NULL) {
+        GlobalUnlock(hData);
+        CloseClipboard();
+        ErrorReporter("HeapAlloc (paste text)");
+        return;
+    }
+
+    for (p = gPaste.lpText, i = 0; i < dwLen; i++) {
+        if (lpClip[i] == ASCII_LF) {
+            if (i == 0 || lpClip[i - 1] != ASCII_CR)
+                *p++ = ASCII_CR;
+        }
+        else
+            *p++ = lpClip[i];
+    }
+    gPaste.dwSize = (DWORD) (p - gPaste.lpText);
+
+    GlobalUnlock(hData);
+    CloseClipboard();
+
+    if (gPaste.dwSize == 0) {
+        HeapFree(GetProcessHeap(), 0, gPaste.lpText);
+        gPaste.lpText = NULL;
+        return;
+    }
+
+    //
+    // local echo as one screen update
+    //
+    if (LOCALECHO(TTYInfo))
+        OutputABufferToWindow(ghWndTTY, gPaste.lpText, gPaste.dwSize);
+
+    gPaste.dwDelay = PASTEDELAY(TTYInfo);
+
+    gPaste.hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (gPaste.hStopEvent == NULL) {
+        ErrorReporter("CreateEvent (paste stop event)");
+        PasteStop();
+        return;
+    }
+
+    gPaste.hThread = CreateThread(NULL, 0, PasteThreadProc, NULL, 0, NULL);
+    if (gPaste.hThread == NULL) {
+        ErrorReporter("CreateThread (paste thread)");
+        PasteStop();
+    }
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: PasteStop
+
+PURPOSE: Stops a paste and frees its resources
+
+COMMENTS: Called before the writer thread is stopped, the paste
+          thread waits on the writer's room event.  Requests
+          already queued are still sent.
+
+-----------------------------------------------------------------------------*/
+void PasteStop()
+{
+    if (gPaste.hThread) {
+        SetEvent(gPaste.hStopEvent);
+        WaitForSingleObject(gPaste.hThread, INFINITE);
+        CloseHandle(gPaste.hThread);
+        gPaste.hThread = NULL;
+    }
+
+    if (gPaste.hStopEvent) {
+        CloseHandle(gPaste.hStopEvent);
+        gPaste.hStopEvent = NULL;
+    }
+
+    if (gPaste.lpText) {
+        HeapFree(GetProcessHeap(), 0, gPaste.lpText);
+        gPaste.lpText = NULL;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: PasteThreadProc(LPVOID)
+
+PURPOSE: Queues the pasted text to the writer
+
+COMMENTS: Each request has its own copy of the data on the process
+          heap; the writer frees it after sending (see WriterRelease).
+          Reports the bytes sent and the time in the status window.
+
+-----------------------------------------------------------------------------*/
+DWORD WINAPI PasteThreadProc(LPVOID lpV)
+{
+    HANDLE hWait[2];
+    char * lpText = gPaste.lpText;
+    DWORD  dwLeft = gPaste.dwSize;
+    DWORD  dwChunk;
+    DWORD  dwStart = GetTickCount();
+    char * lpBuf;
+    char * pEol;
+    char   szMessage[80];
+
+    hWait[0] = gPaste.hStopEvent;
+    hWait[1] = ghWriterRoomEvent;
+
+    while (dwLeft) {
+        //
+        // a chunk, or a line when pacing lines
+        //
+        dwChunk = min(dwLeft, WRITE_SLOT_SIZE);
+        pEol = NULL;
+        if (gPaste.dwDelay) {
+            pEol = (char *) memchr(lpText, ASCII_CR, dwChunk);
+            if (pEol)
+                dwChunk = (DWORD) (pEol - lpText) + 1;
+        }
+
+        //
+        // wait below the write queue watermarks
+        //
+        if (WaitForMultipleObjects(2, hWait, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+            break;
+
+        lpBuf = (char *) HeapAlloc(GetProcessHeap(), 0, dwChunk);
+        if (lpBuf == NULL) {
+            ErrorReporter("HeapAlloc (paste block)");
+            break;
+        }
+        CopyMemory(lpBuf, lpText, dwChunk);
+
+        if (!WriterAddNewNode(WRITE_BLOCK, dwChunk, 0, lpBuf, GetProcessHeap(), NULL)) {
+            HeapFree(GetProcessHeap(), 0, lpBuf);
+            break;
+        }
+
+        lpText += dwChunk;
+        dwLeft -= dwChunk;
+
+        if (pEol && WaitForSingleObject(gPaste.hStopEvent, gPaste.dwDelay) != WAIT_TIMEOUT)
+            break;
+    }
+
+    wsprintf(szMessage, "Pasted %lu of %lu bytes, queued in %lu ms\r\n",
+             gPaste.dwSize - dwLeft, gPaste.dwSize, GetTickCount() - dwStart);
+    UpdateStatus(szMessage);
+
+    // return cached packets to the write request pool
+    WrPoolThreadExit();
+
+    return 0;
+}
@@ -13,8 +13,16 @@
     PURPOSE: Read from comm port
 
     FUNCTIONS:
+        TTYScanSpecial        - finds next byte that isn't copied as is
+        TTYMarkDirty          - records changed screen cells
+        TTYRepaint            - invalidates and paints changed screen cells
+        TTYScheduleRepaint    - limits repaints to the repaint rate
+        TTYLineFeed           - moves to next row, scrolls if needed
+        TTYEraseCells         - blanks cells of one row
+        TTYPutRun             - copies a run of characters to the screen
+        TTYPutHex             - shows bytes in hex
+        TTYControl            - carries out a control character
         OutputABufferToWindow - process incoming data destined for tty window
-        OutputABufferToFile   - process incoming data destined for a file
         OutputABuffer         - called when data is read from port
 
 -----------------------------------------------------------------------------*/
@@ -28,18 +36,425 @@
 /*
     Prototypes for functions call only within this file
 */
-void OutputABufferToFile( HANDLE, char *, DWORD );
+void TTYScheduleRepaint( HWND );
 
-void OutputACharToWindow(HWND hTTY, char c)
-{
+/*
+    Word at a time byte tests, 4 bytes per DWORD.
+    HASLESS is nonzero if any byte in x is less than n (n <= 128),
+    HASMORE is nonzero if any byte in x is greater than n (n <= 127).
+    They can report false hits, so a hit is always checked bytewise.
+*/
+#define ONES_DWORD          0x01010101UL
+#define HIGHS_DWORD         0x80808080UL
+#define HASLESS(x, n)       (((x) - ONES_DWORD * (n)) & ~(x) & HIGHS_DWORD)
+#define HASMORE(x, n)       ((((x) + ONES_DWORD * (127 - (n))) | (x)) & HIGHS_DWORD)
+
+/*
+    Hex pair of every byte value, the pair of byte b is at gHexPairs[2 * b]
+*/
+const char gHexPairs[] =
+    "000102030405060708090a0b0c0d0e0f"
+    "101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f"
+    "303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f"
+    "505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f"
+    "707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f"
+    "909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+    "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+    "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+    "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+#define HEX_CHUNK           64      // bytes formatted per screen run
+
+/*
+    A byte is special if it can't be copied to the screen as is:
+    BEL, BS, CR and LF normally, anything outside ' '..'~' when
+    non printable characters are shown in hex, any C0 control
+    (ESC included) for the ANSI parser.
+*/
+#define ISCONTROL(c)        ((c) == ASCII_BEL || (c) == ASCII_BS || \
+                             (c) == ASCII_CR || (c) == ASCII_LF)
+#define ISNONPRINT(c)       ((c) < ' ' || (c) > '~')
+#define ISSPECIAL(c, mode)  ((mode) == SCAN_NONPRINT ? ISNONPRINT(c) : \
+                             (mode) == SCAN_C0 ? (c) < ' ' : ISCONTROL(c))
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TTYScanSpecial(const BYTE *, DWORD, int)
+
+PURPOSE: Finds the first byte that needs special handling
+
+PARAMETERS:
+    lpBuf     - address of data buffer
+    dwBufLen  - size of data buffer
+    nMode     - SCAN_CONTROL, SCAN_NONPRINT or SCAN_C0
+
+RETURN: index of first special byte, dwBufLen if there is none
+
+COMMENTS: Tests a DWORD at a time, so printable text is skipped
+          four bytes per iteration.
+
+-----------------------------------------------------------------------------*/
+DWORD TTYScanSpecial(const BYTE * lpBuf, DWORD dwBufLen, int nMode)
+{
+    DWORD i = 0, j, dwWord, dwHit;
+
+    while (i + sizeof(DWORD) <= dwBufLen) {
+        CopyMemory(&dwWord, lpBuf + i, sizeof(DWORD));
+
+        if (nMode == SCAN_NONPRINT)
+            dwHit = HASLESS(dwWord, ' ') | HASMORE(dwWord, '~');
+        else if (nMode == SCAN_C0)
+            dwHit = HASLESS(dwWord, ' ');
+        else
+            dwHit = HASLESS(dwWord, ASCII_CR + 1);
+
+        if (dwHit) {
+            for (j = i; j < i + sizeof(DWORD); j++)
+                if (ISSPECIAL(lpBuf[j], nMode))
+                    return j;
+        }
+        i += sizeof(DWORD);
+    }
+
+    for (; i < dwBufLen; i++)
+        if (ISSPECIAL(lpBuf[i], nMode))
+            break;
+
+    return i;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TTYMarkDirty(int, int, int)
+
+PURPOSE: Records changed cells of one row
+
+PARAMETERS:
+    nRow   - screen row
+    nLeft  - first changed column
+    nRight - one past last changed column
+
+COMMENTS: Sets the row in the dirty row bitmap and widens the
+          damaged column span, nothing is invalidated until
+          the next repaint.
+
+-----------------------------------------------------------------------------*/
+void TTYMarkDirty(int nRow, int nLeft, int nRight)
+{
+    gRepaintStats.dwUpdates++;
+
+    //
+    // after a scroll the whole window is repainted anyway
+    //
+    if (SCROLLPENDING( TTYInfo ))
+        return;
+
+    DIRTYROWS( TTYInfo )[nRow >> 5] |= 1UL << (nRow & 31);
+    DAMAGELEFT( TTYInfo ) = min(DAMAGELEFT( TTYInfo ), nLeft);
+    DAMAGERIGHT( TTYInfo ) = max(DAMAGERIGHT( TTYInfo ), nRight);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TTYRepaint(HWND)
+
+PURPOSE: Invalidates the screen region changed since the last repaint
+         and paints it
+
+PARAMETERS:
+    hTTY - handle to the TTY child window
+
+COMMENTS: Each run of adjacent dirty rows is invalidated with one
+          rectangle covering the damaged columns.  If the screen
+          scrolled, the whole window is invalidated.  The window is
+          updated right away, since WM_PAINT would otherwise wait
+          until the receive data stops.
+
+-----------------------------------------------------------------------------*/
+void TTYRepaint(HWND hTTY)
+{
     RECT rect;
+    int  nRow, nEndRow;
+    BOOL fDirty = FALSE;
+
+    if (TTYInfo.fRepaintTimer) {
+        KillTimer(hTTY, TIMERID);
+        TTYInfo.fRepaintTimer = FALSE;
+    }
+
+    TTYInfo.dwLastRepaint = timeGetTime();
+
+    if (SCROLLPENDING( TTYInfo )) {
+        UpdateTTYVertScroll( hTTY ) ;
+        InvalidateRect( hTTY, NULL, FALSE ) ;
+        fDirty = TRUE;
+    }
+    else if (DAMAGELEFT( TTYInfo ) < DAMAGERIGHT( TTYInfo )) {
+        rect.left = (DAMAGELEFT( TTYInfo ) * XCHAR( TTYInfo )) - XOFFSET( TTYInfo ) ;
+        rect.right = (DAMAGERIGHT( TTYInfo ) * XCHAR( TTYInfo )) - XOFFSET( TTYInfo ) ;
+
+        for (nRow = 0; nRow < MAXROWS; )
+        {
+            if (!ISROWDIRTY( TTYInfo, nRow )) {
+                nRow++;
+                continue;
+            }
+
+            for (nEndRow = nRow + 1; nEndRow < MAXROWS && ISROWDIRTY( TTYInfo, nEndRow ); nEndRow++)
+                ;
+
+            rect.top = (nRow * YCHAR( TTYInfo )) - YOFFSET( TTYInfo ) ;
+            rect.bottom = (nEndRow * YCHAR( TTYInfo )) - YOFFSET( TTYInfo ) ;
+            InvalidateRect( hTTY, &rect, FALSE ) ;
+
+            nRow = nEndRow;
+        }
+        fDirty = TRUE;
+    }
+
+    ZeroMemory(DIRTYROWS( TTYInfo ), sizeof(DIRTYROWS( TTYInfo )));
+    DAMAGELEFT( TTYInfo ) = MAXCOLS;
+    DAMAGERIGHT( TTYInfo ) = 0;
+    SCROLLPENDING( TTYInfo ) = 0;
 
-    /*
-        update screen buffer with new character
-        need to do a character by character check
-        for special characters
-    */
-    switch (c)
+    if (fDirty) {
+        gRepaintStats.dwRepaints++;
+        UpdateWindow(hTTY);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TTYScheduleRepaint(HWND)
+
+PURPOSE: Repaints now, or arms a timer for the next repaint slot
+
+PARAMETERS:
+    hTTY - handle to the TTY child window
+
+COMMENTS: Repaints are limited to REPAINTRATE per second.  If the
+          last repaint is older than one frame (input was idle) the
+          repaint is done at once, otherwise the changes are collected
+          until the timer fires.  Zero repaint rate means no limit.
+
+-----------------------------------------------------------------------------*/
+void TTYScheduleRepaint(HWND hTTY)
+{
+    DWORD dwInterval, dwElapsed;
+
+    if (REPAINTRATE( TTYInfo ) == 0) {
+        TTYRepaint(hTTY);
+        return;
+    }
+
+    dwInterval = 1000 / REPAINTRATE( TTYInfo );
+    dwElapsed = timeGetTime() - TTYInfo.dwLastRepaint;
+
+    if (dwElapsed >= dwInterval)
+        TTYRepaint(hTTY);
+    else if (!TTYInfo.fRepaintTimer) {
+        SetTimer(hTTY, TIMERID, dwInterval - dwElapsed, NULL);
+        TTYInfo.fRepaintTimer = TRUE;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TTYLineFeed(HWND)
+
+PURPOSE: Moves to the next row, scrolls the screen on the last row
+
+PARAMETERS:
+    hTTY - handle to the TTY child window
+
+COMMENTS: Scrolling rotates the screen row ring by one slot,
+          the old top row slot becomes the new, blank, bottom row.
+          The old top row goes to the scrollback history; if the
+          window shows history, the view moves up with its lines.
+
+-----------------------------------------------------------------------------*/
+void TTYLineFeed(HWND hTTY)
+{
+    if (ROW( TTYInfo )++ == MAXROWS - 1)
+    {
+        SbAddLine(SCREENROW( TTYInfo, 0 ), MAXCOLS);
+        if (YOFFSET( TTYInfo ) < 0)
+            YOFFSET( TTYInfo ) -= YCHAR( TTYInfo ) ;
+
+        SCREENTOP( TTYInfo ) = (SCREENTOP( TTYInfo ) + 1) % MAXROWS ;
+        TTYEraseCells(MAXROWS - 1, 0, MAXCOLS, ATTR_DEFCOLOR);
+        SCROLLPENDING( TTYInfo )++;
+        gRepaintStats.dwUpdates++;
+        ROW( TTYInfo )-- ;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TTYEraseCells(int, int, int, BYTE)
+
+PURPOSE: Blanks cells of one row
+
+PARAMETERS:
+    nRow   - screen row
+    nLeft  - first column
+    nRight - one past last column
+    bBg    - background color of the blanks
+
+COMMENTS: Doesn't mark the cells dirty, the caller does if needed.
+
+-----------------------------------------------------------------------------*/
+void TTYEraseCells(int nRow, int nLeft, int nRight, BYTE bBg)
+{
+    FillMemory(SCREENROW( TTYInfo, nRow ) + nLeft, nRight - nLeft, ' ');
+    FillMemory(FGROW( TTYInfo, nRow ) + nLeft, nRight - nLeft, ATTR_DEFCOLOR);
+    FillMemory(BGROW( TTYInfo, nRow ) + nLeft, nRight - nLeft, bBg);
+    FillMemory(FLAGSROW( TTYInfo, nRow ) + nLeft, nRight - nLeft, 0);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TTYPutRun(HWND, const char *, int)
+
+PURPOSE: Copies a run of printable characters to the screen buffer
+
+PARAMETERS:
+    hTTY   - handle to the TTY child window
+    lpRun  - characters to put at the cursor position
+    nCount - number of characters
+
+COMMENTS: Copies as much as fits in the current row at once,
+          then wraps (or overwrites the last column if autowrap is off).
+          The cells get the current pen attributes.
+
+-----------------------------------------------------------------------------*/
+void TTYPutRun(HWND hTTY, const char * lpRun, int nCount)
+{
+    int nCopy, nCol, nRow;
+
+    while (nCount > 0)
+    {
+        nCol = COLUMN( TTYInfo );
+        nRow = ROW( TTYInfo );
+        nCopy = min(nCount, MAXCOLS - nCol);
+        CopyMemory(SCREENROW( TTYInfo, nRow ) + nCol, lpRun, nCopy);
+        FillMemory(FGROW( TTYInfo, nRow ) + nCol, nCopy, PENFG( TTYInfo ));
+        FillMemory(BGROW( TTYInfo, nRow ) + nCol, nCopy, PENBG( TTYInfo ));
+        FillMemory(FLAGSROW( TTYInfo, nRow ) + nCol, nCopy, PENFLAGS( TTYInfo ));
+        TTYMarkDirty(nRow, nCol, nCol + nCopy);
+
+        lpRun += nCopy;
+        nCount -= nCopy;
+        COLUMN( TTYInfo ) += nCopy;
+
+        //
+        // Line wrap
+        //
+        if (COLUMN( TTYInfo ) == MAXCOLS)
+        {
+            if (AUTOWRAP( TTYInfo ))
+            {
+                COLUMN( TTYInfo ) = 0 ;
+                TTYLineFeed(hTTY) ;
+            }
+            else
+            {
+                //
+                // rest of the run lands on the last column,
+                // only the final character stays visible
+                //
+                COLUMN( TTYInfo ) = MAXCOLS - 1 ;
+                if (nCount > 0)
+                {
+                    lpRun += nCount - 1;
+                    nCount = 1;
+                }
+            }
+        }
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TTYPutHex(HWND, const BYTE *, DWORD, BOOL)
+
+PURPOSE: Shows bytes in hex, as xx or <xx>
+
+PARAMETERS:
+    hTTY      - handle to the TTY child window
+    lpBuf     - bytes to show
+    dwBufLen  - number of bytes
+    fBrackets - TRUE for <xx> (non printable), FALSE for xx (all as hex)
+
+COMMENTS: The bytes are expanded from the hex pair table into
+          a staging buffer, which goes to the screen as one run
+          per HEX_CHUNK bytes.
+
+-----------------------------------------------------------------------------*/
+void TTYPutHex(HWND hTTY, const BYTE * lpBuf, DWORD dwBufLen, BOOL fBrackets)
+{
+    char  szHex[HEX_CHUNK * 4];
+    char  *lpOut;
+    DWORD i, dwChunk;
+
+    while (dwBufLen > 0)
+    {
+        dwChunk = min(dwBufLen, HEX_CHUNK);
+        lpOut = szHex;
+
+        if (fBrackets) {
+            for (i = 0; i < dwChunk; i++) {
+                lpOut[0] = '<';
+                CopyMemory(lpOut + 1, gHexPairs + 2 * lpBuf[i], 2);
+                lpOut[3] = '>';
+                lpOut += 4;
+            }
+        }
+        else {
+            for (i = 0; i < dwChunk; i++) {
+                CopyMemory(lpOut, gHexPairs + 2 * lpBuf[i], 2);
+                lpOut += 2;
+            }
+        }
+
+        TTYPutRun(hTTY, szHex, (int) (lpOut - szHex));
+        lpBuf += dwChunk;
+        dwBufLen -= dwChunk;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TTYControl(HWND, BYTE)
+
+PURPOSE: Carries out a control character
+
+PARAMETERS:
+    hTTY - handle to the TTY child window
+    c    - control character
+
+COMMENTS: Other control characters are ignored.  HT, VT and FF
+          only get here from the ANSI parser.
+
+-----------------------------------------------------------------------------*/
+void TTYControl(HWND hTTY, BYTE c)
+{
+    switch (c)
     {
         case ASCII_BEL:                // BELL CHAR
             MessageBeep( 0 ) ;
@@ -49,6 +464,10 @@ void OutputACharToWindow(HWND hTTY, char c)
             if (COLUMN( TTYInfo ) > 0) COLUMN( TTYInfo ) -- ;
         break ;
 
+        case ASCII_HT:                 // Tab, stops every 8 columns
+            COLUMN( TTYInfo ) = min(MAXCOLS - 1, (COLUMN( TTYInfo ) + 8) & ~7) ;
+        break ;
+
         case ASCII_CR:                 // Carriage Return
             COLUMN( TTYInfo ) = 0 ;
             if (!NEWLINE( TTYInfo )) break;
@@ -58,39 +477,13 @@ void OutputACharToWindow(HWND hTTY, char c)
             //
 
         case ASCII_LF:                 // Line Feed
-            if (ROW( TTYInfo )++ == MAXROWS - 1)
-            {
-                MoveMemory( (LPSTR) (SCREEN( TTYInfo )), (LPSTR) (SCREEN( TTYInfo ) + MAXCOLS), (MAXROWS - 1) * MAXCOLS ) ;
-                FillMemory((LPSTR) (SCREEN( TTYInfo ) + (MAXROWS - 1) * MAXCOLS), MAXCOLS,  ' ' ) ;
-                InvalidateRect( hTTY, NULL, FALSE ) ;
-                ROW( TTYInfo )-- ;
-            }
+        case ASCII_VT:
+        case ASCII_FF:
+            TTYLineFeed(hTTY) ;
         break ;
-
-        default:                       // standard character
-            SCREENCHAR(TTYInfo, COLUMN(TTYInfo), ROW(TTYInfo)) = c;
-
-            rect.left = (COLUMN( TTYInfo ) * XCHAR( TTYInfo )) - XOFFSET( TTYInfo ) ;
-            rect.right = rect.left + XCHAR( TTYInfo ) ;
-            rect.top = (ROW( TTYInfo ) * YCHAR( TTYInfo )) - YOFFSET( TTYInfo ) ;
-            rect.bottom = rect.top + YCHAR( TTYInfo ) ;
-            InvalidateRect( hTTY, &rect, FALSE ) ;
-
-            //
-            // Line wrap
-            //
-            if (COLUMN( TTYInfo ) < MAXCOLS-1 ) COLUMN( TTYInfo )++ ;
-            else if (AUTOWRAP( TTYInfo ))
-            {
-                OutputACharToWindow(hTTY, '\r') ;
-                if (!NEWLINE( TTYInfo )) OutputACharToWindow(hTTY, '\n') ;
-            }
-        break;
     }
+}
 
-    MoveTTYCursor(hTTY);
-}
-
 
 /*-----------------------------------------------------------------------------
 
@@ -103,6 +496,12 @@ PARAMETERS:
     lpBuf    - address of data buffer
     dwBufLen - size of data buffer
 
+COMMENTS: Runs of ordinary characters are copied to the screen
+          buffer in one go, only special bytes are handled one by one.
+          With ANSI on, escape sequences are handed to the VT100 parser.
+          Changed cells are only marked dirty, the repaint is scheduled
+          once per buffer and the caret is moved once per buffer.
+
 HISTORY:   Date       Author      Comment
             5/ 8/91   BryanW      Wrote it
            10/27/95   AllenD      Modified for MTTTY Sample
@@ -110,75 +509,46 @@ HISTORY:   Date       Author      Comment
 -----------------------------------------------------------------------------*/
 void OutputABufferToWindow(HWND hTTY, char * lpBuf, DWORD dwBufLen)
 {
-    /*
-        update screen buffer with new buffer
-        need to do a character by character check
-        for special characters
-    */
-    int i;
-    char hexbuff[8];
-
-    for ( i = 0 ; i < (int) dwBufLen; i++)
-    {
-        if(DISPLAYHEX( TTYInfo ))
-        {
-            sprintf(hexbuff, "%02x", lpBuf[ i ]);
-
-            OutputACharToWindow(hTTY, hexbuff[0]) ;
-            OutputACharToWindow(hTTY, hexbuff[1]) ;
-        }
-        else if(NONPRINTHEX( TTYInfo ))
-        {
-            unsigned c = lpBuf[ i ];
-            if(c < ' ' || c > '~')
-            {
-                sprintf(hexbuff, "<%02x>", lpBuf[ i ]);
-
-                OutputACharToWindow(hTTY, hexbuff[0]) ;
-                OutputACharToWindow(hTTY, hexbuff[1]) ;
-                OutputACharToWindow(hTTY, hexbuff[2]) ;
-                OutputACharToWindow(hTTY, hexbuff[3]) ;
-            }
-            else OutputACharToWindow(hTTY, c ) ;
-        }
-        else OutputACharToWindow(hTTY, lpBuf[ i ] ) ;
-    }
-}
-
-/*-----------------------------------------------------------------------------
-
-FUNCTION: OutputABufferToFile(HANDLE, char *, DWORD)
-
-PURPOSE: Output a rec'd buffer to a file
-
-PARAMETERS:
-    hFile    - handle of file save data into
-    lpBuf    - address of data buffer
-    dwBufLen - size of data buffer
-
-HISTORY:   Date:      Author:     Comment:
-           10/27/95   AllenD      Wrote it
-
------------------------------------------------------------------------------*/
-void OutputABufferToFile(HANDLE hFile, char * lpBuf, DWORD dwBufLen)
-{
-    DWORD dwWritten;
-
-    //
-    // place buffer into file, report any errors
-    //
-    if (!WriteFile(hFile, lpBuf, dwBufLen, &dwWritten, NULL))
-        ErrorReporter("WriteFile in file capture");
+    DWORD i, dwRun;
+    BOOL  fNonPrint;
+
+    if (DISPLAYHEX( TTYInfo ))
+        TTYPutHex(hTTY, (BYTE *) lpBuf, dwBufLen, FALSE);
+    else if (ANSI( TTYInfo ))
+        VtParse(hTTY, (BYTE *) lpBuf, dwBufLen);
+    else
+    {
+        fNonPrint = NONPRINTHEX( TTYInfo );
 
-    if (dwBufLen != dwWritten)
-        ErrorReporter("WriteFile");
+        for ( i = 0 ; i < dwBufLen; )
+        {
+            dwRun = TTYScanSpecial((BYTE *) lpBuf + i, dwBufLen - i,
+                                   fNonPrint ? SCAN_NONPRINT : SCAN_CONTROL);
+            if (dwRun)
+            {
+                TTYPutRun(hTTY, lpBuf + i, (int) dwRun);
+                i += dwRun;
+                if (i == dwBufLen)
+                    break;
+            }
 
-    //
-    // update transfer progress bar
-    //
-    PostMessage(GetDlgItem(ghWndStatusDlg, IDC_TRANSFERPROGRESS), PBM_STEPIT, 0, 0);
+            if (fNonPrint)
+            {
+                //
+                // non printable bytes often come in runs, show them at once
+                //
+                for (dwRun = 1; i + dwRun < dwBufLen && ISNONPRINT((BYTE) lpBuf[i + dwRun]); dwRun++)
+                    ;
+                TTYPutHex(hTTY, (BYTE *) lpBuf + i, dwRun, TRUE);
+                i += dwRun;
+            }
+            else
+                TTYControl(hTTY, (BYTE) lpBuf[ i++ ]);
+        }
+    }
 
-    return;
+    TTYScheduleRepaint(hTTY);
+    MoveTTYCursor(hTTY);
 }
 
 /*-----------------------------------------------------------------------------
@@ -208,11 +578,18 @@ void OutputABuffer(HWND hTTY, char * lpBuf, DWORD dwBufLen)
     switch(gdwReceiveState)
     {
         case RECEIVE_TTY:
-            OutputABufferToWindow(hTTY, lpBuf, dwBufLen);
+            //
+            // screen update is done by the tty window thread,
+            // here the data is only queued so the read can be reissued
+            //
+            RxRingWrite(hTTY, lpBuf, dwBufLen);
             break;
 
         case RECEIVE_CAPTURED:
-            OutputABufferToFile(ghFileCapture, lpBuf, dwBufLen);
+            //
+            // copied to the capture buffers, written by the sink thread
+            //
+            CapSinkWrite(lpBuf, dwBufLen);
             break;
 
         default:
@@ -115,7 +115,7 @@ DWORD WINAPI ReaderAndStatusProc(LPVOID lpV)
             }
             else {    // read completed immediately
                 if ((dwRead != MAX_READ_BUFFER) && SHOWTIMEOUTS(TTYInfo))
-                    UpdateStatus("Read timed out immediately.\r\n");
+                    StatusLog(STATUSLOG_READIMMEDIATE, 0, 0);
 
                 if (dwRead)
                     OutputABuffer(hTTY, lpBuf, dwRead);
@@ -177,7 +177,7 @@ DWORD WINAPI ReaderAndStatusProc(LPVOID lpV)
                     }
                     else {      // read completed successfully
                         if ((dwRead != MAX_READ_BUFFER) && SHOWTIMEOUTS(TTYInfo))
-                            UpdateStatus("Read timed out overlapped.\r\n");
+                            StatusLog(STATUSLOG_READOVERLAPPED, 0, 0);
 
                         if (dwRead)
                             OutputABuffer(hTTY, lpBuf, dwRead);
@@ -232,6 +232,11 @@ DWORD WINAPI ReaderAndStatusProc(LPVOID lpV)
                                                     //   a comm status check
                     }
 
+                    //
+                    // repeats of a message still being counted are shown
+                    //
+                    StatusMessage();
+
                     break;
 
                 default:
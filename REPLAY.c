@@ -0,0 +1,455 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: Replay.c
+
+    PURPOSE: Replays a timestamped capture (.MTC).
+
+             The data received in the capture (CAPREC_RX records) is
+             replayed by a replay thread.  Not connected, it goes to
+             the tty window through OutputABuffer, the entry point of
+             the reader thread, so the receive ring, the VT100 parser
+             and the repaints see it as if it came from the port;
+             with the reader stopped the replay thread is the ring's
+             only producer.  Connected, it is sent out the port
+             through the writer, waiting on the write queue
+             watermarks like a paste.
+
+             REPLAYSPEED sets the timing, in percent of the original:
+             100 keeps the gaps between records, 200 halves them, 0
+             replays as fast as the receiver takes the data.  Into
+             the tty window, the thread waits for room in the receive
+             ring instead of letting it drop data.
+
+             The replay reports the bytes per second achieved, how
+             late records went out against their schedule and, into
+             the tty window, the render lag: the time from handing
+             data to OutputABuffer until the tty window has taken it
+             from the ring.
+
+    FUNCTIONS:
+        CmdReplay        - starts, or stops, a replay
+        ReplayStop       - stops a replay and waits for the thread
+        ReplayGetStats   - replay statistics
+        ReplayThreadProc - replays the records
+        ReplayWait       - waits until a record is due
+        ReplayToTTY      - hands a record to OutputABuffer
+        ReplayToPort     - queues a record to the writer
+        ReplayLag        - takes a render lag sample
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "MTTTY.h"
+
+#define REPLAY_SPIN_US  2000            // wait the last part of a gap spinning
+
+//
+// Prototypes for functions called only within this file
+//
+DWORD WINAPI ReplayThreadProc( LPVOID );
+BOOL ReplayWait( ULONGLONG );
+BOOL ReplayToTTY( const BYTE *, DWORD );
+BOOL ReplayToPort( const BYTE *, DWORD );
+void ReplayLag( void );
+
+static struct
+{
+    HANDLE    hThread;
+    HANDLE    hStopEvent;           // manual reset, ends the replay
+    CAPREADER Cap;
+    BOOL      fPort;                // out the port, else into the tty
+    DWORD     dwSpeed;              // REPLAYSPEED when started
+    DWORD     dwConsumed;           // ring bytes taken before the replay
+    BOOL      fMark;                // a lag sample is waiting
+    DWORD     dwMark;               // replay bytes the tty must take
+    ULONGLONG ullMark;              // when they were handed over, us
+    ULONGLONG ullLagTotal;
+    DWORD     dwLagSamples;
+    REPLAYSTATS Stats;
+} gReplay;
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CmdReplay(HWND)
+
+PURPOSE: Replays a timestamped capture
+
+PARAMETERS:
+    hwnd - main window, owner of the file dialog
+
+COMMENTS: Choosing replay while a replay runs stops it.
+
+-----------------------------------------------------------------------------*/
+void CmdReplay(HWND hwnd)
+{
+    const char * szFilter = "Timestamped Captures\0*.MTC\0";
+    char szFile[MAX_PATH];
+    OPENFILENAME ofn;
+
+    if (gReplay.hThread) {
+        if (WaitForSingleObject(gReplay.hThread, 0) == WAIT_TIMEOUT) {
+            ReplayStop();
+            return;
+        }
+        ReplayStop();           // finished, clean up
+    }
+
+    szFile[0] = 0;
+    memset(&ofn, 0, sizeof(OPENFILENAME));
+    ofn.lStructSize = sizeof(OPENFILENAME);
+    ofn.hwndOwner = hwnd;
+    ofn.lpstrFilter = szFilter;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = MAX_PATH;
+    ofn.lpstrTitle = "Replay Capture";
+    ofn.Flags = OFN_FILEMUSTEXIST;
+
+    if (!GetOpenFileName(&ofn))
+        return;
+
+    if (!CapReadOpen(szFile, &gReplay.Cap)) {
+        MessageBox(hwnd, "Not a timestamped capture.", szFile, MB_OK | MB_ICONEXCLAMATION);
+        return;
+    }
+
+    gReplay.fPort = CONNECTED(TTYInfo);
+    gReplay.dwSpeed = REPLAYSPEED(TTYInfo);
+    ZeroMemory(&gReplay.Stats, sizeof(gReplay.Stats));
+
+    gReplay.hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (gReplay.hStopEvent == NULL) {
+        ErrorReporter("CreateEvent (replay stop event)");
+        ReplayStop();
+        return;
+    }
+
+    gReplay.hThread = CreateThread(NULL, 0, ReplayThreadProc, NULL, 0, NULL);
+    if (gReplay.hThread == NULL) {
+        ErrorReporter("CreateThread (replay thread)");
+        ReplayStop();
+    }
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ReplayStop
+
+PURPOSE: Stops a replay and frees its resources
+
+COMMENTS: Called before the writer thread is stopped, and before the
+          reader thread is started: a replay into the tty window must
+          not run beside the reader, the receive ring has room for
+          one producer only.
+
+-----------------------------------------------------------------------------*/
+void ReplayStop()
+{
+    if (gReplay.hThread) {
+        SetEvent(gReplay.hStopEvent);
+        WaitForSingleObject(gReplay.hThread, INFINITE);
+        CloseHandle(gReplay.hThread);
+        gReplay.hThread = NULL;
+    }
+
+    if (gReplay.Cap.hFile)
+        CapReadClose(&gReplay.Cap);
+
+    if (gReplay.hStopEvent) {
+        CloseHandle(gReplay.hStopEvent);
+        gReplay.hStopEvent = NULL;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ReplayGetStats(REPLAYSTATS *)
+
+PURPOSE: Returns the statistics of the running or last replay
+
+PARAMETERS:
+    pStats - structure to fill in
+
+-----------------------------------------------------------------------------*/
+void ReplayGetStats(REPLAYSTATS * pStats)
+{
+    *pStats = gReplay.Stats;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ReplayThreadProc(LPVOID)
+
+PURPOSE: Replays the received data of the capture
+
+COMMENTS: Records are due at their capture time from the first
+          record, scaled by the replay speed.  Into the tty window,
+          the replay ends when the tty window has taken all the data,
+          so the rate includes rendering it.  Reports the result in
+          the status window.
+
+-----------------------------------------------------------------------------*/
+DWORD WINAPI ReplayThreadProc(LPVOID lpV)
+{
+    CAPRECORD Rec;
+    RXRINGSTATS Ring;
+    ULONGLONG ullStart, ullFirst = 0, ullElapsed;
+    BOOL fFirst = TRUE;
+    BOOL fDone = TRUE;
+    char szMessage[128];
+
+    timeBeginPeriod(1);
+
+    RxRingGetStats(&Ring);
+    gReplay.dwConsumed = Ring.dwReceived - Ring.dwUsed;
+    gReplay.fMark = FALSE;
+    gReplay.ullLagTotal = 0;
+    gReplay.dwLagSamples = 0;
+
+    ullStart = MetricsMicroseconds();
+
+    while (CapReadNext(&gReplay.Cap, &Rec)) {
+        if (Rec.dwType != CAPREC_RX || Rec.dwLength == 0)
+            continue;
+
+        if (fFirst) {
+            ullFirst = Rec.ullTime;
+            fFirst = FALSE;
+        }
+
+        if (gReplay.dwSpeed &&
+            !ReplayWait(ullStart + (Rec.ullTime - ullFirst) * 100 / gReplay.dwSpeed)) {
+            fDone = FALSE;
+            break;
+        }
+
+        if (!(gReplay.fPort ? ReplayToPort(Rec.lpData, Rec.dwLength) :
+                              ReplayToTTY(Rec.lpData, Rec.dwLength))) {
+            fDone = FALSE;
+            break;
+        }
+
+        gReplay.Stats.dwRecords++;
+    }
+
+    //
+    // wait for the tty window to take the rest
+    //
+    while (!gReplay.fPort && fDone) {
+        ReplayLag();
+        RxRingGetStats(&Ring);
+        if (Ring.dwReceived - Ring.dwUsed - gReplay.dwConsumed >= gReplay.Stats.dwBytes)
+            break;
+        if (WaitForSingleObject(gReplay.hStopEvent, 1) != WAIT_TIMEOUT)
+            break;
+    }
+
+    ullElapsed = MetricsMicroseconds() - ullStart;
+    if (ullElapsed)
+        gReplay.Stats.dwRate = (DWORD) (gReplay.Stats.dwBytes * (ULONGLONG) 1000000 / ullElapsed);
+
+    timeEndPeriod(1);
+
+    wsprintf(szMessage, "Replayed %lu bytes %s in %lu ms, %lu B/s",
+             gReplay.Stats.dwBytes, gReplay.fPort ? "to the port" : "to the tty",
+             (DWORD) (ullElapsed / 1000), gReplay.Stats.dwRate);
+    if (!gReplay.fPort)
+        wsprintf(szMessage + lstrlen(szMessage), ", lag avg %lu max %lu us",
+                 gReplay.Stats.dwLagAvg, gReplay.Stats.dwLagMax);
+    lstrcat(szMessage, fDone ? "\r\n" : ", stopped\r\n");
+    UpdateStatus(szMessage);
+
+    // return cached packets to the write request pool
+    WrPoolThreadExit();
+
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ReplayWait(ULONGLONG)
+
+PURPOSE: Waits until a record is due
+
+PARAMETERS:
+    ullDue - performance counter time, us
+
+RETURN: FALSE if the replay was stopped
+
+COMMENTS: Sleeps on the stop event until REPLAY_SPIN_US before the
+          time and spins the rest, a sleep alone is only good to a
+          millisecond or so.  Records already late go at once, their
+          lateness is counted.
+
+-----------------------------------------------------------------------------*/
+BOOL ReplayWait(ULONGLONG ullDue)
+{
+    ULONGLONG ullNow = MetricsMicroseconds();
+    DWORD dwLate;
+
+    if (ullNow >= ullDue) {
+        dwLate = (DWORD) min(ullNow - ullDue, MAXDWORD);
+        gReplay.Stats.dwLateMax = max(gReplay.Stats.dwLateMax, dwLate);
+        return WaitForSingleObject(gReplay.hStopEvent, 0) == WAIT_TIMEOUT;
+    }
+
+    if (ullDue - ullNow > REPLAY_SPIN_US) {
+        if (WaitForSingleObject(gReplay.hStopEvent,
+                (DWORD) ((ullDue - ullNow - REPLAY_SPIN_US) / 1000)) != WAIT_TIMEOUT)
+            return FALSE;
+    }
+
+    while (MetricsMicroseconds() < ullDue) {
+        if (!gReplay.fPort)
+            ReplayLag();
+    }
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ReplayToTTY(const BYTE *, DWORD)
+
+PURPOSE: Hands a record to OutputABuffer, as the reader thread would
+
+PARAMETERS:
+    lpData - record data
+    dwLen  - its length
+
+RETURN: FALSE if the replay was stopped
+
+COMMENTS: Only as much as the receive ring has room for is handed
+          over at a time; the thread waits for the tty window to
+          make room.
+
+-----------------------------------------------------------------------------*/
+BOOL ReplayToTTY(const BYTE * lpData, DWORD dwLen)
+{
+    RXRINGSTATS Ring;
+    DWORD dwChunk;
+
+    while (dwLen) {
+        ReplayLag();
+
+        RxRingGetStats(&Ring);
+        dwChunk = min(dwLen, Ring.dwSize - Ring.dwUsed);
+        if (dwChunk == 0) {
+            if (WaitForSingleObject(gReplay.hStopEvent, 1) != WAIT_TIMEOUT)
+                return FALSE;
+            continue;
+        }
+
+        OutputABuffer(ghWndTTY, (char *) lpData, dwChunk);
+
+        lpData += dwChunk;
+        dwLen -= dwChunk;
+        gReplay.Stats.dwBytes += dwChunk;
+
+        if (!gReplay.fMark) {
+            gReplay.dwMark = gReplay.Stats.dwBytes;
+            gReplay.ullMark = MetricsMicroseconds();
+            gReplay.fMark = TRUE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ReplayToPort(const BYTE *, DWORD)
+
+PURPOSE: Queues a record to the writer
+
+PARAMETERS:
+    lpData - record data
+    dwLen  - its length
+
+RETURN: FALSE if the replay was stopped or the request failed
+
+COMMENTS: Each request has its own copy of the data on the process
+          heap, like a paste.
+
+-----------------------------------------------------------------------------*/
+BOOL ReplayToPort(const BYTE * lpData, DWORD dwLen)
+{
+    HANDLE hWait[2];
+    DWORD dwChunk;
+    char * lpBuf;
+
+    hWait[0] = gReplay.hStopEvent;
+    hWait[1] = ghWriterRoomEvent;
+
+    while (dwLen) {
+        dwChunk = min(dwLen, WRITE_SLOT_SIZE);
+
+        //
+        // wait below the write queue watermarks
+        //
+        if (WaitForMultipleObjects(2, hWait, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+            return FALSE;
+
+        lpBuf = (char *) HeapAlloc(GetProcessHeap(), 0, dwChunk);
+        if (lpBuf == NULL) {
+            ErrorReporter("HeapAlloc (replay block)");
+            return FALSE;
+        }
+        CopyMemory(lpBuf, lpData, dwChunk);
+
+        if (!WriterAddNewNode(WRITE_BLOCK, dwChunk, 0, lpBuf, GetProcessHeap(), NULL)) {
+            HeapFree(GetProcessHeap(), 0, lpBuf);
+            return FALSE;
+        }
+
+        lpData += dwChunk;
+        dwLen -= dwChunk;
+        gReplay.Stats.dwBytes += dwChunk;
+    }
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ReplayLag
+
+PURPOSE: Takes a render lag sample once the tty window has caught up
+         with the mark
+
+COMMENTS: The mark is the replay byte count after some data was
+          handed over, and when; the tty window has taken it when the
+          ring's consumed count (received less waiting) passes it.
+          One sample is pending at a time, the next mark is set by
+          the next hand over.
+
+-----------------------------------------------------------------------------*/
+void ReplayLag()
+{
+    RXRINGSTATS Ring;
+    DWORD dwLag;
+
+    if (!gReplay.fMark)
+        return;
+
+    RxRingGetStats(&Ring);
+    if (Ring.dwReceived - Ring.dwUsed - gReplay.dwConsumed < gReplay.dwMark)
+        return;
+
+    dwLag = (DWORD) (MetricsMicroseconds() - gReplay.ullMark);
+    gReplay.fMark = FALSE;
+
+    gReplay.ullLagTotal += dwLag;
+    gReplay.dwLagSamples++;
+    gReplay.Stats.dwLagAvg = (DWORD) (gReplay.ullLagTotal / gReplay.dwLagSamples);
+    gReplay.Stats.dwLagMax = max(gReplay.Stats.dwLagMax, dwLag);
+}
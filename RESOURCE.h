@@ -19,6 +19,8 @@
 // Mario Ivani, 2018
 #define IDD_SETMACROS                   112
 #define IDD_HELP                        113
+#define IDD_OPTIONSDLG                  114
+#define IDD_FINDDLG                     115
 // End MArio
 #define IDC_PORTCOMBO                   1000
 #define IDC_BAUDCOMBO                   1001
@@ -143,6 +145,29 @@
 #define IDC_ALLASHEXCHK                 1129
 #define IDC_HELPTEXT                    1130
 // End Mario
+#define IDC_STATSEDIT                   1131
+#define IDC_OPTIONSBTN                  1132
+#define IDC_REPAINTRATEEDIT             1133
+#define IDC_HISTORYMBEDIT               1134
+#define IDC_FINDEDIT                    1135
+#define IDC_FINDCASECHK                 1136
+#define IDC_FINDPREVBTN                 1137
+#define IDC_ANSICHK                     1138
+#define IDC_TXHIGHEDIT                  1139
+#define IDC_TXLOWEDIT                   1140
+#define IDC_COALESCEMSEDIT              1141
+#define IDC_COALESCEBYTESEDIT           1142
+#define IDC_PASTEDELAYEDIT              1143
+#define IDC_PACERATEEDIT                1144
+#define IDC_PACEGAPEDIT                 1145
+#define IDC_PACELINEEDIT                1146
+#define IDC_READAHEADEDIT               1147
+#define IDC_THROUGHPUTGRAPH             1148
+#define IDC_REPLAYSPEEDEDIT             1149
+#define IDC_ROTATEMBEDIT                1150
+#define IDC_ROTATEMINEDIT               1151
+#define IDC_ROTATEBUDGETEDIT            1152
+#define IDC_ROTATECOMPRESSCHK           1153
 
 #define ID_FILE_EXIT                    40001
 #define ID_HELP_ABOUTMTTTY              40002
@@ -155,6 +180,12 @@
 #define ID_TRANSFER_ABORTSENDING        40016
 #define ID_TRANSFER_ABORTREPEATEDSENDING 40018
 #define ID_HELP_HELP                    40019
+#define ID_TTY_FIND                     40021
+#define ID_TTY_FINDNEXT                 40022
+#define ID_TTY_FINDPREV                 40023
+#define ID_TTY_HEXVIEW                  40024
+#define ID_TTY_PASTE                    40025
+#define ID_TRANSFER_REPLAY              40026
 #define IDC_STATIC                      65535
 
 // Next default values for new objects
@@ -0,0 +1,205 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: RxRing.c
+
+    PURPOSE: Byte ring between the reader thread and the TTY window.
+
+             The reader thread (ReaderAndStatusProc) is the only producer,
+             it copies received data into the ring and goes straight back
+             to ReadFile.  The TTY window thread is the only consumer, it
+             drains the ring into the screen buffer when it gets the
+             WM_TTYRXDATA message.  Head and tail are free running counters
+             that live on separate cache lines, so the two threads never
+             write to the same line and no lock is needed.
+
+    FUNCTIONS:
+        RxRingClearStats - clears ring statistics
+        RxRingWrite      - copies received data into the ring (reader thread)
+        RxRingDrain      - moves ring data to the TTY window (UI thread)
+        RxRingGetStats   - returns current ring statistics
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "MTTTY.h"
+
+#define CACHE_LINE          64
+
+//
+// max bytes drained per WM_TTYRXDATA, so that input
+// and other messages get a chance during a data flood
+//
+#define RX_DRAIN_CHUNK      0x4000
+
+#if (RX_RING_SIZE & (RX_RING_SIZE - 1))
+#error RX_RING_SIZE must be a power of two
+#endif
+
+static struct
+{
+    DWORD volatile dwHead;          // written only by the reader thread
+    char  pad1[CACHE_LINE - sizeof(DWORD)];
+    DWORD volatile dwTail;          // written only by the UI thread
+    char  pad2[CACHE_LINE - sizeof(DWORD)];
+    LONG  volatile lNotified;       // WM_TTYRXDATA is in the message queue
+    DWORD dwHighWater;              // statistics, written by reader thread
+    DWORD dwDropped;
+    DWORD dwReceived;
+} gRxRing;
+
+static BYTE gRxData[RX_RING_SIZE];
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: RxRingClearStats
+
+PURPOSE: Clears high water mark and byte counters
+
+COMMENTS: Called before the reader thread is started
+
+-----------------------------------------------------------------------------*/
+void RxRingClearStats()
+{
+    gRxRing.dwHighWater = 0;
+    gRxRing.dwDropped = 0;
+    gRxRing.dwReceived = 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: RxRingWrite(HWND, char *, DWORD)
+
+PURPOSE: Copies received bytes into the ring and wakes up the TTY window
+
+PARAMETERS:
+    hTTY     - handle to the TTY child window
+    lpBuf    - address of data buffer
+    dwBufLen - size of data buffer
+
+COMMENTS: Called only from the reader thread.  If the ring is full
+          the bytes that don't fit are dropped and counted.
+
+-----------------------------------------------------------------------------*/
+void RxRingWrite(HWND hTTY, char * lpBuf, DWORD dwBufLen)
+{
+    DWORD dwHead, dwTail, dwFree, dwOffset, dwFirst, dwUsed;
+
+    dwHead = gRxRing.dwHead;
+    dwTail = gRxRing.dwTail;
+    MemoryBarrier();                // don't overwrite data before tail is seen
+
+    dwFree = RX_RING_SIZE - (dwHead - dwTail);
+    if (dwBufLen > dwFree) {
+        gRxRing.dwDropped += dwBufLen - dwFree;
+        dwBufLen = dwFree;
+    }
+
+    if (dwBufLen) {
+        dwOffset = dwHead & (RX_RING_SIZE - 1);
+        dwFirst = min(dwBufLen, RX_RING_SIZE - dwOffset);
+        CopyMemory(gRxData + dwOffset, lpBuf, dwFirst);
+        if (dwFirst < dwBufLen)
+            CopyMemory(gRxData, lpBuf + dwFirst, dwBufLen - dwFirst);
+
+        //
+        // publish new head, data is visible to the consumer after this
+        //
+        InterlockedExchange((LONG volatile *) &gRxRing.dwHead, (LONG) (dwHead + dwBufLen));
+        gRxRing.dwReceived += dwBufLen;
+
+        dwUsed = dwHead + dwBufLen - dwTail;
+        if (dwUsed > gRxRing.dwHighWater)
+            gRxRing.dwHighWater = dwUsed;
+    }
+
+    //
+    // post only one notification until the consumer picks it up
+    //
+    if (InterlockedExchange(&gRxRing.lNotified, TRUE) == FALSE)
+        PostMessage(hTTY, WM_TTYRXDATA, 0, 0);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: RxRingDrain(HWND)
+
+PURPOSE: Moves data from the ring into the TTY screen buffer
+
+PARAMETERS:
+    hTTY - handle to the TTY child window
+
+COMMENTS: Called from TTYChildProc on WM_TTYRXDATA.  At most
+          RX_DRAIN_CHUNK bytes are handled per call; if more is
+          waiting, another WM_TTYRXDATA is posted.
+
+-----------------------------------------------------------------------------*/
+void RxRingDrain(HWND hTTY)
+{
+    DWORD dwHead, dwTail, dwOffset, dwLen, dwBudget;
+
+    //
+    // clear the flag before looking at head, so that
+    // any later write posts a new message
+    //
+    InterlockedExchange(&gRxRing.lNotified, FALSE);
+
+    dwHead = gRxRing.dwHead;
+    MemoryBarrier();                // read head before the data it covers
+    dwTail = gRxRing.dwTail;
+    dwBudget = RX_DRAIN_CHUNK;
+
+    while (dwTail != dwHead && dwBudget) {
+        dwOffset = dwTail & (RX_RING_SIZE - 1);
+        dwLen = min(dwHead - dwTail, RX_RING_SIZE - dwOffset);
+        dwLen = min(dwLen, dwBudget);
+
+        HexLogWrite(gRxData + dwOffset, dwLen);
+        OutputABufferToWindow(hTTY, (char *) gRxData + dwOffset, dwLen);
+
+        dwTail += dwLen;
+        dwBudget -= dwLen;
+
+        //
+        // give the space back to the reader thread
+        //
+        InterlockedExchange((LONG volatile *) &gRxRing.dwTail, (LONG) dwTail);
+    }
+
+    HexViewUpdate();
+
+    if (dwTail != dwHead)
+        if (InterlockedExchange(&gRxRing.lNotified, TRUE) == FALSE)
+            PostMessage(hTTY, WM_TTYRXDATA, 0, 0);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: RxRingGetStats(RXRINGSTATS *)
+
+PURPOSE: Returns ring occupancy and counters for the status dialog
+
+PARAMETERS:
+    pStats - structure to fill in
+
+-----------------------------------------------------------------------------*/
+void RxRingGetStats(RXRINGSTATS * pStats)
+{
+    DWORD dwHead = gRxRing.dwHead;
+    DWORD dwTail = gRxRing.dwTail;
+
+    pStats->dwSize      = RX_RING_SIZE;
+    pStats->dwUsed      = dwHead - dwTail;
+    pStats->dwHighWater = gRxRing.dwHighWater;
+    pStats->dwDropped   = gRxRing.dwDropped;
+    pStats->dwReceived  = gRxRing.dwReceived;
+
+    return;
+}
@@ -0,0 +1,607 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: ScrollBk.c
+
+    PURPOSE: Scrollback history of lines scrolled off the top of the
+             tty screen.
+
+             New lines go into an open (hot) block that is kept as is.
+             When it holds SB_BLOCK_LINES lines it is sealed: compressed
+             with LzCompress and added to the block index, a ring of
+             block descriptors, oldest first.  Since every
+             sealed block holds the same number of lines, the block of a
+             line is found by division, and reading a line decompresses
+             at most one block (the last one is cached).  When sealed
+             blocks take more memory than the budget, the oldest ones
+             are dropped.  If memory runs out while sealing, older
+             blocks are dropped to make room rather than the hot block.
+
+             A block, hot or unpacked, starts with a table of
+             SB_BLOCK_LINES + 1 WORD offsets of each line's text,
+             followed by the text with trailing blanks removed.
+
+             Each sealed block also has a bloom filter of the
+             (case folded) trigrams in its text, so a search can skip
+             blocks that can't hold the searched text without
+             unpacking them.
+
+             Only the tty window thread adds lines, so it reads the
+             history without locking.  The search thread reads blocks
+             with SbReadBlock, which holds the history lock, and the
+             tty window thread holds it while changing the history.
+    FUNCTIONS:
+        SbCreate        - creates history heap
+        SbDestroy       - frees history heap
+        SbClear         - forgets all history
+        SbSetBudget     - sets memory limit of sealed blocks
+        SbAddLine       - appends a line to the history
+        SbGetLineCount  - number of lines in history
+        SbGetLine       - reads one line from history
+        SbGetFirstLine  - absolute number of oldest line
+        SbBlockLine     - finds a line in an unpacked block
+        SbTrigramBits   - bloom filter bits of a text
+        SbReadBlock     - unpacks a block for searching
+        SbGetStats      - history statistics
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "MTTTY.h"
+
+#define SB_BLOOM_SIZE       (SB_BLOOM_BITS / 8)
+#define SB_BLOOMBIT1(h)     ((h) >> (32 - 13))
+#define SB_BLOOMBIT2(h)     (((h) >> 3) & (SB_BLOOM_BITS - 1))
+#define SB_TRIGRAMHASH(p)   ((DWORD) (((ASCII_FOLD((p)[0]) << 16) | \
+                                       (ASCII_FOLD((p)[1]) << 8) | \
+                                        ASCII_FOLD((p)[2])) * 2654435761U))
+
+#if (SB_BLOOM_BITS != (1 << 13))
+#error SB_BLOOMBIT1 assumes 8192 bloom bits
+#endif
+
+#define SB_BLOCK(n)         (&gSb.pBlocks[(gSb.dwFirst + (n)) & (gSb.dwMaxBlocks - 1)])
+
+typedef struct SBBLOCK
+{
+    BYTE *  lpData;             // bloom filter, then compressed block
+    DWORD   dwSize;             // compressed size
+    DWORD   dwRawSize;          // uncompressed size
+} SBBLOCK;
+
+/*
+    Prototypes for functions called only within this file
+*/
+BOOL SbSealBlock( void );
+void SbDropOldest( void );
+BYTE * SbGetBlock( DWORD );
+void SbBloomAdd( BYTE *, const BYTE *, int );
+
+static struct
+{
+    CRITICAL_SECTION csLock;    // see module comment
+    HANDLE    hHeap;
+    SBBLOCK * pBlocks;          // ring of sealed blocks, see SB_BLOCK
+    DWORD     dwFirst;          // ring index of the oldest block
+    DWORD     dwBlocks;         // number of sealed blocks
+    DWORD     dwMaxBlocks;      // ring size, a power of two
+    DWORD     dwDropped;        // blocks dropped since last clear
+    DWORD     dwBytes;          // memory used by sealed blocks
+    DWORD     dwRawBytes;       // same blocks, uncompressed
+    DWORD     dwBudget;         // limit for dwBytes
+    DWORD     dwHotLines;       // lines in the hot block
+    DWORD     dwCacheBlock;     // block number in Cache, SB_NOBLOCK if none
+    DWORD     dwHot[(SB_RAW_SIZE + 3) / sizeof(DWORD)];
+    DWORD     dwCache[(SB_RAW_SIZE + 3) / sizeof(DWORD)];
+    BYTE      Work[LZ_BOUND(SB_RAW_SIZE)];
+} gSb;
+
+#define SB_NOBLOCK          0xFFFFFFFF
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbCreate
+
+PURPOSE: Creates the history heap
+
+COMMENTS: Partner to SbDestroy
+
+-----------------------------------------------------------------------------*/
+void SbCreate()
+{
+    InitializeCriticalSection(&gSb.csLock);
+
+    gSb.hHeap = HeapCreate(0, 0x10000, 0);
+    if (gSb.hHeap == NULL)
+        ErrorReporter("HeapCreate (History)");
+
+    gSb.dwBudget = HISTORYMB_DEFAULT * 0x100000;
+    SbClear();
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbDestroy
+
+PURPOSE: Frees all history memory
+
+-----------------------------------------------------------------------------*/
+void SbDestroy()
+{
+    if (gSb.hHeap)
+        HeapDestroy(gSb.hHeap);
+
+    gSb.hHeap = NULL;
+    gSb.pBlocks = NULL;
+    gSb.dwFirst = gSb.dwBlocks = gSb.dwMaxBlocks = 0;
+
+    DeleteCriticalSection(&gSb.csLock);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbClear
+
+PURPOSE: Forgets all history lines
+
+-----------------------------------------------------------------------------*/
+void SbClear()
+{
+    EnterCriticalSection(&gSb.csLock);
+
+    while (gSb.dwBlocks)
+        SbDropOldest();
+
+    gSb.dwFirst = 0;
+    gSb.dwDropped = 0;
+    gSb.dwBytes = 0;
+    gSb.dwRawBytes = 0;
+    gSb.dwHotLines = 0;
+    gSb.dwCacheBlock = SB_NOBLOCK;
+    ((WORD *) gSb.dwHot)[0] = 0;
+
+    LeaveCriticalSection(&gSb.csLock);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbSetBudget(DWORD)
+
+PURPOSE: Sets the memory limit for sealed history blocks
+
+PARAMETERS:
+    dwBytes - limit in bytes
+
+COMMENTS: Oldest blocks are dropped right away if history is
+          already over the new limit.
+
+-----------------------------------------------------------------------------*/
+void SbSetBudget(DWORD dwBytes)
+{
+    EnterCriticalSection(&gSb.csLock);
+
+    gSb.dwBudget = dwBytes;
+
+    while (gSb.dwBlocks && gSb.dwBytes > gSb.dwBudget)
+        SbDropOldest();
+
+    LeaveCriticalSection(&gSb.csLock);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbDropOldest
+
+PURPOSE: Frees the oldest sealed block
+
+COMMENTS: Only the ring start moves, the index isn't copied.
+
+-----------------------------------------------------------------------------*/
+void SbDropOldest()
+{
+    SBBLOCK * pBlock = SB_BLOCK(0);
+
+    gSb.dwBytes -= SB_BLOOM_SIZE + pBlock->dwSize + sizeof(SBBLOCK);
+    gSb.dwRawBytes -= pBlock->dwRawSize;
+    HeapFree(gSb.hHeap, 0, pBlock->lpData);
+
+    gSb.dwFirst = (gSb.dwFirst + 1) & (gSb.dwMaxBlocks - 1);
+    gSb.dwBlocks--;
+    gSb.dwDropped++;
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbSealBlock
+
+PURPOSE: Compresses the hot block and appends it to the block index
+
+RETURN: FALSE if there isn't memory for the block, the hot block
+        is left as it is
+
+COMMENTS: Called with the history lock held
+
+-----------------------------------------------------------------------------*/
+BOOL SbSealBlock()
+{
+    WORD *  pwOffset = (WORD *) gSb.dwHot;
+    BYTE *  lpText = (BYTE *) gSb.dwHot + SB_TABLE_SIZE;
+    DWORD   dwRawSize, dwSize, dwLine;
+    SBBLOCK * pNew;
+    BYTE *  lpData;
+
+    if (gSb.dwBlocks == gSb.dwMaxBlocks) {
+        DWORD dwMax = gSb.dwMaxBlocks ? gSb.dwMaxBlocks * 2 : 256;
+        DWORD i;
+
+        //
+        // the ring grows into a new array, unrolled oldest first
+        //
+        pNew = (SBBLOCK *) HeapAlloc(gSb.hHeap, 0, dwMax * sizeof(SBBLOCK));
+        if (pNew == NULL)
+            return FALSE;
+
+        for (i = 0; i < gSb.dwBlocks; i++)
+            pNew[i] = *SB_BLOCK(i);
+
+        if (gSb.pBlocks)
+            HeapFree(gSb.hHeap, 0, gSb.pBlocks);
+
+        gSb.pBlocks = pNew;
+        gSb.dwMaxBlocks = dwMax;
+        gSb.dwFirst = 0;
+    }
+
+    dwRawSize = SB_TABLE_SIZE + pwOffset[gSb.dwHotLines];
+    dwSize = LzCompress((BYTE *) gSb.dwHot, dwRawSize, gSb.Work, sizeof(gSb.Work));
+
+    lpData = (BYTE *) HeapAlloc(gSb.hHeap, HEAP_ZERO_MEMORY, SB_BLOOM_SIZE + dwSize);
+    if (lpData == NULL)
+        return FALSE;
+    CopyMemory(lpData + SB_BLOOM_SIZE, gSb.Work, dwSize);
+
+    for (dwLine = 0; dwLine < gSb.dwHotLines; dwLine++)
+        SbBloomAdd(lpData, lpText + pwOffset[dwLine], pwOffset[dwLine + 1] - pwOffset[dwLine]);
+
+    pNew = SB_BLOCK(gSb.dwBlocks);
+    gSb.dwBlocks++;
+    pNew->lpData = lpData;
+    pNew->dwSize = dwSize;
+    pNew->dwRawSize = dwRawSize;
+
+    gSb.dwBytes += SB_BLOOM_SIZE + dwSize + sizeof(SBBLOCK);
+    gSb.dwRawBytes += dwRawSize;
+
+    //
+    // keep to the memory budget
+    //
+    while (gSb.dwBlocks > 1 && gSb.dwBytes > gSb.dwBudget)
+        SbDropOldest();
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbAddLine(const char *, int)
+
+PURPOSE: Appends a line to the history
+
+PARAMETERS:
+    lpLine - line text
+    nLen   - length of line, trailing blanks are not stored
+
+-----------------------------------------------------------------------------*/
+void SbAddLine(const char * lpLine, int nLen)
+{
+    WORD * pwOffset = (WORD *) gSb.dwHot;
+    BYTE * lpText = (BYTE *) gSb.dwHot + SB_TABLE_SIZE;
+
+    if (gSb.hHeap == NULL)
+        return;
+
+    while (nLen > 0 && lpLine[nLen - 1] == ' ')
+        nLen--;
+
+    EnterCriticalSection(&gSb.csLock);
+
+    CopyMemory(lpText + pwOffset[gSb.dwHotLines], lpLine, nLen);
+    pwOffset[gSb.dwHotLines + 1] = (WORD) (pwOffset[gSb.dwHotLines] + nLen);
+    gSb.dwHotLines++;
+
+    if (gSb.dwHotLines == SB_BLOCK_LINES) {
+        //
+        // out of memory, older history makes room for the hot block;
+        // with nothing left to drop it is lost, and counted as dropped
+        // so line numbers stay right
+        //
+        while (!SbSealBlock()) {
+            if (gSb.dwBlocks == 0) {
+                ErrorReporter("HeapAlloc (History block)");
+                gSb.dwDropped++;
+                break;
+            }
+            SbDropOldest();
+        }
+        gSb.dwHotLines = 0;
+        pwOffset[0] = 0;
+    }
+
+    LeaveCriticalSection(&gSb.csLock);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbGetLineCount
+
+PURPOSE: Returns the number of lines in the history
+
+-----------------------------------------------------------------------------*/
+DWORD SbGetLineCount()
+{
+    return gSb.dwBlocks * SB_BLOCK_LINES + gSb.dwHotLines;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbGetBlock(DWORD)
+
+PURPOSE: Returns the unpacked block holding a line
+
+PARAMETERS:
+    dwBlock - index of block, dwBlocks is the hot block
+
+COMMENTS: Sealed blocks are unpacked into a one block cache.
+
+-----------------------------------------------------------------------------*/
+BYTE * SbGetBlock(DWORD dwBlock)
+{
+    SBBLOCK * pBlock;
+
+    if (dwBlock == gSb.dwBlocks)
+        return (BYTE *) gSb.dwHot;
+
+    if (gSb.dwCacheBlock != gSb.dwDropped + dwBlock) {
+        pBlock = SB_BLOCK(dwBlock);
+        if (LzDecompress(pBlock->lpData + SB_BLOOM_SIZE, pBlock->dwSize,
+                         (BYTE *) gSb.dwCache, sizeof(gSb.dwCache)) != pBlock->dwRawSize) {
+            gSb.dwCacheBlock = SB_NOBLOCK;
+            return NULL;
+        }
+        gSb.dwCacheBlock = gSb.dwDropped + dwBlock;
+    }
+
+    return (BYTE *) gSb.dwCache;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbGetLine(DWORD, char *)
+
+PURPOSE: Reads a line from the history
+
+PARAMETERS:
+    dwLine - line number, 0 is the oldest line
+    lpBuf  - buffer of MAXCOLS characters for the line
+
+RETURN: length of line, 0 if the line doesn't exist
+
+-----------------------------------------------------------------------------*/
+int SbGetLine(DWORD dwLine, char * lpBuf)
+{
+    BYTE * lpBlock;
+    const char * lpLine;
+    int    nLen;
+
+    if (dwLine >= SbGetLineCount())
+        return 0;
+
+    lpBlock = SbGetBlock(dwLine / SB_BLOCK_LINES);
+    if (lpBlock == NULL)
+        return 0;
+
+    lpLine = SbBlockLine(lpBlock, dwLine % SB_BLOCK_LINES, &nLen);
+    CopyMemory(lpBuf, lpLine, nLen);
+
+    return nLen;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbGetFirstLine
+
+PURPOSE: Returns the absolute number of the oldest history line
+
+COMMENTS: Lines are numbered from the last clear, and keep their
+          number when older lines are dropped.  Line number
+          SbGetFirstLine() + SbGetLineCount() is screen row 0.
+
+-----------------------------------------------------------------------------*/
+DWORD SbGetFirstLine()
+{
+    return gSb.dwDropped * SB_BLOCK_LINES;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbBlockLine(const BYTE *, DWORD, int *)
+
+PURPOSE: Finds a line in an unpacked block
+
+PARAMETERS:
+    lpBlock - unpacked block
+    dwIndex - line index in block
+    pnLen   - receives line length
+
+RETURN: address of line text
+
+-----------------------------------------------------------------------------*/
+const char * SbBlockLine(const BYTE * lpBlock, DWORD dwIndex, int * pnLen)
+{
+    const WORD * pwOffset = (const WORD *) lpBlock;
+
+    *pnLen = pwOffset[dwIndex + 1] - pwOffset[dwIndex];
+
+    return (const char *) lpBlock + SB_TABLE_SIZE + pwOffset[dwIndex];
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbBloomAdd(BYTE *, const BYTE *, int)
+
+PURPOSE: Adds the trigrams of a line to a bloom filter
+
+-----------------------------------------------------------------------------*/
+void SbBloomAdd(BYTE * lpBloom, const BYTE * lpText, int nLen)
+{
+    DWORD dwHash;
+    int   i;
+
+    for (i = 0; i + 3 <= nLen; i++) {
+        dwHash = SB_TRIGRAMHASH(lpText + i);
+        lpBloom[SB_BLOOMBIT1(dwHash) >> 3] |= 1 << (SB_BLOOMBIT1(dwHash) & 7);
+        lpBloom[SB_BLOOMBIT2(dwHash) >> 3] |= 1 << (SB_BLOOMBIT2(dwHash) & 7);
+    }
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbTrigramBits(const char *, int, DWORD *, int)
+
+PURPOSE: Lists the bloom filter bits a block must have set to
+         possibly contain a text
+
+PARAMETERS:
+    lpText  - searched text
+    nLen    - length of text
+    pdwBits - receives bit numbers
+    nMax    - size of pdwBits
+
+RETURN: number of bits, 0 if the text is too short to use the filter
+
+-----------------------------------------------------------------------------*/
+int SbTrigramBits(const char * lpText, int nLen, DWORD * pdwBits, int nMax)
+{
+    DWORD dwHash;
+    int   i, n = 0;
+
+    for (i = 0; i + 3 <= nLen && n + 2 <= nMax; i++) {
+        dwHash = SB_TRIGRAMHASH((const BYTE *) lpText + i);
+        pdwBits[n++] = SB_BLOOMBIT1(dwHash);
+        pdwBits[n++] = SB_BLOOMBIT2(dwHash);
+    }
+
+    return n;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbReadBlock(DWORD, const DWORD *, int, BYTE *, BYTE *)
+
+PURPOSE: Unpacks a block for the search thread
+
+PARAMETERS:
+    dwAbsBlock - absolute block number (first line / SB_BLOCK_LINES)
+    pdwBits    - bloom bits from SbTrigramBits
+    nBits      - number of bloom bits
+    lpRaw      - receives the unpacked block, SB_RAW_SIZE bytes
+    lpWork     - work buffer, LZ_BOUND(SB_RAW_SIZE) bytes
+
+RETURN: number of lines in lpRaw,
+        0 if the bloom filter rules the block out,
+        SB_READ_GONE if the block was dropped or doesn't exist yet
+
+COMMENTS: Only the copy of the compressed block is done holding
+          the history lock, it is unpacked after the lock is released.
+          The hot block has no bloom filter and is always copied.
+
+-----------------------------------------------------------------------------*/
+int SbReadBlock(DWORD dwAbsBlock, const DWORD * pdwBits, int nBits, BYTE * lpRaw, BYTE * lpWork)
+{
+    SBBLOCK * pBlock;
+    DWORD dwBlock, dwSize, dwRawSize;
+    int   i, nLines;
+
+    EnterCriticalSection(&gSb.csLock);
+
+    dwBlock = dwAbsBlock - gSb.dwDropped;
+    if (dwAbsBlock < gSb.dwDropped || dwBlock > gSb.dwBlocks) {
+        LeaveCriticalSection(&gSb.csLock);
+        return SB_READ_GONE;
+    }
+
+    if (dwBlock == gSb.dwBlocks) {
+        nLines = gSb.dwHotLines;
+        CopyMemory(lpRaw, gSb.dwHot, SB_TABLE_SIZE + ((WORD *) gSb.dwHot)[nLines]);
+        LeaveCriticalSection(&gSb.csLock);
+        return nLines;
+    }
+
+    pBlock = SB_BLOCK(dwBlock);
+    for (i = 0; i < nBits; i++)
+        if ((pBlock->lpData[pdwBits[i] >> 3] & (1 << (pdwBits[i] & 7))) == 0) {
+            LeaveCriticalSection(&gSb.csLock);
+            return 0;
+        }
+
+    dwSize = pBlock->dwSize;
+    dwRawSize = pBlock->dwRawSize;
+    CopyMemory(lpWork, pBlock->lpData + SB_BLOOM_SIZE, dwSize);
+
+    LeaveCriticalSection(&gSb.csLock);
+
+    if (LzDecompress(lpWork, dwSize, lpRaw, SB_RAW_SIZE) != dwRawSize)
+        return SB_READ_GONE;
+
+    return SB_BLOCK_LINES;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SbGetStats(SBSTATS *)
+
+PURPOSE: Returns history size and memory use
+
+PARAMETERS:
+    pStats - structure to fill in
+
+-----------------------------------------------------------------------------*/
+void SbGetStats(SBSTATS * pStats)
+{
+    pStats->dwLines    = SbGetLineCount();
+    pStats->dwBlocks   = gSb.dwBlocks;
+    pStats->dwBytes    = gSb.dwBytes;
+    pStats->dwRawBytes = gSb.dwRawBytes;
+    pStats->dwBudget   = gSb.dwBudget;
+
+    return;
+}
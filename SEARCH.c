@@ -0,0 +1,692 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: Search.c
+
+    PURPOSE: Text search in the scrollback history and the screen.
+
+             A search runs on its own thread, so a long history doesn't
+             stall the tty window.  The thread goes through the history
+             blocks oldest first; the trigram bloom filter of each sealed
+             block lets it skip blocks that can't hold the text without
+             unpacking them.  Matching lines are added to the hit list
+             as they are found and the tty window is told with
+             WM_TTYSEARCH, so next/previous works before the search
+             is done.
+
+             Lines are known by absolute line number (see SbGetFirstLine),
+             which stays the same when the screen scrolls or old history
+             is dropped.  The screen rows are copied when the search
+             starts and searched as the lines following the history.
+
+    FUNCTIONS:
+        SearchCreate     - initializes search data
+        SearchDestroy    - stops search, frees search data
+        CmdFind          - shows the Find dialog
+        FindDlgProc      - Find dialog procedure
+        SearchStart      - starts a search for a new text
+        SearchRun        - starts the search thread
+        SearchStop       - stops the search thread
+        SearchReset      - forgets hits when line numbers start over
+        SearchProc       - search thread procedure
+        SearchLine       - matches one line
+        SearchAddHits    - adds lines found to the hit list
+        SearchNext       - moves to the next or previous hit
+        SearchResults    - handles WM_TTYSEARCH
+        SearchShowLine   - scrolls the tty window to a line
+        SearchGetCurrent - returns line of current hit
+        SearchGetStats   - search statistics
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "MTTTY.h"
+
+#define SEARCH_NONE         0xFFFFFFFF
+#define SEARCH_MAX_HITS     0x100000
+#define SEARCH_MAX_BITS     (2 * MAX_FIND_LENGTH)
+
+/*
+    Prototypes for functions called only within this file
+*/
+BOOL CALLBACK FindDlgProc( HWND, UINT, WPARAM, LPARAM );
+void SearchRun( void );
+DWORD WINAPI SearchProc( LPVOID );
+BOOL SearchLine( const char *, int );
+void SearchAddHits( const DWORD *, int );
+void SearchShowLine( HWND, DWORD );
+
+static struct
+{
+    CRITICAL_SECTION csHits;        // protects hit list and fDone
+    HANDLE  hThread;
+    LONG volatile lCancel;
+    LONG volatile lNotified;        // WM_TTYSEARCH is in the message queue
+    char    szQuery[MAX_FIND_LENGTH];
+    char    szFolded[MAX_FIND_LENGTH];  // query with case folded
+    int     nQueryLen;
+    BOOL    fMatchCase;
+    BOOL    fStale;                 // hits are for old line numbers
+    DWORD   dwBits[SEARCH_MAX_BITS];    // bloom bits of query trigrams
+    int     nBits;
+    DWORD   dwFirstBlock;           // absolute blocks to search
+    DWORD   dwLastBlock;
+    DWORD   dwEndLine;              // screen row 0 at search start
+    char    Screen[MAXROWS * MAXCOLS];  // screen rows at search start
+    DWORD * pdwHits;                // absolute line numbers, ascending
+    DWORD   dwHits;
+    DWORD   dwMaxHits;
+    BOOL    fDone;
+    DWORD   dwCurrent;              // current hit, SEARCH_NONE if none
+    int     nPending;               // direction of navigation waiting for hits
+    DWORD   dwStartTime;
+    SEARCHSTATS Stats;
+} gSearch;
+
+//
+// search thread buffers, only one search thread runs at a time
+//
+static BYTE gSearchRaw[SB_RAW_SIZE];
+static BYTE gSearchWork[LZ_BOUND(SB_RAW_SIZE)];
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchCreate
+
+PURPOSE: Initializes search data
+
+COMMENTS: Partner to SearchDestroy
+
+-----------------------------------------------------------------------------*/
+void SearchCreate()
+{
+    InitializeCriticalSection(&gSearch.csHits);
+    gSearch.dwCurrent = SEARCH_NONE;
+    gSearch.fDone = TRUE;
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchDestroy
+
+PURPOSE: Stops the search thread and frees search data
+
+COMMENTS: Must be called before the history is destroyed
+
+-----------------------------------------------------------------------------*/
+void SearchDestroy()
+{
+    SearchStop();
+
+    if (gSearch.pdwHits)
+        HeapFree(GetProcessHeap(), 0, gSearch.pdwHits);
+    gSearch.pdwHits = NULL;
+    gSearch.dwHits = gSearch.dwMaxHits = 0;
+
+    DeleteCriticalSection(&gSearch.csHits);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CmdFind(HWND)
+
+PURPOSE: Shows the Find dialog and moves to the first hit
+
+PARAMETERS:
+    hwnd - Owner of the window
+
+-----------------------------------------------------------------------------*/
+void CmdFind(HWND hwnd)
+{
+    int nRet;
+
+    nRet = DialogBox(ghInst, MAKEINTRESOURCE(IDD_FINDDLG), hwnd, FindDlgProc);
+
+    if (nRet == IDOK || nRet == IDC_FINDPREVBTN)
+        SearchNext(ghWndTTY, nRet == IDC_FINDPREVBTN);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: FindDlgProc(HWND, UINT, WPARAM, LPARAM)
+
+PURPOSE: Dialog Procedure for Find dialog
+
+PARAMETERS:
+    hdlg     - Dialog window handle
+    uMessage - window message
+    wparam   - message parameter (depends on message)
+    lparam   - message parameter (depends on message)
+
+RETURN:
+    TRUE if message is handled
+    FALSE if message is not handled
+
+COMMENTS: A new search starts only if the text or the case
+          option changed.
+
+-----------------------------------------------------------------------------*/
+BOOL CALLBACK FindDlgProc(HWND hdlg, UINT uMessage, WPARAM wparam, LPARAM lparam)
+{
+    char szText[MAX_FIND_LENGTH];
+    BOOL fMatchCase;
+
+    switch(uMessage)
+    {
+	case WM_INITDIALOG:
+	    SendDlgItemMessage(hdlg, IDC_FINDEDIT, EM_LIMITTEXT, MAX_FIND_LENGTH - 1, 0);
+	    SetDlgItemText(hdlg, IDC_FINDEDIT, gSearch.szQuery);
+	    CheckDlgButton(hdlg, IDC_FINDCASECHK, gSearch.fMatchCase);
+	    break;
+
+	case WM_COMMAND:
+	    switch(LOWORD(wparam))
+	    {
+		case IDOK:
+		case IDC_FINDPREVBTN:
+			GetDlgItemText(hdlg, IDC_FINDEDIT, szText, sizeof(szText));
+			fMatchCase = IsDlgButtonChecked(hdlg, IDC_FINDCASECHK);
+
+			if (szText[0] == 0) {
+			    MessageBeep(MB_OK);
+			    return TRUE;
+			}
+
+			if (strcmp(szText, gSearch.szQuery) != 0 || fMatchCase != gSearch.fMatchCase)
+			    SearchStart(szText, fMatchCase);
+
+			//
+			// FALL THROUGH
+			//
+
+		case IDCANCEL:
+			EndDialog(hdlg, LOWORD(wparam));
+			return TRUE;
+	    }
+	    break;
+    }
+
+    return FALSE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchStart(const char *, BOOL)
+
+PURPOSE: Starts a search for a new text
+
+PARAMETERS:
+    szText     - text to find
+    fMatchCase - TRUE for case sensitive search
+
+-----------------------------------------------------------------------------*/
+void SearchStart(const char * szText, BOOL fMatchCase)
+{
+    int i;
+
+    SearchStop();
+
+    lstrcpyn(gSearch.szQuery, szText, MAX_FIND_LENGTH);
+    gSearch.nQueryLen = lstrlen(gSearch.szQuery);
+    gSearch.fMatchCase = fMatchCase;
+    for (i = 0; i < gSearch.nQueryLen; i++)
+        gSearch.szFolded[i] = ASCII_FOLD(gSearch.szQuery[i]);
+
+    gSearch.nBits = SbTrigramBits(gSearch.szQuery, gSearch.nQueryLen,
+                                  gSearch.dwBits, SEARCH_MAX_BITS);
+    gSearch.dwCurrent = SEARCH_NONE;
+
+    SearchRun();
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchRun
+
+PURPOSE: Searches the current history and screen for the current text
+
+COMMENTS: The history extent and the screen are taken now, lines
+          added later are not searched.
+
+-----------------------------------------------------------------------------*/
+void SearchRun()
+{
+    DWORD dwThreadId;
+    int   nRow;
+
+    SearchStop();
+
+    gSearch.dwHits = 0;
+    gSearch.fDone = FALSE;
+    gSearch.fStale = FALSE;
+    gSearch.nPending = 0;
+    gSearch.lCancel = FALSE;
+    ZeroMemory(&gSearch.Stats, sizeof(gSearch.Stats));
+
+    gSearch.dwEndLine = SbGetFirstLine() + SbGetLineCount();
+    gSearch.dwFirstBlock = SbGetFirstLine() / SB_BLOCK_LINES;
+    gSearch.dwLastBlock = gSearch.dwEndLine / SB_BLOCK_LINES;
+
+    for (nRow = 0; nRow < MAXROWS; nRow++)
+        CopyMemory(gSearch.Screen + nRow * MAXCOLS, SCREENROW( TTYInfo, nRow ), MAXCOLS);
+
+    gSearch.dwStartTime = timeGetTime();
+    gSearch.hThread = CreateThread(NULL, 0, SearchProc, NULL, 0, &dwThreadId);
+    if (gSearch.hThread == NULL) {
+        ErrorReporter("CreateThread (Search)");
+        gSearch.fDone = TRUE;
+    }
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchStop
+
+PURPOSE: Stops the search thread and waits for it to exit
+
+-----------------------------------------------------------------------------*/
+void SearchStop()
+{
+    if (gSearch.hThread == NULL)
+        return;
+
+    InterlockedExchange(&gSearch.lCancel, TRUE);
+    WaitForSingleObject(gSearch.hThread, INFINITE);
+    CloseHandle(gSearch.hThread);
+    gSearch.hThread = NULL;
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchReset
+
+PURPOSE: Forgets hits after the history is cleared
+
+COMMENTS: Line numbers start over after a clear, so the hits are
+          useless.  The text is kept, the next SearchNext searches again.
+
+-----------------------------------------------------------------------------*/
+void SearchReset()
+{
+    SearchStop();
+
+    gSearch.dwHits = 0;
+    gSearch.dwCurrent = SEARCH_NONE;
+    gSearch.nPending = 0;
+    gSearch.fDone = TRUE;
+    gSearch.fStale = TRUE;
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchProc(LPVOID)
+
+PURPOSE: Search thread procedure
+
+COMMENTS: Blocks are read through SbReadBlock, which unpacks them
+          only if the bloom filter allows a hit.  The hot block can
+          have grown since the search started, its new lines are
+          still on the screen copy and are skipped here.
+
+-----------------------------------------------------------------------------*/
+DWORD WINAPI SearchProc(LPVOID lpV)
+{
+    DWORD dwFound[SB_BLOCK_LINES];
+    DWORD dwBlock, dwLine;
+    const char * lpLine;
+    int   nLines, nLen, nFound, i;
+
+    for (dwBlock = gSearch.dwFirstBlock;
+         dwBlock <= gSearch.dwLastBlock && !gSearch.lCancel; dwBlock++)
+    {
+        nLines = SbReadBlock(dwBlock, gSearch.dwBits, gSearch.nBits,
+                             gSearchRaw, gSearchWork);
+        gSearch.Stats.dwBlocks++;
+
+        if (nLines == SB_READ_GONE)
+            continue;
+
+        if (nLines == 0) {
+            gSearch.Stats.dwSkipped++;
+            continue;
+        }
+
+        nFound = 0;
+        for (i = 0; i < nLines; i++) {
+            dwLine = dwBlock * SB_BLOCK_LINES + i;
+            if (dwLine >= gSearch.dwEndLine)
+                break;
+
+            lpLine = SbBlockLine(gSearchRaw, i, &nLen);
+            if (SearchLine(lpLine, nLen))
+                dwFound[nFound++] = dwLine;
+        }
+        SearchAddHits(dwFound, nFound);
+    }
+
+    //
+    // screen rows as they were at search start
+    //
+    nFound = 0;
+    for (i = 0; i < MAXROWS && !gSearch.lCancel; i++)
+        if (SearchLine(gSearch.Screen + i * MAXCOLS, MAXCOLS))
+            dwFound[nFound++] = gSearch.dwEndLine + i;
+    SearchAddHits(dwFound, nFound);
+
+    EnterCriticalSection(&gSearch.csHits);
+    gSearch.fDone = TRUE;
+    gSearch.Stats.dwTime = timeGetTime() - gSearch.dwStartTime;
+    LeaveCriticalSection(&gSearch.csHits);
+
+    if (InterlockedExchange(&gSearch.lNotified, TRUE) == FALSE)
+        PostMessage(ghWndTTY, WM_TTYSEARCH, 0, 0);
+
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchLine(const char *, int)
+
+PURPOSE: Checks if a line holds the searched text
+
+-----------------------------------------------------------------------------*/
+BOOL SearchLine(const char * lpLine, int nLen)
+{
+    const char * lpQuery;
+    int  i, j;
+    char c;
+
+    lpQuery = gSearch.fMatchCase ? gSearch.szQuery : gSearch.szFolded;
+
+    for (i = 0; i + gSearch.nQueryLen <= nLen; i++) {
+        for (j = 0; j < gSearch.nQueryLen; j++) {
+            c = lpLine[i + j];
+            if (!gSearch.fMatchCase)
+                c = ASCII_FOLD(c);
+            if (c != lpQuery[j])
+                break;
+        }
+
+        if (j == gSearch.nQueryLen)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchAddHits(const DWORD *, int)
+
+PURPOSE: Adds lines found to the hit list and tells the tty window
+
+COMMENTS: Called from the search thread.  Hits past SEARCH_MAX_HITS
+          are ignored.
+
+-----------------------------------------------------------------------------*/
+void SearchAddHits(const DWORD * pdwFound, int nFound)
+{
+    DWORD * pdwNew;
+    DWORD   dwMax;
+
+    if (nFound == 0)
+        return;
+
+    EnterCriticalSection(&gSearch.csHits);
+
+    if (gSearch.dwHits + nFound > gSearch.dwMaxHits &&
+        gSearch.dwMaxHits < SEARCH_MAX_HITS)
+    {
+        dwMax = gSearch.dwMaxHits ? gSearch.dwMaxHits * 2 : 1024;
+        if (gSearch.pdwHits)
+            pdwNew = (DWORD *) HeapReAlloc(GetProcessHeap(), 0, gSearch.pdwHits, dwMax * sizeof(DWORD));
+        else
+            pdwNew = (DWORD *) HeapAlloc(GetProcessHeap(), 0, dwMax * sizeof(DWORD));
+
+        if (pdwNew) {
+            gSearch.pdwHits = pdwNew;
+            gSearch.dwMaxHits = dwMax;
+        }
+    }
+
+    nFound = min((DWORD) nFound, gSearch.dwMaxHits - gSearch.dwHits);
+    CopyMemory(gSearch.pdwHits + gSearch.dwHits, pdwFound, nFound * sizeof(DWORD));
+    gSearch.dwHits += nFound;
+    gSearch.Stats.dwHits = gSearch.dwHits;
+
+    LeaveCriticalSection(&gSearch.csHits);
+
+    if (InterlockedExchange(&gSearch.lNotified, TRUE) == FALSE)
+        PostMessage(ghWndTTY, WM_TTYSEARCH, 0, 0);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchNext(HWND, BOOL)
+
+PURPOSE: Moves to the next or previous hit
+
+PARAMETERS:
+    hTTY      - handle to the TTY child window
+    fBackward - TRUE to go to the previous hit
+
+RETURN: FALSE if there is no text to search for
+
+COMMENTS: Without a current hit, the search goes from the top
+          (or bottom) line of the window.  If the hit isn't known
+          yet, the move is done when the search thread finds it.
+
+-----------------------------------------------------------------------------*/
+BOOL SearchNext(HWND hTTY, BOOL fBackward)
+{
+    DWORD dwStart, dwHit = SEARCH_NONE;
+    DWORD dwLow, dwHigh, dwMid;
+    int   nHistory;
+    BOOL  fKnown;
+
+    if (gSearch.nQueryLen == 0)
+        return FALSE;
+
+    if (gSearch.fStale)
+        SearchRun();
+
+    if (gSearch.dwCurrent != SEARCH_NONE)
+        dwStart = gSearch.dwCurrent + (fBackward ? 0 : 1);
+    else {
+        //
+        // the offset is at least -nHistory rows, as in SearchShowLine
+        //
+        nHistory = ScrollbackRows();
+        dwStart = SbGetFirstLine() + SbGetLineCount() - nHistory +
+                  (YOFFSET( TTYInfo ) + nHistory * YCHAR( TTYInfo )) / YCHAR( TTYInfo );
+        if (fBackward)
+            dwStart += YSIZE( TTYInfo ) / YCHAR( TTYInfo );
+    }
+
+    //
+    // first hit at or after dwStart
+    //
+    EnterCriticalSection(&gSearch.csHits);
+
+    dwLow = 0;
+    dwHigh = gSearch.dwHits;
+    while (dwLow < dwHigh) {
+        dwMid = (dwLow + dwHigh) / 2;
+        if (gSearch.pdwHits[dwMid] < dwStart)
+            dwLow = dwMid + 1;
+        else
+            dwHigh = dwMid;
+    }
+
+    //
+    // hits come in ascending order, so once there is one at or
+    // after dwStart, the hits on both sides of dwStart are final
+    //
+    fKnown = gSearch.fDone || dwLow < gSearch.dwHits;
+    if (!fBackward && dwLow < gSearch.dwHits)
+        dwHit = gSearch.pdwHits[dwLow];
+    else if (fBackward && dwLow > 0 && fKnown)
+        dwHit = gSearch.pdwHits[dwLow - 1];
+
+    LeaveCriticalSection(&gSearch.csHits);
+
+    if (dwHit != SEARCH_NONE) {
+        gSearch.nPending = 0;
+        gSearch.dwCurrent = dwHit;
+        SearchShowLine(hTTY, dwHit);
+    }
+    else if (!fKnown)
+        gSearch.nPending = fBackward ? -1 : 1;
+    else if (!fBackward && gSearch.dwEndLine != SbGetFirstLine() + SbGetLineCount()) {
+        //
+        // new lines came in since this search, search again
+        //
+        SearchRun();
+        gSearch.nPending = 1;
+    }
+    else {
+        gSearch.nPending = 0;
+        MessageBeep(MB_OK);
+        UpdateStatus("Search: no more matches\r\n");
+    }
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchResults(HWND)
+
+PURPOSE: Handles WM_TTYSEARCH, finishes a waiting next/previous
+
+PARAMETERS:
+    hTTY - handle to the TTY child window
+
+-----------------------------------------------------------------------------*/
+void SearchResults(HWND hTTY)
+{
+    InterlockedExchange(&gSearch.lNotified, FALSE);
+
+    if (gSearch.nPending)
+        SearchNext(hTTY, gSearch.nPending < 0);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchShowLine(HWND, DWORD)
+
+PURPOSE: Scrolls the tty window so that a line is visible
+
+PARAMETERS:
+    hTTY   - handle to the TTY child window
+    dwLine - absolute line number
+
+COMMENTS: A line out of view is put in the upper third of the window.
+
+-----------------------------------------------------------------------------*/
+void SearchShowLine(HWND hTTY, DWORD dwLine)
+{
+    int nHistory, nRow, nTop;
+
+    nHistory = ScrollbackRows();
+    if (dwLine < SbGetFirstLine()) {
+        MessageBeep(MB_OK);
+        UpdateStatus("Search: line dropped from history\r\n");
+        return;
+    }
+
+    nRow = (int) (dwLine - SbGetFirstLine() - SbGetLineCount());
+    if (nRow < -nHistory) {
+        MessageBeep(MB_OK);
+        UpdateStatus("Search: line is above the scrollable history\r\n");
+        return;
+    }
+
+    nTop = nRow * YCHAR( TTYInfo );
+
+    if (nTop < YOFFSET( TTYInfo ) ||
+        nTop + YCHAR( TTYInfo ) > YOFFSET( TTYInfo ) + YSIZE( TTYInfo ))
+    {
+        nTop -= YSIZE( TTYInfo ) / 3;
+        nTop = max(nTop, -nHistory * YCHAR( TTYInfo ));
+        nTop = min(nTop, YSCROLL( TTYInfo ));
+        YOFFSET( TTYInfo ) = nTop;
+        UpdateTTYVertScroll(hTTY);
+    }
+
+    InvalidateRect(hTTY, NULL, FALSE);
+
+    return;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchGetCurrent
+
+PURPOSE: Returns the absolute line number of the current hit,
+         0xFFFFFFFF if there is none
+
+-----------------------------------------------------------------------------*/
+DWORD SearchGetCurrent()
+{
+    return gSearch.dwCurrent;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SearchGetStats(SEARCHSTATS *)
+
+PURPOSE: Returns hit count, time and bloom filter effect of the
+         last search
+
+PARAMETERS:
+    pStats - structure to fill in
+
+-----------------------------------------------------------------------------*/
+void SearchGetStats(SEARCHSTATS * pStats)
+{
+    EnterCriticalSection(&gSearch.csHits);
+
+    *pStats = gSearch.Stats;
+    pStats->fDone = gSearch.fDone;
+    if (!gSearch.fDone)
+        pStats->dwTime = timeGetTime() - gSearch.dwStartTime;
+
+    LeaveCriticalSection(&gSearch.csHits);
+
+    return;
+}
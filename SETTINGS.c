@@ -68,6 +68,9 @@ BOOL CALLBACK TimeoutsProc( HWND, UINT, WPARAM, LPARAM );
 void InitTimeoutsDlg( HWND, COMMTIMEOUTS );
 void SaveTimeoutsDlg( HWND );
 BOOL CALLBACK GetADWORDProc( HWND, UINT, WPARAM, LPARAM );
+BOOL CALLBACK OptionsProc( HWND, UINT, WPARAM, LPARAM );
+void InitOptionsDlg( HWND );
+void SaveOptionsDlg( HWND );
 // Mario Ivani, 2018
 BOOL CALLBACK SetMacrosProc(HWND hdlg, UINT uMessage, WPARAM wparam, LPARAM lparam);
 // convert COMnn to \\.\COMnn
@@ -465,6 +468,7 @@ void UpdateTTYInfo()
 
     NONPRINTHEX(TTYInfo)  = IsDlgButtonChecked(ghWndToolbarDlg, IDC_NONPRINTHEXCHK);
     DISPLAYHEX(TTYInfo)  = IsDlgButtonChecked(ghWndToolbarDlg, IDC_ALLASHEXCHK);
+    ANSI(TTYInfo)  = IsDlgButtonChecked(ghWndToolbarDlg, IDC_ANSICHK);
 
     if (CONNECTED(TTYInfo))      // if connected, then update port state
 	UpdateConnection();
@@ -770,6 +774,7 @@ BOOL SettingsDlgInit( HWND hDlg )
 
     CheckDlgButton( hDlg, IDC_NONPRINTHEXCHK,  NONPRINTHEX( TTYInfo ) );
     CheckDlgButton( hDlg, IDC_ALLASHEXCHK,  DISPLAYHEX( TTYInfo ) );
+    CheckDlgButton( hDlg, IDC_ANSICHK,  ANSI( TTYInfo ) );
 
     EnableWindow( GetDlgItem(hDlg, IDC_OPENBTN), TRUE);
     EnableWindow( GetDlgItem(hDlg, IDC_CLOSEBTN), FALSE);
@@ -957,6 +962,11 @@ BOOL CALLBACK ToolbarProc(HWND hWndDlg, UINT uMsg, WPARAM wParam, LPARAM lParam)
 		    case IDC_TIMEOUTSBTN:
 			DialogBox(ghInst, MAKEINTRESOURCE(IDD_TIMEOUTSDLG), ghwndMain, TimeoutsProc);
 			fRet = FALSE;
+			break;
+
+		    case IDC_OPTIONSBTN:
+			DialogBox(ghInst, MAKEINTRESOURCE(IDD_OPTIONSDLG), ghwndMain, OptionsProc);
+			fRet = FALSE;
 			break;
 
 			// Mario Ivani, 2018
@@ -980,7 +990,9 @@ BOOL CALLBACK ToolbarProc(HWND hWndDlg, UINT uMsg, WPARAM wParam, LPARAM lParam)
                 int i = LOWORD(wParam) - IDC_MACRO1BTN;
                 unsigned char* p = macro_buffer[i].buff;
                 int len = macro_buffer[i].len;
-                if(len)
+                if(len && WriterWouldBlock())
+                    MessageBeep(MB_OK);
+                else if(len)
                 {
                     WriterAddNewNode(WRITE_BLOCK, len, 0, p, NULL, NULL);
                     if (LOCALECHO(TTYInfo)) OutputABufferToWindow(ghWndTTY, p, len);
@@ -1829,6 +1841,170 @@ BOOL CALLBACK TimeoutsProc(HWND hdlg, UINT uMessage, WPARAM wparam, LPARAM lpara
     return FALSE;
 }
 
+/*-----------------------------------------------------------------------------
+
+FUNCTION: InitOptionsDlg(HWND)
+
+PURPOSE: Sets options dialog controls from current tty settings
+
+PARAMETERS:
+    hdlg - Dialog window handle
+
+-----------------------------------------------------------------------------*/
+void InitOptionsDlg(HWND hdlg)
+{
+    SetDlgItemInt(hdlg, IDC_REPAINTRATEEDIT, REPAINTRATE(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_HISTORYMBEDIT, HISTORYMB(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_TXHIGHEDIT, TXHIGHKB(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_TXLOWEDIT, TXLOWKB(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_COALESCEMSEDIT, COALESCEMS(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_COALESCEBYTESEDIT, COALESCEBYTES(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_PASTEDELAYEDIT, PASTEDELAY(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_PACERATEEDIT, PACERATE(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_PACEGAPEDIT, PACECHARGAP(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_PACELINEEDIT, PACELINEDELAY(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_READAHEADEDIT, READAHEADKB(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_REPLAYSPEEDEDIT, REPLAYSPEED(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_ROTATEMBEDIT, ROTATEMB(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_ROTATEMINEDIT, ROTATEMIN(TTYInfo), FALSE);
+    SetDlgItemInt(hdlg, IDC_ROTATEBUDGETEDIT, ROTATEBUDGETMB(TTYInfo), FALSE);
+    CheckDlgButton(hdlg, IDC_ROTATECOMPRESSCHK, ROTATECOMPRESS(TTYInfo));
+    return;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SaveOptionsDlg(HWND)
+
+PURPOSE: Saves values from options dialog controls into tty settings
+
+PARAMETERS:
+    hdlg - Dialog window handle
+
+-----------------------------------------------------------------------------*/
+void SaveOptionsDlg(HWND hdlg)
+{
+    REPAINTRATE(TTYInfo) = GetDlgItemInt(hdlg, IDC_REPAINTRATEEDIT, NULL, FALSE);
+
+    HISTORYMB(TTYInfo) = GetDlgItemInt(hdlg, IDC_HISTORYMBEDIT, NULL, FALSE);
+    if (HISTORYMB(TTYInfo) > HISTORYMB_MAX)
+        HISTORYMB(TTYInfo) = HISTORYMB_MAX;
+    SbSetBudget(HISTORYMB(TTYInfo) * 0x100000);
+
+    //
+    // the writer reads the watermarks as it goes, low must be below high
+    //
+    TXHIGHKB(TTYInfo) = GetDlgItemInt(hdlg, IDC_TXHIGHEDIT, NULL, FALSE);
+    if (TXHIGHKB(TTYInfo) > TXQUEUEKB_MAX)
+        TXHIGHKB(TTYInfo) = TXQUEUEKB_MAX;
+    if (TXHIGHKB(TTYInfo) == 0)
+        TXHIGHKB(TTYInfo) = 1;
+    TXLOWKB(TTYInfo) = GetDlgItemInt(hdlg, IDC_TXLOWEDIT, NULL, FALSE);
+    if (TXLOWKB(TTYInfo) >= TXHIGHKB(TTYInfo))
+        TXLOWKB(TTYInfo) = TXHIGHKB(TTYInfo) / 2;
+
+    //
+    // typed characters are collected for up to COALESCEMS or
+    // COALESCEBYTES, whichever comes first
+    //
+    COALESCEMS(TTYInfo) = GetDlgItemInt(hdlg, IDC_COALESCEMSEDIT, NULL, FALSE);
+    if (COALESCEMS(TTYInfo) > COALESCEMS_MAX)
+        COALESCEMS(TTYInfo) = COALESCEMS_MAX;
+    COALESCEBYTES(TTYInfo) = GetDlgItemInt(hdlg, IDC_COALESCEBYTESEDIT, NULL, FALSE);
+    if (COALESCEBYTES(TTYInfo) > WRITE_SLOT_SIZE)
+        COALESCEBYTES(TTYInfo) = WRITE_SLOT_SIZE;
+
+    PASTEDELAY(TTYInfo) = GetDlgItemInt(hdlg, IDC_PASTEDELAYEDIT, NULL, FALSE);
+    if (PASTEDELAY(TTYInfo) > PASTEDELAY_MAX)
+        PASTEDELAY(TTYInfo) = PASTEDELAY_MAX;
+
+    //
+    // transmit pacing, 0 turns each limit off
+    //
+    PACERATE(TTYInfo) = GetDlgItemInt(hdlg, IDC_PACERATEEDIT, NULL, FALSE);
+    PACECHARGAP(TTYInfo) = GetDlgItemInt(hdlg, IDC_PACEGAPEDIT, NULL, FALSE);
+    if (PACECHARGAP(TTYInfo) > PACEDELAY_MAX)
+        PACECHARGAP(TTYInfo) = PACEDELAY_MAX;
+    PACELINEDELAY(TTYInfo) = GetDlgItemInt(hdlg, IDC_PACELINEEDIT, NULL, FALSE);
+    if (PACELINEDELAY(TTYInfo) > PACEDELAY_MAX)
+        PACELINEDELAY(TTYInfo) = PACEDELAY_MAX;
+
+    //
+    // read-ahead is taken when a file send starts
+    //
+    READAHEADKB(TTYInfo) = GetDlgItemInt(hdlg, IDC_READAHEADEDIT, NULL, FALSE);
+    READAHEADKB(TTYInfo) = max(READAHEADKB_MIN, min(READAHEADKB(TTYInfo), READAHEADKB_MAX));
+
+    //
+    // replay speed is taken when a replay starts, 0 = as fast as possible
+    //
+    REPLAYSPEED(TTYInfo) = GetDlgItemInt(hdlg, IDC_REPLAYSPEEDEDIT, NULL, FALSE);
+    if (REPLAYSPEED(TTYInfo) > REPLAYSPEED_MAX)
+        REPLAYSPEED(TTYInfo) = REPLAYSPEED_MAX;
+
+    //
+    // capture rotation is taken when a capture starts, 0 turns each limit off
+    //
+    ROTATEMB(TTYInfo) = GetDlgItemInt(hdlg, IDC_ROTATEMBEDIT, NULL, FALSE);
+    if (ROTATEMB(TTYInfo) > ROTATEMB_MAX)
+        ROTATEMB(TTYInfo) = ROTATEMB_MAX;
+    ROTATEMIN(TTYInfo) = GetDlgItemInt(hdlg, IDC_ROTATEMINEDIT, NULL, FALSE);
+    if (ROTATEMIN(TTYInfo) > ROTATEMIN_MAX)
+        ROTATEMIN(TTYInfo) = ROTATEMIN_MAX;
+    ROTATEBUDGETMB(TTYInfo) = GetDlgItemInt(hdlg, IDC_ROTATEBUDGETEDIT, NULL, FALSE);
+    ROTATECOMPRESS(TTYInfo) = IsDlgButtonChecked(hdlg, IDC_ROTATECOMPRESSCHK) == BST_CHECKED;
+
+    UpdateTTYVertScroll(ghWndTTY);
+    InvalidateRect(ghWndTTY, NULL, FALSE);
+    return;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: OptionsProc(HWND, UINT, WPARAM, LPARAM)
+
+PURPOSE: Dialog Procedure for program options
+
+PARAMETERS:
+    hdlg     - Dialog window handle
+    uMessage - window message
+    wparam   - message parameter (depends on message)
+    lparam   - message parameter (depends on message)
+
+RETURN:
+    TRUE if message is handled
+    FALSE if message is not handled
+
+-----------------------------------------------------------------------------*/
+BOOL CALLBACK OptionsProc(HWND hdlg, UINT uMessage, WPARAM wparam, LPARAM lparam)
+{
+    switch(uMessage)
+    {
+	case WM_INITDIALOG:     // init controls
+	    InitOptionsDlg(hdlg);
+	    break;
+
+	case WM_COMMAND:
+	    switch(LOWORD(wparam))
+	    {
+		case IDOK:
+			SaveOptionsDlg(hdlg);
+
+			//
+			// FALL THROUGH
+			//
+
+		case IDCANCEL:
+			EndDialog(hdlg, LOWORD(wparam));
+			return TRUE;
+	    }
+	    break;
+    }
+
+    return FALSE;
+}
+
+
 BOOL CALLBACK GetADWORDProc(HWND hDlg, UINT uMessage, WPARAM wParam, LPARAM lParam)
 {
     int iRet = 0;
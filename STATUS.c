@@ -15,16 +15,24 @@
         OpenStatusToolBar    - Creates the status dialog
         CreateStatusEditFont - Creates the status edit control font
         StatusDlgProc        - Status dialog procedure
-        InitStatusMessage    - Initializes the status message mechanism
-        StatusMessage        - Updates status edit control
-        UpdateStatus         - Creates a status message node (entry point
-                               for other threads
+        InitStatusMessage    - Initializes the status log
+        StatusMessage        - Updates status edit control from the log
+        StatusFormat         - Makes the text of a status log record
+        StatusRepeats        - Writes the count of a repeated message
+        StatusAppend         - Adds text to the status edit control
+        StatusLog            - Logs a message by format id (entry point
+                               for other threads)
+        UpdateStatus         - Logs a copy of a string (entry point
+                               for other threads)
+        StatusLogClaim       - Claims a status log record
+        StatusLogPublish     - Hands a record to the consumer
         ReportModemStatus    - Updates modem status controls
         CheckModemStatus     - Calls GetCommModemStatus and ReportModemStatus
         ReportComStat        - Updates comm status controls based on
                                COMSTAT structure (from ClearCommError)
         ReportCommError      - Reports comm errors when they occur
         ReportStatusEvent    - Reports comm events when they occur
+        ReportStatistics     - Updates statistics edit control
 
 -----------------------------------------------------------------------------*/
 
@@ -33,7 +41,53 @@
 #include <stdio.h>
 #include "MTTTY.h"
 
-#define MAX_STATUS_LENGTH       100
+#define MAX_STATS_LENGTH        4096
+#define STATS_UPDATE_TIMEOUT    500
+
+#define STATUS_LOG_SIZE         256         // records, a power of 2
+#define STATUS_TEXT_SIZE        128         // UpdateStatus text per record
+#define STATUS_LINE_SIZE        160         // a formatted message
+#define STATUS_BATCH_SIZE       8192        // text per EM_REPLACESEL
+#define STATUS_REPEAT_MS        1000        // repeat counts shown this often
+
+//
+// Status log, a lock-free ring written by any thread and read by
+// the reader thread; look in StatusLog for more info
+//
+typedef struct STATUSLOGREC
+{
+    LONG volatile lSeq;                 // position it is free or ready for
+    DWORD   dwFormat;                   // STATUSLOG_*
+    DWORD   dwArgs[2];
+    char    szText[STATUS_TEXT_SIZE];   // STATUSLOG_TEXT
+} STATUSLOGREC;
+
+static struct
+{
+    STATUSLOGREC  Recs[STATUS_LOG_SIZE];
+    LONG volatile lHead;                // next position to claim
+    DWORD         dwTail;               // next position to show
+    LONG volatile lDropped;             // messages lost, log full
+    LONG volatile lNotified;            // status event set, not yet handled
+    char          szLast[STATUS_LINE_SIZE];     // last message shown
+    DWORD         dwRepeats;            // of it since, not shown
+    DWORD         dwRepeatTime;         // tick of the first of them
+} gStatusLog;
+
+//
+// Formats by STATUSLOG_* id, NULL if made by StatusFormat
+//
+static const char * gszStatusFormats[] =
+{
+    NULL,                               // STATUSLOG_TEXT
+    NULL,                               // STATUSLOG_EVENT
+    "Read timed out immediately.\r\n",   // STATUSLOG_READIMMEDIATE
+    "Read timed out overlapped.\r\n",    // STATUSLOG_READOVERLAPPED
+    "Write timed out. (immediate)\r\n",  // STATUSLOG_WRITEIMMEDIATE
+    "Write timed out. (overlapped)\r\n", // STATUSLOG_WRITEOVERLAPPED
+    "%lu bytes in input buffer.\r\n",    // STATUSLOG_INQUEUE
+    "%lu bytes in output buffer.\r\n",   // STATUSLOG_OUTQUEUE
+};
 
 //
 // Prototypes for functions called only within this file
@@ -43,6 +97,11 @@ void ReportCommError( void );
 void ReportModemStatus( DWORD );
 BOOL CALLBACK StatusDlgProc( HWND, UINT, WPARAM, LPARAM );
 void InitStatusMessage( void );
+void StatusFormat( STATUSLOGREC *, char * );
+int StatusRepeats( char * );
+void StatusAppend( HWND, char * );
+STATUSLOGREC * StatusLogClaim( void );
+void StatusLogPublish( STATUSLOGREC * );
 
 
 /*-----------------------------------------------------------------------------
@@ -127,6 +186,30 @@ BOOL CALLBACK StatusDlgProc(HWND hWndDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
         case WM_INITDIALOG:     // setup dialog with defaults
             SendMessage(GetDlgItem(hWndDlg, IDC_STATUSEDIT), WM_SETFONT, (WPARAM)ghFontStatus, 0);
             InitStatusMessage();
+            SetTimer(hWndDlg, TIMERID, STATS_UPDATE_TIMEOUT, NULL);
+            SetTimer(hWndDlg, METRICS_TIMERID, METRICS_SAMPLE_MS, NULL);
+            break;
+
+        case WM_TIMER:
+            if (wParam == METRICS_TIMERID) {
+                MetricsSample();
+                InvalidateRect(GetDlgItem(hWndDlg, IDC_THROUGHPUTGRAPH), NULL, FALSE);
+            }
+            else
+                ReportStatistics();
+            fRet = TRUE;
+            break;
+
+        case WM_DRAWITEM:
+            if (wParam == IDC_THROUGHPUTGRAPH) {
+                MetricsDrawGraph((DRAWITEMSTRUCT *) lParam);
+                fRet = TRUE;
+            }
+            break;
+
+        case WM_DESTROY:
+            KillTimer(hWndDlg, TIMERID);
+            KillTimer(hWndDlg, METRICS_TIMERID);
             break;
 
         case WM_COMMAND:
@@ -174,7 +257,10 @@ BOOL CALLBACK StatusDlgProc(HWND hWndDlg, UINT uMsg, WPARAM wParam, LPARAM lPara
 
 FUNCTION: InitStatusMessage
 
-PURPOSE: Initializes status message heap and linked list
+PURPOSE: Initializes the status log
+
+COMMENTS: Every slot is free for the producer with the matching
+          position, see StatusLog.
 
 HISTORY:   Date:      Author:     Comment:
            11/21/95   AllenD      Wrote it
@@ -182,15 +268,16 @@ HISTORY:   Date:      Author:     Comment:
 -----------------------------------------------------------------------------*/
 void InitStatusMessage()
 {
-    SYSTEM_INFO SysInfo;
-
-    GetSystemInfo(&SysInfo);
-    ghStatusMessageHeap = HeapCreate(0, SysInfo.dwPageSize, 0);
-    if (ghStatusMessageHeap == NULL)
-        ErrorReporter("HeapCreate (Status message)");
+    DWORD i;
 
-    glpStatusMessageHead = (STATUS_MESSAGE*)HeapAlloc(ghStatusMessageHeap, HEAP_ZERO_MEMORY, sizeof(STATUS_MESSAGE));
-    glpStatusMessageTail = glpStatusMessageHead;
+    for (i = 0; i < STATUS_LOG_SIZE; i++)
+        gStatusLog.Recs[i].lSeq = (LONG) i;
+    gStatusLog.lHead = 0;
+    gStatusLog.dwTail = 0;
+    gStatusLog.lDropped = 0;
+    gStatusLog.lNotified = FALSE;
+    gStatusLog.szLast[0] = 0;
+    gStatusLog.dwRepeats = 0;
 
     gnStatusIndex = 0;
 
@@ -208,12 +295,18 @@ void InitStatusMessage()
 
 FUNCTION: StatusMessage
 
-PURPOSE: Retrieves status message from status message linked list
-         and updates status edit control.
+PURPOSE: Formats the messages in the status log and adds them to the
+         status edit control
 
 COMMENTS: Called from ReaderAndStatusProc when the status event
-          has been set.  Clears edit control when number of characters
-          exceeds MAX_STATUS_BUFFER.
+          has been set, and when its wait times out.  Clears edit
+          control when number of characters exceeds MAX_STATUS_BUFFER.
+
+          All messages waiting go in with one EM_REPLACESEL, unless
+          they take more than STATUS_BATCH_SIZE.  A message the same
+          as the last one isn't shown again, it is counted; the count
+          is shown as "x N" before the next different message, or
+          after STATUS_REPEAT_MS while the repeats go on.
 
 HISTORY:   Date:      Author:     Comment:
            11/21/95   AllenD      Wrote it
@@ -221,10 +314,18 @@ HISTORY:   Date:      Author:     Comment:
 -----------------------------------------------------------------------------*/
 void StatusMessage()
 {
-    STATUS_MESSAGE * lpStatusMessage;
-    DWORD dwRes;
+    static char szBatch[STATUS_BATCH_SIZE];
+    char szLine[STATUS_LINE_SIZE];
+    STATUSLOGREC * pRec;
+    DWORD dwRes, dwSeq, dwDropped;
     HWND hEdit;
-    BOOL bRes;
+    int n = 0;
+
+    //
+    // clear the flag before looking at the log, so that
+    // any later message sets the event again
+    //
+    InterlockedExchange(&gStatusLog.lNotified, FALSE);
 
     hEdit = GetDlgItem (ghWndStatusDlg, IDC_STATUSEDIT);
 
@@ -244,61 +345,223 @@ void StatusMessage()
         gnStatusIndex = 0;
     }
 
-    //
-    // Loop through each node in the status message linked list.
-    //
-    for ( lpStatusMessage = glpStatusMessageHead->lpNext ; lpStatusMessage ; )
-    {
+    dwDropped = (DWORD) InterlockedExchange(&gStatusLog.lDropped, 0);
+    if (dwDropped)
+        n += wsprintf(szBatch + n, "%lu status messages lost, log full\r\n", dwDropped);
+
+    for (;;) {
         //
         // if global quit event is set, then just exit this loop
         //
         if (WaitForSingleObject(ghThreadExitEvent, 0) == WAIT_OBJECT_0)
+            return;
+
+        //
+        // next record, if its producer has finished it
+        //
+        dwSeq = gStatusLog.dwTail + 1;
+        pRec = &gStatusLog.Recs[gStatusLog.dwTail & (STATUS_LOG_SIZE - 1)];
+        if ((DWORD) pRec->lSeq != dwSeq)
             break;
+        MemoryBarrier();                // read the record after its sequence
+
+        StatusFormat(pRec, szLine);
 
         //
-        // Place each status message into the status control.
+        // give the slot back, for the producer a lap ahead
         //
-        SendMessageTimeout( hEdit, EM_SETSEL,
-                            gnStatusIndex, gnStatusIndex,
-                            SMTO_NORMAL | SMTO_ABORTIFHUNG,
-                            500, &dwRes);
-        SendMessageTimeout( hEdit, EM_REPLACESEL,
-                            0, (LPARAM) ((LPSTR) &(lpStatusMessage->chMessageStart)),
-                            SMTO_NORMAL | SMTO_ABORTIFHUNG,
-                            500, &dwRes);
-        gnStatusIndex += strlen(&(lpStatusMessage->chMessageStart));
+        InterlockedExchange(&pRec->lSeq, (LONG) (gStatusLog.dwTail + STATUS_LOG_SIZE));
+        gStatusLog.dwTail++;
+
+        if (lstrcmp(szLine, gStatusLog.szLast) == 0) {
+            if (gStatusLog.dwRepeats++ == 0)
+                gStatusLog.dwRepeatTime = GetTickCount();
+            continue;
+        }
 
         //
-        // Update status message linked list
+        // room for the repeat count, the counter and the line
         //
-        EnterCriticalSection(&gStatusCritical);
+        if (n + 2 * STATUS_LINE_SIZE > STATUS_BATCH_SIZE) {
+            StatusAppend(hEdit, szBatch);
+            n = 0;
+        }
+
+        n += StatusRepeats(szBatch + n);
+        n += wsprintf(szBatch + n, "%lu:%s", dwSeq, szLine);
+        lstrcpy(gStatusLog.szLast, szLine);
+    }
+
+    if (gStatusLog.dwRepeats && GetTickCount() - gStatusLog.dwRepeatTime >= STATUS_REPEAT_MS)
+        n += StatusRepeats(szBatch + n);
+
+    if (n)
+        StatusAppend(hEdit, szBatch);
 
-        bRes = HeapFree(ghStatusMessageHeap, 0, glpStatusMessageHead);
+    return;
+}
 
-        glpStatusMessageHead = lpStatusMessage;
-        lpStatusMessage = lpStatusMessage->lpNext;
+/*-----------------------------------------------------------------------------
 
-        LeaveCriticalSection(&gStatusCritical);
+FUNCTION: StatusFormat(STATUSLOGREC *, char *)
 
-        if (!bRes)
-            ErrorReporter("HeapFree (status message)");
+PURPOSE: Makes the text of a status log record
+
+PARAMETERS:
+    pRec   - record
+    szLine - STATUS_LINE_SIZE buffer for the text
+
+COMMENTS: The producers only store the format id and its arguments,
+          the text is made here, on the reader thread.
+
+-----------------------------------------------------------------------------*/
+void StatusFormat(STATUSLOGREC * pRec, char * szLine)
+{
+    DWORD dwStatus;
+
+    switch (pRec->dwFormat)
+    {
+        case STATUSLOG_TEXT:
+            lstrcpy(szLine, pRec->szText);
+            break;
+
+        case STATUSLOG_EVENT:
+            /*
+                Construct status message indicating the
+                status event flags that are set.
+            */
+            dwStatus = pRec->dwArgs[0];
+            strcpy(szLine, "EVENT: ");
+            strcat(szLine, EV_CTS & dwStatus ? "CTS " : "");
+            strcat(szLine, EV_DSR & dwStatus ? "DSR " : "");
+            strcat(szLine, EV_ERR & dwStatus ? "ERR " : "");
+            strcat(szLine, EV_RING & dwStatus ? "RING " : "");
+            strcat(szLine, EV_RLSD & dwStatus ? "RLSD " : "");
+            strcat(szLine, EV_BREAK & dwStatus ? "BREAK " : "");
+            strcat(szLine, EV_RXFLAG & dwStatus ? "RXFLAG " : "");
+            strcat(szLine, EV_RXCHAR & dwStatus ? "RXCHAR " : "");
+            strcat(szLine, EV_TXEMPTY & dwStatus ? "TXEMPTY " : "");
+
+            /*
+                If dwStatus == NULL, then no status event flags are set.
+                This happens when the event flag is changed with SetCommMask.
+            */
+            if (dwStatus == 0x0000)
+                strcat(szLine, "NULL");
+
+            strcat(szLine, "\r\n");
+            break;
+
+        default:
+            if (pRec->dwFormat < sizeof(gszStatusFormats) / sizeof(gszStatusFormats[0]) &&
+                gszStatusFormats[pRec->dwFormat])
+                wsprintf(szLine, gszStatusFormats[pRec->dwFormat],
+                         pRec->dwArgs[0], pRec->dwArgs[1]);
+            else
+                wsprintf(szLine, "Unknown status message %lu\r\n", pRec->dwFormat);
+            break;
     }
+}
 
-    return;
+/*-----------------------------------------------------------------------------
+
+FUNCTION: StatusRepeats(char *)
+
+PURPOSE: Writes the count of repeats of the last message
+
+PARAMETERS:
+    szText - where to write it
+
+RETURN: characters written, 0 if there were no repeats
+
+-----------------------------------------------------------------------------*/
+int StatusRepeats(char * szText)
+{
+    int n;
+
+    if (gStatusLog.dwRepeats == 0)
+        return 0;
+
+    n = wsprintf(szText, "  x %lu\r\n", gStatusLog.dwRepeats);
+    gStatusLog.dwRepeats = 0;
+
+    return n;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: StatusAppend(HWND, char *)
+
+PURPOSE: Adds text at the end of the status edit control
+
+PARAMETERS:
+    hEdit  - status edit control
+    szText - text
+
+-----------------------------------------------------------------------------*/
+void StatusAppend(HWND hEdit, char * szText)
+{
+    DWORD dwRes;
+
+    SendMessageTimeout( hEdit, EM_SETSEL,
+                        gnStatusIndex, gnStatusIndex,
+                        SMTO_NORMAL | SMTO_ABORTIFHUNG,
+                        500, &dwRes);
+    SendMessageTimeout( hEdit, EM_REPLACESEL,
+                        0, (LPARAM) szText,
+                        SMTO_NORMAL | SMTO_ABORTIFHUNG,
+                        500, &dwRes);
+    gnStatusIndex += strlen(szText);
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: StatusLog(DWORD, DWORD, DWORD)
+
+PURPOSE: Places a message in the status log and sets the event to
+         make it display
+
+PARAMETERS:
+    dwFormat - STATUSLOG_* id
+    dwArg1   - arguments for its format
+    dwArg2
+
+COMMENTS: Any thread, without locks or allocations.  The log is a
+          ring of STATUS_LOG_SIZE records; a producer claims the next
+          position by moving the head with a compare exchange, once
+          the record of that position is free, fills it in and
+          publishes it by setting its sequence.  A message that finds
+          the log full is lost and counted.  The event is set only if
+          the consumer hasn't been woken already.
+
+-----------------------------------------------------------------------------*/
+void StatusLog(DWORD dwFormat, DWORD dwArg1, DWORD dwArg2)
+{
+    STATUSLOGREC * pRec;
+
+    pRec = StatusLogClaim();
+    if (pRec == NULL)
+        return;
+
+    pRec->dwFormat = dwFormat;
+    pRec->dwArgs[0] = dwArg1;
+    pRec->dwArgs[1] = dwArg2;
+
+    StatusLogPublish(pRec);
 }
 
 /*-----------------------------------------------------------------------------
 
 FUNCTION: UpdateStatus(char *)
 
-PURPOSE: Places the passed in string into the status message linked
-         list and sets the event to make the message display.
+PURPOSE: Places a copy of the passed in string in the status log
 
 PARAMETERS:
     szText - message to be placed in the status control
 
-COMMENTS: Synchronization needed in order to ensure that only
-          one thread at a time places a string in the list
+COMMENTS: Text longer than a record holds is cut, keeping the line
+          end.  Messages that come often should use StatusLog with a
+          format id, they are formatted only when shown.
 
 HISTORY:   Date:      Author:     Comment:
            10/27/95   AllenD      Wrote it
@@ -307,47 +570,80 @@ HISTORY:   Date:      Author:     Comment:
 -----------------------------------------------------------------------------*/
 void UpdateStatus(const char * szText)
 {
-    char * szNewMsg;
-    DWORD dwSize;
-    STATUS_MESSAGE * lpStatusMessage;
-    static int dwMessageCounter = 0;
+    STATUSLOGREC * pRec;
 
-    dwMessageCounter++;
+    pRec = StatusLogClaim();
+    if (pRec == NULL)
+        return;
 
-    dwSize = strlen(szText) + 30;    // include NULL terminator and space for counter
+    pRec->dwFormat = STATUSLOG_TEXT;
+    lstrcpyn(pRec->szText, szText, STATUS_TEXT_SIZE);
+    if (lstrlen(szText) >= STATUS_TEXT_SIZE)
+        lstrcpy(pRec->szText + STATUS_TEXT_SIZE - 3, "\r\n");
 
-    EnterCriticalSection(&gStatusCritical);
+    StatusLogPublish(pRec);
 
-    szNewMsg = (char*)HeapAlloc(ghStatusMessageHeap, 0, dwSize+30);
-    if (szNewMsg == NULL) {
-        LeaveCriticalSection(&gStatusCritical);
-        ErrorReporter("HeapAlloc (status message)");
-        return;
-    }
-    else {
-        wsprintf(szNewMsg, "%d:%s", dwMessageCounter, szText);
-        if (strlen(szNewMsg) > dwSize) {
-            LeaveCriticalSection(&gStatusCritical);
-            ErrorInComm("Heap Corruption in UpdateStatus\n");
+    return ;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: StatusLogClaim
+
+PURPOSE: Claims the next record of the status log
+
+RETURN: record to fill in, NULL if the log is full
+
+COMMENTS: A record is free for position pos when its sequence is
+          pos; it is ready for the consumer at pos + 1 and free again
+          a lap later.  A sequence behind pos means the consumer
+          hasn't taken the record of the last lap yet: full.
+
+-----------------------------------------------------------------------------*/
+STATUSLOGREC * StatusLogClaim()
+{
+    STATUSLOGREC * pRec;
+    LONG lPos, lDiff;
+
+    for (;;) {
+        lPos = gStatusLog.lHead;
+        pRec = &gStatusLog.Recs[(DWORD) lPos & (STATUS_LOG_SIZE - 1)];
+        lDiff = pRec->lSeq - lPos;
+
+        if (lDiff == 0) {
+            if (InterlockedCompareExchange(&gStatusLog.lHead, lPos + 1, lPos) == lPos)
+                return pRec;
+        }
+        else if (lDiff < 0) {
+            InterlockedIncrement(&gStatusLog.lDropped);
+            return NULL;
         }
-    }
 
-    lpStatusMessage = (STATUS_MESSAGE*)HeapAlloc(ghStatusMessageHeap, 0, sizeof(LPSTR) + dwSize );
-    if (lpStatusMessage == NULL) {
-        LeaveCriticalSection(&gStatusCritical);
-        ErrorReporter("HeapAlloc (status message)");
-        return ;
+        //
+        // another producer took the position, try the next
+        //
     }
+}
+
+/*-----------------------------------------------------------------------------
 
-    lpStatusMessage->lpNext = NULL;
-    glpStatusMessageTail->lpNext = lpStatusMessage;
-    glpStatusMessageTail = lpStatusMessage;
-    CopyMemory(&(lpStatusMessage->chMessageStart), szNewMsg, dwSize);
-    LeaveCriticalSection(&gStatusCritical);
+FUNCTION: StatusLogPublish(STATUSLOGREC *)
 
-    SetEvent(ghStatusMessageEvent);
+PURPOSE: Hands a filled record to the consumer and wakes it
 
-    return ;
+PARAMETERS:
+    pRec - record from StatusLogClaim
+
+-----------------------------------------------------------------------------*/
+void StatusLogPublish(STATUSLOGREC * pRec)
+{
+    //
+    // the position was the sequence when claimed, one more publishes
+    //
+    InterlockedIncrement(&pRec->lSeq);
+
+    if (InterlockedExchange(&gStatusLog.lNotified, TRUE) == FALSE)
+        SetEvent(ghStatusMessageEvent);
 }
 
 /*-----------------------------------------------------------------------------
@@ -404,12 +700,11 @@ void CheckModemStatus( BOOL bUpdateNow )
     //
     // dwOldStatus needs to be static so that it is maintained
     // between function calls by the same thread.
-    // It also needs to be __declspec(thread) so that it is
+    // It also needs to be THREAD_LOCAL so that it is
     // initialized when a new thread is created.
     //
 
-    //__declspec(thread) static DWORD dwOldStatus = 0;
-    static __thread DWORD dwOldStatus = 0;
+    static THREAD_LOCAL DWORD dwOldStatus = 0;
 
     DWORD dwNewModemStatus;
 
@@ -480,10 +775,8 @@ void CheckComStat(BOOL bUpdateNow)
     COMSTAT ComStatNew;
     DWORD dwErrors;
 
-    //__declspec(thread) static COMSTAT ComStatOld;
-    //__declspec(thread) static DWORD dwErrorsOld = 0;
-    static __thread COMSTAT ComStatOld;
-    static __thread DWORD dwErrorsOld = 0;
+    static THREAD_LOCAL COMSTAT ComStatOld;
+    static THREAD_LOCAL DWORD dwErrorsOld = 0;
 
     memset(&ComStatOld, 0, sizeof(COMSTAT));
 
@@ -606,15 +899,11 @@ void ReportCommError()
     if (comStat.fTxim)
         UpdateStatus("Character waiting for Tx.\r\n");
 
-    if (comStat.cbInQue) {
-        wsprintf(szMessage, "%d bytes in input buffer.\r\n", comStat.cbInQue);
-        UpdateStatus(szMessage);
-    }
+    if (comStat.cbInQue)
+        StatusLog(STATUSLOG_INQUEUE, comStat.cbInQue, 0);
 
-    if (comStat.cbOutQue) {
-        wsprintf(szMessage, "%d bytes in output buffer.\r\n", comStat.cbOutQue);
-        UpdateStatus(szMessage);
-    }
+    if (comStat.cbOutQue)
+        StatusLog(STATUSLOG_OUTQUEUE, comStat.cbOutQue, 0);
 
     return;
 }
@@ -640,51 +929,17 @@ HISTORY:   Date:      Author:     Comment:
 /*-----------------------------------------------------------------------------*/
 void ReportStatusEvent(DWORD dwStatus)
 {
-    BOOL fRING, fRLSD, fRXCHAR, fRXFLAG, fTXEMPTY;
-    BOOL fBREAK, fCTS, fDSR, fERR;
-    char szMessage[70];
+    BOOL fERR;
 
-    //
-    // Get status event flags.
-    //
-    fCTS = EV_CTS & dwStatus;
-    fDSR = EV_DSR & dwStatus;
     fERR = EV_ERR & dwStatus;
-    fRING = EV_RING & dwStatus;
-    fRLSD = EV_RLSD & dwStatus;
-    fBREAK = EV_BREAK & dwStatus;
-    fRXCHAR = EV_RXCHAR & dwStatus;
-    fRXFLAG = EV_RXFLAG & dwStatus;
-    fTXEMPTY = EV_TXEMPTY & dwStatus;
-
-    /*
-        Construct status message indicating the
-        status event flags that are set.
-    */
-    strcpy(szMessage, "EVENT: ");
-    strcat(szMessage, fCTS ? "CTS " : "");
-    strcat(szMessage, fDSR ? "DSR " : "");
-    strcat(szMessage, fERR ? "ERR " : "");
-    strcat(szMessage, fRING ? "RING " : "");
-    strcat(szMessage, fRLSD ? "RLSD " : "");
-    strcat(szMessage, fBREAK ? "BREAK " : "");
-    strcat(szMessage, fRXFLAG ? "RXFLAG " : "");
-    strcat(szMessage, fRXCHAR ? "RXCHAR " : "");
-    strcat(szMessage, fTXEMPTY ? "TXEMPTY " : "");
-
-    /*
-        If dwStatus == NULL, then no status event flags are set.
-        This happens when the event flag is changed with SetCommMask.
-    */
-    if (dwStatus == 0x0000)
-        strcat(szMessage, "NULL");
-
-    strcat(szMessage, "\r\n");
 
     //
-    // Queue the status message for the status control
+    // Queue the event for the status control, its names are
+    // made when it is shown, and record the event in a
+    // timestamped capture
     //
-    UpdateStatus(szMessage);
+    StatusLog(STATUSLOG_EVENT, dwStatus, 0);
+    CapSinkRecord(CAPREC_EVENT, (const char *) &dwStatus, sizeof(dwStatus));
 
     /*
         If an error flag is set in the event flag, then
@@ -714,3 +969,170 @@ void ReportStatusEvent(DWORD dwStatus)
 
     return;
 }
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ReportStatistics
+
+PURPOSE: Updates the statistics edit control with internal counters
+
+COMMENTS: Called from the status dialog timer.  The control is
+          only rewritten when the text changes, and keeps its
+          scroll position.
+
+-----------------------------------------------------------------------------*/
+void ReportStatistics()
+{
+    static char szOldStats[MAX_STATS_LENGTH];
+    char   szStats[MAX_STATS_LENGTH];
+    int    n = 0;
+    int    nFirstLine;
+    HWND   hEdit;
+    RXRINGSTATS RxRing;
+    SBSTATS History;
+    SEARCHSTATS Search;
+    HEXVIEWSTATS HexView;
+    WRITERSTATS Writer;
+    WRPOOLSTATS WrPool;
+    REPEATSTATS Repeat;
+    METRICSSTATS Metrics;
+    CAPSINKSTATS CapSink;
+    REPLAYSTATS Replay;
+
+    //
+    // receive ring between reader thread and tty window
+    //
+    RxRingGetStats(&RxRing);
+    n += wsprintf(szStats + n, "RX ring: %lu of %lu KB\r\n",
+                    RxRing.dwUsed / 1024, RxRing.dwSize / 1024);
+    n += wsprintf(szStats + n, "RX ring peak: %lu KB\r\n",
+                    RxRing.dwHighWater / 1024);
+    n += wsprintf(szStats + n, "RX dropped: %lu of %lu\r\n",
+                    RxRing.dwDropped, RxRing.dwReceived + RxRing.dwDropped);
+
+    //
+    // pipelined writes, latency is WriteFile to completion
+    //
+    WriterGetStats(&Writer);
+    n += wsprintf(szStats + n, "TX writes: %lu, %lu KB, %lu in flight\r\n",
+                    Writer.dwWrites, Writer.dwBytes / 1024, Writer.dwInFlight);
+    n += wsprintf(szStats + n, "TX latency: %lu us, avg %lu, max %lu\r\n",
+                    Writer.dwLastLatency, Writer.dwAvgLatency, Writer.dwMaxLatency);
+    n += wsprintf(szStats + n, "TX queue: %lu KB, peak %lu KB, full %lu\r\n",
+                    Writer.dwQueued / 1024, Writer.dwQueuedPeak / 1024, Writer.dwFull);
+    n += wsprintf(szStats + n, "TX calls: %lu, %lu per KB, %lu saved\r\n",
+                    Writer.dwWriteCalls,
+                    Writer.dwBytes ? (DWORD) ((DWORDLONG) Writer.dwWriteCalls * 1024 / Writer.dwBytes) : 0,
+                    Writer.dwCallsSaved);
+    n += wsprintf(szStats + n, "TX pacing: %lu of %lu B/s, late %lu us, jitter %lu us\r\n",
+                    Writer.dwPaceRate, PACERATE(TTYInfo),
+                    Writer.dwPaceLate, Writer.dwPaceJitter);
+    //
+    // throughput from the last sample windows, efficiency against the line rate
+    //
+    MetricsGetStats(&Metrics);
+    n += wsprintf(szStats + n, "TX rate: %lu B/s, avg %lu, peak %lu, %lu%% of line\r\n",
+                    Metrics.dwTxRate, Metrics.dwTxAvg, Metrics.dwTxPeak,
+                    Metrics.dwLineRate ? (DWORD) ((ULONGLONG) Metrics.dwTxAvg * 100 / Metrics.dwLineRate) : 0);
+    n += wsprintf(szStats + n, "RX rate: %lu B/s, avg %lu, peak %lu, %lu%% of line\r\n",
+                    Metrics.dwRxRate, Metrics.dwRxAvg, Metrics.dwRxPeak,
+                    Metrics.dwLineRate ? (DWORD) ((ULONGLONG) Metrics.dwRxAvg * 100 / Metrics.dwLineRate) : 0);
+    WrPoolGetStats(&WrPool);
+    n += wsprintf(szStats + n, "TX packets: %lu of %lu, peak %lu, full %lu\r\n",
+                    WrPool.dwInUse, WrPool.dwNodes, WrPool.dwPeak, WrPool.dwFailures);
+
+    //
+    // repeated send, lateness is the scheduler wakeup after each deadline
+    //
+    TransferRepeatGetStats(&Repeat);
+    if (Repeat.dwPeriod) {
+        n += wsprintf(szStats + n, "Repeat: %lu sent, %lu overruns, %lu missed\r\n",
+                        Repeat.dwSent, Repeat.dwOverruns, Repeat.dwMissed);
+        n += wsprintf(szStats + n, "Repeat period: %lu us, avg %lu, max late %lu\r\n",
+                        Repeat.dwPeriod, Repeat.dwAvgPeriod, Repeat.dwMaxLate);
+        n += wsprintf(szStats + n, "Repeat late (us): <100 %lu, <500 %lu, <1000 %lu, "
+                        "<2000 %lu, <5000 %lu, more %lu\r\n",
+                        Repeat.dwLate[0], Repeat.dwLate[1], Repeat.dwLate[2],
+                        Repeat.dwLate[3], Repeat.dwLate[4], Repeat.dwLate[5]);
+    }
+
+    //
+    // capture sink, dropped bytes found every buffer waiting for the disk
+    //
+    CapSinkGetStats(&CapSink);
+    if (CapSink.dwBuffers) {
+        n += wsprintf(szStats + n, "Capture: %lu KB, written %lu KB, dropped %lu\r\n",
+                        CapSink.dwCapturedKB, CapSink.dwWrittenKB, CapSink.dwDropped);
+        n += wsprintf(szStats + n, "Capture queue: peak %lu of %lu, %lu writes, max %lu ms, %lu errors\r\n",
+                        CapSink.dwQueuedPeak, CapSink.dwBuffers, CapSink.dwWrites,
+                        CapSink.dwMaxWriteTime, CapSink.dwErrors);
+        if (CapSink.dwBlocks)
+            n += wsprintf(szStats + n, "Capture blocks: %lu\r\n", CapSink.dwBlocks);
+        if (CapSink.dwSegments)
+            n += wsprintf(szStats + n, "Capture segments: %lu, compressed %lu, deleted %lu\r\n",
+                            CapSink.dwSegments, CapSink.dwCompressed, CapSink.dwDeleted);
+    }
+
+    //
+    // capture replay, lag only into the tty window
+    //
+    ReplayGetStats(&Replay);
+    if (Replay.dwRecords) {
+        n += wsprintf(szStats + n, "Replay: %lu bytes, %lu records, %lu B/s\r\n",
+                        Replay.dwBytes, Replay.dwRecords, Replay.dwRate);
+        n += wsprintf(szStats + n, "Replay lag: avg %lu us, max %lu us, late max %lu us\r\n",
+                        Replay.dwLagAvg, Replay.dwLagMax, Replay.dwLateMax);
+    }
+
+    //
+    // tty repaints, every update not causing its own repaint was coalesced
+    //
+    n += wsprintf(szStats + n, "Repaints: %lu, paints: %lu\r\n",
+                    gRepaintStats.dwRepaints, gRepaintStats.dwPaints);
+    n += wsprintf(szStats + n, "Coalesced updates: %lu\r\n",
+                    gRepaintStats.dwUpdates - min(gRepaintStats.dwUpdates, gRepaintStats.dwRepaints));
+
+    //
+    // scrollback history, ratio in tenths
+    //
+    SbGetStats(&History);
+    n += wsprintf(szStats + n, "History: %lu lines, %lu blocks\r\n",
+                    History.dwLines, History.dwBlocks);
+    n += wsprintf(szStats + n, "History memory: %lu of %lu KB\r\n",
+                    History.dwBytes / 1024, History.dwBudget / 1024);
+    if (History.dwBytes)
+        n += wsprintf(szStats + n, "History ratio: %lu.%lu : 1\r\n",
+                        History.dwRawBytes / History.dwBytes,
+                        (DWORD) ((ULONGLONG) History.dwRawBytes * 10 / History.dwBytes % 10));
+
+    //
+    // last search, blocks skipped by the bloom filter weren't unpacked
+    //
+    SearchGetStats(&Search);
+    n += wsprintf(szStats + n, "Search: %lu hits, %lu ms%s\r\n",
+                    Search.dwHits, Search.dwTime, Search.fDone ? "" : " ...");
+    n += wsprintf(szStats + n, "Search skipped: %lu of %lu blocks\r\n",
+                    Search.dwSkipped, Search.dwBlocks);
+
+    //
+    // hex view, rate counts formatting only, not drawing
+    //
+    HexViewGetStats(&HexView);
+    n += wsprintf(szStats + n, "Hex log: %lu KB, %lu KB dropped, %lu errors\r\n",
+                    HexView.dwLogKB, HexView.dwDroppedKB, HexView.dwErrors);
+    n += wsprintf(szStats + n, "Hex rows: %lu, %lu rows/s\r\n",
+                    HexView.dwRows, HexView.dwRowsPerSec);
+
+    if (strcmp(szStats, szOldStats) == 0)
+        return;
+
+    strcpy(szOldStats, szStats);
+
+    hEdit = GetDlgItem(ghWndStatusDlg, IDC_STATSEDIT);
+    nFirstLine = (int) SendMessage(hEdit, EM_GETFIRSTVISIBLELINE, 0, 0);
+    SetWindowText(hEdit, szStats);
+    SendMessage(hEdit, EM_LINESCROLL, 0, nFirstLine);
+
+    return;
+}
@@ -14,14 +14,15 @@
     FUNCTIONS:
         TransferRepeatCreate   - Preps program for a repeated send
         TransferRepeatDestroy  - Completes a repeated send
+        TransferRepeatProc     - Scheduler thread for a repeated send
         TransferRepeatDo       - Sends the data to the writer thread
+        TransferRepeatGetStats - Repeated send statistics
         TransferFileTextStart  - Preps program for a text file send
         TransferFileTextEnd    - Completes a file transfer
         TransferThreadProc     - Thread procedure to do actual transfer
         TransferFileText       - Preps program for a text file send
         ReceiveFileText        - Preps program for a text file capture
         OpenTheFile            - Opens a file
-        CreateTheFile          - Creates a file
         GetTransferSizes       - Determines transfer metrics from file and buffer sizes
         ShowTransferStatistics - Displays transfer stats
         CheckForMessges        - Peek message check to keep things flowing
@@ -29,10 +30,38 @@
         SendFile               - Send a file
         CaptureFile            - Sets the receive state for file capture
 
+    A repeated send is run by a scheduler thread.  Deadlines are
+    absolute, the k-th send is due at start + k * period, so late
+    wakeups don't add up.  The thread waits on a waitable timer until
+    about a millisecond before a deadline and spins on the performance
+    counter for the rest.  If the previous block is still being sent
+    at a deadline the send is skipped and counted as an overrun;
+    deadlines that passed while the thread was held up are counted as
+    missed.  The lateness of each wakeup goes into a histogram for the
+    status window.
+
+    Files are sent from memory mapped views, not read into buffers.
+    The transfer thread keeps MAPVIEW_COUNT views of MAPVIEW_SIZE bytes
+    mapped and queues WRITE_FILE packets pointing into them.  Each
+    packet holds a reference on its view (MAPREF); a view is unmapped
+    and the next part of the file mapped in its place once the writer
+    has released all its packets.  So the memory used doesn't grow
+    with the file, and sizes are 64 bit.  A repeated send maps its
+    file once, as one view.
+
+    Mapped data is read from disk when first touched.  So the writer
+    thread doesn't wait on the disk, the transfer thread reads ahead:
+    while the write queue is full it maps the coming views and touches
+    their pages, READAHEAD_CHUNK bytes at a time, up to READAHEADKB
+    ahead of the data queued.  If the writer has room but the next
+    data isn't read yet, the read-ahead has fallen behind; these
+    starvations are counted and shown with the transfer statistics.
+
 -----------------------------------------------------------------------------*/
 
 #include <windows.h>
 #include <commctrl.h>
+#include <string.h>
 #include "mttty.h"
 
 //
@@ -41,18 +70,76 @@
 HANDLE hFile;
 HANDLE hTransferAbortEvent;
 HANDLE hTransferThread;
-UINT   uTimerId;
-MMRESULT mmTimer = (MMRESULT)NULL;
 char * lpBuf;
+
+//
+// streamed sends, MAPVIEW_SIZE is a multiple of the allocation
+// granularity (64 KB) and of MAPSEND_PACKET
+//
+#define MAPVIEW_SIZE    0x100000        // bytes per mapped view
+#define MAPVIEW_COUNT   4               // views mapped at a time
+#define MAPSEND_PACKET  WRITE_SLOT_SIZE // bytes per write request
+
+#define READAHEAD_CHUNK 0x10000         // bytes touched per step
+
+typedef struct MAPVIEW
+{
+    char *   lpBase;
+    MAPREF   Ref;                       // packets queued from the view
+} MAPVIEW;
+
+//
+// a streamed send; view n of the file is in Views[n % MAPVIEW_COUNT]
+//
+typedef struct MAPSTREAM
+{
+    HANDLE    hMap;
+    HANDLE    hViewEvent;               // set when a view is released
+    MAPVIEW   Views[MAPVIEW_COUNT];
+    ULONGLONG ullSize;
+    ULONGLONG ullQueued;                // bytes queued to the writer
+    ULONGLONG ullAhead;                 // bytes mapped and touched
+    DWORD     dwPageSize;
+} MAPSTREAM;
+
+#define READAHEAD_DONE      0
+#define READAHEAD_BLOCKED   1           // view still used by the writer
+#define READAHEAD_FAILED    2
+
+//
+// repeated send scheduler, the statistics are read by the UI thread
+//
+static struct
+{
+    HANDLE        hThread;
+    HANDLE        hStopEvent;       // manual reset, ends the thread
+    HANDLE        hTimer;
+    HANDLE        hMap;             // the file, lpBuf is its view
+    MAPREF        Ref;              // blocks queued from lpBuf
+    DWORD         dwSize;           // bytes in lpBuf
+    LARGE_INTEGER liFreq;
+    LONGLONG      llPeriod;         // performance counter ticks
+    LONGLONG      llPeriodSum;      // between releases, ticks
+    DWORD         dwPeriods;
+    REPEATSTATS   Stats;
+} gRepeat;
+
+//
+// upper bounds of the lateness histogram bins, us; the last is open
+//
+static const DWORD gdwLateBins[REPEAT_HIST_BINS - 1] = { 100, 500, 1000, 2000, 5000 };
+
 //
 // Prototypes for functions called only within this file
 //
 DWORD WINAPI TransferThreadProc(LPVOID);
+DWORD WINAPI TransferRepeatProc(LPVOID);
+BOOL TransferRepeatDo( void );
 HANDLE OpenTheFile( LPCTSTR );
-HANDLE CreateTheFile( LPCTSTR );
-void CaptureFile( HANDLE, HWND );
+void CaptureFile( void );
 UINT CheckForMessages( void );
-BOOL GetTransferSizes( HANDLE, DWORD *, DWORD *, DWORD *);
+BOOL GetTransferSizes( HANDLE, DWORD *, ULONGLONG *, ULONGLONG * );
+int TransferReadAhead( MAPSTREAM * );
 
 
 /*-----------------------------------------------------------------------------
@@ -63,13 +150,12 @@ PURPOSE: Prepares program for a repeated text file transfer (send)
 
 PARAMETERS:
     lpstrFileName - name of file selected to send
-    dwFrequency   - frequency of timer
+    dwFrequency   - period of the sends, ms
 
-COMMENTS: This function sets up a window timer to fire off
-          every so often.  When it fires, TransferRepeatDo is
-          called with the same name as above.  This causes the file transfer
-          to actuall take place.
-          TransferRepeatDestroy is called to kill the timer.
+COMMENTS: This function starts the scheduler thread, which calls
+          TransferRepeatDo at every deadline.  This causes the file
+          transfer to actually take place.
+          TransferRepeatDestroy is called to stop the thread.
           This function disables certain menu items that should not be
           available for the duration of a repeated send even if the actual
           Tx is not taking place.
@@ -82,10 +168,10 @@ void TransferRepeatCreate(LPCTSTR lpszFileName, DWORD dwFrequency)
 {
     HMENU hMenu;
     UINT  MenuFlags ;
-    DWORD dwFileSize;
-    DWORD dwMaxPackets;
+    ULONGLONG ullFileSize;
+    ULONGLONG ullPackets;
     DWORD dwPacketSize;
-    DWORD dwRead;
+    DWORD dwThreadId;
 
     //
     // open the file
@@ -110,36 +196,63 @@ void TransferRepeatCreate(LPCTSTR lpszFileName, DWORD dwFrequency)
     SetWindowText(GetDlgItem(ghWndStatusDlg, IDC_ABORTBTN), "Abort Tx");
     ShowWindow(GetDlgItem(ghWndStatusDlg, IDC_ABORTBTN), SW_SHOW);
 
-    if (!GetTransferSizes(hFile, &dwPacketSize, &dwMaxPackets, &dwFileSize)) {
+    ZeroMemory(&gRepeat, sizeof(gRepeat));
+
+    if (!GetTransferSizes(hFile, &dwPacketSize, &ullPackets, &ullFileSize)) {
         TransferRepeatDestroy();
         return;
     }
 
-    // Allocate a buffer
-    lpBuf = (char*)HeapAlloc(ghWriterHeap, 0, dwFileSize);
-    if (lpBuf == NULL) {
-        ErrorReporter("HeapAlloc (data block from writer heap).\r\nFile is too large");
+    //
+    // each send is one block, its size is a DWORD
+    //
+    if (ullFileSize == 0 || ullFileSize > MAXDWORD) {
+        MessageBox(ghwndMain, ullFileSize ? "File is too large to send repeatedly." :
+                   "File is empty.", "File Transfer Error", MB_OK);
         TransferRepeatDestroy();
         return;
     }
 
-    // fill the buffer
-    if (!ReadFile(hFile, lpBuf, dwFileSize, &dwRead, NULL)) {
-        ErrorReporter("Can't read from file\n");
+    // map the file, the blocks are sent from the view
+    gRepeat.hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (gRepeat.hMap == NULL) {
+        ErrorReporter("CreateFileMapping (repeated send)");
         TransferRepeatDestroy();
+        return;
     }
 
-    if (dwRead != dwFileSize)
-        ErrorReporter("Didn't read entire file\n");
+    lpBuf = (char *) MapViewOfFile(gRepeat.hMap, FILE_MAP_READ, 0, 0, 0);
+    if (lpBuf == NULL) {
+        ErrorReporter("MapViewOfFile (repeated send)");
+        TransferRepeatDestroy();
+        return;
+    }
+    gRepeat.dwSize = (DWORD) ullFileSize;
+
+    //
+    // start the scheduler
+    //
+    QueryPerformanceFrequency(&gRepeat.liFreq);
+    gRepeat.llPeriod = gRepeat.liFreq.QuadPart * max(dwFrequency, 1) / 1000;
+    gRepeat.Stats.dwPeriod = max(dwFrequency, 1) * 1000;
+
+    gRepeat.hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    gRepeat.hTimer = CreateWaitableTimer(NULL, TRUE, NULL);
+    gRepeat.Ref.hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (gRepeat.hStopEvent == NULL || gRepeat.hTimer == NULL || gRepeat.Ref.hEvent == NULL) {
+        ErrorReporter("CreateEvent (repeat scheduler)");
+        TransferRepeatDestroy();
+        return;
+    }
 
-    mmTimer = timeSetEvent((UINT) dwFrequency, 10, TransferRepeatDo, dwRead, TIME_PERIODIC);
-    if (mmTimer == (MMRESULT) NULL) {
-        ErrorReporter("Could not create mm timer");
+    gRepeat.hThread = CreateThread(NULL, 0, TransferRepeatProc, NULL, 0, &dwThreadId);
+    if (gRepeat.hThread == NULL) {
+        ErrorReporter("CreateThread (repeat scheduler)");
         TransferRepeatDestroy();
     }
     else {
         REPEATING(TTYInfo) = TRUE;
-        OutputDebugString("Timer setup.\n");
+        OutputDebugString("Repeat scheduler started.\n");
     }
 
     return;
@@ -151,7 +264,7 @@ FUNCTION: TransferRepeatDestroy( void )
 
 PURPOSE: Stops a repeated text file transfer (send)
 
-COMMENTS: Kills the repeated-send timer.
+COMMENTS: Stops the scheduler thread.
 
 HISTORY:   Date:      Author:     Comment:
             1/29/96   AllenD      Wrote it
@@ -161,25 +274,54 @@ void TransferRepeatDestroy()
 {
     HMENU hMenu;
     DWORD MenuFlags;
-    MMRESULT mmRes;
 
-    if (mmTimer != (MMRESULT) NULL) {
-        mmRes = timeKillEvent(mmTimer);
-        if (mmRes != TIMERR_NOERROR)
-            ErrorReporter("Can't kill mm timer");
-        mmTimer = (MMRESULT) NULL;
+    if (gRepeat.hThread) {
+        SetEvent(gRepeat.hStopEvent);
+        WaitForSingleObject(gRepeat.hThread, INFINITE);
+        CloseHandle(gRepeat.hThread);
+        gRepeat.hThread = NULL;
+    }
+    if (gRepeat.hStopEvent) {
+        CloseHandle(gRepeat.hStopEvent);
+        gRepeat.hStopEvent = NULL;
+    }
+    if (gRepeat.hTimer) {
+        CloseHandle(gRepeat.hTimer);
+        gRepeat.hTimer = NULL;
     }
 
     // close the file
     CloseHandle(hFile);
 
     // inform writer to abort all pending write requests
-    if (!WriterAddFirstNodeTimeout(WRITE_ABORT, 0, 0, NULL, NULL, NULL, 500))
+    if (!WriterAddUrgentNodeTimeout(WRITE_ABORT, 0, 0, NULL, NULL, NULL, 500))
         ErrorReporter("Couldn't inform writer to abort sending.");
 
-    // free the buffer
-    if (!HeapFree(ghWriterHeap, 0, lpBuf))
-        ErrorReporter("HeapFree (data block from writer heap)");
+    //
+    // unmap the file once the writer has released the blocks,
+    // leave it mapped if the writer doesn't let go
+    //
+    if (gRepeat.Ref.hEvent) {
+        while (gRepeat.Ref.lRefs)
+            if (WaitForSingleObject(gRepeat.Ref.hEvent, 3000) != WAIT_OBJECT_0)
+                break;
+    }
+
+    if (lpBuf) {
+        if (gRepeat.Ref.lRefs == 0)
+            UnmapViewOfFile(lpBuf);
+        else
+            ErrorReporter("Repeated send buffer still in use");
+        lpBuf = NULL;
+    }
+    if (gRepeat.hMap) {
+        CloseHandle(gRepeat.hMap);
+        gRepeat.hMap = NULL;
+    }
+    if (gRepeat.Ref.hEvent && gRepeat.Ref.lRefs == 0) {
+        CloseHandle(gRepeat.Ref.hEvent);
+        gRepeat.Ref.hEvent = NULL;
+    }
 
     REPEATING(TTYInfo) = FALSE;
     OutputDebugString("Repeated transfer destroyed.\r\n");
@@ -201,27 +343,145 @@ void TransferRepeatDestroy()
 
 /*-----------------------------------------------------------------------------
 
+FUNCTION: TransferRepeatProc(LPVOID)
+
+PURPOSE: Scheduler thread for a repeated send
+
+COMMENTS: Ends on the stop event, or on the thread exit event when
+          the port is closed.  Uses write request packets, so the
+          pool cache is given back before exit.
+
+-----------------------------------------------------------------------------*/
+DWORD WINAPI TransferRepeatProc(LPVOID lpV)
+{
+    LARGE_INTEGER liNow, liDue;
+    LONGLONG llFreq = gRepeat.liFreq.QuadPart;
+    LONGLONG llStart, llDue, llLast, llNext;
+    LONGLONG k = 1;
+    HANDLE hWait[3];
+    DWORD dwLate, i;
+
+    hWait[0] = gRepeat.hTimer;
+    hWait[1] = gRepeat.hStopEvent;
+    hWait[2] = ghThreadExitEvent;
+
+    timeBeginPeriod(1);
+    QueryPerformanceCounter(&liNow);
+    llStart = llLast = liNow.QuadPart;
+
+    for ( ; ; ) {
+        llDue = llStart + k * gRepeat.llPeriod;
+
+        //
+        // timer to a millisecond before the deadline, spin the rest
+        //
+        QueryPerformanceCounter(&liNow);
+        if (llDue - liNow.QuadPart > llFreq / 1000 * 2) {
+            liDue.QuadPart = -((llDue - liNow.QuadPart - llFreq / 1000) * 10000000 / llFreq);
+            if (!SetWaitableTimer(gRepeat.hTimer, &liDue, 0, NULL, NULL, FALSE)) {
+                ErrorReporter("SetWaitableTimer (repeat scheduler)");
+                break;
+            }
+            if (WaitForMultipleObjects(3, hWait, FALSE, INFINITE) != WAIT_OBJECT_0)
+                break;
+        }
+        else if (WaitForMultipleObjects(2, hWait + 1, FALSE, 0) != WAIT_TIMEOUT)
+            break;
+
+        do
+            QueryPerformanceCounter(&liNow);
+        while (liNow.QuadPart < llDue);
+
+        //
+        // lateness and period measured
+        //
+        dwLate = (DWORD) ((liNow.QuadPart - llDue) * 1000000 / llFreq);
+        for (i = 0; i < REPEAT_HIST_BINS - 1 && dwLate >= gdwLateBins[i]; i++)
+            ;
+        gRepeat.Stats.dwLate[i]++;
+        gRepeat.Stats.dwMaxLate = max(gRepeat.Stats.dwMaxLate, dwLate);
+
+        gRepeat.llPeriodSum += liNow.QuadPart - llLast;
+        gRepeat.dwPeriods++;
+        gRepeat.Stats.dwAvgPeriod = (DWORD) (gRepeat.llPeriodSum * 1000000 /
+                                             gRepeat.dwPeriods / llFreq);
+        llLast = liNow.QuadPart;
+
+        //
+        // skip the send while the last block is still going out
+        //
+        if (WriterBusy())
+            gRepeat.Stats.dwOverruns++;
+        else if (TransferRepeatDo())
+            gRepeat.Stats.dwSent++;
+        else {
+            PostMessage(ghwndMain, WM_COMMAND, ID_TRANSFER_ABORTSENDING, MAKELPARAM(IDC_ABORTBTN, 0) );
+            break;
+        }
+
+        //
+        // next deadline; those already passed are missed
+        //
+        k++;
+        QueryPerformanceCounter(&liNow);
+        if (liNow.QuadPart >= llStart + k * gRepeat.llPeriod) {
+            llNext = (liNow.QuadPart - llStart) / gRepeat.llPeriod + 1;
+            gRepeat.Stats.dwMissed += (DWORD) (llNext - k);
+            k = llNext;
+        }
+    }
+
+    timeEndPeriod(1);
+    WrPoolThreadExit();
+
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+
 FUNCTION: TransferRepeatDo( void )
 
 PURPOSE: Performs a single text file transfer (send)
 
-COMMENTS: Allocates a block to hold the file.
-          Prepares the writer packet.
+RETURN: FALSE if the block could not be queued
+
+COMMENTS: Prepares the writer packet, the block is the mapped
+          file, shared by all sends and unmapped by
+          TransferRepeatDestroy.
 
 HISTORY:   Date:      Author:     Comment:
             1/29/96   AllenD      Wrote it
 
 -----------------------------------------------------------------------------*/
-void CALLBACK TransferRepeatDo( UINT uTimerId,
-                                        UINT uRes,
-                                        DWORD dwFileSize,
-                                        DWORD dwRes1,
-                                        DWORD dwRes2)
+BOOL TransferRepeatDo()
 {
-    if (!WriterAddNewNodeTimeout(WRITE_BLOCK, dwFileSize, 0, lpBuf, 0, 0, 10))
-        PostMessage(ghwndMain, WM_COMMAND, ID_TRANSFER_ABORTSENDING, MAKELPARAM(IDC_ABORTBTN, 0) );
+    PWRITEREQUEST pWrite;
 
-    return;
+    pWrite = WrPoolAlloc();
+    if (pWrite == NULL) {
+        ErrorReporter("WrPoolAlloc (repeated send)");
+        return FALSE;
+    }
+
+    return WriterAddMappedNode(pWrite, WRITE_BLOCK, gRepeat.dwSize, lpBuf, &gRepeat.Ref, NULL);
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TransferRepeatGetStats(REPEATSTATS *)
+
+PURPOSE: Returns the repeated send statistics
+
+PARAMETERS:
+    pStats - structure to fill in
+
+COMMENTS: Read without locking, the numbers may be one send apart.
+          The last run's numbers stay until the next one starts.
+
+-----------------------------------------------------------------------------*/
+void TransferRepeatGetStats(REPEATSTATS * pStats)
+{
+    *pStats = gRepeat.Stats;
 }
 
 /*-----------------------------------------------------------------------------
@@ -365,12 +625,16 @@ void ReceiveFileText(LPCTSTR lpstrFileName)
 {
     HMENU hMenu;
     UINT MenuFlags ;
+    LPCTSTR lpExt;
+    BOOL fFormat;
 
     //
-    // create the file
+    // create the file, the sink thread writes it;
+    // a .MTC file is a timestamped capture
     //
-    ghFileCapture = CreateTheFile(lpstrFileName);
-    if (ghFileCapture == INVALID_HANDLE_VALUE)
+    lpExt = strrchr(lpstrFileName, '.');
+    fFormat = lpExt && lstrcmpi(lpExt, CAPFMT_EXT) == 0;
+    if (!CapSinkOpen(lpstrFileName, GetDlgItem(ghWndStatusDlg, IDC_TRANSFERPROGRESS), fFormat))
         return;
 
     /*
@@ -400,7 +664,7 @@ void ReceiveFileText(LPCTSTR lpstrFileName)
     //
     // send file until done or abort
     //
-    CaptureFile(ghFileCapture, GetDlgItem(ghWndStatusDlg, IDC_TRANSFERPROGRESS));
+    CaptureFile();
 
     //
     // enable menu
@@ -424,7 +688,7 @@ void ReceiveFileText(LPCTSTR lpstrFileName)
 
     gfAbortTransfer = FALSE;
 
-    CloseHandle(ghFileCapture);
+    CapSinkClose();
 
     return; // returns when file transfer is complete or aborted
 }
@@ -456,32 +720,7 @@ HANDLE OpenTheFile(LPCTSTR lpFName)
 
 /*-----------------------------------------------------------------------------
 
-FUNCTION: CreateTheFile(LPCTSTR)
-
-PURPOSE: Creates a file and returns the file handle
-
-PARAMETERS:
-    lpFName - name of file to create
-
-HISTORY:   Date:      Author:     Comment:
-           10/27/95   AllenD      Wrote it
-
------------------------------------------------------------------------------*/
-HANDLE CreateTheFile(LPCTSTR lpFName)
-{
-    HANDLE hTemp;
-
-    hTemp = CreateFile(lpFName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0,NULL);
-
-    if (hTemp == INVALID_HANDLE_VALUE)
-        ErrorReporter("CreateFile");
-
-    return hTemp;
-}
-
-/*-----------------------------------------------------------------------------
-
-FUNCTION: GetTransferSizes(HANDLE, DWORD *, DWORD *, DWORD *)
+FUNCTION: GetTransferSizes(HANDLE, DWORD *, ULONGLONG *, ULONGLONG *)
 
 PURPOSE: Examines file and determines packet size, number of packets,
          and file size.
@@ -489,22 +728,22 @@ PURPOSE: Examines file and determines packet size, number of packets,
 PARAMETERS:
     hFile - handle of file to get size information from
     pdwDataPacketSize - size of an individual data packet
-    pdwNumPackets     - total number of packets
-    pdwFileSize       - size of file
+    pullNumPackets    - total number of packets
+    pullFileSize      - size of file
 
 RETURN:
     TRUE  - all metrics could be determined
     FALSE - something wrong with the file metrics, can't transfer
 
 COMMENTS:
-    This module can't handle files that are extremely large, so
-    it may return FALSE if a large file is specified.
+    Sizes are 64 bit, files are streamed from mapped views so
+    there is no size limit.
 
 HISTORY:   Date:      Author:     Comment:
            10/27/95   AllenD      Wrote it
 
 -----------------------------------------------------------------------------*/
-BOOL GetTransferSizes(HANDLE hFile, DWORD * pdwDataPacketSize, DWORD * pdwNumPackets, DWORD * pdwFileSize)
+BOOL GetTransferSizes(HANDLE hFile, DWORD * pdwDataPacketSize, ULONGLONG * pullNumPackets, ULONGLONG * pullFileSize)
 {
     BY_HANDLE_FILE_INFORMATION fi;
 
@@ -512,57 +751,70 @@ BOOL GetTransferSizes(HANDLE hFile, DWORD * pdwDataPacketSize, DWORD * pdwNumPac
         ErrorReporter("GetFileInformationByHandle");
         return FALSE;
     }
-    else {
-        if (fi.nFileSizeHigh) {
-            MessageBox(ghwndMain, "File is too large to transfer.", "File Transfer Error", MB_OK);
-            return FALSE;
-        }
 
-        //
-        // setup packet size, file size and compute the number of packets
-        //
-        *pdwDataPacketSize = MAX_WRITE_BUFFER;
-        *pdwFileSize = fi.nFileSizeLow;
-        *pdwNumPackets = *pdwFileSize / *pdwDataPacketSize;
+    //
+    // setup packet size, file size and compute the number of packets
+    //
+    *pdwDataPacketSize = MAPSEND_PACKET;
+    *pullFileSize = ((ULONGLONG) fi.nFileSizeHigh << 32) | fi.nFileSizeLow;
+    *pullNumPackets = (*pullFileSize + *pdwDataPacketSize - 1) / *pdwDataPacketSize;
 
-        if (*pdwNumPackets > 65534) {
-            MessageBox(ghwndMain, "File is too large for buffer size.", "File Transfer Error", MB_OK);
-            return FALSE;
-        }
-    }
     return TRUE;
 }
 
 /*-----------------------------------------------------------------------------
 
-FUNCTION: ShowTransferStatistics(DWORD, DWORD, DWORD)
+FUNCTION: ShowTransferStatistics(ULONGLONG, ULONGLONG, ULONGLONG, DWORD, DWORD)
 
-PURPOSE: Displays bytes transferred and bytes per second
+PURPOSE: Displays bytes transferred, bytes per second and efficiency
 
 PARAMETERS:
-    dwEnd              - ending time in milliseconds
-    dwStart            - starting time
-    dwBytesTransferred - bytes sent
+    ullEnd             - ending time in microseconds (MetricsMicroseconds)
+    ullStart           - starting time
+    ullBytesTransferred - bytes sent
+    dwStarved          - times the read-ahead fell behind the writer
+    dwStarvedTime      - time spent catching up, ms
+
+COMMENTS: Efficiency is the rate as a percentage of the line rate
+          of the port settings (MetricsLineRate).
 
 HISTORY:   Date:      Author:     Comment:
            10/27/95   AllenD      Wrote it
 
 -----------------------------------------------------------------------------*/
-void ShowTransferStatistics(DWORD dwEnd, DWORD dwStart, DWORD dwBytesTransferred)
+void ShowTransferStatistics(ULONGLONG ullEnd, ULONGLONG ullStart, ULONGLONG ullBytesTransferred,
+                            DWORD dwStarved, DWORD dwStarvedTime)
 {
-    char szTemp[100];
-    DWORD dwSecs;
-
-    dwSecs = (dwEnd - dwStart) / 1000;
+    char szTemp[160];
+    ULONGLONG ullTime;
+    DWORD dwRate, dwLineRate;
 
     //
-    // display only if dwSecs != 0; if dwSecs == 0, then divide by zero occurs.
+    // microsecond timing, so short transfers get a rate too
     //
-    if (dwSecs != 0) {
-        wsprintf(szTemp, "Bytes transferred: %d\r\nBytes/Second: %d\r\n", dwBytesTransferred, dwBytesTransferred / dwSecs);
+    ullTime = ullEnd - ullStart;
+    if (ullTime != 0) {
+        dwRate = (DWORD) (ullBytesTransferred * 1000000 / ullTime);
+        dwLineRate = MetricsLineRate();
+
+        if (ullBytesTransferred <= MAXDWORD)
+            wsprintf(szTemp, "Bytes transferred: %lu in %lu.%03lu s\r\n",
+                     (DWORD) ullBytesTransferred,
+                     (DWORD) (ullTime / 1000000), (DWORD) (ullTime / 1000 % 1000));
+        else
+            wsprintf(szTemp, "KB transferred: %lu in %lu.%03lu s\r\n",
+                     (DWORD) (ullBytesTransferred / 1024),
+                     (DWORD) (ullTime / 1000000), (DWORD) (ullTime / 1000 % 1000));
+        UpdateStatus(szTemp);
+
+        wsprintf(szTemp, "Bytes/Second: %lu, %lu%% of line rate\r\n",
+                 dwRate, dwLineRate ? (DWORD) ((ULONGLONG) dwRate * 100 / dwLineRate) : 0);
         UpdateStatus(szTemp);
     }
 
+    wsprintf(szTemp, "Read-ahead starved: %lu times, %lu ms\r\n", dwStarved, dwStarvedTime);
+    UpdateStatus(szTemp);
+
     return;
 }
 
@@ -618,21 +870,18 @@ UINT CheckForMessages()
 
 /*-----------------------------------------------------------------------------
 
-FUNCTION: CaptureFile(HANDLE, HWND)
+FUNCTION: CaptureFile
 
 PURPOSE: Receives a file
 
-PARAMETERS:
-    hFile - handle of file to receive the data being captured (not used)
-    hWndProgress - window handle of progress bar (not used)
-
-COMMENTS: Sets the receive state and waits for capture to end
+COMMENTS: Sets the receive state and waits for capture to end.
+          The reader thread hands the data to the capture sink.
 
 HISTORY:   Date:      Author:     Comment:
            10/27/95   AllenD      Wrote it
 
 -----------------------------------------------------------------------------*/
-void CaptureFile(HANDLE hFile, HWND hWndProgress)
+void CaptureFile()
 {
     UINT uMsgResult;
     gdwReceiveState = RECEIVE_CAPTURED;
@@ -672,6 +921,8 @@ COMMENTS: Function allows the hTransferAbortEvent to
           signal an abort condition.
           If the thread finishes OK, then the thread
           calls the TransferFileTextEnd function itself.
+          The file is sent from a window of mapped views,
+          see the module header.
 
 HISTORY:   Date:      Author:     Comment:
            1/26/96   AllenD      Wrote it
@@ -679,33 +930,51 @@ HISTORY:   Date:      Author:     Comment:
 -----------------------------------------------------------------------------*/
 DWORD WINAPI TransferThreadProc(LPVOID lpV)
 {
-    DWORD  dwPacketSize, dwMaxPackets, dwFileSize;
-    DWORD  dwStartTime;
+    DWORD  dwPacketSize, dwFileSize;
+    ULONGLONG ullPackets;
+    ULONGLONG ullStartTime;
+    DWORD  dwStarved = 0, dwStarvedTime = 0, dwStarveStart = 0;
+    ULONGLONG ullReadAhead = READAHEADKB(TTYInfo) * (ULONGLONG) 1024;
     HWND   hWndProgress;
     HANDLE hFileHandle;
-    HANDLE hDataHeap;
-    BOOL fStarted = TRUE;
+    MAPSTREAM Stream;
+    SYSTEM_INFO sysInfo;
+    BOOL fStarving = FALSE;
+    BOOL fLeaked = FALSE;
     BOOL fAborting = FALSE;
+    int i;
 
     hFileHandle = (HANDLE) lpV;
     hWndProgress = GetDlgItem(ghWndStatusDlg, IDC_TRANSFERPROGRESS);
 
+    ZeroMemory(&Stream, sizeof(Stream));
+    GetSystemInfo(&sysInfo);
+    Stream.dwPageSize = sysInfo.dwPageSize;
+
     // set up transfer metrics
-    if (!GetTransferSizes(hFileHandle, &dwPacketSize, &dwMaxPackets, &dwFileSize))
+    if (!GetTransferSizes(hFileHandle, &dwPacketSize, &ullPackets, &Stream.ullSize))
         fAborting = TRUE;
     else {
-        SendMessage(hWndProgress, PBM_SETRANGE, 0, MAKELPARAM(0, dwMaxPackets+1));
+        SendMessage(hWndProgress, PBM_SETRANGE32, 0, (LPARAM) min(ullPackets + 1, 0x7FFFFFFF));
         SendMessage(hWndProgress, PBM_SETSTEP, (WPARAM) 1, 0);
         SendMessage(hWndProgress, PBM_SETPOS, 0, 0);
     }
+    dwFileSize = (DWORD) min(Stream.ullSize, MAXDWORD);
 
-    // set up transfer heaps
-    if (!fAborting) {
-        SYSTEM_INFO sysInfo;
-        GetSystemInfo(&sysInfo);
-        hDataHeap = HeapCreate(0, sysInfo.dwPageSize * 2, sysInfo.dwPageSize * 10);
-        if (hDataHeap == NULL) {
-            ErrorReporter("HeapCreate (Data Heap)");
+    // set up the views, the event is set when a view is released
+    Stream.hViewEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (Stream.hViewEvent == NULL) {
+        ErrorReporter("CreateEvent (view released event)");
+        fAborting = TRUE;
+    }
+    for (i = 0; i < MAPVIEW_COUNT; i++)
+        Stream.Views[i].Ref.hEvent = Stream.hViewEvent;
+
+    // map the file, an empty file can't be mapped
+    if (!fAborting && Stream.ullSize) {
+        Stream.hMap = CreateFileMapping(hFileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (Stream.hMap == NULL) {
+            ErrorReporter("CreateFileMapping");
             fAborting = TRUE;
         }
     }
@@ -719,67 +988,90 @@ DWORD WINAPI TransferThreadProc(LPVOID lpV)
     OutputDebugString("Xfer: About to start sending data\n");
 
     // Get Transfer Start Time
-    dwStartTime = GetTickCount();
+    ullStartTime = MetricsMicroseconds();
 
     if (WaitForSingleObject(hTransferAbortEvent, 0) == WAIT_OBJECT_0)
         fAborting = TRUE;
 
-    while (!fAborting) {
-        char * lpDataBuf;
+    while (!fAborting && Stream.ullQueued < Stream.ullSize) {
+        MAPVIEW * pView;
         PWRITEREQUEST pWrite;
+        HANDLE hWait[3];
+        DWORD dwRes, dwPacket;
 
-        // transfer file, loop until all blocks of file have been read
-        lpDataBuf = (char*)HeapAlloc(hDataHeap, 0, dwPacketSize);
-        pWrite = (PWRITEREQUEST)HeapAlloc(ghWriterHeap, 0, sizeof(WRITEREQUEST));
-        if ((lpDataBuf != NULL) && (pWrite != NULL)) {
-
-            DWORD dwRead;
-
-            // read from file into new buffer
-            if (ReadFile(hFileHandle, lpDataBuf, dwPacketSize, &dwRead, NULL)) {
-                WriterAddExistingNode(pWrite, WRITE_FILE, dwRead, 0, lpDataBuf, hDataHeap, hWndProgress);
+        hWait[0] = ghWriterRoomEvent;
+        hWait[1] = hTransferAbortEvent;
+        hWait[2] = Stream.hViewEvent;
 
-                if (dwRead != dwPacketSize) // eof
-                    break;
+        //
+        // the next data must be read first; when the writer got
+        // ahead of the read-ahead, count a starvation
+        //
+        if (Stream.ullAhead <= Stream.ullQueued) {
+            if (Stream.ullQueued && !fStarving) {
+                fStarving = TRUE;
+                dwStarved++;
+                dwStarveStart = GetTickCount();
             }
+            dwRes = TransferReadAhead(&Stream);
+            if (dwRes == READAHEAD_FAILED)
+                fAborting = TRUE;
+            else if (dwRes == READAHEAD_BLOCKED &&
+                     WaitForMultipleObjects(2, hWait + 1, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+                fAborting = TRUE;
+            continue;
         }
-        else {
-            BOOL fRes;
-            /*
-                Either the data heap is full, or the writer heap is full.
-                Free any allocated block, wait a little and try again.
 
-                Waiting lets the writer thread send some blocks and free
-                the data blocks from the data heap and the control
-                blocks from the writer heap.
-            */
-            if (lpDataBuf) {
-                EnterCriticalSection(&gcsDataHeap);
-                fRes = HeapFree(hDataHeap, 0, lpDataBuf);
-                LeaveCriticalSection(&gcsDataHeap);
-                if (!fRes)
-                    ErrorReporter("HeapFree (Data block)");
-            }
+        if (fStarving) {
+            fStarving = FALSE;
+            dwStarvedTime += GetTickCount() - dwStarveStart;
+        }
 
-            if (pWrite) {
-                EnterCriticalSection(&gcsWriterHeap);
-                fRes = HeapFree(ghWriterHeap, 0, pWrite);
-                LeaveCriticalSection(&gcsWriterHeap);
-                if (!fRes)
-                    ErrorReporter("HeapFree (Writer block)");
+        //
+        // while the write queue is above its watermarks, read ahead;
+        // with nothing to read, wait for room or a view released
+        //
+        dwRes = WaitForMultipleObjects(2, hWait, FALSE, 0);
+        if (dwRes == WAIT_TIMEOUT) {
+            if (Stream.ullAhead < min(Stream.ullSize, Stream.ullQueued + ullReadAhead)) {
+                dwRes = TransferReadAhead(&Stream);
+                if (dwRes == READAHEAD_FAILED)
+                    fAborting = TRUE;
+                if (dwRes != READAHEAD_BLOCKED)
+                    continue;
             }
+            if (WaitForMultipleObjects(3, hWait, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+                fAborting = TRUE;
+            continue;
+        }
+        if (dwRes != WAIT_OBJECT_0) {
+            fAborting = TRUE;
+            break;
+        }
 
-            OutputDebugString("Xfer: A heap is full.  Waiting...\n");
-
-            // wait a little
-            // check for abort during the wait
+        pWrite = WrPoolAlloc();
+        if (pWrite == NULL) {
+            /*
+                The write request pool is empty.  Wait a little
+                and try again, the writer thread sends some blocks
+                and frees their packets back to the pool.
+            */
+            OutputDebugString("Xfer: The packet pool is empty.  Waiting...\n");
             if (WaitForSingleObject(hTransferAbortEvent, 200) == WAIT_OBJECT_0)
                 fAborting = TRUE;
+            continue;
         }
 
-        // has the user aborted?
-        if (WaitForSingleObject(hTransferAbortEvent, 0) == WAIT_OBJECT_0)
-            fAborting = TRUE;
+        //
+        // queue a packet, the data isn't copied; packets don't cross
+        // views, MAPSEND_PACKET divides MAPVIEW_SIZE
+        //
+        pView = &Stream.Views[(Stream.ullQueued / MAPVIEW_SIZE) % MAPVIEW_COUNT];
+        dwPacket = (DWORD) min(Stream.ullAhead - Stream.ullQueued, dwPacketSize);
+        WriterAddMappedNode(pWrite, WRITE_FILE, dwPacket,
+                            pView->lpBase + (DWORD) (Stream.ullQueued % MAPVIEW_SIZE),
+                            &pView->Ref, hWndProgress);
+        Stream.ullQueued += dwPacket;
     }
 
     OutputDebugString("Xfer: Done sending packets.\n");
@@ -788,7 +1080,7 @@ DWORD WINAPI TransferThreadProc(LPVOID lpV)
         // inform writer that transfer is aborting
 
         OutputDebugString("Xfer: Sending Abort Packet to writer\n");
-        WriterAddFirstNodeTimeout(WRITE_ABORT, dwFileSize, 0, NULL, NULL, NULL, 500);
+        WriterAddUrgentNodeTimeout(WRITE_ABORT, dwFileSize, 0, NULL, NULL, NULL, 500);
     }
     else
         WriterAddNewNodeTimeout(WRITE_FILEEND, dwFileSize, 0, NULL, NULL, NULL, 500);
@@ -797,7 +1089,7 @@ DWORD WINAPI TransferThreadProc(LPVOID lpV)
         // wait til writer thread finishes with all blocks
         HANDLE hEvents[2];
         DWORD dwRes;
-        BOOL  fTransferComplete;
+        BOOL  fTransferComplete = FALSE;
 
         hEvents[0] = ghTransferCompleteEvent;
         hEvents[1] = hTransferAbortEvent;
@@ -816,7 +1108,7 @@ DWORD WINAPI TransferThreadProc(LPVOID lpV)
                 fAborting = TRUE;
                 OutputDebugString("Transfer abort signal rec'd\n");
                 OutputDebugString("Xfer: Sending Abort Packet to writer\n");
-                if (!WriterAddFirstNodeTimeout(WRITE_ABORT, dwFileSize, 0, NULL, NULL, NULL, 500))
+                if (!WriterAddUrgentNodeTimeout(WRITE_ABORT, dwFileSize, 0, NULL, NULL, NULL, 500))
                     ErrorReporter("Can't add abort packet\n");
                 break;
             case WAIT_TIMEOUT:                                   break;
@@ -832,16 +1124,30 @@ DWORD WINAPI TransferThreadProc(LPVOID lpV)
 
     // report statistics
     if (!fAborting)
-        ShowTransferStatistics(GetTickCount(), dwStartTime, dwFileSize);
+        ShowTransferStatistics(MetricsMicroseconds(), ullStartTime, Stream.ullSize,
+                               dwStarved, dwStarvedTime);
 
     // break down metrics
     PostMessage(hWndProgress, PBM_SETPOS, 0, 0);
 
-    // break down heaps
-    if (hDataHeap != NULL) {
-        if (!HeapDestroy(hDataHeap))
-            ErrorReporter("HeapDestroy (data heap)");
+    // unmap the views, the writer has released their packets by now
+    for (i = 0; i < MAPVIEW_COUNT; i++) {
+        if (Stream.Views[i].lpBase == NULL)
+            continue;
+        if (Stream.Views[i].Ref.lRefs == 0)
+            UnmapViewOfFile(Stream.Views[i].lpBase);
+        else {
+            OutputDebugString("Xfer: view still in use, left mapped\n");
+            fLeaked = TRUE;
+        }
     }
+    if (Stream.hMap != NULL)
+        CloseHandle(Stream.hMap);
+    if (Stream.hViewEvent != NULL && !fLeaked)
+        CloseHandle(Stream.hViewEvent);
+
+    // return cached packets to the write request pool
+    WrPoolThreadExit();
 
     // If I am done without user intervention, then post the
     // "abort" message myself.  This will cause the main thread to
@@ -854,3 +1160,59 @@ DWORD WINAPI TransferThreadProc(LPVOID lpV)
     return 0;
 }
 
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TransferReadAhead(MAPSTREAM *)
+
+PURPOSE: Reads the next READAHEAD_CHUNK bytes of a streamed send
+
+PARAMETERS:
+    pStream - the send
+
+RETURN:
+    READAHEAD_DONE    - the chunk is in memory
+    READAHEAD_BLOCKED - its view is still used by the writer, wait
+                        for the view released event and try again
+    READAHEAD_FAILED  - the view can't be mapped
+
+COMMENTS: Maps a view when the chunk starts one, in the place of the
+          view MAPVIEW_COUNT views back.  Touching a byte of each page
+          reads the page in, here rather than in the writer thread.
+
+-----------------------------------------------------------------------------*/
+int TransferReadAhead(MAPSTREAM * pStream)
+{
+    MAPVIEW * pView;
+    DWORD dwOffset, dwChunk, dwSize, i;
+    char volatile * lpData;
+
+    pView = &pStream->Views[(pStream->ullAhead / MAPVIEW_SIZE) % MAPVIEW_COUNT];
+    dwOffset = (DWORD) (pStream->ullAhead % MAPVIEW_SIZE);
+
+    if (dwOffset == 0) {
+        if (pView->Ref.lRefs)
+            return READAHEAD_BLOCKED;
+
+        if (pView->lpBase)
+            UnmapViewOfFile(pView->lpBase);
+
+        dwSize = (DWORD) min(pStream->ullSize - pStream->ullAhead, MAPVIEW_SIZE);
+        pView->lpBase = (char *) MapViewOfFile(pStream->hMap, FILE_MAP_READ,
+                                    (DWORD) (pStream->ullAhead >> 32),
+                                    (DWORD) pStream->ullAhead, dwSize);
+        if (pView->lpBase == NULL) {
+            ErrorReporter("MapViewOfFile");
+            return READAHEAD_FAILED;
+        }
+    }
+
+    dwChunk = (DWORD) min(pStream->ullSize - pStream->ullAhead, READAHEAD_CHUNK);
+
+    lpData = pView->lpBase + dwOffset;
+    for (i = 0; i < dwChunk; i += pStream->dwPageSize)
+        (void) lpData[i];
+
+    pStream->ullAhead += dwChunk;
+
+    return READAHEAD_DONE;
+}
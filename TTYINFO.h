@@ -42,11 +42,22 @@
 //
 #define ASCII_BEL       0x07
 #define ASCII_BS        0x08
+#define ASCII_HT        0x09
 #define ASCII_LF        0x0A
+#define ASCII_VT        0x0B
+#define ASCII_FF        0x0C
 #define ASCII_CR        0x0D
+#define ASCII_ESC       0x1B
 #define ASCII_XON       0x11
 #define ASCII_XOFF      0x13
 
+//
+// cell attributes, colors are indexes into the ANSI palette
+//
+#define ATTR_DEFCOLOR   16      // font color / window background
+#define ATTR_BOLD       0x01
+#define ATTR_UNDERLINE  0x02
+#define ATTR_REVERSE    0x04
 //
 // data structures
 //
@@ -55,6 +66,28 @@ struct TTYInfoStruct
     HANDLE  hCommPort, hReaderStatus, hWriter ;
     DWORD   dwEventFlags;
     CHAR    Screen[MAXCOLS * MAXROWS];
+    BYTE    Fg[MAXCOLS * MAXROWS];      // cell attributes, same layout
+    BYTE    Bg[MAXCOLS * MAXROWS];      // as Screen
+    BYTE    Flags[MAXCOLS * MAXROWS];
+    BYTE    bPenFg, bPenBg, bPenFlags;  // attributes for new characters
+    int     nScreenTop;         // slot in Screen holding row 0
+    DWORD   dwDirtyRows[(MAXROWS + 31) / 32];   // rows changed since repaint
+    int     nDamageLeft, nDamageRight;          // columns changed since repaint
+    int     nScrollPending;                     // lines scrolled since repaint
+    DWORD   dwRepaintRate;                      // max repaints per second
+    DWORD   dwLastRepaint;
+    BOOL    fRepaintTimer;
+    DWORD   dwHistoryMB;                        // scrollback memory limit
+    DWORD   dwTxHighKB, dwTxLowKB;              // write queue watermarks
+    DWORD   dwCoalesceMs, dwCoalesceBytes;      // typed char coalescing
+    DWORD   dwPasteDelay;                       // ms after each pasted line
+    DWORD   dwPaceRate;                         // transmit bytes/s, 0 = any
+    DWORD   dwPaceCharGap, dwPaceLineDelay;     // ms between chars, after lines
+    DWORD   dwReadAheadKB;                      // file send read-ahead
+    DWORD   dwReplaySpeed;                      // % of capture timing, 0 = max
+    DWORD   dwRotateMB, dwRotateMin;            // capture segment limits
+    DWORD   dwRotateBudgetMB;                   // closed segments on disk
+    BOOL    fRotateCompress;
     CHAR    chFlag, chXON, chXOFF;
     WORD    wXONLimit, wXOFFLimit;
     DWORD   fRtsControl;
@@ -66,11 +99,12 @@ struct TTYInfoStruct
             fXonXoffOutFlow, fXonXoffInFlow,
             fTXafterXoffSent,
             fNoReading, fNoWriting, fNoEvents, fNoStatus,
-            fDisplayTimeouts, fNonPrintHex, fAllHex;
+            fDisplayTimeouts, fNonPrintHex, fAllHex,
+            fAnsi;
     BYTE    bPort, bByteSize, bParity, bStopBits ;
     DWORD   dwBaudRate ;
     WORD    wCursorState ;
-    HFONT   hTTYFont ;
+    HFONT   hTTYFont, hTTYFontUnderline ;
     LOGFONT lfTTYFont ;
     DWORD   rgbFGColor ;
     COMMTIMEOUTS timeoutsorig;
@@ -98,6 +132,7 @@ struct TTYInfoStruct
 #define STOPBITS( x )       (x.bStopBits)
 #define BAUDRATE( x )       (x.dwBaudRate)
 #define HTTYFONT( x )       (x.hTTYFont)
+#define HTTYFONTUL( x )     (x.hTTYFontUnderline)
 #define LFTTYFONT( x )      (x.lfTTYFont)
 #define FGCOLOR( x )        (x.rgbFGColor)
 #define XSIZE( x )          (x.xSize)
@@ -117,7 +152,43 @@ struct TTYInfoStruct
 #define READSTATTHREAD( x ) (x.hReaderStatus)
 #define EVENTFLAGS( x )     (x.dwEventFlags)
 #define FLAGCHAR( x )       (x.chFlag)
-#define SCREENCHAR( x, col, row )   (x.Screen[row * MAXCOLS + col])
+#define SCREENTOP( x )      (x.nScreenTop)
+#define DIRTYROWS( x )      (x.dwDirtyRows)
+#define DAMAGELEFT( x )     (x.nDamageLeft)
+#define DAMAGERIGHT( x )    (x.nDamageRight)
+#define SCROLLPENDING( x )  (x.nScrollPending)
+#define REPAINTRATE( x )    (x.dwRepaintRate)
+#define HISTORYMB( x )      (x.dwHistoryMB)
+#define TXHIGHKB( x )       (x.dwTxHighKB)
+#define TXLOWKB( x )        (x.dwTxLowKB)
+#define COALESCEMS( x )     (x.dwCoalesceMs)
+#define COALESCEBYTES( x )  (x.dwCoalesceBytes)
+#define PASTEDELAY( x )     (x.dwPasteDelay)
+#define PACERATE( x )       (x.dwPaceRate)
+#define PACECHARGAP( x )    (x.dwPaceCharGap)
+#define PACELINEDELAY( x )  (x.dwPaceLineDelay)
+#define READAHEADKB( x )    (x.dwReadAheadKB)
+#define REPLAYSPEED( x )    (x.dwReplaySpeed)
+#define ROTATEMB( x )       (x.dwRotateMB)
+#define ROTATEMIN( x )      (x.dwRotateMin)
+#define ROTATEBUDGETMB( x ) (x.dwRotateBudgetMB)
+#define ROTATECOMPRESS( x ) (x.fRotateCompress)
+#define ISROWDIRTY( x, row )    (x.dwDirtyRows[(row) >> 5] & (1UL << ((row) & 31)))
+#define PENFG( x )          (x.bPenFg)
+#define PENBG( x )          (x.bPenBg)
+#define PENFLAGS( x )       (x.bPenFlags)
+
+//
+// Screen is a ring of MAXROWS row slots, logical row 0 lives in
+// slot SCREENTOP, so scrolling only moves SCREENTOP.  The attribute
+// arrays use the same slots.
+//
+#define SCREENSLOT( x, row )        ((((row) + x.nScreenTop) % MAXROWS) * MAXCOLS)
+#define SCREENROW( x, row )         (x.Screen + SCREENSLOT( x, row ))
+#define SCREENCHAR( x, col, row )   (SCREENROW( x, row )[col])
+#define FGROW( x, row )             (x.Fg + SCREENSLOT( x, row ))
+#define BGROW( x, row )             (x.Bg + SCREENSLOT( x, row ))
+#define FLAGSROW( x, row )          (x.Flags + SCREENSLOT( x, row ))
 
 #define DTRCONTROL( x )     (x.fDtrControl)
 #define RTSCONTROL( x )     (x.fRtsControl)
@@ -140,6 +211,7 @@ struct TTYInfoStruct
 
 #define NONPRINTHEX( x )   (x.fNonPrintHex)
 #define DISPLAYHEX( x )   (x.fAllHex)
+#define ANSI( x )         (x.fAnsi)
 
 //---------------------------------------------------------------------------
 //  End of File: ttyinfo.h
@@ -0,0 +1,836 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: VT100.c
+
+    PURPOSE: VT100/ANSI escape sequence parser.
+
+             The parser is a state machine in the style of the DEC
+             ANSI parser, driven by one table lookup per byte:
+             gVtTable[state][byte] holds the action to take and the
+             next state.  Printable text in the ground state isn't
+             looked up at all, it is found with TTYScanSpecial and
+             copied to the screen as runs, like in plain mode.
+
+             Cursor addressing is relative to the terminal page, the
+             last window full of rows of the screen buffer, which is
+             what the window shows when scrolled to the bottom.
+
+             Cell colors are indexes into a 16 color palette, or
+             ATTR_DEFCOLOR for the tty font color and window color.
+
+    FUNCTIONS:
+        VtRange      - sets table entries for a range of bytes
+        VtInit       - builds the state table
+        VtReset      - resets parser state and pen
+        VtTop        - returns first row of the terminal page
+        VtParam      - returns a parameter or its default
+        VtCopyRow    - copies a screen row, text and attributes
+        VtShiftCells - moves cells within a row
+        VtEraseRows  - blanks rows and marks them dirty
+        VtScrollDown - inserts blank rows, pushes rows below down
+        VtScrollUp   - deletes rows, pulls rows below up
+        VtExecute    - carries out a C0 control
+        VtEscDispatch - carries out an ESC sequence
+        VtSgr        - sets pen attributes (CSI m)
+        VtCsiDispatch - carries out a CSI sequence
+        VtParse      - parses received data
+        VtCellColors - returns colors of a cell
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "MTTTY.h"
+
+//
+// parser states
+//
+#define VT_GROUND           0
+#define VT_ESCAPE           1
+#define VT_ESCAPE_INTER     2
+#define VT_CSI_ENTRY        3
+#define VT_CSI_PARAM        4
+#define VT_CSI_INTER        5
+#define VT_CSI_IGNORE       6
+#define VT_STRING           7       // OSC, DCS, SOS, PM, APC; ignored
+#define VT_STATES           8
+
+//
+// parser actions
+//
+#define VA_NONE             0
+#define VA_PRINT            1
+#define VA_EXECUTE          2
+#define VA_CLEAR            3
+#define VA_COLLECT          4
+#define VA_PARAM            5
+#define VA_ESCDISPATCH      6
+#define VA_CSIDISPATCH      7
+
+#define VT_MAXPARAMS        16
+#define VT_MAXPARAMVALUE    9999
+
+#define VT_ENTRY( a, s )    ((BYTE) (((a) << 4) | (s)))
+
+/*
+    Parser state
+*/
+struct VTSTATE
+{
+    int   nState;
+    int   nParams;
+    int   nParam[VT_MAXPARAMS];
+    BYTE  bPrivate;             // private marker, '?' etc.
+    BYTE  bInter;               // intermediate byte
+    int   nSavedRow, nSavedCol; // ESC 7 / CSI s
+    BYTE  bSavedFg, bSavedBg, bSavedFlags;
+} gVt;
+
+BYTE gVtTable[VT_STATES][256];
+
+/*
+    xterm default palette, 8 normal and 8 bright colors
+*/
+COLORREF gVtPalette[16] = {
+    RGB(0, 0, 0),       RGB(205, 0, 0),     RGB(0, 205, 0),     RGB(205, 205, 0),
+    RGB(0, 0, 238),     RGB(205, 0, 205),   RGB(0, 205, 205),   RGB(229, 229, 229),
+    RGB(127, 127, 127), RGB(255, 0, 0),     RGB(0, 255, 0),     RGB(255, 255, 0),
+    RGB(92, 92, 255),   RGB(255, 0, 255),   RGB(0, 255, 255),   RGB(255, 255, 255)
+};
+
+/*
+    Prototypes for functions called only within this file
+*/
+void VtRange( int, int, int, int, int );
+int VtTop( void );
+int VtParam( int, int );
+void VtCopyRow( int, int );
+void VtShiftCells( int, int, int, int );
+void VtEraseRows( int, int );
+void VtScrollDown( int, int );
+void VtScrollUp( int, int );
+void VtExecute( HWND, BYTE );
+void VtEscDispatch( HWND, BYTE );
+void VtSgr( void );
+void VtCsiDispatch( HWND, BYTE );
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtRange(int, int, int, int, int)
+
+PURPOSE: Sets table entries for a range of bytes
+
+PARAMETERS:
+    nState  - state the entries belong to
+    nFirst  - first byte
+    nLast   - last byte
+    nAction - action for these bytes
+    nNext   - next state
+
+-----------------------------------------------------------------------------*/
+void VtRange(int nState, int nFirst, int nLast, int nAction, int nNext)
+{
+    int c;
+
+    for (c = nFirst; c <= nLast; c++)
+        gVtTable[nState][c] = VT_ENTRY(nAction, nNext);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtInit
+
+PURPOSE: Builds the parser state table
+
+COMMENTS: Called once at startup.  Bytes not mentioned for a state
+          are ignored, C0 controls are carried out in any state but
+          the string state.
+
+-----------------------------------------------------------------------------*/
+void VtInit()
+{
+    int nState;
+
+    for (nState = 0; nState < VT_STATES; nState++) {
+        VtRange(nState, 0x00, 0xFF, VA_NONE, nState);
+        VtRange(nState, 0x00, 0x1F, VA_EXECUTE, nState);
+    }
+
+    VtRange(VT_GROUND, 0x20, 0xFF, VA_PRINT, VT_GROUND);
+
+    VtRange(VT_ESCAPE, 0x20, 0x2F, VA_COLLECT, VT_ESCAPE_INTER);
+    VtRange(VT_ESCAPE, 0x30, 0x7E, VA_ESCDISPATCH, VT_GROUND);
+    VtRange(VT_ESCAPE, '[', '[', VA_NONE, VT_CSI_ENTRY);
+    VtRange(VT_ESCAPE, ']', ']', VA_NONE, VT_STRING);
+    VtRange(VT_ESCAPE, 'P', 'P', VA_NONE, VT_STRING);
+    VtRange(VT_ESCAPE, 'X', 'X', VA_NONE, VT_STRING);
+    VtRange(VT_ESCAPE, '^', '_', VA_NONE, VT_STRING);
+
+    VtRange(VT_ESCAPE_INTER, 0x20, 0x2F, VA_COLLECT, VT_ESCAPE_INTER);
+    VtRange(VT_ESCAPE_INTER, 0x30, 0x7E, VA_ESCDISPATCH, VT_GROUND);
+
+    VtRange(VT_CSI_ENTRY, 0x20, 0x2F, VA_COLLECT, VT_CSI_INTER);
+    VtRange(VT_CSI_ENTRY, 0x30, 0x39, VA_PARAM, VT_CSI_PARAM);
+    VtRange(VT_CSI_ENTRY, ':', ':', VA_NONE, VT_CSI_IGNORE);
+    VtRange(VT_CSI_ENTRY, ';', ';', VA_PARAM, VT_CSI_PARAM);
+    VtRange(VT_CSI_ENTRY, 0x3C, 0x3F, VA_COLLECT, VT_CSI_PARAM);
+    VtRange(VT_CSI_ENTRY, 0x40, 0x7E, VA_CSIDISPATCH, VT_GROUND);
+
+    VtRange(VT_CSI_PARAM, 0x20, 0x2F, VA_COLLECT, VT_CSI_INTER);
+    VtRange(VT_CSI_PARAM, 0x30, 0x39, VA_PARAM, VT_CSI_PARAM);
+    VtRange(VT_CSI_PARAM, ':', ':', VA_NONE, VT_CSI_IGNORE);
+    VtRange(VT_CSI_PARAM, ';', ';', VA_PARAM, VT_CSI_PARAM);
+    VtRange(VT_CSI_PARAM, 0x3C, 0x3F, VA_NONE, VT_CSI_IGNORE);
+    VtRange(VT_CSI_PARAM, 0x40, 0x7E, VA_CSIDISPATCH, VT_GROUND);
+
+    VtRange(VT_CSI_INTER, 0x20, 0x2F, VA_COLLECT, VT_CSI_INTER);
+    VtRange(VT_CSI_INTER, 0x30, 0x3F, VA_NONE, VT_CSI_IGNORE);
+    VtRange(VT_CSI_INTER, 0x40, 0x7E, VA_CSIDISPATCH, VT_GROUND);
+
+    VtRange(VT_CSI_IGNORE, 0x40, 0x7E, VA_NONE, VT_GROUND);
+
+    //
+    // strings end with BEL or ST (ESC \)
+    //
+    VtRange(VT_STRING, 0x00, 0x1F, VA_NONE, VT_STRING);
+    VtRange(VT_STRING, ASCII_BEL, ASCII_BEL, VA_NONE, VT_GROUND);
+
+    //
+    // CAN and SUB abort a sequence, ESC starts a new one
+    //
+    for (nState = 0; nState < VT_STATES; nState++) {
+        VtRange(nState, 0x18, 0x18, VA_EXECUTE, VT_GROUND);
+        VtRange(nState, 0x1A, 0x1A, VA_EXECUTE, VT_GROUND);
+        VtRange(nState, ASCII_ESC, ASCII_ESC, VA_CLEAR, VT_ESCAPE);
+    }
+
+    VtReset();
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtReset
+
+PURPOSE: Resets parser state and pen attributes
+
+-----------------------------------------------------------------------------*/
+void VtReset()
+{
+    ZeroMemory(&gVt, sizeof(gVt));
+    gVt.nState = VT_GROUND;
+    gVt.bSavedFg = gVt.bSavedBg = ATTR_DEFCOLOR;
+
+    PENFG( TTYInfo ) = ATTR_DEFCOLOR;
+    PENBG( TTYInfo ) = ATTR_DEFCOLOR;
+    PENFLAGS( TTYInfo ) = 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtTop
+
+PURPOSE: Returns the first row of the terminal page
+
+COMMENTS: The page is as high as the window, at the end of
+          the screen buffer.
+
+-----------------------------------------------------------------------------*/
+int VtTop()
+{
+    int nRows = 1;
+
+    if (YCHAR( TTYInfo ) > 0)
+        nRows = max(1, YSIZE( TTYInfo ) / YCHAR( TTYInfo ));
+
+    return max(0, MAXROWS - nRows);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtParam(int, int)
+
+PURPOSE: Returns a parameter of the current sequence
+
+PARAMETERS:
+    nIndex   - parameter index
+    nDefault - value if the parameter is missing or zero
+
+-----------------------------------------------------------------------------*/
+int VtParam(int nIndex, int nDefault)
+{
+    if (nIndex < gVt.nParams && gVt.nParam[nIndex] != 0)
+        return gVt.nParam[nIndex];
+
+    return nDefault;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtCopyRow(int, int)
+
+PURPOSE: Copies a screen row, text and attributes
+
+PARAMETERS:
+    nDst - destination row
+    nSrc - source row
+
+-----------------------------------------------------------------------------*/
+void VtCopyRow(int nDst, int nSrc)
+{
+    CopyMemory(SCREENROW( TTYInfo, nDst ), SCREENROW( TTYInfo, nSrc ), MAXCOLS);
+    CopyMemory(FGROW( TTYInfo, nDst ), FGROW( TTYInfo, nSrc ), MAXCOLS);
+    CopyMemory(BGROW( TTYInfo, nDst ), BGROW( TTYInfo, nSrc ), MAXCOLS);
+    CopyMemory(FLAGSROW( TTYInfo, nDst ), FLAGSROW( TTYInfo, nSrc ), MAXCOLS);
+    TTYMarkDirty(nDst, 0, MAXCOLS);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtShiftCells(int, int, int, int)
+
+PURPOSE: Moves cells within a row
+
+PARAMETERS:
+    nRow   - screen row
+    nDst   - destination column
+    nSrc   - source column
+    nCount - number of cells
+
+-----------------------------------------------------------------------------*/
+void VtShiftCells(int nRow, int nDst, int nSrc, int nCount)
+{
+    MoveMemory(SCREENROW( TTYInfo, nRow ) + nDst, SCREENROW( TTYInfo, nRow ) + nSrc, nCount);
+    MoveMemory(FGROW( TTYInfo, nRow ) + nDst, FGROW( TTYInfo, nRow ) + nSrc, nCount);
+    MoveMemory(BGROW( TTYInfo, nRow ) + nDst, BGROW( TTYInfo, nRow ) + nSrc, nCount);
+    MoveMemory(FLAGSROW( TTYInfo, nRow ) + nDst, FLAGSROW( TTYInfo, nRow ) + nSrc, nCount);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtEraseRows(int, int)
+
+PURPOSE: Blanks whole rows with the pen background
+
+PARAMETERS:
+    nFirst - first row
+    nEnd   - one past last row
+
+-----------------------------------------------------------------------------*/
+void VtEraseRows(int nFirst, int nEnd)
+{
+    int nRow;
+
+    for (nRow = nFirst; nRow < nEnd; nRow++) {
+        TTYEraseCells(nRow, 0, MAXCOLS, PENBG( TTYInfo ));
+        TTYMarkDirty(nRow, 0, MAXCOLS);
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtScrollDown(int, int)
+
+PURPOSE: Inserts blank rows, rows below move down
+
+PARAMETERS:
+    nRow   - first row to insert
+    nCount - number of rows
+
+COMMENTS: Rows pushed off the bottom are lost, they don't go
+          to the history.
+
+-----------------------------------------------------------------------------*/
+void VtScrollDown(int nRow, int nCount)
+{
+    int i;
+
+    nCount = min(nCount, MAXROWS - nRow);
+
+    for (i = MAXROWS - 1; i >= nRow + nCount; i--)
+        VtCopyRow(i, i - nCount);
+
+    VtEraseRows(nRow, nRow + nCount);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtScrollUp(int, int)
+
+PURPOSE: Deletes rows, rows below move up
+
+PARAMETERS:
+    nRow   - first row to delete
+    nCount - number of rows
+
+-----------------------------------------------------------------------------*/
+void VtScrollUp(int nRow, int nCount)
+{
+    int i;
+
+    nCount = min(nCount, MAXROWS - nRow);
+
+    for (i = nRow; i < MAXROWS - nCount; i++)
+        VtCopyRow(i, i + nCount);
+
+    VtEraseRows(MAXROWS - nCount, MAXROWS);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtExecute(HWND, BYTE)
+
+PURPOSE: Carries out a C0 control
+
+COMMENTS: Controls without a meaning here are shown in hex
+          if non printable characters are shown, else ignored.
+
+-----------------------------------------------------------------------------*/
+void VtExecute(HWND hTTY, BYTE c)
+{
+    switch (c)
+    {
+        case ASCII_BEL:
+        case ASCII_BS:
+        case ASCII_HT:
+        case ASCII_LF:
+        case ASCII_VT:
+        case ASCII_FF:
+        case ASCII_CR:
+            TTYControl(hTTY, c);
+            break;
+
+        default:
+            if (NONPRINTHEX( TTYInfo ))
+                TTYPutHex(hTTY, &c, 1, TRUE);
+            break;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtEscDispatch(HWND, BYTE)
+
+PURPOSE: Carries out an ESC sequence
+
+PARAMETERS:
+    hTTY - handle to the TTY child window
+    c    - final byte
+
+COMMENTS: Sequences with intermediates (character set selection)
+          are ignored.
+
+-----------------------------------------------------------------------------*/
+void VtEscDispatch(HWND hTTY, BYTE c)
+{
+    if (gVt.bInter)
+        return;
+
+    switch (c)
+    {
+        case '7':                       // DECSC, save cursor
+            gVt.nSavedRow = ROW( TTYInfo );
+            gVt.nSavedCol = COLUMN( TTYInfo );
+            gVt.bSavedFg = PENFG( TTYInfo );
+            gVt.bSavedBg = PENBG( TTYInfo );
+            gVt.bSavedFlags = PENFLAGS( TTYInfo );
+            break;
+
+        case '8':                       // DECRC, restore cursor
+            ROW( TTYInfo ) = gVt.nSavedRow;
+            COLUMN( TTYInfo ) = gVt.nSavedCol;
+            PENFG( TTYInfo ) = gVt.bSavedFg;
+            PENBG( TTYInfo ) = gVt.bSavedBg;
+            PENFLAGS( TTYInfo ) = gVt.bSavedFlags;
+            break;
+
+        case 'c':                       // RIS, reset
+            VtReset();
+            VtEraseRows(VtTop(), MAXROWS);
+            ROW( TTYInfo ) = VtTop();
+            COLUMN( TTYInfo ) = 0;
+            break;
+
+        case 'D':                       // IND, index
+            TTYLineFeed(hTTY);
+            break;
+
+        case 'E':                       // NEL, next line
+            COLUMN( TTYInfo ) = 0;
+            TTYLineFeed(hTTY);
+            break;
+
+        case 'M':                       // RI, reverse index
+            if (ROW( TTYInfo ) > VtTop())
+                ROW( TTYInfo )--;
+            else
+                VtScrollDown(ROW( TTYInfo ), 1);
+            break;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtSgr
+
+PURPOSE: Sets pen attributes, CSI m
+
+COMMENTS: 256 color indexes above 15 and direct colors
+          are skipped.
+
+-----------------------------------------------------------------------------*/
+void VtSgr()
+{
+    int i, n, nCount = max(1, gVt.nParams);
+
+    for (i = 0; i < nCount; i++)
+    {
+        n = gVt.nParam[i];
+
+        if (n >= 30 && n <= 37)
+            PENFG( TTYInfo ) = (BYTE) (n - 30);
+        else if (n >= 40 && n <= 47)
+            PENBG( TTYInfo ) = (BYTE) (n - 40);
+        else if (n >= 90 && n <= 97)
+            PENFG( TTYInfo ) = (BYTE) (n - 90 + 8);
+        else if (n >= 100 && n <= 107)
+            PENBG( TTYInfo ) = (BYTE) (n - 100 + 8);
+        else switch (n)
+        {
+            case 0:
+                PENFG( TTYInfo ) = ATTR_DEFCOLOR;
+                PENBG( TTYInfo ) = ATTR_DEFCOLOR;
+                PENFLAGS( TTYInfo ) = 0;
+                break;
+
+            case 1:  PENFLAGS( TTYInfo ) |= ATTR_BOLD;          break;
+            case 4:  PENFLAGS( TTYInfo ) |= ATTR_UNDERLINE;     break;
+            case 7:  PENFLAGS( TTYInfo ) |= ATTR_REVERSE;       break;
+            case 22: PENFLAGS( TTYInfo ) &= ~ATTR_BOLD;         break;
+            case 24: PENFLAGS( TTYInfo ) &= ~ATTR_UNDERLINE;    break;
+            case 27: PENFLAGS( TTYInfo ) &= ~ATTR_REVERSE;      break;
+            case 39: PENFG( TTYInfo ) = ATTR_DEFCOLOR;          break;
+            case 49: PENBG( TTYInfo ) = ATTR_DEFCOLOR;          break;
+
+            case 38:
+            case 48:
+                if (i + 2 < gVt.nParams && gVt.nParam[i + 1] == 5) {
+                    if (gVt.nParam[i + 2] < 16) {
+                        if (n == 38)
+                            PENFG( TTYInfo ) = (BYTE) gVt.nParam[i + 2];
+                        else
+                            PENBG( TTYInfo ) = (BYTE) gVt.nParam[i + 2];
+                    }
+                    i += 2;
+                }
+                else if (i + 4 < gVt.nParams && gVt.nParam[i + 1] == 2)
+                    i += 4;
+                else
+                    i = nCount;
+                break;
+        }
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtCsiDispatch(HWND, BYTE)
+
+PURPOSE: Carries out a CSI sequence
+
+PARAMETERS:
+    hTTY - handle to the TTY child window
+    c    - final byte
+
+COMMENTS: Private (DEC mode) sequences and sequences with
+          intermediates are ignored.  Changed cells are marked
+          dirty, the caller repaints.
+
+-----------------------------------------------------------------------------*/
+void VtCsiDispatch(HWND hTTY, BYTE c)
+{
+    int nTop = VtTop();
+    int nRow = ROW( TTYInfo );
+    int nCol = COLUMN( TTYInfo );
+    int n;
+
+    if (gVt.bPrivate || gVt.bInter)
+        return;
+
+    switch (c)
+    {
+        case 'm':                       // SGR
+            VtSgr();
+            break;
+
+        case 'H':                       // CUP
+        case 'f':                       // HVP
+            ROW( TTYInfo ) = min(MAXROWS - 1, nTop + VtParam(0, 1) - 1);
+            COLUMN( TTYInfo ) = min(MAXCOLS - 1, VtParam(1, 1) - 1);
+            break;
+
+        case 'A':                       // CUU
+            ROW( TTYInfo ) = max(nTop, nRow - VtParam(0, 1));
+            break;
+
+        case 'B':                       // CUD
+            ROW( TTYInfo ) = min(MAXROWS - 1, nRow + VtParam(0, 1));
+            break;
+
+        case 'C':                       // CUF
+            COLUMN( TTYInfo ) = min(MAXCOLS - 1, nCol + VtParam(0, 1));
+            break;
+
+        case 'D':                       // CUB
+            COLUMN( TTYInfo ) = max(0, nCol - VtParam(0, 1));
+            break;
+
+        case 'E':                       // CNL
+            ROW( TTYInfo ) = min(MAXROWS - 1, nRow + VtParam(0, 1));
+            COLUMN( TTYInfo ) = 0;
+            break;
+
+        case 'F':                       // CPL
+            ROW( TTYInfo ) = max(nTop, nRow - VtParam(0, 1));
+            COLUMN( TTYInfo ) = 0;
+            break;
+
+        case 'G':                       // CHA
+            COLUMN( TTYInfo ) = min(MAXCOLS - 1, VtParam(0, 1) - 1);
+            break;
+
+        case 'd':                       // VPA
+            ROW( TTYInfo ) = min(MAXROWS - 1, nTop + VtParam(0, 1) - 1);
+            break;
+
+        case 'J':                       // ED
+            switch (VtParam(0, 0))
+            {
+                case 0:
+                    TTYEraseCells(nRow, nCol, MAXCOLS, PENBG( TTYInfo ));
+                    TTYMarkDirty(nRow, nCol, MAXCOLS);
+                    VtEraseRows(nRow + 1, MAXROWS);
+                    break;
+
+                case 1:
+                    VtEraseRows(nTop, nRow);
+                    TTYEraseCells(nRow, 0, nCol + 1, PENBG( TTYInfo ));
+                    TTYMarkDirty(nRow, 0, nCol + 1);
+                    break;
+
+                case 2:
+                    VtEraseRows(nTop, MAXROWS);
+                    break;
+            }
+            break;
+
+        case 'K':                       // EL
+            switch (VtParam(0, 0))
+            {
+                case 0:
+                    TTYEraseCells(nRow, nCol, MAXCOLS, PENBG( TTYInfo ));
+                    TTYMarkDirty(nRow, nCol, MAXCOLS);
+                    break;
+
+                case 1:
+                    TTYEraseCells(nRow, 0, nCol + 1, PENBG( TTYInfo ));
+                    TTYMarkDirty(nRow, 0, nCol + 1);
+                    break;
+
+                case 2:
+                    VtEraseRows(nRow, nRow + 1);
+                    break;
+            }
+            break;
+
+        case 'X':                       // ECH
+            n = min(VtParam(0, 1), MAXCOLS - nCol);
+            TTYEraseCells(nRow, nCol, nCol + n, PENBG( TTYInfo ));
+            TTYMarkDirty(nRow, nCol, nCol + n);
+            break;
+
+        case '@':                       // ICH
+            n = min(VtParam(0, 1), MAXCOLS - nCol);
+            VtShiftCells(nRow, nCol + n, nCol, MAXCOLS - nCol - n);
+            TTYEraseCells(nRow, nCol, nCol + n, PENBG( TTYInfo ));
+            TTYMarkDirty(nRow, nCol, MAXCOLS);
+            break;
+
+        case 'P':                       // DCH
+            n = min(VtParam(0, 1), MAXCOLS - nCol);
+            VtShiftCells(nRow, nCol, nCol + n, MAXCOLS - nCol - n);
+            TTYEraseCells(nRow, MAXCOLS - n, MAXCOLS, PENBG( TTYInfo ));
+            TTYMarkDirty(nRow, nCol, MAXCOLS);
+            break;
+
+        case 'L':                       // IL
+            if (nRow >= nTop)
+                VtScrollDown(nRow, VtParam(0, 1));
+            break;
+
+        case 'M':                       // DL
+            if (nRow >= nTop)
+                VtScrollUp(nRow, VtParam(0, 1));
+            break;
+
+        case 's':                       // SCOSC, save cursor
+            gVt.nSavedRow = nRow;
+            gVt.nSavedCol = nCol;
+            break;
+
+        case 'u':                       // SCORC, restore cursor
+            ROW( TTYInfo ) = gVt.nSavedRow;
+            COLUMN( TTYInfo ) = gVt.nSavedCol;
+            break;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtParse(HWND, const BYTE *, DWORD)
+
+PURPOSE: Parses received data and updates the screen buffer
+
+PARAMETERS:
+    hTTY     - handle to the TTY child window
+    lpBuf    - address of data buffer
+    dwBufLen - size of data buffer
+
+COMMENTS: Parser state carries over between buffers, so a
+          sequence may be split anywhere.
+
+-----------------------------------------------------------------------------*/
+void VtParse(HWND hTTY, const BYTE * lpBuf, DWORD dwBufLen)
+{
+    int   nMode = NONPRINTHEX( TTYInfo ) ? SCAN_NONPRINT : SCAN_C0;
+    DWORD i, dwRun;
+    BYTE  c, bEntry;
+
+    for (i = 0; i < dwBufLen; )
+    {
+        if (gVt.nState == VT_GROUND)
+        {
+            dwRun = TTYScanSpecial(lpBuf + i, dwBufLen - i, nMode);
+            if (dwRun)
+            {
+                TTYPutRun(hTTY, (const char *) lpBuf + i, (int) dwRun);
+                i += dwRun;
+                if (i == dwBufLen)
+                    break;
+            }
+        }
+
+        c = lpBuf[ i++ ];
+        bEntry = gVtTable[gVt.nState][c];
+        gVt.nState = bEntry & 0x0F;
+
+        switch (bEntry >> 4)
+        {
+            case VA_PRINT:
+                if (NONPRINTHEX( TTYInfo ) && c > '~') {
+                    //
+                    // a run of 8 bit bytes is shown in one go
+                    //
+                    for (dwRun = 1; i - 1 + dwRun < dwBufLen && lpBuf[i - 1 + dwRun] > '~'; dwRun++)
+                        ;
+                    TTYPutHex(hTTY, lpBuf + i - 1, dwRun, TRUE);
+                    i += dwRun - 1;
+                }
+                else
+                    TTYPutRun(hTTY, (const char *) &c, 1);
+                break;
+
+            case VA_EXECUTE:
+                VtExecute(hTTY, c);
+                break;
+
+            case VA_CLEAR:
+                gVt.nParams = 0;
+                ZeroMemory(gVt.nParam, sizeof(gVt.nParam));
+                gVt.bPrivate = gVt.bInter = 0;
+                break;
+
+            case VA_COLLECT:
+                if (c < 0x30)
+                    gVt.bInter = c;
+                else
+                    gVt.bPrivate = c;
+                break;
+
+            case VA_PARAM:
+                if (gVt.nParams == 0)
+                    gVt.nParams = 1;
+
+                if (c == ';') {
+                    if (gVt.nParams < VT_MAXPARAMS)
+                        gVt.nParams++;
+                }
+                else
+                    gVt.nParam[gVt.nParams - 1] =
+                        min(VT_MAXPARAMVALUE, gVt.nParam[gVt.nParams - 1] * 10 + (c - '0'));
+                break;
+
+            case VA_ESCDISPATCH:
+                VtEscDispatch(hTTY, c);
+                break;
+
+            case VA_CSIDISPATCH:
+                VtCsiDispatch(hTTY, c);
+                break;
+        }
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: VtCellColors(BYTE, BYTE, BYTE, COLORREF *, COLORREF *)
+
+PURPOSE: Returns text and background color of a cell
+
+PARAMETERS:
+    bFg     - foreground color index
+    bBg     - background color index
+    bFlags  - cell flags
+    lpcrFg  - text color
+    lpcrBg  - background color
+
+COMMENTS: Bold makes the normal colors bright.
+
+-----------------------------------------------------------------------------*/
+void VtCellColors(BYTE bFg, BYTE bBg, BYTE bFlags, COLORREF * lpcrFg, COLORREF * lpcrBg)
+{
+    COLORREF crFg, crBg;
+
+    if (bFg == ATTR_DEFCOLOR)
+        crFg = FGCOLOR( TTYInfo );
+    else
+        crFg = gVtPalette[((bFlags & ATTR_BOLD) && bFg < 8) ? bFg + 8 : bFg];
+
+    if (bBg == ATTR_DEFCOLOR)
+        crBg = GetSysColor(COLOR_WINDOW);
+    else
+        crBg = gVtPalette[bBg];
+
+    if (bFlags & ATTR_REVERSE) {
+        *lpcrFg = crBg;
+        *lpcrBg = crFg;
+    }
+    else {
+        *lpcrFg = crFg;
+        *lpcrBg = crBg;
+    }
+}
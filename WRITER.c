@@ -9,7 +9,7 @@
 
     MODULE: Writer.c
 
-    PURPOSE: Handles all port writing and write request linked list
+    PURPOSE: Handles all port writing and write request queues
 
     FUNCTIONS:
         WriterProc - Thread procedure handles all writing
@@ -19,18 +19,38 @@
         WriterFileStart     - initializes a file transfer
         WriterChar          - Writes a char out the port
         WriterGeneric       - Actual writing funciton handles all i/o operations
-        WriterAddNewNode    - Adds new write request packet to linked list
+        WriterIssue         - issues the writes for a buffer
+        WriterPaced         - sends a buffer at the pacing limits
+        WriterPaceWait      - waits for a pacing due time
+        WriterUrgentPending - tells if an urgent request waits
+        WriterSlotsCreate   - creates the overlapped write slots
+        WriterSlotsDestroy  - cancels writes in flight, frees the slots
+        WriterCompleteOldest - completes the oldest write in flight
+        WriterFlush         - completes all writes in flight
+        WriterGetStats      - write statistics
+        WriterRequestBytes  - data bytes a request adds to the queue
+        WriterRelease       - frees a processed request
+        WriterOpenRoom      - lets producers add data again
+        WriterWouldBlock    - tells if the queue is above its high watermark
+        WriterBusy          - tells if data is queued or being written
+        WriterCoalesceFlush - sends the collected typed characters
+        WriterCoalesceWait  - time left until they are due
+        WriterAddNewNode    - Adds new write request packet to the queue
         WriterAddNewNodeTimeout - Adds new node, but can timeout.
+        WriterAddUrgentNodeTimeout - Adds new node to the urgent queue
         WriterAddExistingNode - Modifies an existing packet and
-                                links it to the linked list
-        AddToLinkedList     - Adds the node to the list
-        RemoveFromLinkedList - Removes a node
+                                queues it
+        WriterAddMappedNode - Queues a packet for data in a mapped view
+        WrQueueInit         - Initializes a write request queue
+        WrQueuePush         - Adds a node to a queue, any thread
+        WrQueuePop          - Takes the oldest node, writer thread only
+        WriterNextRequest   - Takes the next request, urgent first
 
 -----------------------------------------------------------------------------*/
 
 /*-----------------------------------------------------------------------------
 
-    Write request packets are put into the writer request linked list
+    Write request packets are put into the write request queues
     and processed by the functions in this module.
 
     The members of the WRITEREQUEST structure are described as follows:
@@ -41,6 +61,7 @@
           char *    lpBuf;             // address of data buffer
           HANDLE    hHeap;             // heap containing data buffer
           HWND      hWndProgress;      // hwnd for progress indicator
+          MAPREF *  pMapRef;           // mapped file view holding lpBuf
 
 
     dwWriteType can be one of the following values:
@@ -56,6 +77,8 @@
             WriteReqeust.lpBuf        : points to the buffer containing the data to send
             WriteRequest.hHeap        : contains the handle of the heap containing the data buffer
             WriteReqeust.hWndProgress : contains the hwnd of the file transfer progress indicator
+            WriteRequest.pMapRef      : if not NULL, lpBuf is in a mapped file view
+                                        and hHeap is NULL
 
 
         WRITE_FILESTART  0x03    // indicates the a file transfer is starting
@@ -72,7 +95,53 @@
                                  // a block of data
              WriteRequest.dwSize : containst the size of the buffer
              WriteRequest.lpBuf  : points to the buffer containing the data to send
-
+             WriteRequest.hHeap  : if not NULL, the heap lpBuf is freed to once sent
+             WriteRequest.pMapRef: if not NULL, lpBuf is in a mapped file view
+
+    Requests for data in a mapped file view (WriterAddMappedNode) hold
+    a reference on the view.  WriterRelease drops it, so the owner may
+    unmap the view once its reference count is back to zero.
+
+
+    Writes are pipelined.  WriterGeneric copies the data into one of
+    WRITE_SLOTS write slots, each with its own OVERLAPPED structure and
+    event, issues the write and returns without waiting, so the driver
+    always has the next block queued when the current one is sent.
+    Only when all slots are busy does it wait, for the oldest write.
+    Writes complete in the order issued; the writer thread also
+    completes them while it waits for new requests.
+
+    Requests are queued without locks.  Each queue is an intrusive
+    multi producer, single consumer queue (D. Vyukov): a producer
+    links its packet in with one interlocked exchange, the writer
+    thread alone takes packets out.  The tty window, the transfer
+    thread and the repeat scheduler never wait for each other or for
+    the writer.  WRITE_ABORT goes to a second, urgent queue which the
+    writer empties before taking the next data request, so an abort
+    doesn't wait behind queued file blocks.
+
+    The data queue is bounded by bytes.  When the bytes queued reach
+    the high watermark (TXHIGHKB) ghWriterRoomEvent is reset; the
+    transfer thread waits on it, the macro buttons check
+    WriterWouldBlock and skip a send instead.  The event is set
+    again when the writer has drained the queue below the low
+    watermark (TXLOWKB).  Characters typed and control requests are
+    never held back.
+
+    Typed characters can be coalesced.  With COALESCEMS set, WRITE_CHAR
+    requests are collected and sent with one WriteFile when the first
+    of them is COALESCEMS old, when COALESCEBYTES are collected, or
+    before any other request.  Off by default, each key is then sent
+    at once.
+
+    Transmit pacing is for devices that can't take data at the line
+    rate.  A token bucket limits the rate to PACERATE bytes per
+    second with bursts of PACE_BUCKET bytes, PACECHARGAP puts a gap
+    between characters and PACELINEDELAY a delay after each line end.
+    The writer waits on a waitable timer, finishing the last
+    millisecond on the performance counter; the lateness of these
+    waits is shown as the pacing accuracy.  Pacing applies to when
+    writes are issued, the driver and UART fifo may still add delay.
 
 -----------------------------------------------------------------------------*/
 
@@ -81,22 +150,119 @@
 
 #include "MTTTY.h"
 
+/*
+    Overlapped write slots, used only by the writer thread.
+    Slots gdwSlotHead .. gdwSlotHead + gdwSlotCount - 1 (mod WRITE_SLOTS)
+    have writes in flight, oldest first.
+*/
+static struct
+{
+    OVERLAPPED    os;
+    LARGE_INTEGER liIssued;         // for the write latency
+    DWORD         dwSize;
+    char          Buf[WRITE_SLOT_SIZE];
+} gWriteSlots[WRITE_SLOTS];
+
+static DWORD gdwSlotHead;
+static DWORD gdwSlotCount;
+
+/*
+    Write request queue.  pIn is the last node pushed, pOut the next
+    node to pop.  The stub node is pushed back whenever the queue
+    would become empty, so pIn is never NULL.
+*/
+typedef struct WRQUEUE
+{
+    PWRITEREQUEST volatile pIn;
+    PWRITEREQUEST pOut;
+    WRITEREQUEST  Stub;
+} WRQUEUE;
+
+#define NEXTNODE( p )   (*(PWRITEREQUEST volatile *) &(p)->pNext)
+
+static WRQUEUE gWriterQueue;            // data requests, in order
+static WRQUEUE gWriterUrgent;           // aborts, before any data
+
+/*
+    Write queue fill.  lQueued is changed with interlocked calls by
+    producers and the writer; only the full / not full changes, and
+    ghWriterRoomEvent with them, are made under csRoom.
+*/
+static struct
+{
+    CRITICAL_SECTION csRoom;
+    LONG volatile    lQueued;           // data bytes in gWriterQueue
+    BOOL volatile    fFull;             // above high, not yet below low
+} gWriterFill;
+
+/*
+    Typed characters collected for one write, writer thread only
+*/
+static struct
+{
+    char          Buf[WRITE_SLOT_SIZE];
+    DWORD         dwCount;
+    LARGE_INTEGER liDue;            // when the first one must be sent
+} gCoalesce;
+
+/*
+    Transmit pacing, writer thread only.  Times are performance
+    counter values, the credit is bytes times the counter frequency.
+*/
+#define PACE_BUCKET     16          // burst, about a UART fifo
+
+static struct
+{
+    HANDLE        hTimer;           // waitable timer for the long waits
+    LONGLONG      llCredit;
+    LONGLONG      llRefill;         // when the credit was last refilled
+    LONGLONG      llNextDue;        // end of gap or line delay, 0 if none
+    LONGLONG      llDue;            // last wait's due time
+    LONGLONG      llBytes;          // statistics
+    LONGLONG      llTime;
+    LONGLONG      llLateSum;        // microseconds
+    LONGLONG      llLateSquares;
+    DWORD         dwWaits;
+} gPace;
+
+static struct
+{
+    LARGE_INTEGER liFreq;
+    LONGLONG      llLatencySum;     // microseconds
+    WRITERSTATS   Stats;
+} gWriter;
+
 //
 // Prototypes for function called only within this file
 //
-PWRITEREQUEST RemoveFromLinkedList( PWRITEREQUEST );
+void WrQueueInit( WRQUEUE * );
+void WrQueuePush( WRQUEUE *, PWRITEREQUEST );
+PWRITEREQUEST WrQueuePop( WRQUEUE * );
+PWRITEREQUEST WriterNextRequest( void );
+DWORD WriterRequestBytes( PWRITEREQUEST );
+void WriterRelease( PWRITEREQUEST );
+void WriterOpenRoom( void );
 BOOL WriterAddExistingNode( PWRITEREQUEST, DWORD, DWORD, char, char *, HANDLE, HWND );
 BOOL WriterAddNewNode( DWORD, DWORD, char, char *, HANDLE, HWND );
 void HandleWriteRequests( void );
 void WriterFileStart( DWORD );
 void WriterComplete( void );
-void WriterAbort( PWRITEREQUEST );
-void AddToLinkedList( PWRITEREQUEST );
-void AddToFrontOfLinkedList( PWRITEREQUEST );
+void WriterAbort( void );
+void AddToQueue( WRQUEUE *, PWRITEREQUEST );
 void WriterGeneric( char *, DWORD );
 void WriterFile( PWRITEREQUEST );
 void WriterChar( PWRITEREQUEST );
 void WriterBlock( PWRITEREQUEST );
+BOOL WriterSlotsCreate( void );
+void WriterSlotsDestroy( void );
+BOOL WriterCompleteOldest( BOOL );
+void WriterFlush( void );
+void WriterCoalesceFlush( BOOL );
+DWORD WriterCoalesceWait( void );
+BOOL WriterIssue( char *, DWORD );
+void WriterPaced( char *, DWORD );
+BOOL WriterPaceWait( LONGLONG );
+BOOL WriterUrgentPending( void );
 
 
 /*-----------------------------------------------------------------------------
@@ -111,20 +277,12 @@ HISTORY:   Date:      Author:     Comment:
 -----------------------------------------------------------------------------*/
 DWORD WINAPI WriterProc(LPVOID lpV)
 {
-    SYSTEM_INFO sysInfo;
-    HANDLE hArray[2];
+    HANDLE hArray[3];
     DWORD dwRes;
-    DWORD dwSize;
+    DWORD dwTimeout;
+    PWRITEREQUEST pWrite;
     BOOL fDone = FALSE;
 
-    //
-    // create a heap for WRITE_REQUEST packets
-    //
-    GetSystemInfo(&sysInfo);
-    ghWriterHeap = HeapCreate(0, sysInfo.dwPageSize*2, sysInfo.dwPageSize*4);
-    if (ghWriterHeap == NULL)
-        ErrorInComm("HeapCreate (write request heap)");
-
     //
     // create synchronization events for write requests and file transfers
     //
@@ -137,22 +295,53 @@ DWORD WINAPI WriterProc(LPVOID lpV)
         ErrorInComm("CreateEvent(transfer complete event)");
 
     //
-    // initialize write request linked list
+    // manual reset, set while the write queue takes more data
     //
-    dwSize = sizeof(WRITEREQUEST);
-    gpWriterHead = (WRITEREQUEST*)HeapAlloc(ghWriterHeap, HEAP_ZERO_MEMORY, dwSize);
-    gpWriterTail = (WRITEREQUEST*)HeapAlloc(ghWriterHeap, HEAP_ZERO_MEMORY, dwSize);
-    gpWriterHead->pNext = gpWriterTail;
-    gpWriterTail->pPrev = gpWriterHead;
+    ghWriterRoomEvent = CreateEvent(NULL, TRUE, TRUE, NULL);
+    if (ghWriterRoomEvent == NULL)
+        ErrorInComm("CreateEvent(writer room event)");
+
+    InitializeCriticalSection(&gWriterFill.csRoom);
+    gWriterFill.lQueued = 0;
+    gWriterFill.fFull = FALSE;
+
+    //
+    // initialize write request queues
+    //
+    WrQueueInit(&gWriterQueue);
+    WrQueueInit(&gWriterUrgent);
+
+    if (!WriterSlotsCreate())
+        ErrorInComm("CreateEvent (overlapped write hEvent)");
+
+    //
+    // manual reset timer for transmit pacing
+    //
+    ZeroMemory(&gPace, sizeof(gPace));
+    gPace.hTimer = CreateWaitableTimer(NULL, TRUE, NULL);
+    if (gPace.hTimer == NULL)
+        ErrorInComm("CreateWaitableTimer (pacing timer)");
 
     hArray[0] = ghWriterEvent;
     hArray[1] = ghThreadExitEvent;
 
     while ( !fDone ) {
-        dwRes = WaitForMultipleObjects(2, hArray, FALSE, WRITE_CHECK_TIMEOUT);
+        //
+        // while writes are in flight, also wait for the oldest one
+        //
+        hArray[2] = gWriteSlots[gdwSlotHead].os.hEvent;
+        dwTimeout = gCoalesce.dwCount ? WriterCoalesceWait() : WRITE_CHECK_TIMEOUT;
+        dwRes = WaitForMultipleObjects(gdwSlotCount ? 3 : 2, hArray, FALSE, dwTimeout);
         switch(dwRes)
         {
+            //
+            // collected characters are due,
+            // or the watermarks may have been changed in the options
+            //
             case WAIT_TIMEOUT:
+                    if (gCoalesce.dwCount && WriterCoalesceWait() == 0)
+                        WriterCoalesceFlush(TRUE);
+                    WriterOpenRoom();
                     break;
 
             case WAIT_FAILED:
@@ -171,16 +360,32 @@ DWORD WINAPI WriterProc(LPVOID lpV)
             case WAIT_OBJECT_0 + 1:
                     fDone = TRUE;
                     break;
+
+            //
+            // oldest write in flight is done
+            //
+            case WAIT_OBJECT_0 + 2:
+                    WriterCompleteOldest(FALSE);
+                    break;
         }
     }
 
+    WriterCoalesceFlush(FALSE);
+    WriterSlotsDestroy();
+    CloseHandle(gPace.hTimer);
     CloseHandle(ghTransferCompleteEvent);
     CloseHandle(ghWriterEvent);
 
     //
-    // Destroy WRITE_REQUEST heap
+    // give unsent packets back to the pool
     //
-    HeapDestroy(ghWriterHeap);
+    while ((pWrite = WriterNextRequest()) != NULL)
+        WriterRelease(pWrite);
+    WrPoolThreadExit();
+
+    CloseHandle(ghWriterRoomEvent);
+    DeleteCriticalSection(&gWriterFill.csRoom);
+
     return 1;
 }
 
@@ -202,9 +407,13 @@ void HandleWriteRequests()
     PWRITEREQUEST pWrite;
     BOOL fRes;
 
-    pWrite = gpWriterHead->pNext;
+    while((pWrite = WriterNextRequest()) != NULL) {
+        //
+        // collected characters go before anything else
+        //
+        if (pWrite->dwWriteType != WRITE_CHAR)
+            WriterCoalesceFlush(TRUE);
 
-    while(pWrite != gpWriterTail) {
         switch(pWrite->dwWriteType)
         {
             case WRITE_CHAR:          WriterChar(pWrite);                break;
@@ -213,8 +422,11 @@ void HandleWriteRequests()
 
             case WRITE_FILE:          WriterFile(pWrite);
                                       //
-                                      // free data block
+                                      // free data block, mapped ones
+                                      // are released below
                                       //
+                                      if (pWrite->hHeap == NULL)
+                                          break;
                                       EnterCriticalSection(&gcsDataHeap);
                                       fRes = HeapFree(pWrite->hHeap, 0, pWrite->lpBuf);
                                       LeaveCriticalSection(&gcsDataHeap);
@@ -222,9 +434,11 @@ void HandleWriteRequests()
                                           ErrorReporter("HeapFree(file transfer buffer)");
                                       break;
 
-            case WRITE_FILEEND:       WriterComplete();                 break;
+            case WRITE_FILEEND:       WriterFlush();
+                                      WriterComplete();
+                                      break;
 
-            case WRITE_ABORT:         WriterAbort(pWrite);              break;
+            case WRITE_ABORT:         WriterAbort();                    break;
 
             case WRITE_BLOCK:         WriterBlock(pWrite);              break;
 
@@ -232,13 +446,14 @@ void HandleWriteRequests()
                                       break;
         }
 
-        //
-        // remove current node and get next node
-        //
-        pWrite = RemoveFromLinkedList(pWrite);
-        pWrite = gpWriterHead->pNext;
+        WriterRelease(pWrite);
     }
 
+    if (gCoalesce.dwCount && WriterCoalesceWait() == 0)
+        WriterCoalesceFlush(TRUE);
+
+    WriterOpenRoom();
+
     return;
 }
 
@@ -264,45 +479,32 @@ void WriterComplete()
 
 FUNCTION: WriterAbort
 
-PURPOSE: Handle an transfer abort.  Delete all writer packets.
+PURPOSE: Handle an transfer abort.  Delete all queued writer packets.
          Data packets get deleted with the entire data heap in the transfer
          thread.
 
+COMMENTS: The abort packet comes through the urgent queue, so the
+          packets deleted are the ones queued before it.
+
 HISTORY:   Date:      Author:     Comment:
             1/26/96   AllenD      Wrote it
 
 -----------------------------------------------------------------------------*/
-void WriterAbort(PWRITEREQUEST pAbortNode)
+void WriterAbort()
 {
     PWRITEREQUEST pCurrent;
-    PWRITEREQUEST pNextNode;
-    BOOL fRes = 0;
     int i = 0;
     char szMessage[30];
 
-    EnterCriticalSection(&gcsWriterHeap);
-    // remove all nodes after me
-    pCurrent = pAbortNode->pNext;
-
-    while (pCurrent != gpWriterTail) {
-        pNextNode = pCurrent->pNext;
-        fRes = HeapFree(ghWriterHeap, 0, pCurrent);
-        if (!fRes)
-            break;
+    // remove all queued data requests
+    while ((pCurrent = WrQueuePop(&gWriterQueue)) != NULL) {
+        WriterRelease(pCurrent);
         i++;
-        pCurrent = pNextNode;
     }
 
-    pAbortNode->pNext = gpWriterTail;
-    gpWriterTail->pPrev = pAbortNode;
-    LeaveCriticalSection(&gcsWriterHeap);
-
     wsprintf(szMessage, "%d packets ignored.\n", i);
     OutputDebugString(szMessage);
 
-    if (!fRes)
-        ErrorReporter("HeapFree (Writer heap)");
-
     if (!SetEvent(ghTransferCompleteEvent))
         ErrorReporter("SetEvent (transfer complete event)");
 
@@ -398,13 +600,247 @@ PARAMETER:
 COMMENTS: WRITEREQUEST packet contains the following:
             ch : character to send
 
+          When coalescing, the character is only collected.
+
 HISTORY:   Date:      Author:     Comment:
            10/27/95   AllenD      Wrote it
 
 -----------------------------------------------------------------------------*/
 void WriterChar(PWRITEREQUEST pWrite)
 {
-    WriterGeneric(&(pWrite->ch), 1);
+    if (COALESCEMS(TTYInfo) == 0) {
+        WriterCoalesceFlush(TRUE);      // coalescing was just turned off
+        WriterGeneric(&(pWrite->ch), 1);
+        return;
+    }
+
+    //
+    // the first character sets the deadline; ask for a 1 ms
+    // timer resolution so a short delay isn't rounded up
+    // to the system tick
+    //
+    if (gCoalesce.dwCount == 0) {
+        QueryPerformanceCounter(&gCoalesce.liDue);
+        gCoalesce.liDue.QuadPart += gWriter.liFreq.QuadPart * COALESCEMS(TTYInfo) / 1000;
+        timeBeginPeriod(1);
+    }
+
+    gCoalesce.Buf[gCoalesce.dwCount++] = pWrite->ch;
+
+    if (gCoalesce.dwCount >= min(COALESCEBYTES(TTYInfo), WRITE_SLOT_SIZE))
+        WriterCoalesceFlush(TRUE);
+
+    return;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterCoalesceFlush(BOOL)
+
+PURPOSE: Sends the collected typed characters with one write
+
+PARAMETERS:
+    fSend - FALSE drops them, when the writer is exiting
+
+-----------------------------------------------------------------------------*/
+void WriterCoalesceFlush(BOOL fSend)
+{
+    if (gCoalesce.dwCount == 0)
+        return;
+
+    if (fSend) {
+        WriterGeneric(gCoalesce.Buf, gCoalesce.dwCount);
+        gWriter.Stats.dwCallsSaved += gCoalesce.dwCount - 1;
+    }
+
+    gCoalesce.dwCount = 0;
+    timeEndPeriod(1);
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterCoalesceWait
+
+PURPOSE: Returns the time until the collected characters are due
+
+RETURN: milliseconds, rounded up; 0 if they are due now
+
+-----------------------------------------------------------------------------*/
+DWORD WriterCoalesceWait()
+{
+    LARGE_INTEGER liNow;
+    LONGLONG llLeft;
+
+    QueryPerformanceCounter(&liNow);
+    llLeft = gCoalesce.liDue.QuadPart - liNow.QuadPart;
+    if (llLeft <= 0)
+        return 0;
+
+    return (DWORD) ((llLeft * 1000 + gWriter.liFreq.QuadPart - 1) / gWriter.liFreq.QuadPart);
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterSlotsCreate
+
+PURPOSE: Creates the events of the overlapped write slots
+
+RETURN: FALSE if an event can't be created
+
+COMMENTS: Called when the writer thread starts, also clears
+          the write statistics.
+
+-----------------------------------------------------------------------------*/
+BOOL WriterSlotsCreate()
+{
+    int i;
+
+    gdwSlotHead = gdwSlotCount = 0;
+    ZeroMemory(&gWriter, sizeof(gWriter));
+    QueryPerformanceFrequency(&gWriter.liFreq);
+
+    for (i = 0; i < WRITE_SLOTS; i++) {
+        ZeroMemory(&gWriteSlots[i].os, sizeof(OVERLAPPED));
+        gWriteSlots[i].os.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (gWriteSlots[i].os.hEvent == NULL)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterSlotsDestroy
+
+PURPOSE: Cancels writes still in flight and closes the slot events
+
+COMMENTS: Called when the writer thread exits, before the port
+          is closed.
+
+-----------------------------------------------------------------------------*/
+void WriterSlotsDestroy()
+{
+    DWORD dwWritten;
+    int i;
+
+    if (gdwSlotCount)
+        CancelIo(COMDEV(TTYInfo));
+
+    while (gdwSlotCount) {
+        GetOverlappedResult(COMDEV(TTYInfo), &gWriteSlots[gdwSlotHead].os, &dwWritten, TRUE);
+        gdwSlotHead = (gdwSlotHead + 1) % WRITE_SLOTS;
+        gdwSlotCount--;
+    }
+
+    for (i = 0; i < WRITE_SLOTS; i++) {
+        if (gWriteSlots[i].os.hEvent)
+            CloseHandle(gWriteSlots[i].os.hEvent);
+        gWriteSlots[i].os.hEvent = NULL;
+    }
+
+    return;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterCompleteOldest(BOOL)
+
+PURPOSE: Completes the oldest write in flight
+
+PARAMETER:
+    fWait - TRUE to wait for the write, FALSE if it is known to be done
+
+RETURN: FALSE if the thread exit event was set while waiting
+
+COMMENTS: Reports errors and timeouts of the write and records
+          its latency, from WriteFile to completion.
+
+-----------------------------------------------------------------------------*/
+BOOL WriterCompleteOldest(BOOL fWait)
+{
+    LARGE_INTEGER liNow;
+    HANDLE hArray[2];
+    DWORD dwWritten, dwRes, dwLatency;
+    DWORD dwSlot = gdwSlotHead;
+
+    if (gdwSlotCount == 0)
+        return TRUE;
+
+    if (fWait) {
+        hArray[0] = gWriteSlots[dwSlot].os.hEvent;
+        hArray[1] = ghThreadExitEvent;
+
+        dwRes = WaitForMultipleObjects(2, hArray, FALSE, INFINITE);
+        switch(dwRes)
+        {
+            //
+            // write event set
+            //
+            case WAIT_OBJECT_0:
+                        break;
+
+            //
+            // thread exit event set
+            //
+            case WAIT_OBJECT_0 + 1:
+                        return FALSE;
+
+            case WAIT_FAILED:
+            default:    ErrorInComm("WaitForMultipleObjects (WriterGeneric)");
+                        return FALSE;
+        }
+    }
+
+    SetLastError(ERROR_SUCCESS);
+    if (!GetOverlappedResult(COMDEV(TTYInfo), &gWriteSlots[dwSlot].os, &dwWritten, FALSE)) {
+        if (GetLastError() == ERROR_OPERATION_ABORTED)
+            UpdateStatus("Write aborted\r\n");
+        else
+            ErrorInComm("GetOverlappedResult(in Writer)");
+    }
+
+    if (dwWritten != gWriteSlots[dwSlot].dwSize) {
+        if ((GetLastError() == ERROR_SUCCESS) && SHOWTIMEOUTS(TTYInfo))
+            StatusLog(STATUSLOG_WRITEOVERLAPPED, 0, 0);
+        else
+            ErrorReporter("Error writing data to port (overlapped)");
+    }
+
+    QueryPerformanceCounter(&liNow);
+    dwLatency = gWriter.liFreq.QuadPart == 0 ? 0 :
+        (DWORD) ((liNow.QuadPart - gWriteSlots[dwSlot].liIssued.QuadPart) * 1000000 /
+                 gWriter.liFreq.QuadPart);
+
+    gWriter.Stats.dwWrites++;
+    gWriter.Stats.dwBytes += dwWritten;
+    gWriter.Stats.dwLastLatency = dwLatency;
+    gWriter.Stats.dwMaxLatency = max(gWriter.Stats.dwMaxLatency, dwLatency);
+    gWriter.llLatencySum += dwLatency;
+    gWriter.Stats.dwAvgLatency = (DWORD) (gWriter.llLatencySum / gWriter.Stats.dwWrites);
+
+    gdwSlotHead = (gdwSlotHead + 1) % WRITE_SLOTS;
+    gdwSlotCount--;
+
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterFlush
+
+PURPOSE: Waits until all writes in flight are done
+
+COMMENTS: Used where the order of writes and other events matters,
+          like the end of a file transfer.
+
+-----------------------------------------------------------------------------*/
+void WriterFlush()
+{
+    while (gdwSlotCount)
+        if (!WriterCompleteOldest(TRUE))
+            break;
+
     return;
 }
 
@@ -418,105 +854,453 @@ PARAMETER:
     lpBuf     - pointer to data buffer
     dwToWrite - size of buffer
 
+COMMENTS: Data goes through the pacing stage when any pacing
+          option is set, else straight to the write slots.
+          The caller may free the buffer on return.
+
 HISTORY:   Date:      Author:     Comment:
            10/27/95   AllenD      Wrote it
 
 -----------------------------------------------------------------------------*/
 void WriterGeneric(char * lpBuf, DWORD dwToWrite)
 {
-    OVERLAPPED osWrite;
-    HANDLE hArray[2];
-    DWORD dwWritten;
-    DWORD dwRes;
-
-    memset(&osWrite, 0, sizeof(OVERLAPPED));
-
     //
     // If no writing is allowed, then just return
     //
     if (NOWRITING(TTYInfo))
         return ;
 
-    //
-    // create this writes overlapped structure hEvent
-    //
-    osWrite.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-    if (osWrite.hEvent == NULL)
-        ErrorInComm("CreateEvent (overlapped write hEvent)");
+    if (PACERATE(TTYInfo) || PACECHARGAP(TTYInfo) || PACELINEDELAY(TTYInfo))
+        WriterPaced(lpBuf, dwToWrite);
+    else
+        WriterIssue(lpBuf, dwToWrite);
 
-    hArray[0] = osWrite.hEvent;
-    hArray[1] = ghThreadExitEvent;
+    return;
+}
 
-    //
-    // issue write
-    //
-    if (!WriteFile(COMDEV(TTYInfo), lpBuf, dwToWrite, &dwWritten, &osWrite)) {
-        if (GetLastError() == ERROR_IO_PENDING) {
-            //
-            // write is delayed
-            //
-            dwRes = WaitForMultipleObjects(2, hArray, FALSE, INFINITE);
-            switch(dwRes)
-            {
-                //
-                // write event set
-                //
-                case WAIT_OBJECT_0:
-                            SetLastError(ERROR_SUCCESS);
-                            if (!GetOverlappedResult(COMDEV(TTYInfo), &osWrite, &dwWritten, FALSE)) {
-                                if (GetLastError() == ERROR_OPERATION_ABORTED)
-                                    UpdateStatus("Write aborted\r\n");
-                                else
-                                    ErrorInComm("GetOverlappedResult(in Writer)");
-                            }
-
-                            if (dwWritten != dwToWrite) {
-                                if ((GetLastError() == ERROR_SUCCESS) && SHOWTIMEOUTS(TTYInfo))
-                                    UpdateStatus("Write timed out. (overlapped)\r\n");
-                                else
-                                    ErrorReporter("Error writing data to port (overlapped)");
-                            }
-                            break;
+/*-----------------------------------------------------------------------------
 
-                //
-                // thread exit event set
-                //
-                case WAIT_OBJECT_0 + 1:
-                            break;
+FUNCTION: WriterIssue(char *, DWORD)
 
-                //
-                // wait timed out
-                //
-                case WAIT_TIMEOUT:
-                            UpdateStatus("Wait Timeout in WriterGeneric.\r\n");
-                            break;
+PURPOSE: Issues writes for a buffer
 
-                case WAIT_FAILED:
-                default:    ErrorInComm("WaitForMultipleObjects (WriterGeneric)");
-                            break;
-            }
+PARAMETER:
+    lpBuf     - pointer to data buffer
+    dwToWrite - size of buffer
+
+RETURN: FALSE if the writer thread is exiting
+
+COMMENTS: The data is copied into free write slots, WRITE_SLOT_SIZE
+          bytes per slot, and the writes are issued without waiting
+          for them.  A timestamped capture records the data as it
+          is issued.
+
+-----------------------------------------------------------------------------*/
+BOOL WriterIssue(char * lpBuf, DWORD dwToWrite)
+{
+    DWORD dwSlot;
+    DWORD dwSize;
+    DWORD dwWritten;
+
+    while (dwToWrite) {
+        //
+        // all slots busy, wait for the oldest write
+        //
+        if (gdwSlotCount == WRITE_SLOTS)
+            if (!WriterCompleteOldest(TRUE))
+                return FALSE;
+
+        dwSlot = (gdwSlotHead + gdwSlotCount) % WRITE_SLOTS;
+        dwSize = min(dwToWrite, WRITE_SLOT_SIZE);
+
+        CopyMemory(gWriteSlots[dwSlot].Buf, lpBuf, dwSize);
+        gWriteSlots[dwSlot].dwSize = dwSize;
+        QueryPerformanceCounter(&gWriteSlots[dwSlot].liIssued);
+        CapSinkRecord(CAPREC_TX, gWriteSlots[dwSlot].Buf, dwSize);
+
+        lpBuf += dwSize;
+        dwToWrite -= dwSize;
+
+        //
+        // issue write
+        //
+        gWriter.Stats.dwWriteCalls++;
+        if (WriteFile(COMDEV(TTYInfo), gWriteSlots[dwSlot].Buf, dwSize, &dwWritten,
+                      &gWriteSlots[dwSlot].os)) {
+            //
+            // writefile returned immediately
+            //
+            if (dwWritten != dwSize)
+                StatusLog(STATUSLOG_WRITEIMMEDIATE, 0, 0);
+            gWriter.Stats.dwWrites++;
+            gWriter.Stats.dwBytes += dwWritten;
         }
+        else if (GetLastError() == ERROR_IO_PENDING)
+            //
+            // write is delayed
+            //
+            gdwSlotCount++;
         else
             //
             // writefile failed, but it isn't delayed
             //
             ErrorInComm("WriteFile (in Writer)");
     }
-    else {
+
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterPaced(char *, DWORD)
+
+PURPOSE: Sends a buffer through the pacing stage
+
+PARAMETER:
+    lpBuf     - pointer to data buffer
+    dwToWrite - size of buffer
+
+COMMENTS: The buffer is cut into pieces: single characters with a
+          character gap, at most PACE_BUCKET bytes with a rate, and
+          ending at a line end with a line delay.  Before each piece
+          the writer waits for its tokens and for the gap or line
+          delay after the previous piece.  An urgent request (abort)
+          drops the rest of the buffer.
+
+-----------------------------------------------------------------------------*/
+void WriterPaced(char * lpBuf, DWORD dwToWrite)
+{
+    LARGE_INTEGER liNow;
+    LONGLONG llFreq = gWriter.liFreq.QuadPart;
+    LONGLONG llNeed, llStart;
+    DWORD dwRate = PACERATE(TTYInfo);
+    DWORD dwPiece, i;
+
+    timeBeginPeriod(1);
+    QueryPerformanceCounter(&liNow);
+    llStart = liNow.QuadPart;
+
+    while (dwToWrite && !WriterUrgentPending()) {
+        //
+        // cut the next piece
+        //
+        dwPiece = PACECHARGAP(TTYInfo) ? 1 : dwToWrite;
+        if (dwRate)
+            dwPiece = min(dwPiece, PACE_BUCKET);
+        if (PACELINEDELAY(TTYInfo)) {
+            for (i = 0; i < dwPiece; i++)
+                if (lpBuf[i] == ASCII_CR || lpBuf[i] == ASCII_LF)
+                    break;
+            if (i < dwPiece) {
+                // keep CR LF together
+                if (lpBuf[i] == ASCII_CR && i + 1 < dwToWrite && lpBuf[i + 1] == ASCII_LF)
+                    i++;
+                dwPiece = i + 1;
+            }
+        }
+
+        //
+        // gap or line delay after the previous piece
+        //
+        if (gPace.llNextDue && !WriterPaceWait(gPace.llNextDue))
+            break;
+
+        //
+        // token bucket: credit is bytes * llFreq, refilled at dwRate
+        // per second, at most PACE_BUCKET bytes
+        //
+        if (dwRate) {
+            QueryPerformanceCounter(&liNow);
+            gPace.llCredit += min(liNow.QuadPart - gPace.llRefill, llFreq) * dwRate;
+            gPace.llCredit = min(gPace.llCredit, (LONGLONG) PACE_BUCKET * llFreq);
+            gPace.llRefill = liNow.QuadPart;
+
+            llNeed = (LONGLONG) dwPiece * llFreq;
+            if (gPace.llCredit < llNeed) {
+                if (!WriterPaceWait(liNow.QuadPart + (llNeed - gPace.llCredit + dwRate - 1) / dwRate))
+                    break;
+                gPace.llCredit = llNeed;
+                gPace.llRefill = gPace.llDue;
+            }
+            gPace.llCredit -= llNeed;
+        }
+
+        if (!WriterIssue(lpBuf, dwPiece))
+            break;
+
         //
-        // writefile returned immediately
+        // when the next piece may go
         //
-        if (dwWritten != dwToWrite)
-            UpdateStatus("Write timed out. (immediate)\r\n");
+        QueryPerformanceCounter(&liNow);
+        gPace.llNextDue = 0;
+        if (PACELINEDELAY(TTYInfo) &&
+            (lpBuf[dwPiece - 1] == ASCII_CR || lpBuf[dwPiece - 1] == ASCII_LF))
+            gPace.llNextDue = liNow.QuadPart + llFreq * PACELINEDELAY(TTYInfo) / 1000;
+        else if (PACECHARGAP(TTYInfo))
+            gPace.llNextDue = liNow.QuadPart + llFreq * PACECHARGAP(TTYInfo) / 1000;
+
+        gPace.llBytes += dwPiece;
+        lpBuf += dwPiece;
+        dwToWrite -= dwPiece;
     }
 
-    CloseHandle(osWrite.hEvent);
+    QueryPerformanceCounter(&liNow);
+    gPace.llTime += liNow.QuadPart - llStart;
+    timeEndPeriod(1);
 
     return;
 }
 
 /*-----------------------------------------------------------------------------
 
+FUNCTION: WriterPaceWait(LONGLONG)
+
+PURPOSE: Waits until a performance counter time
+
+PARAMETER:
+    llDue - performance counter value to wait for
+
+RETURN: FALSE if the writer thread is exiting or an urgent
+        request came in
+
+COMMENTS: Waits on the waitable timer until about a millisecond
+          before llDue, then spins the rest, so the wait isn't
+          rounded to the timer resolution.  The lateness of each
+          wait is kept for the pacing statistics.  Returns at once
+          if llDue has passed.
+
+-----------------------------------------------------------------------------*/
+BOOL WriterPaceWait(LONGLONG llDue)
+{
+    LARGE_INTEGER liNow, liDue;
+    LONGLONG llFreq = gWriter.liFreq.QuadPart;
+    LONGLONG llLate;
+    HANDLE hArray[3];
+    DWORD nCount = 3;
+    DWORD dwRes;
+
+    gPace.llDue = llDue;
+
+    //
+    // already due, nothing to measure
+    //
+    QueryPerformanceCounter(&liNow);
+    if (liNow.QuadPart >= llDue)
+        return TRUE;
+
+    if (llDue - liNow.QuadPart > llFreq / 1000 * 2) {
+        //
+        // relative due time in 100 ns units, negative
+        //
+        liDue.QuadPart = -((llDue - liNow.QuadPart - llFreq / 1000) * 10000000 / llFreq);
+        if (SetWaitableTimer(gPace.hTimer, &liDue, 0, NULL, NULL, FALSE)) {
+            hArray[0] = gPace.hTimer;
+            hArray[1] = ghThreadExitEvent;
+            hArray[2] = ghWriterEvent;
+            while ((dwRes = WaitForMultipleObjects(nCount, hArray, FALSE, INFINITE))
+                   != WAIT_OBJECT_0) {
+                if (dwRes != WAIT_OBJECT_0 + 2)
+                    return FALSE;
+                //
+                // a new request; keep the event set for WriterProc,
+                // stop for an abort, else wait for the timer alone
+                //
+                SetEvent(ghWriterEvent);
+                if (WriterUrgentPending())
+                    return FALSE;
+                nCount = 2;
+            }
+        }
+    }
+
+    do
+        QueryPerformanceCounter(&liNow);
+    while (liNow.QuadPart < llDue);
+
+    //
+    // lateness in microseconds
+    //
+    llLate = (liNow.QuadPart - llDue) * 1000000 / llFreq;
+    gPace.llLateSum += llLate;
+    gPace.llLateSquares += llLate * llLate;
+    gPace.dwWaits++;
+
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterUrgentPending
+
+PURPOSE: Tells if an urgent request waits, so a long paced
+         write can stop
+
+-----------------------------------------------------------------------------*/
+BOOL WriterUrgentPending()
+{
+    return gWriterUrgent.pOut != &gWriterUrgent.Stub ||
+           NEXTNODE(gWriterUrgent.pOut) != NULL;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterGetStats(WRITERSTATS *)
+
+PURPOSE: Returns write counters and latencies for the status dialog
+
+PARAMETERS:
+    pStats - structure to fill in
+
+COMMENTS: Read without locking from the UI thread, the numbers
+          may be one write apart.
+
+-----------------------------------------------------------------------------*/
+void WriterGetStats(WRITERSTATS * pStats)
+{
+    LONGLONG llMean, llVar, llRoot, llNext;
+
+    *pStats = gWriter.Stats;
+    pStats->dwInFlight = gdwSlotCount;
+    pStats->dwQueued = (DWORD) max(0, gWriterFill.lQueued);
+
+    //
+    // pacing: rate achieved, mean and standard deviation of the
+    // wait lateness
+    //
+    pStats->dwPaceRate = gPace.llTime == 0 ? 0 :
+        (DWORD) (gPace.llBytes * gWriter.liFreq.QuadPart / gPace.llTime);
+    pStats->dwPaceLate = pStats->dwPaceJitter = 0;
+    if (gPace.dwWaits) {
+        llMean = gPace.llLateSum / gPace.dwWaits;
+        llVar = gPace.llLateSquares / gPace.dwWaits - llMean * llMean;
+        llRoot = llVar;
+        if (llVar > 1) {
+            // integer square root, Newton's method
+            llNext = (llRoot + 1) / 2;
+            while (llNext < llRoot) {
+                llRoot = llNext;
+                llNext = (llRoot + llVar / llRoot) / 2;
+            }
+        }
+        pStats->dwPaceLate = (DWORD) llMean;
+        pStats->dwPaceJitter = (DWORD) llRoot;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterRequestBytes(PWRITEREQUEST)
+
+PURPOSE: Returns the data bytes a request holds in the queue
+
+COMMENTS: WRITE_FILESTART carries the file size, not data.
+
+-----------------------------------------------------------------------------*/
+DWORD WriterRequestBytes(PWRITEREQUEST pWrite)
+{
+    switch(pWrite->dwWriteType)
+    {
+        case WRITE_CHAR:    return 1;
+        case WRITE_FILE:
+        case WRITE_BLOCK:   return pWrite->dwSize;
+        default:            return 0;
+    }
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterRelease(PWRITEREQUEST)
+
+PURPOSE: Takes a processed or dropped request off the queue fill
+         and frees the packet, and the data of a WRITE_BLOCK
+         request that has a heap (a paste)
+
+PARAMETERS:
+    pWrite - request popped from a queue
+
+-----------------------------------------------------------------------------*/
+void WriterRelease(PWRITEREQUEST pWrite)
+{
+    DWORD dwBytes = WriterRequestBytes(pWrite);
+    LONG  lQueued;
+
+    if (pWrite->dwWriteType == WRITE_BLOCK && pWrite->hHeap)
+        HeapFree(pWrite->hHeap, 0, pWrite->lpBuf);
+
+    if (pWrite->pMapRef && InterlockedDecrement(&pWrite->pMapRef->lRefs) == 0)
+        SetEvent(pWrite->pMapRef->hEvent);
+
+    WrPoolFree(pWrite);
+
+    if (dwBytes == 0)
+        return;
+
+    lQueued = InterlockedExchangeAdd(&gWriterFill.lQueued, -(LONG) dwBytes) - (LONG) dwBytes;
+    if (gWriterFill.fFull && lQueued < (LONG) (TXLOWKB(TTYInfo) * 1024))
+        WriterOpenRoom();
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterOpenRoom
+
+PURPOSE: Sets ghWriterRoomEvent if the queue is full and has
+         drained below the low watermark
+
+COMMENTS: Writer thread only.  Called for each request released
+          and, to catch a producer that filled the queue while a
+          release was checking, whenever the writer goes idle.
+
+-----------------------------------------------------------------------------*/
+void WriterOpenRoom()
+{
+    if (!gWriterFill.fFull)
+        return;
+
+    EnterCriticalSection(&gWriterFill.csRoom);
+    if (gWriterFill.fFull &&
+        gWriterFill.lQueued < (LONG) (TXLOWKB(TTYInfo) * 1024)) {
+        gWriterFill.fFull = FALSE;
+        SetEvent(ghWriterRoomEvent);
+    }
+    LeaveCriticalSection(&gWriterFill.csRoom);
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterWouldBlock
+
+PURPOSE: Tells a producer that can't wait if it should hold its data
+
+RETURN:
+    TRUE if the queue reached the high watermark and hasn't
+    drained below the low watermark yet.
+
+-----------------------------------------------------------------------------*/
+BOOL WriterWouldBlock()
+{
+    return gWriterFill.fFull;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterBusy
+
+PURPOSE: Tells if the writer still has data to send
+
+RETURN:
+    TRUE while data bytes are queued or writes are in flight.
+
+COMMENTS: Used by the repeat scheduler to find overruns.
+
+-----------------------------------------------------------------------------*/
+BOOL WriterBusy()
+{
+    return gWriterFill.lQueued > 0 || gdwSlotCount > 0;
+}
+
+/*-----------------------------------------------------------------------------
+
 FUNCTION: WriterAddNewNode(DWORD, DWORD, char, char *, HANDLE, HWND)
 
 PURPOSE: Adds a new write request packet
@@ -530,7 +1314,7 @@ PARAMETERS:
     hProgress     - hwnd of transfer progress bar
 
 RETURN:
-    TRUE if node is added to linked list
+    TRUE if node is added to the queue
     FALSE if node can't be allocated.
 
 COMMENTS: Allocates a new packet and fills it based on the
@@ -552,9 +1336,9 @@ BOOL WriterAddNewNode(  DWORD dwRequestType,
     //
     // allocate new packet
     //
-    pWrite = (PWRITEREQUEST)HeapAlloc(ghWriterHeap, 0, sizeof(WRITEREQUEST));
+    pWrite = WrPoolAlloc();
     if (pWrite == NULL) {
-        ErrorReporter("HeapAlloc (writer packet)");
+        ErrorReporter("WrPoolAlloc (writer packet)");
         return FALSE;
     }
 
@@ -567,8 +1351,9 @@ BOOL WriterAddNewNode(  DWORD dwRequestType,
     pWrite->lpBuf        = lpBuf;
     pWrite->hHeap        = hHeap;
     pWrite->hWndProgress = hProgress;
+    pWrite->pMapRef      = NULL;
 
-    AddToLinkedList(pWrite);
+    AddToQueue(&gWriterQueue, pWrite);
 
     return TRUE;
 }
@@ -590,12 +1375,13 @@ PARAMETERS:
     dwTimeout     - timeout value for waiting
 
 RETURN:
-    TRUE if node is added to linked list
-    FALSE if node can't be allocated.
+    TRUE if node is added to the queue
+    FALSE if the queue stayed full or node can't be allocated.
 
 COMMENTS: Allocates a new packet and fills it based on the
-          parameters passed in.  If the first attemp to allocate packet
-          fails, then the function sleeps and tries again when it resumes.
+          parameters passed in.  A request carrying data first
+          waits, up to dwTimeout, for the queue to drain below the
+          low watermark.
 
 HISTORY:   Date:      Author:     Comment:
            10/27/95   AllenD      Wrote it
@@ -612,19 +1398,17 @@ BOOL WriterAddNewNodeTimeout(   DWORD dwRequestType,
     PWRITEREQUEST pWrite;
 
     //
-    // attempt first allocation
+    // data waits for room in the queue
     //
-    pWrite = (PWRITEREQUEST)HeapAlloc(ghWriterHeap, 0, sizeof(WRITEREQUEST));
-    if (pWrite == NULL) {
-        Sleep(dwTimeout);
-        //
-        // attempt second allocation
-        //
-        pWrite = (PWRITEREQUEST)HeapAlloc(ghWriterHeap, 0, sizeof(WRITEREQUEST));
-        if (pWrite == NULL) {
-            ErrorReporter("HeapAlloc (writer packet)");
+    if (dwRequestType == WRITE_FILE || dwRequestType == WRITE_BLOCK) {
+        if (WaitForSingleObject(ghWriterRoomEvent, dwTimeout) != WAIT_OBJECT_0)
             return FALSE;
-        }
+    }
+
+    pWrite = WrPoolAlloc();
+    if (pWrite == NULL) {
+        ErrorReporter("WrPoolAlloc (writer packet)");
+        return FALSE;
     }
 
     //
@@ -636,19 +1420,20 @@ BOOL WriterAddNewNodeTimeout(   DWORD dwRequestType,
     pWrite->lpBuf        = lpBuf;
     pWrite->hHeap        = hHeap;
     pWrite->hWndProgress = hProgress;
+    pWrite->pMapRef      = NULL;
 
-    AddToLinkedList(pWrite);
+    AddToQueue(&gWriterQueue, pWrite);
 
     return TRUE;
 }
 
 /*-----------------------------------------------------------------------------
 
-FUNCTION: WriterAddFirstNodeTimeout(DWORD, DWORD, char, char *,
+FUNCTION: WriterAddUrgentNodeTimeout(DWORD, DWORD, char, char *,
                                     HANDLE, HWND, DWORD)
 
-PURPOSE: Adds a new write request packet and places it at the front of the
-         list, timesout if can't allocate packet.
+PURPOSE: Adds a new write request packet to the urgent queue,
+         timesout if can't allocate packet.
 
 PARAMETERS:
     dwRequestType - write request packet request type
@@ -660,17 +1445,17 @@ PARAMETERS:
     dwTimeout     - timeout value for waiting
 
 RETURN:
-    TRUE if node is added to linked list
+    TRUE if node is added to the queue
     FALSE if node can't be allocated.
 
 COMMENTS: This function differs from WriterAddNewNodeTimeout only in that
-          it places the node at the front of the list.
+          the writer takes the node before any queued data request.
 
 HISTORY:   Date:      Author:     Comment:
             1/26/96   AllenD      Wrote it
 
 -----------------------------------------------------------------------------*/
-BOOL WriterAddFirstNodeTimeout(   DWORD dwRequestType,
+BOOL WriterAddUrgentNodeTimeout(  DWORD dwRequestType,
                                 DWORD dwSize,
                                 char ch,
                                 char * lpBuf,
@@ -683,15 +1468,15 @@ BOOL WriterAddFirstNodeTimeout(   DWORD dwRequestType,
     //
     // attempt first allocation
     //
-    pWrite = (PWRITEREQUEST)HeapAlloc(ghWriterHeap, 0, sizeof(WRITEREQUEST));
+    pWrite = WrPoolAlloc();
     if (pWrite == NULL) {
         Sleep(dwTimeout);
         //
         // attempt second allocation
         //
-        pWrite = (PWRITEREQUEST)HeapAlloc(ghWriterHeap, 0, sizeof(WRITEREQUEST));
+        pWrite = WrPoolAlloc();
         if (pWrite == NULL) {
-            ErrorReporter("HeapAlloc (writer packet)");
+            ErrorReporter("WrPoolAlloc (writer packet)");
             return FALSE;
         }
     }
@@ -705,8 +1490,9 @@ BOOL WriterAddFirstNodeTimeout(   DWORD dwRequestType,
     pWrite->lpBuf        = lpBuf;
     pWrite->hHeap        = hHeap;
     pWrite->hWndProgress = hProgress;
+    pWrite->pMapRef      = NULL;
 
-    AddToFrontOfLinkedList(pWrite);
+    AddToQueue(&gWriterUrgent, pWrite);
 
     return TRUE;
 }
@@ -751,42 +1537,93 @@ BOOL WriterAddExistingNode( PWRITEREQUEST pNode,
     pNode->lpBuf        = lpBuf;
     pNode->hHeap        = hHeap;
     pNode->hWndProgress = hProgress;
+    pNode->pMapRef      = NULL;
 
-    AddToLinkedList(pNode);
+    AddToQueue(&gWriterQueue, pNode);
 
     return TRUE;
 }
 
 /*-----------------------------------------------------------------------------
 
-FUNCTION: AddToLinkedList(PWRITEREQUEST)
+FUNCTION: WriterAddMappedNode
 
-PURPOSE: Adds a node to the write request linked list
+PURPOSE: Adds a write request packet for data in a mapped file view
 
 PARAMETERS:
-    pNode - pointer to write request packet to add to linked list
+    pNode         - packet from WrPoolAlloc
+    dwRequestType - WRITE_FILE or WRITE_BLOCK
+    dwSize        - size of write request
+    lpBuf         - address of the data in the view
+    pMapRef       - references to the view
+    hProgress     - hwnd of transfer progress bar
 
-HISTORY:   Date:      Author:     Comment:
-           10/27/95   AllenD      Wrote it
+RETURN: always TRUE
+
+COMMENTS: The data isn't copied.  The packet holds a reference on
+          the view until the writer releases it, the view must stay
+          mapped until then.
 
 -----------------------------------------------------------------------------*/
-void AddToLinkedList(PWRITEREQUEST pNode)
+BOOL WriterAddMappedNode( PWRITEREQUEST pNode,
+                          DWORD dwRequestType,
+                          DWORD dwSize,
+                          char * lpBuf,
+                          MAPREF * pMapRef,
+                          HWND hProgress)
 {
-    PWRITEREQUEST pOldLast;
-    //
-    // add node to linked list
-    //
-    EnterCriticalSection(&gcsWriterHeap);
+    InterlockedIncrement(&pMapRef->lRefs);
+
+    pNode->dwWriteType  = dwRequestType;
+    pNode->dwSize       = dwSize;
+    pNode->ch           = 0;
+    pNode->lpBuf        = lpBuf;
+    pNode->hHeap        = NULL;
+    pNode->hWndProgress = hProgress;
+    pNode->pMapRef      = pMapRef;
+
+    AddToQueue(&gWriterQueue, pNode);
+
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: AddToQueue(WRQUEUE *, PWRITEREQUEST)
 
-    pOldLast = gpWriterTail->pPrev;
+PURPOSE: Adds a node to a write request queue and wakes the writer
 
-    pNode->pNext = gpWriterTail;
-    pNode->pPrev = pOldLast;
+PARAMETERS:
+    pQueue - gWriterQueue or gWriterUrgent
+    pNode  - pointer to write request packet to add to the queue
+
+-----------------------------------------------------------------------------*/
+void AddToQueue(WRQUEUE * pQueue, PWRITEREQUEST pNode)
+{
+    DWORD dwBytes = WriterRequestBytes(pNode);
+    LONG  lQueued;
 
-    pOldLast->pNext = pNode;
-    gpWriterTail->pPrev = pNode;
+    //
+    // count the bytes before the writer can release them
+    //
+    if (dwBytes) {
+        lQueued = InterlockedExchangeAdd(&gWriterFill.lQueued, (LONG) dwBytes) + (LONG) dwBytes;
+        if ((DWORD) lQueued > gWriter.Stats.dwQueuedPeak)
+            gWriter.Stats.dwQueuedPeak = (DWORD) lQueued;
+
+        if (!gWriterFill.fFull && lQueued >= (LONG) (TXHIGHKB(TTYInfo) * 1024)) {
+            EnterCriticalSection(&gWriterFill.csRoom);
+            if (!gWriterFill.fFull &&
+                gWriterFill.lQueued >= (LONG) (TXHIGHKB(TTYInfo) * 1024)) {
+                gWriterFill.fFull = TRUE;
+                ResetEvent(ghWriterRoomEvent);
+                gWriter.Stats.dwFull++;
+            }
+            LeaveCriticalSection(&gWriterFill.csRoom);
+        }
+    }
 
-    LeaveCriticalSection(&gcsWriterHeap);
+    WrQueuePush(pQueue, pNode);
 
     //
     // notify writer thread that a node has been added
@@ -799,85 +1636,116 @@ void AddToLinkedList(PWRITEREQUEST pNode)
 
 /*-----------------------------------------------------------------------------
 
-FUNCTION: AddToFrontOfLinkedList(PWRITEREQUEST)
-
-PURPOSE: Adds a node to the front of the write request linked list
+FUNCTION: WrQueueInit(WRQUEUE *)
 
-PARAMETERS:
-    pNode - pointer to write request packet to add to linked list
-
-HISTORY:   Date:      Author:     Comment:
-            1/26/96   AllenD      Wrote it
+PURPOSE: Makes an empty queue, holding only the stub node
 
 -----------------------------------------------------------------------------*/
-void AddToFrontOfLinkedList(PWRITEREQUEST pNode)
+void WrQueueInit(WRQUEUE * pQueue)
 {
-    PWRITEREQUEST pNextNode;
-    //
-    // add node to linked list
-    //
-    EnterCriticalSection(&gcsWriterHeap);
+    pQueue->Stub.pNext = NULL;
+    pQueue->pIn = &pQueue->Stub;
+    pQueue->pOut = &pQueue->Stub;
+}
 
-    pNextNode = gpWriterHead->pNext;
+/*-----------------------------------------------------------------------------
 
-    pNextNode->pPrev = pNode;
-    gpWriterHead->pNext = pNode;
+FUNCTION: WrQueuePush(WRQUEUE *, PWRITEREQUEST)
 
-    pNode->pNext = pNextNode;
-    pNode->pPrev = gpWriterHead;
+PURPOSE: Adds a node at the end of a queue
 
-    LeaveCriticalSection(&gcsWriterHeap);
+PARAMETERS:
+    pQueue - queue
+    pNode  - node to add
 
-    //
-    // notify writer thread that a node has been added
-    //
-    if (!SetEvent(ghWriterEvent))
-        ErrorReporter("SetEvent( writer packet )");
+COMMENTS: Safe from any number of threads.  Between the exchange
+          and the store to pPrev->pNext the node is not reachable
+          yet, WrQueuePop sees the queue as empty until it is.
 
-    return;
+-----------------------------------------------------------------------------*/
+void WrQueuePush(WRQUEUE * pQueue, PWRITEREQUEST pNode)
+{
+    PWRITEREQUEST pPrev;
+
+    pNode->pNext = NULL;
+    pPrev = (PWRITEREQUEST) InterlockedExchangePointer((PVOID volatile *) &pQueue->pIn, pNode);
+    NEXTNODE(pPrev) = pNode;
 }
 
 /*-----------------------------------------------------------------------------
 
-FUNCTION: RemoveFromLinkedList(PWRITEREQUEST)
+FUNCTION: WrQueuePop(WRQUEUE *)
 
-PURPOSE: Deallocates the head node and makes the passed in node
-         the new head node.
-         Sets the head node point to node just after the passed in node.
-         Returns the node pointed to by the head node.
+PURPOSE: Takes the oldest node out of a queue
 
 PARAMETERS:
-    pNode - pointer to node to make the new head
+    pQueue - queue
 
 RETURN:
-    Pointer to next node.  This will be NULL if there are no
-    more nodes in the list.
+    The node, or NULL if the queue is empty or a push of
+    the last node isn't finished.
 
-HISTORY:   Date:      Author:     Comment:
-           10/27/95   AllenD      Wrote it
+COMMENTS: Writer thread only.  A NULL during an unfinished push is
+          harmless, the producer sets ghWriterEvent after the push.
 
 -----------------------------------------------------------------------------*/
-PWRITEREQUEST RemoveFromLinkedList(PWRITEREQUEST pNode)
+PWRITEREQUEST WrQueuePop(WRQUEUE * pQueue)
 {
-    PWRITEREQUEST pNextNode;
-    PWRITEREQUEST pPrevNode;
-    BOOL bRes;
-
-    EnterCriticalSection(&gcsWriterHeap);
+    PWRITEREQUEST pOut = pQueue->pOut;
+    PWRITEREQUEST pNext = NEXTNODE(pOut);
 
-    pNextNode = pNode->pNext;
-    pPrevNode = pNode->pPrev;
+    //
+    // skip the stub node
+    //
+    if (pOut == &pQueue->Stub) {
+        if (pNext == NULL)
+            return NULL;
+        pQueue->pOut = pNext;
+        pOut = pNext;
+        pNext = NEXTNODE(pNext);
+    }
 
-    bRes = HeapFree(ghWriterHeap, 0, pNode);
+    if (pNext != NULL) {
+        pQueue->pOut = pNext;
+        return pOut;
+    }
 
-    pPrevNode->pNext = pNextNode;
-    pNextNode->pPrev = pPrevNode;
+    //
+    // pOut is the last node linked, a push may be under way
+    //
+    if (pOut != pQueue->pIn)
+        return NULL;
 
-    LeaveCriticalSection(&gcsWriterHeap);
+    //
+    // put the stub behind it so pOut can be taken
+    //
+    WrQueuePush(pQueue, &pQueue->Stub);
 
-    if (!bRes)
-        ErrorReporter("HeapFree(write request)");
+    pNext = NEXTNODE(pOut);
+    if (pNext != NULL) {
+        pQueue->pOut = pNext;
+        return pOut;
+    }
 
-    return pNextNode;     // return the freed node's pNext (maybe the tail)
+    return NULL;
 }
 
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WriterNextRequest
+
+PURPOSE: Takes the next write request, urgent requests first
+
+RETURN: The request, or NULL if both queues are empty
+
+-----------------------------------------------------------------------------*/
+PWRITEREQUEST WriterNextRequest()
+{
+    PWRITEREQUEST pWrite;
+
+    pWrite = WrQueuePop(&gWriterUrgent);
+    if (pWrite == NULL)
+        pWrite = WrQueuePop(&gWriterQueue);
+
+    return pWrite;
+}
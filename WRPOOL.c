@@ -0,0 +1,240 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: WrPool.c
+
+    PURPOSE: Fixed size allocator for write request packets.
+
+             All packets come from one static slab of WRPOOL_NODES
+             nodes, so sending a key or a file block never calls the
+             heap.  Free nodes are kept in a global free list and in
+             a small cache per thread:
+
+             - a producer (tty window, transfer thread) takes nodes
+               from its cache, refilling it from the global list
+               WRPOOL_BATCH nodes at a time;
+             - the writer thread frees nodes into its cache and gives
+               them back to the global list in batches.
+
+             So the global lock is taken once per WRPOOL_BATCH packets.
+             The slab size limits the number of queued requests, a
+             full pool makes senders wait like the old writer heap
+             limit did.
+
+    FUNCTIONS:
+        WrPoolCreate     - builds the free list
+        WrPoolDestroy    - frees the pool lock
+        WrPoolAlloc      - allocates a packet
+        WrPoolFree       - frees a packet
+        WrPoolThreadExit - returns a thread's cached packets
+        WrPoolGetStats   - pool statistics
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include "MTTTY.h"
+
+#define WRPOOL_BATCH        32          // nodes moved per global lock
+
+/*
+    Free nodes of one thread, linked through pNext
+*/
+typedef struct WRCACHE
+{
+    PWRITEREQUEST pHead;
+    DWORD         dwCount;
+} WRCACHE;
+
+static struct
+{
+    CRITICAL_SECTION csFree;            // protects pFree and dwFree
+    PWRITEREQUEST    pFree;
+    DWORD            dwFree;
+    LONG volatile    lInUse;            // statistics
+    LONG volatile    lPeak;
+    LONG volatile    lFailures;
+} gWrPool;
+
+static WRITEREQUEST gWrNodes[WRPOOL_NODES];
+
+static THREAD_LOCAL WRCACHE gWrCache;
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WrPoolCreate
+
+PURPOSE: Puts all slab nodes in the global free list
+
+-----------------------------------------------------------------------------*/
+void WrPoolCreate()
+{
+    int i;
+
+    InitializeCriticalSection(&gWrPool.csFree);
+
+    for (i = 0; i < WRPOOL_NODES - 1; i++)
+        gWrNodes[i].pNext = &gWrNodes[i + 1];
+    gWrNodes[WRPOOL_NODES - 1].pNext = NULL;
+
+    gWrPool.pFree = gWrNodes;
+    gWrPool.dwFree = WRPOOL_NODES;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WrPoolDestroy
+
+PURPOSE: Frees the pool lock
+
+-----------------------------------------------------------------------------*/
+void WrPoolDestroy()
+{
+    DeleteCriticalSection(&gWrPool.csFree);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WrPoolAlloc
+
+PURPOSE: Allocates a write request packet
+
+RETURN: packet, not zeroed; NULL if all packets are in use
+
+-----------------------------------------------------------------------------*/
+PWRITEREQUEST WrPoolAlloc()
+{
+    PWRITEREQUEST pNode;
+    LONG lInUse, lPeak;
+    DWORD i;
+
+    if (gWrCache.pHead == NULL) {
+        //
+        // refill the cache, the batch is the front of the global list
+        //
+        EnterCriticalSection(&gWrPool.csFree);
+
+        pNode = gWrPool.pFree;
+        for (i = 1; pNode && i < WRPOOL_BATCH && pNode->pNext; i++)
+            pNode = pNode->pNext;
+
+        if (pNode) {
+            gWrCache.pHead = gWrPool.pFree;
+            gWrCache.dwCount = i;
+            gWrPool.pFree = pNode->pNext;
+            gWrPool.dwFree -= i;
+            pNode->pNext = NULL;
+        }
+
+        LeaveCriticalSection(&gWrPool.csFree);
+
+        if (gWrCache.pHead == NULL) {
+            InterlockedIncrement(&gWrPool.lFailures);
+            return NULL;
+        }
+    }
+
+    pNode = gWrCache.pHead;
+    gWrCache.pHead = pNode->pNext;
+    gWrCache.dwCount--;
+
+    lInUse = InterlockedIncrement(&gWrPool.lInUse);
+    while (lInUse > (lPeak = gWrPool.lPeak))
+        if (InterlockedCompareExchange(&gWrPool.lPeak, lInUse, lPeak) == lPeak)
+            break;
+
+    return pNode;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WrPoolFree(PWRITEREQUEST)
+
+PURPOSE: Frees a write request packet
+
+PARAMETERS:
+    pNode - packet from WrPoolAlloc, may come from another thread
+
+COMMENTS: When the thread's cache holds two batches, one batch
+          goes back to the global list.
+
+-----------------------------------------------------------------------------*/
+void WrPoolFree(PWRITEREQUEST pNode)
+{
+    PWRITEREQUEST pLast;
+    DWORD i;
+
+    pNode->pNext = gWrCache.pHead;
+    gWrCache.pHead = pNode;
+    gWrCache.dwCount++;
+
+    InterlockedDecrement(&gWrPool.lInUse);
+
+    if (gWrCache.dwCount < 2 * WRPOOL_BATCH)
+        return;
+
+    for (pLast = gWrCache.pHead, i = 1; i < WRPOOL_BATCH; i++)
+        pLast = pLast->pNext;
+
+    EnterCriticalSection(&gWrPool.csFree);
+    pNode = gWrCache.pHead;
+    gWrCache.pHead = pLast->pNext;
+    pLast->pNext = gWrPool.pFree;
+    gWrPool.pFree = pNode;
+    gWrPool.dwFree += WRPOOL_BATCH;
+    LeaveCriticalSection(&gWrPool.csFree);
+
+    gWrCache.dwCount -= WRPOOL_BATCH;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WrPoolThreadExit
+
+PURPOSE: Gives the calling thread's cached packets back
+
+COMMENTS: Called by threads that use the pool before they exit,
+          or the packets in their cache would be lost.
+
+-----------------------------------------------------------------------------*/
+void WrPoolThreadExit()
+{
+    PWRITEREQUEST pLast;
+
+    if (gWrCache.pHead == NULL)
+        return;
+
+    for (pLast = gWrCache.pHead; pLast->pNext; pLast = pLast->pNext)
+        ;
+
+    EnterCriticalSection(&gWrPool.csFree);
+    pLast->pNext = gWrPool.pFree;
+    gWrPool.pFree = gWrCache.pHead;
+    gWrPool.dwFree += gWrCache.dwCount;
+    LeaveCriticalSection(&gWrPool.csFree);
+
+    gWrCache.pHead = NULL;
+    gWrCache.dwCount = 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: WrPoolGetStats(WRPOOLSTATS *)
+
+PURPOSE: Returns pool usage for the status dialog
+
+PARAMETERS:
+    pStats - structure to fill in
+
+-----------------------------------------------------------------------------*/
+void WrPoolGetStats(WRPOOLSTATS * pStats)
+{
+    pStats->dwNodes    = WRPOOL_NODES;
+    pStats->dwInUse    = (DWORD) max(0, gWrPool.lInUse);
+    pStats->dwPeak     = (DWORD) gWrPool.lPeak;
+    pStats->dwFailures = (DWORD) gWrPool.lFailures;
+}
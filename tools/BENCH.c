@@ -0,0 +1,896 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: Bench.c
+
+    PURPOSE: Headless benchmarks of the receive display path.
+
+             bench [-m MB] [-l lines] [case ...]
+
+                -m MB       data per run, default 4
+                -l lines    history lines to search, default 1000000
+                case        run only the named cases, default all
+
+             The real Reader.c (with the VT100 parser and the
+             scrollback history it feeds) runs against a hidden tty
+             window, so invalidating and timers cost what they do
+             in mttty, but nothing is painted.  Data goes in
+             RX_CHUNK byte buffers, the way the tty window drains
+             the receive ring.
+
+             Where the code was rewritten for speed, the case also
+             runs the old code, kept here as it was, on the same
+             data and prints both rates.  The caret isn't shown, so
+             the old code's per character caret move costs nothing
+             and the old rates are on the high side.
+
+             A case with a display option on can also run the same
+             data with all options off, and prints the plain rate
+             next to its own.
+
+             The old code shows bytes above 0x7F as ff, so its
+             screen is only compared on text.
+
+             The search case fills the history with log lines and
+             times queries on the real Search.c: until the first hit
+             is known and until the search is done.
+
+             The hexrows case formats random data into hex view rows
+             with the real HexView.c, and with sprintf on the same
+             data for a yardstick, and prints rows per second.
+
+    FUNCTIONS:
+        main                    - parses the command line, runs the cases
+        BenchSelected           - tells if a case is to be run
+        BenchWindow             - makes the hidden tty window
+        BenchReset              - clears the screen and the history
+        BenchMakeText           - fills a buffer with text lines
+        BenchMakeBinary         - fills a buffer with random bytes
+        BenchMakeAnsi           - fills a buffer with colored text lines
+        BenchRandom             - pseudo random numbers
+        BenchRun                - times one display path over the data
+        OldOutputACharToWindow  - old display path, per character
+        OldOutputABufferToWindow - old display path, per buffer
+        BenchSearch             - times searches of a long history
+        BenchQuery              - times one search
+        BenchHexRows            - times hex view row formatting
+        SprintfHexFormatRow     - hex view row with sprintf
+        MoveTTYCursor           - stands in for the tty window's
+        UpdateTTYVertScroll     - ignored, no scroll bar
+        ScrollbackRows          - as the tty window's
+        UpdateStatus            - ignored, no status window
+        RxRingWrite             - unused, no receive ring
+        CapSinkWrite            - unused, no capture
+        ErrorReporter           - reports errors
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../MTTTY.h"
+
+#define RX_CHUNK        0x4000          // bytes per display call
+#define BENCH_LINE_MAX  120             // longest text line
+#define BENCH_WORD_MAX  12              // longest colored word
+
+#define DATA_TEXT       0               // printable lines
+#define DATA_BINARY     1               // random bytes
+#define DATA_ANSI       2               // lines with SGR color sequences
+#define BENCH_HISTORY   0x40000000      // history budget for the search case
+#define BENCH_ERRORS    100000          // lines per ERROR line in the history
+#define BENCH_HEXRUNS   8               // passes over the data in the hexrows case
+
+typedef void (*OUTPUTPROC)( HWND, char *, DWORD );
+
+typedef struct BENCHCASE
+{
+    const char * szName;
+    int        nData;               // DATA_*
+    BOOL       fNonPrintHex;        // the display options
+    BOOL       fDisplayHex;
+    BOOL       fAnsi;
+    OUTPUTPROC pOld;                // old code, NULL if none
+    BOOL       fCompare;            // old and new must give the same screen
+    BOOL       fVsPlain;            // also run with the display options off
+} BENCHCASE;
+
+typedef struct BENCHQUERY
+{
+    const char * szText;
+    BOOL       fMatchCase;
+} BENCHQUERY;
+
+//
+// a few hits, the same ignoring case, one hit, every line, none
+//
+BENCHQUERY gQueries[] =
+{
+    { "ERROR 0x",       TRUE  },
+    { "error 0x",       FALSE },
+    { "seq=123456 ",    TRUE  },
+    { "status=OK",      TRUE  },
+    { "not in there",   TRUE  },
+};
+
+#define BENCH_QUERIES   (sizeof(gQueries) / sizeof(gQueries[0]))
+
+DWORD gdwRandom = 1;
+LARGE_INTEGER gliFreq;
+CHAR gNewScreen[MAXCOLS * MAXROWS];
+char ** gpszCases;                  // cases named on the command line
+int gnCases;
+
+//
+// Prototypes for functions called only within this file
+//
+BOOL BenchSelected( const char * );
+HWND BenchWindow( void );
+void BenchReset( void );
+void BenchMakeText( char *, DWORD );
+void BenchMakeBinary( char *, DWORD );
+void BenchMakeAnsi( char *, DWORD );
+DWORD BenchRandom( void );
+double BenchRun( OUTPUTPROC, HWND, char *, DWORD );
+void OldOutputACharToWindow( HWND, char );
+void OldOutputABufferToWindow( HWND, char *, DWORD );
+void BenchSearch( DWORD );
+void BenchQuery( const BENCHQUERY * );
+BOOL BenchHexRows( char *, DWORD );
+void SprintfHexFormatRow( DWORDLONG, const BYTE *, int, char * );
+
+BENCHCASE gCases[] =
+{
+    { "text",       DATA_TEXT,   FALSE, FALSE, FALSE, OldOutputABufferToWindow, TRUE,  FALSE },
+    { "text-nph",   DATA_TEXT,   TRUE,  FALSE, FALSE, OldOutputABufferToWindow, TRUE,  FALSE },
+    { "binary-nph", DATA_BINARY, TRUE,  FALSE, FALSE, OldOutputABufferToWindow, FALSE, FALSE },
+    { "text-hex",   DATA_TEXT,   FALSE, TRUE,  FALSE, OldOutputABufferToWindow, TRUE,  TRUE  },
+    { "binary-hex", DATA_BINARY, FALSE, TRUE,  FALSE, OldOutputABufferToWindow, FALSE, TRUE  },
+    { "text-ansi",  DATA_TEXT,   FALSE, FALSE, TRUE,  NULL,                     FALSE, TRUE  },
+    { "ansi",       DATA_ANSI,   FALSE, FALSE, TRUE,  NULL,                     FALSE, TRUE  },
+};
+
+#define BENCH_CASES     (sizeof(gCases) / sizeof(gCases[0]))
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: main(int, char **)
+
+PURPOSE: Parses the command line and runs the cases
+
+RETURN: 0 if run, 1 on a bad command line or when old and new
+        code don't give the same screen
+
+-----------------------------------------------------------------------------*/
+int main(int argc, char ** argv)
+{
+    BENCHCASE * pCase;
+    HWND hTTY;
+    char * lpData;
+    DWORD dwBytes = 4 * 0x100000;
+    DWORD dwLines = 1000000;
+    double dOld, dNew, dPlain;
+    BOOL fFailed = FALSE;
+    int i, j;
+
+    for (i = 1; i < argc; i++) {
+        if (lstrcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            dwBytes = strtoul(argv[++i], NULL, 0) * 0x100000;
+        else if (lstrcmp(argv[i], "-l") == 0 && i + 1 < argc)
+            dwLines = strtoul(argv[++i], NULL, 0);
+        else if (argv[i][0] != '-') {
+            gpszCases = argv + i;
+            gnCases = argc - i;
+            break;
+        }
+        else {
+            dwBytes = 0;
+            break;
+        }
+    }
+
+    if (dwBytes == 0 || dwLines == 0) {
+        fprintf(stderr, "usage: bench [-m MB] [-l lines] [case ...]\n");
+        return 1;
+    }
+
+    lpData = (char *) malloc(dwBytes);
+    hTTY = BenchWindow();
+    if (lpData == NULL || hTTY == NULL) {
+        fprintf(stderr, "bench: can't set up\n");
+        return 1;
+    }
+
+    ghWndTTY = hTTY;
+    QueryPerformanceFrequency(&gliFreq);
+    SbCreate();
+    SearchCreate();
+    VtInit();
+
+    for (pCase = gCases; pCase < gCases + BENCH_CASES; pCase++) {
+        if (!BenchSelected(pCase->szName))
+            continue;
+
+        gdwRandom = 1;
+        if (pCase->nData == DATA_BINARY)
+            BenchMakeBinary(lpData, dwBytes);
+        else if (pCase->nData == DATA_ANSI)
+            BenchMakeAnsi(lpData, dwBytes);
+        else
+            BenchMakeText(lpData, dwBytes);
+
+        NONPRINTHEX( TTYInfo ) = pCase->fNonPrintHex;
+        DISPLAYHEX( TTYInfo ) = pCase->fDisplayHex;
+        ANSI( TTYInfo ) = pCase->fAnsi;
+
+        dNew = BenchRun(OutputABufferToWindow, hTTY, lpData, dwBytes);
+        printf("%-12s new %8.1f MB/s", pCase->szName, dNew);
+
+        if (pCase->pOld) {
+            //
+            // the new screen is a row ring, the old one isn't
+            //
+            for (j = 0; j < MAXROWS; j++)
+                CopyMemory(gNewScreen + j * MAXCOLS, SCREENROW( TTYInfo, j ), MAXCOLS);
+            dOld = BenchRun(pCase->pOld, hTTY, lpData, dwBytes);
+            printf(", old %8.1f MB/s, %.1fx", dOld, dNew / dOld);
+
+            if (pCase->fCompare &&
+                memcmp(gNewScreen, SCREEN( TTYInfo ), sizeof(gNewScreen)) != 0) {
+                printf(", screens differ");
+                fFailed = TRUE;
+            }
+        }
+
+        if (pCase->fVsPlain) {
+            NONPRINTHEX( TTYInfo ) = FALSE;
+            DISPLAYHEX( TTYInfo ) = FALSE;
+            ANSI( TTYInfo ) = FALSE;
+            dPlain = BenchRun(OutputABufferToWindow, hTTY, lpData, dwBytes);
+            printf(", plain %8.1f MB/s, %.1fx", dPlain, dNew / dPlain);
+        }
+        printf("\n");
+    }
+
+    if (BenchSelected("search"))
+        BenchSearch(dwLines);
+
+    if (BenchSelected("hexrows") && !BenchHexRows(lpData, dwBytes))
+        fFailed = TRUE;
+
+    SearchDestroy();
+    DestroyWindow(hTTY);
+    free(lpData);
+    return fFailed ? 1 : 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchSelected(const char *)
+
+PURPOSE: Tells if a case is to be run
+
+RETURN: TRUE if it was named on the command line or none were
+
+-----------------------------------------------------------------------------*/
+BOOL BenchSelected(const char * szName)
+{
+    int i;
+
+    for (i = 0; i < gnCases; i++)
+        if (lstrcmp(gpszCases[i], szName) == 0)
+            return TRUE;
+
+    return gnCases == 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchWindow
+
+PURPOSE: Makes the hidden window the display path draws into
+
+RETURN: the window, NULL if it can't be made
+
+COMMENTS: It is never shown, so invalidated cells are never painted.
+
+-----------------------------------------------------------------------------*/
+HWND BenchWindow()
+{
+    WNDCLASS wc;
+
+    ZeroMemory(&wc, sizeof(wc));
+    wc.lpfnWndProc = DefWindowProc;
+    wc.hInstance = GetModuleHandle(NULL);
+    wc.lpszClassName = "BenchTTY";
+    if (!RegisterClass(&wc))
+        return NULL;
+
+    XCHAR( TTYInfo ) = 8;
+    YCHAR( TTYInfo ) = 16;
+    XSIZE( TTYInfo ) = MAXCOLS * XCHAR( TTYInfo );
+    YSIZE( TTYInfo ) = MAXROWS * YCHAR( TTYInfo );
+    AUTOWRAP( TTYInfo ) = TRUE;
+    NEWLINE( TTYInfo ) = TRUE;
+    REPAINTRATE( TTYInfo ) = REPAINTRATE_DEFAULT;
+
+    return CreateWindow("BenchTTY", "bench", WS_OVERLAPPEDWINDOW | WS_VSCROLL,
+                        0, 0, XSIZE( TTYInfo ), YSIZE( TTYInfo ),
+                        NULL, NULL, wc.hInstance, NULL);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchReset
+
+PURPOSE: Clears the screen and the history before a run
+
+COMMENTS: As ClearTTYContents, without the parts of mttty that
+          aren't here.
+
+-----------------------------------------------------------------------------*/
+void BenchReset()
+{
+    FillMemory(SCREEN(TTYInfo), MAXCOLS*MAXROWS, ' ');
+    FillMemory(TTYInfo.Fg, MAXCOLS*MAXROWS, ATTR_DEFCOLOR);
+    FillMemory(TTYInfo.Bg, MAXCOLS*MAXROWS, ATTR_DEFCOLOR);
+    ZeroMemory(TTYInfo.Flags, MAXCOLS*MAXROWS);
+    SCREENTOP( TTYInfo ) = 0;
+    ZeroMemory(DIRTYROWS( TTYInfo ), sizeof(DIRTYROWS( TTYInfo )));
+    DAMAGELEFT( TTYInfo ) = MAXCOLS;
+    DAMAGERIGHT( TTYInfo ) = 0;
+    SCROLLPENDING( TTYInfo ) = 0;
+    COLUMN( TTYInfo ) = 0;
+    ROW( TTYInfo ) = MAXROWS - 1;
+    YOFFSET( TTYInfo ) = 0;
+    VtReset();
+    SbClear();
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchMakeText(char *, DWORD)
+
+PURPOSE: Fills a buffer with printable lines ending in CR LF
+
+PARAMETERS:
+    lpBuf   - buffer
+    dwBytes - its size
+
+-----------------------------------------------------------------------------*/
+void BenchMakeText(char * lpBuf, DWORD dwBytes)
+{
+    DWORD i = 0, dwLine;
+
+    while (i < dwBytes) {
+        dwLine = BenchRandom() % BENCH_LINE_MAX;
+        while (dwLine-- && i < dwBytes)
+            lpBuf[i++] = (char) (' ' + BenchRandom() % ('~' - ' ' + 1));
+        if (i < dwBytes)
+            lpBuf[i++] = ASCII_CR;
+        if (i < dwBytes)
+            lpBuf[i++] = ASCII_LF;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchMakeBinary(char *, DWORD)
+
+PURPOSE: Fills a buffer with random bytes
+
+PARAMETERS:
+    lpBuf   - buffer
+    dwBytes - its size
+
+-----------------------------------------------------------------------------*/
+void BenchMakeBinary(char * lpBuf, DWORD dwBytes)
+{
+    DWORD i;
+
+    for (i = 0; i < dwBytes; i++)
+        lpBuf[i] = (char) (BenchRandom() >> 8);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchMakeAnsi(char *, DWORD)
+
+PURPOSE: Fills a buffer with text lines whose words are colored
+
+PARAMETERS:
+    lpBuf   - buffer
+    dwBytes - its size
+
+COMMENTS: Each word gets a foreground color, some bold, and the
+          line ends with a reset, the way colored logs look.
+
+-----------------------------------------------------------------------------*/
+void BenchMakeAnsi(char * lpBuf, DWORD dwBytes)
+{
+    char szSgr[16];
+    DWORD i = 0, dwLine, dwWord, dwRandom;
+    int nLen;
+
+    while (i + sizeof(szSgr) + BENCH_WORD_MAX + 2 < dwBytes) {
+        dwLine = BenchRandom() % BENCH_LINE_MAX;
+        while (dwLine > BENCH_WORD_MAX && i + 2 * sizeof(szSgr) + BENCH_WORD_MAX + 2 < dwBytes) {
+            dwRandom = BenchRandom();
+            nLen = wsprintf(szSgr, dwRandom & 0x100 ? "\x1b[1;3%lum" : "\x1b[3%lum", dwRandom % 8);
+            CopyMemory(lpBuf + i, szSgr, nLen);
+            i += nLen;
+
+            dwWord = 1 + BenchRandom() % BENCH_WORD_MAX;
+            dwLine -= dwWord;
+            while (dwWord--)
+                lpBuf[i++] = (char) ('!' + BenchRandom() % ('~' - '!' + 1));
+            lpBuf[i++] = ' ';
+        }
+
+        CopyMemory(lpBuf + i, "\x1b[0m\r\n", 6);
+        i += 6;
+    }
+
+    //
+    // the rest as plain text
+    //
+    for ( ; i < dwBytes; i++)
+        lpBuf[i] = ' ';
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchRandom
+
+PURPOSE: Returns pseudo random numbers, the same ones every run
+
+-----------------------------------------------------------------------------*/
+DWORD BenchRandom()
+{
+    gdwRandom = gdwRandom * 1103515245 + 12345;
+    return gdwRandom >> 1;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchRun(OUTPUTPROC, HWND, char *, DWORD)
+
+PURPOSE: Times one display path over the data
+
+PARAMETERS:
+    pOutput - display path
+    hTTY    - hidden tty window
+    lpData  - data
+    dwBytes - its size
+
+RETURN: MB per second
+
+-----------------------------------------------------------------------------*/
+double BenchRun(OUTPUTPROC pOutput, HWND hTTY, char * lpData, DWORD dwBytes)
+{
+    LARGE_INTEGER liStart, liEnd;
+    DWORD i;
+
+    BenchReset();
+
+    QueryPerformanceCounter(&liStart);
+    for (i = 0; i < dwBytes; i += RX_CHUNK)
+        pOutput(hTTY, lpData + i, min(RX_CHUNK, dwBytes - i));
+    QueryPerformanceCounter(&liEnd);
+
+    return (dwBytes / 1048576.0) * gliFreq.QuadPart / (double) (liEnd.QuadPart - liStart.QuadPart);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: OldOutputACharToWindow(HWND, char)
+
+PURPOSE: The old display path: puts one character on the screen
+
+COMMENTS: As Reader.c had it before runs were copied in bulk.
+          The screen doesn't use the row ring: it is moved up a row
+          on a scroll, as it was.
+
+-----------------------------------------------------------------------------*/
+void OldOutputACharToWindow(HWND hTTY, char c)
+{
+    RECT rect;
+
+    switch (c)
+    {
+        case ASCII_BEL:                // BELL CHAR
+            MessageBeep( 0 ) ;
+        break ;
+
+        case ASCII_BS:                 // Backspace CHAR
+            if (COLUMN( TTYInfo ) > 0) COLUMN( TTYInfo ) -- ;
+        break ;
+
+        case ASCII_CR:                 // Carriage Return
+            COLUMN( TTYInfo ) = 0 ;
+            if (!NEWLINE( TTYInfo )) break;
+
+            //
+            // FALL THROUGH
+            //
+
+        case ASCII_LF:                 // Line Feed
+            if (ROW( TTYInfo )++ == MAXROWS - 1)
+            {
+                MoveMemory( (LPSTR) (SCREEN( TTYInfo )), (LPSTR) (SCREEN( TTYInfo ) + MAXCOLS), (MAXROWS - 1) * MAXCOLS ) ;
+                FillMemory((LPSTR) (SCREEN( TTYInfo ) + (MAXROWS - 1) * MAXCOLS), MAXCOLS,  ' ' ) ;
+                InvalidateRect( hTTY, NULL, FALSE ) ;
+                ROW( TTYInfo )-- ;
+            }
+        break ;
+
+        default:                       // standard character
+            SCREEN( TTYInfo )[ROW( TTYInfo ) * MAXCOLS + COLUMN( TTYInfo )] = c;
+
+            rect.left = (COLUMN( TTYInfo ) * XCHAR( TTYInfo )) - XOFFSET( TTYInfo ) ;
+            rect.right = rect.left + XCHAR( TTYInfo ) ;
+            rect.top = (ROW( TTYInfo ) * YCHAR( TTYInfo )) - YOFFSET( TTYInfo ) ;
+            rect.bottom = rect.top + YCHAR( TTYInfo ) ;
+            InvalidateRect( hTTY, &rect, FALSE ) ;
+
+            //
+            // Line wrap
+            //
+            if (COLUMN( TTYInfo ) < MAXCOLS-1 ) COLUMN( TTYInfo )++ ;
+            else if (AUTOWRAP( TTYInfo ))
+            {
+                OldOutputACharToWindow(hTTY, '\r') ;
+                if (!NEWLINE( TTYInfo )) OldOutputACharToWindow(hTTY, '\n') ;
+            }
+        break;
+    }
+
+    MoveTTYCursor(hTTY);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: OldOutputABufferToWindow(HWND, char *, DWORD)
+
+PURPOSE: The old display path: puts a buffer on the screen a
+         character at a time
+
+-----------------------------------------------------------------------------*/
+void OldOutputABufferToWindow(HWND hTTY, char * lpBuf, DWORD dwBufLen)
+{
+    int i;
+    char hexbuff[8];
+
+    for ( i = 0 ; i < (int) dwBufLen; i++)
+    {
+        if(DISPLAYHEX( TTYInfo ))
+        {
+            sprintf(hexbuff, "%02x", lpBuf[ i ]);
+
+            OldOutputACharToWindow(hTTY, hexbuff[0]) ;
+            OldOutputACharToWindow(hTTY, hexbuff[1]) ;
+        }
+        else if(NONPRINTHEX( TTYInfo ))
+        {
+            unsigned c = lpBuf[ i ];
+            if(c < ' ' || c > '~')
+            {
+                sprintf(hexbuff, "<%02x>", lpBuf[ i ]);
+
+                OldOutputACharToWindow(hTTY, hexbuff[0]) ;
+                OldOutputACharToWindow(hTTY, hexbuff[1]) ;
+                OldOutputACharToWindow(hTTY, hexbuff[2]) ;
+                OldOutputACharToWindow(hTTY, hexbuff[3]) ;
+            }
+            else OldOutputACharToWindow(hTTY, c ) ;
+        }
+        else OldOutputACharToWindow(hTTY, lpBuf[ i ] ) ;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchSearch(DWORD)
+
+PURPOSE: Fills the history with log lines and times the queries
+
+PARAMETERS:
+    dwLines - history lines
+
+COMMENTS: Every line has a sequence number and "status=OK", one in
+          BENCH_ERRORS is an ERROR line instead.  The budget is
+          raised so no line is dropped.
+
+-----------------------------------------------------------------------------*/
+void BenchSearch(DWORD dwLines)
+{
+    LARGE_INTEGER liStart, liEnd;
+    SBSTATS Stats;
+    char szLine[MAXCOLS + 1];
+    DWORD i;
+    int nLen;
+
+    BenchReset();
+    SbSetBudget(BENCH_HISTORY);
+
+    QueryPerformanceCounter(&liStart);
+    for (i = 0; i < dwLines; i++) {
+        if (i % BENCH_ERRORS == BENCH_ERRORS / 2)
+            nLen = wsprintf(szLine, "%08lu ERROR 0x%04lX in frame %lu", i, i & 0xFFFF, i);
+        else
+            nLen = wsprintf(szLine, "%08lu rx frame seq=%lu len=%lu crc=%04lX status=OK",
+                            i, i, 16 + i % 240, (i * 40503) & 0xFFFF);
+        SbAddLine(szLine, nLen);
+    }
+    QueryPerformanceCounter(&liEnd);
+
+    SbGetStats(&Stats);
+    printf("search       %lu lines, %lu KB packed, added in %lu ms\n",
+           Stats.dwLines, Stats.dwBytes / 1024,
+           (DWORD) ((liEnd.QuadPart - liStart.QuadPart) * 1000 / gliFreq.QuadPart));
+
+    for (i = 0; i < BENCH_QUERIES; i++)
+        BenchQuery(&gQueries[i]);
+
+    SearchStop();
+    SbSetBudget(HISTORYMB_DEFAULT * 0x100000);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchQuery(const BENCHQUERY *)
+
+PURPOSE: Times one search from start to first hit and to the end
+
+PARAMETERS:
+    pQuery - text and case option
+
+COMMENTS: The stats are polled as the tty window would see hits
+          come in.
+
+-----------------------------------------------------------------------------*/
+void BenchQuery(const BENCHQUERY * pQuery)
+{
+    LARGE_INTEGER liStart, liFirst, liEnd;
+    SEARCHSTATS Stats;
+    BOOL fFirst = FALSE;
+
+    QueryPerformanceCounter(&liStart);
+    SearchStart(pQuery->szText, pQuery->fMatchCase);
+
+    for ( ; ; ) {
+        SearchGetStats(&Stats);
+        if (!fFirst && Stats.dwHits) {
+            QueryPerformanceCounter(&liFirst);
+            fFirst = TRUE;
+        }
+        if (Stats.fDone)
+            break;
+        Sleep(0);
+    }
+    QueryPerformanceCounter(&liEnd);
+
+    printf("  %-16s %8lu hits, first after %6lu us, done after %8lu us, %lu of %lu blocks skipped\n",
+           pQuery->szText, Stats.dwHits,
+           fFirst ? (DWORD) ((liFirst.QuadPart - liStart.QuadPart) * 1000000 / gliFreq.QuadPart) : 0,
+           (DWORD) ((liEnd.QuadPart - liStart.QuadPart) * 1000000 / gliFreq.QuadPart),
+           Stats.dwSkipped, Stats.dwBlocks);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: BenchHexRows(char *, DWORD)
+
+PURPOSE: Times formatting the data into hex view rows
+
+PARAMETERS:
+    lpData  - buffer for the data
+    dwBytes - its size
+
+RETURN: TRUE if HexFormatRow and sprintf give the same rows
+
+COMMENTS: The data is random bytes, so every printable and
+          nonprintable byte shows up.  The rows are formatted
+          BENCH_HEXRUNS times so a short run still times well.
+
+-----------------------------------------------------------------------------*/
+BOOL BenchHexRows(char * lpData, DWORD dwBytes)
+{
+    LARGE_INTEGER liStart, liEnd;
+    char szRow[HEXVIEW_ROWLEN], szOld[HEXVIEW_ROWLEN];
+    DWORD dwRows = dwBytes / HEXVIEW_ROWBYTES;
+    DWORD i, dwRun;
+    double dNew, dOld;
+    BOOL fSame = TRUE;
+
+    BenchMakeBinary(lpData, dwBytes);
+
+    QueryPerformanceCounter(&liStart);
+    for (dwRun = 0; dwRun < BENCH_HEXRUNS; dwRun++)
+        for (i = 0; i < dwRows; i++)
+            HexFormatRow((DWORDLONG) i * HEXVIEW_ROWBYTES,
+                         (BYTE *) lpData + i * HEXVIEW_ROWBYTES, HEXVIEW_ROWBYTES, szRow);
+    QueryPerformanceCounter(&liEnd);
+    dNew = (double) dwRows * BENCH_HEXRUNS * gliFreq.QuadPart / (liEnd.QuadPart - liStart.QuadPart);
+
+    QueryPerformanceCounter(&liStart);
+    for (dwRun = 0; dwRun < BENCH_HEXRUNS; dwRun++)
+        for (i = 0; i < dwRows; i++)
+            SprintfHexFormatRow((DWORDLONG) i * HEXVIEW_ROWBYTES,
+                                (BYTE *) lpData + i * HEXVIEW_ROWBYTES, HEXVIEW_ROWBYTES, szOld);
+    QueryPerformanceCounter(&liEnd);
+    dOld = (double) dwRows * BENCH_HEXRUNS * gliFreq.QuadPart / (liEnd.QuadPart - liStart.QuadPart);
+
+    //
+    // compare every row once, outside the timing
+    //
+    for (i = 0; i < dwRows && fSame; i++) {
+        HexFormatRow((DWORDLONG) i * HEXVIEW_ROWBYTES,
+                     (BYTE *) lpData + i * HEXVIEW_ROWBYTES, HEXVIEW_ROWBYTES, szRow);
+        SprintfHexFormatRow((DWORDLONG) i * HEXVIEW_ROWBYTES,
+                            (BYTE *) lpData + i * HEXVIEW_ROWBYTES, HEXVIEW_ROWBYTES, szOld);
+        fSame = memcmp(szRow, szOld, HEXVIEW_ROWLEN) == 0;
+    }
+
+    printf("hexrows      %8.2f Mrows/s, %8.1f MB/s, sprintf %8.2f Mrows/s, %.1fx%s\n",
+           dNew / 1e6, dNew * HEXVIEW_ROWBYTES / 0x100000, dOld / 1e6, dNew / dOld,
+           fSame ? "" : ", ROWS DIFFER");
+    return fSame;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: SprintfHexFormatRow(DWORDLONG, const BYTE *, int, char *)
+
+PURPOSE: Formats a hex view row the plain way, with sprintf
+
+PARAMETERS:
+    dwlOffset - file offset of the row
+    lpData    - row bytes
+    nBytes    - how many
+    lpOut     - HEXVIEW_ROWLEN characters, not terminated
+
+COMMENTS: Same layout as HexFormatRow.  The offset is printed in
+          two halves of 24 bits, msvcrt has no portable 64 bit
+          format.
+
+-----------------------------------------------------------------------------*/
+void SprintfHexFormatRow(DWORDLONG dwlOffset, const BYTE * lpData, int nBytes, char * lpOut)
+{
+    char szHex[16];
+    char * lpAscii = lpOut + HEXVIEW_ROWLEN - HEXVIEW_ROWBYTES;
+    int i;
+
+    FillMemory(lpOut, HEXVIEW_ROWLEN, ' ');
+
+    sprintf(szHex, "%06lx%06lx", (unsigned long) (dwlOffset >> 24) & 0xFFFFFF,
+            (unsigned long) dwlOffset & 0xFFFFFF);
+    CopyMemory(lpOut, szHex, 12);
+
+    for (i = 0; i < nBytes; i++) {
+        sprintf(szHex, "%02x", lpData[i]);
+        CopyMemory(lpOut + 14 + 3 * i + (i >= 8), szHex, 2);
+        lpAscii[i] = (lpData[i] >= ' ' && lpData[i] <= '~') ? (char) lpData[i] : '.';
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: MoveTTYCursor(HWND)
+
+PURPOSE: Stands in for the tty window's; moves the caret only
+         while connected, and the benchmark never is
+
+-----------------------------------------------------------------------------*/
+BOOL MoveTTYCursor(HWND hWnd)
+{
+    UNREFERENCED_PARAMETER(hWnd);
+
+    if (CONNECTED( TTYInfo ) && (CURSORSTATE( TTYInfo ) & CS_SHOW))
+        SetCaretPos( (COLUMN( TTYInfo ) * XCHAR( TTYInfo )) - XOFFSET( TTYInfo ),
+                     (ROW( TTYInfo ) * YCHAR( TTYInfo )) - YOFFSET( TTYInfo ) );
+
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: UpdateTTYVertScroll(HWND)
+
+PURPOSE: Stands in for the tty window's; there is no scroll bar
+
+-----------------------------------------------------------------------------*/
+void UpdateTTYVertScroll(HWND hWnd)
+{
+    UNREFERENCED_PARAMETER(hWnd);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ScrollbackRows
+
+PURPOSE: As the tty window's, history lines that can be scrolled to
+
+-----------------------------------------------------------------------------*/
+int ScrollbackRows()
+{
+    DWORD dwLines, dwMax;
+
+    dwLines = SbGetLineCount();
+    dwMax = (MAXLONG / 2) / YCHAR( TTYInfo );
+
+    return (int) min(dwLines, dwMax);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: UpdateStatus(const char *)
+
+PURPOSE: Stands in for the status window; ignored
+
+-----------------------------------------------------------------------------*/
+void UpdateStatus(const char * szText)
+{
+    UNREFERENCED_PARAMETER(szText);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: RxRingWrite(HWND, char *, DWORD)
+
+PURPOSE: Stands in for the receive ring; not used
+
+-----------------------------------------------------------------------------*/
+void RxRingWrite(HWND hTTY, char * lpBuf, DWORD dwBufLen)
+{
+    UNREFERENCED_PARAMETER(hTTY);
+    UNREFERENCED_PARAMETER(lpBuf);
+    UNREFERENCED_PARAMETER(dwBufLen);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkWrite(const char *, DWORD)
+
+PURPOSE: Stands in for the capture; not used
+
+-----------------------------------------------------------------------------*/
+void CapSinkWrite(const char * lpBuf, DWORD dwBufLen)
+{
+    UNREFERENCED_PARAMETER(lpBuf);
+    UNREFERENCED_PARAMETER(dwBufLen);
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ErrorReporter(const char *)
+
+PURPOSE: Reports an error from the code under test
+
+-----------------------------------------------------------------------------*/
+void ErrorReporter(const char * szMessage)
+{
+    fprintf(stderr, "bench: %s failed, error %lu\n", szMessage, GetLastError());
+}
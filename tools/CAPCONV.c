@@ -0,0 +1,215 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: CapConv.c
+
+    PURPOSE: Converts a timestamped capture (.MTC) to text or hex.
+
+             capconv [-x] [-s seconds] capture.mtc
+
+                -x          hex dump of the data instead of text
+                -s seconds  start that far into the capture
+
+             Each record is a line with its time in seconds since
+             the capture started and its direction.  Text shows
+             printable characters as they are and the others as C
+             escapes.  Output goes to stdout.
+
+    FUNCTIONS:
+        main       - parses the command line and converts
+        PrintText  - writes record data as escaped text
+        PrintHex   - writes record data as a hex dump
+        PrintEvent - writes a comm event mask
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../CAPFMT.h"
+
+#define HEX_ROW     16              // bytes per hex dump row
+
+//
+// Prototypes for functions called only within this file
+//
+void PrintText( const BYTE *, DWORD );
+void PrintHex( const BYTE *, DWORD );
+void PrintEvent( DWORD );
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: main(int, char **)
+
+PURPOSE: Parses the command line and converts the capture
+
+RETURN: 0 if converted, 1 on a bad command line or capture
+
+-----------------------------------------------------------------------------*/
+int main(int argc, char ** argv)
+{
+    CAPREADER Cap;
+    CAPRECORD Rec;
+    SYSTEMTIME st;
+    BOOL fHex = FALSE;
+    ULONGLONG ullStart = 0;
+    const char * szFile = NULL;
+    const char * szType;
+    DWORD dwRecords = 0;
+    DWORD dwEvent;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (lstrcmp(argv[i], "-x") == 0)
+            fHex = TRUE;
+        else if (lstrcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            ullStart = (ULONGLONG) (atof(argv[++i]) * 1000000.0);
+        else if (argv[i][0] != '-' && szFile == NULL)
+            szFile = argv[i];
+        else {
+            szFile = NULL;
+            break;
+        }
+    }
+
+    if (szFile == NULL) {
+        fprintf(stderr, "usage: capconv [-x] [-s seconds] capture.mtc\n");
+        return 1;
+    }
+
+    if (!CapReadOpen(szFile, &Cap)) {
+        fprintf(stderr, "capconv: %s is not a timestamped capture\n", szFile);
+        return 1;
+    }
+
+    FileTimeToSystemTime(&Cap.Header.ftStart, &st);
+    printf("# capture started %04u-%02u-%02u %02u:%02u:%02u.%03u UTC, %lu baud\n",
+           st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond,
+           st.wMilliseconds, Cap.Header.dwBaudRate);
+    if (!Cap.fIndexed)
+        printf("# capture wasn't closed, index rebuilt from %lu blocks\n", Cap.dwBlocks);
+
+    if (ullStart && !CapReadSeek(&Cap, ullStart)) {
+        CapReadClose(&Cap);
+        return 0;
+    }
+
+    while (CapReadNext(&Cap, &Rec)) {
+        switch (Rec.dwType)
+        {
+            case CAPREC_RX:     szType = "RX";      break;
+            case CAPREC_TX:     szType = "TX";      break;
+            case CAPREC_EVENT:  szType = "EVENT";   break;
+            default:            szType = "?";       break;
+        }
+
+        printf("%6lu.%06lu %-5s ", (DWORD) (Rec.ullTime / 1000000),
+               (DWORD) (Rec.ullTime % 1000000), szType);
+
+        if (Rec.dwType == CAPREC_EVENT && Rec.dwLength == sizeof(DWORD)) {
+            CopyMemory(&dwEvent, Rec.lpData, sizeof(DWORD));
+            PrintEvent(dwEvent);
+        }
+        else if (fHex)
+            PrintHex(Rec.lpData, Rec.dwLength);
+        else
+            PrintText(Rec.lpData, Rec.dwLength);
+
+        dwRecords++;
+    }
+
+    printf("# %lu records\n", dwRecords);
+
+    CapReadClose(&Cap);
+
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: PrintText(const BYTE *, DWORD)
+
+PURPOSE: Writes record data as text on one line
+
+COMMENTS: Backslash, CR, LF, tab and non printable bytes are escaped.
+
+-----------------------------------------------------------------------------*/
+void PrintText(const BYTE * lpData, DWORD dwLen)
+{
+    DWORD i;
+
+    for (i = 0; i < dwLen; i++) {
+        switch (lpData[i])
+        {
+            case '\\':  fputs("\\\\", stdout);  break;
+            case '\r':  fputs("\\r", stdout);   break;
+            case '\n':  fputs("\\n", stdout);   break;
+            case '\t':  fputs("\\t", stdout);   break;
+            default:
+                if (lpData[i] >= 0x20 && lpData[i] < 0x7F)
+                    putchar(lpData[i]);
+                else
+                    printf("\\x%02X", lpData[i]);
+                break;
+        }
+    }
+
+    putchar('\n');
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: PrintHex(const BYTE *, DWORD)
+
+PURPOSE: Writes record data as a hex dump
+
+COMMENTS: The byte count on the record line, then HEX_ROW bytes per
+          row with their characters.
+
+-----------------------------------------------------------------------------*/
+void PrintHex(const BYTE * lpData, DWORD dwLen)
+{
+    DWORD dwRow, i;
+
+    printf("%lu bytes\n", dwLen);
+
+    for (dwRow = 0; dwRow < dwLen; dwRow += HEX_ROW) {
+        printf("    %04lX ", dwRow);
+        for (i = dwRow; i < dwRow + HEX_ROW; i++) {
+            if (i < dwLen)
+                printf(" %02X", lpData[i]);
+            else
+                fputs("   ", stdout);
+        }
+        fputs("  ", stdout);
+        for (i = dwRow; i < dwRow + HEX_ROW && i < dwLen; i++)
+            putchar(lpData[i] >= 0x20 && lpData[i] < 0x7F ? lpData[i] : '.');
+        putchar('\n');
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: PrintEvent(DWORD)
+
+PURPOSE: Writes the names of the comm events in a mask
+
+-----------------------------------------------------------------------------*/
+void PrintEvent(DWORD dwEvent)
+{
+    if (dwEvent & EV_CTS)       fputs("CTS ", stdout);
+    if (dwEvent & EV_DSR)       fputs("DSR ", stdout);
+    if (dwEvent & EV_ERR)       fputs("ERR ", stdout);
+    if (dwEvent & EV_RING)      fputs("RING ", stdout);
+    if (dwEvent & EV_RLSD)      fputs("RLSD ", stdout);
+    if (dwEvent & EV_BREAK)     fputs("BREAK ", stdout);
+    if (dwEvent & EV_RXFLAG)    fputs("RXFLAG ", stdout);
+    if (dwEvent & EV_RXCHAR)    fputs("RXCHAR ", stdout);
+    if (dwEvent & EV_TXEMPTY)   fputs("TXEMPTY ", stdout);
+    if (dwEvent == 0)           fputs("NULL", stdout);
+
+    putchar('\n');
+}
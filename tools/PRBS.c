@@ -0,0 +1,456 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: Prbs.c
+
+    PURPOSE: Generates and checks a PRBS-31 test stream, to show that
+             a capture keeps every byte across segment rotation.
+
+             prbs -g [-n bytes] [-b baud] output
+             prbs -c capture
+
+                -g          generate, to a port or a file
+                -n bytes    how many, default 1048576
+                -b baud     port speed, default 115200
+                -c          check a capture
+
+             Send the stream into the port mttty captures from,
+             with the capture rotating.  The check takes the name
+             the capture was started with: name.ext is checked as
+             its segments name.NNNNNN.ext, joined in order from the
+             lowest number there is to the highest, so a capture
+             whose oldest segments the budget deleted is checked
+             from where it starts now.  A missing segment between
+             them is reported and shows up as a slip.  Without
+             segments name.ext is checked as the one file.  A
+             timestamped capture is checked by its RX records,
+             anything else as raw bytes.
+
+             The sequence is x^31 + x^28 + 1, MSB first.  The last
+             31 bits received are the generator state, so the check
+             locks on after four bytes wherever the stream starts.
+             Then a wrong byte in a run of right ones is corruption,
+             and a run of wrong ones is a slip: bytes were lost or
+             duplicated and the check locks on again.  The exit
+             code is 1 when either was seen.
+
+    FUNCTIONS:
+        main       - parses the command line
+        Generate   - writes the stream to a port or a file
+        FindSegments - finds the lowest and highest segment numbers
+        CheckFile  - feeds one capture file to the check
+        CheckData  - checks received bytes against the sequence
+        PrbsByte   - next byte of the sequence
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../CAPFMT.h"
+
+#define PRBS_MASK       0x7FFFFFFF      // 31 bit state
+#define PRBS_SEED       PRBS_MASK
+#define PRBS_LOCK       16              // right bytes before the first lock counts
+#define PRBS_SLIP       4               // wrong bytes in a row make a slip
+#define PRBS_CHUNK      0x1000
+
+typedef struct PRBSCHECK
+{
+    DWORD      dwState;             // generator state once in sync
+    DWORD      dwShift;             // last bytes while syncing
+    DWORD      dwSyncBytes;
+    BOOL       fSynced;
+    BOOL       fLocked;             // synced and confirmed once
+    DWORD      dwRight;             // right bytes in a row
+    DWORD      dwWrong;             // wrong bytes in a row
+    ULONGLONG  ullBytes;            // bytes seen
+    ULONGLONG  ullChecked;          // bytes compared
+    DWORD      dwErrors;            // corrupted bytes
+    DWORD      dwSlips;
+    const char * szFile;            // file and offset, for reports
+    ULONGLONG  ullFilePos;
+} PRBSCHECK;
+
+//
+// Prototypes for functions called only within this file
+//
+int Generate( const char *, ULONGLONG, DWORD );
+BOOL FindSegments( const char *, const char *, DWORD *, DWORD * );
+BOOL CheckFile( const char *, PRBSCHECK * );
+void CheckData( PRBSCHECK *, const BYTE *, DWORD );
+BYTE PrbsByte( DWORD * );
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: main(int, char **)
+
+PURPOSE: Parses the command line and generates or checks
+
+RETURN: 0 if done and the check passed, 1 otherwise
+
+-----------------------------------------------------------------------------*/
+int main(int argc, char ** argv)
+{
+    PRBSCHECK Check;
+    char szBase[MAX_PATH];
+    char szExt[MAX_PATH];
+    char szSegment[MAX_PATH];
+    char * pDot;
+    const char * szName = NULL;
+    BOOL fGenerate = FALSE;
+    BOOL fCheck = FALSE;
+    ULONGLONG ullBytes = 0x100000;
+    DWORD dwBaud = 115200;
+    DWORD dwSegment, dwFirst, dwLast;
+    DWORD dwSegments = 0, dwMissing = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (lstrcmp(argv[i], "-g") == 0)
+            fGenerate = TRUE;
+        else if (lstrcmp(argv[i], "-c") == 0)
+            fCheck = TRUE;
+        else if (lstrcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            ullBytes = _strtoui64(argv[++i], NULL, 0);
+        else if (lstrcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            dwBaud = strtoul(argv[++i], NULL, 0);
+        else if (argv[i][0] != '-' && szName == NULL)
+            szName = argv[i];
+        else {
+            szName = NULL;
+            break;
+        }
+    }
+
+    if (szName == NULL || fGenerate == fCheck || lstrlen(szName) >= MAX_PATH - 16) {
+        fprintf(stderr, "usage: prbs -g [-n bytes] [-b baud] output\n"
+                        "       prbs -c capture\n");
+        return 1;
+    }
+
+    if (fGenerate)
+        return Generate(szName, ullBytes, dwBaud);
+
+    ZeroMemory(&Check, sizeof(Check));
+
+    //
+    // name.ext as its segments, like the capture names them
+    //
+    lstrcpy(szBase, szName);
+    szExt[0] = 0;
+    pDot = strrchr(szBase, '.');
+    if (pDot && strchr(pDot, '\\') == NULL) {
+        lstrcpy(szExt, pDot);
+        *pDot = 0;
+    }
+
+    if (FindSegments(szBase, szExt, &dwFirst, &dwLast)) {
+        for (dwSegment = dwFirst; dwSegment <= dwLast; dwSegment++) {
+            wsprintf(szSegment, "%s.%06lu%s", szBase, dwSegment, szExt);
+            if (GetFileAttributes(szSegment) == INVALID_FILE_ATTRIBUTES) {
+                printf("%s is missing\n", szSegment);
+                dwMissing++;
+                continue;
+            }
+            if (!CheckFile(szSegment, &Check))
+                return 1;
+            dwSegments++;
+        }
+        printf("segments %06lu to %06lu, ", dwFirst, dwLast);
+    }
+    else {
+        if (!CheckFile(szName, &Check))
+            return 1;
+        dwSegments = 1;
+    }
+
+    printf("%lu files, %I64u bytes, %I64u checked, %lu corrupted, %lu slips\n",
+           dwSegments, Check.ullBytes, Check.ullChecked,
+           Check.dwErrors, Check.dwSlips);
+
+    if (!Check.fLocked) {
+        printf("FAILED: no PRBS stream found\n");
+        return 1;
+    }
+
+    if (Check.dwErrors || Check.dwSlips || dwMissing) {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    printf("passed\n");
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: Generate(const char *, ULONGLONG, DWORD)
+
+PURPOSE: Writes the stream to a port or a file
+
+PARAMETERS:
+    szName   - port or file
+    ullBytes - bytes to write
+    dwBaud   - port speed, 8N1
+
+RETURN: 0 if written, 1 otherwise
+
+COMMENTS: What opens as an existing device with a comm state is a
+          port, anything else is a file that is made or replaced.
+          The stream always starts from the same state.
+
+-----------------------------------------------------------------------------*/
+int Generate(const char * szName, ULONGLONG ullBytes, DWORD dwBaud)
+{
+    BYTE Buf[PRBS_CHUNK];
+    DCB dcb;
+    HANDLE hFile;
+    DWORD dwState = PRBS_SEED;
+    DWORD dwSize, dwWritten, i;
+
+    hFile = CreateFile(szName, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    dcb.DCBlength = sizeof(dcb);
+    if (hFile != INVALID_HANDLE_VALUE && GetCommState(hFile, &dcb)) {
+        dcb.BaudRate = dwBaud;
+        dcb.ByteSize = 8;
+        dcb.Parity = NOPARITY;
+        dcb.StopBits = ONESTOPBIT;
+        if (!SetCommState(hFile, &dcb)) {
+            fprintf(stderr, "prbs: can't set %s to %lu baud\n", szName, dwBaud);
+            CloseHandle(hFile);
+            return 1;
+        }
+    }
+    else {
+        if (hFile != INVALID_HANDLE_VALUE)
+            CloseHandle(hFile);
+        hFile = CreateFile(szName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            fprintf(stderr, "prbs: can't open %s\n", szName);
+            return 1;
+        }
+    }
+
+    while (ullBytes) {
+        dwSize = (DWORD) min(ullBytes, PRBS_CHUNK);
+        for (i = 0; i < dwSize; i++)
+            Buf[i] = PrbsByte(&dwState);
+
+        if (!WriteFile(hFile, Buf, dwSize, &dwWritten, NULL) || dwWritten != dwSize) {
+            fprintf(stderr, "prbs: write to %s failed, error %lu\n", szName, GetLastError());
+            CloseHandle(hFile);
+            return 1;
+        }
+        ullBytes -= dwSize;
+    }
+
+    CloseHandle(hFile);
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: FindSegments(const char *, const char *, DWORD *, DWORD *)
+
+PURPOSE: Finds the lowest and highest segment numbers of a capture
+
+PARAMETERS:
+    szBase   - capture name up to the number
+    szExt    - and after it
+    pdwFirst - lowest number found
+    pdwLast  - highest
+
+RETURN: FALSE if there are no segments
+
+COMMENTS: Segments are named as the capture names them,
+          base.NNNNNN.ext with six digits or more.
+
+-----------------------------------------------------------------------------*/
+BOOL FindSegments(const char * szBase, const char * szExt, DWORD * pdwFirst, DWORD * pdwLast)
+{
+    WIN32_FIND_DATA fd;
+    HANDLE hFind;
+    char szPattern[MAX_PATH];
+    char * pNumber;
+    char * pEnd;
+    DWORD dwSegment;
+    BOOL fFound = FALSE;
+
+    wsprintf(szPattern, "%s.*%s", szBase, szExt);
+    hFind = FindFirstFile(szPattern, &fd);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    do {
+        //
+        // fd has the name without the directory, the number is
+        // after the last dot before the extension
+        //
+        if (lstrlen(fd.cFileName) <= lstrlen(szExt))
+            continue;
+        fd.cFileName[lstrlen(fd.cFileName) - lstrlen(szExt)] = 0;
+        pNumber = strrchr(fd.cFileName, '.');
+        if (pNumber == NULL || lstrlen(++pNumber) < 6 || *pNumber < '0' || *pNumber > '9')
+            continue;
+        dwSegment = strtoul(pNumber, &pEnd, 10);
+        if (*pEnd != 0 || dwSegment == 0)
+            continue;
+
+        if (!fFound || dwSegment < *pdwFirst)
+            *pdwFirst = dwSegment;
+        if (!fFound || dwSegment > *pdwLast)
+            *pdwLast = dwSegment;
+        fFound = TRUE;
+    } while (FindNextFile(hFind, &fd));
+
+    FindClose(hFind);
+    return fFound;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CheckFile(const char *, PRBSCHECK *)
+
+PURPOSE: Feeds one capture file to the check
+
+PARAMETERS:
+    szFile - capture or segment
+    pCheck - check state, carried from the previous segment
+
+RETURN: FALSE if the file can't be read
+
+-----------------------------------------------------------------------------*/
+BOOL CheckFile(const char * szFile, PRBSCHECK * pCheck)
+{
+    BYTE Buf[PRBS_CHUNK];
+    CAPREADER Cap;
+    CAPRECORD Rec;
+    HANDLE hFile;
+    DWORD dwRead;
+
+    pCheck->szFile = szFile;
+    pCheck->ullFilePos = 0;
+
+    if (CapReadOpen(szFile, &Cap)) {
+        while (CapReadNext(&Cap, &Rec))
+            if (Rec.dwType == CAPREC_RX)
+                CheckData(pCheck, Rec.lpData, Rec.dwLength);
+        CapReadClose(&Cap);
+        return TRUE;
+    }
+
+    hFile = CreateFile(szFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "prbs: can't open %s\n", szFile);
+        return FALSE;
+    }
+
+    while (ReadFile(hFile, Buf, sizeof(Buf), &dwRead, NULL) && dwRead)
+        CheckData(pCheck, Buf, dwRead);
+
+    CloseHandle(hFile);
+    return TRUE;
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CheckData(PRBSCHECK *, const BYTE *, DWORD)
+
+PURPOSE: Checks received bytes against the sequence
+
+PARAMETERS:
+    pCheck - check state
+    lpData - received bytes
+    dwLen  - their number
+
+COMMENTS: Until the first PRBS_LOCK right bytes in a row a wrong
+          one just syncs again, so what came before the stream
+          isn't counted.  After that PRBS_SLIP wrong bytes in a
+          row are one slip, not corruption.
+
+-----------------------------------------------------------------------------*/
+void CheckData(PRBSCHECK * pCheck, const BYTE * lpData, DWORD dwLen)
+{
+    BYTE bExpected;
+    DWORD i;
+
+    for (i = 0; i < dwLen; i++, pCheck->ullBytes++, pCheck->ullFilePos++) {
+        if (!pCheck->fSynced) {
+            pCheck->dwShift = (pCheck->dwShift << 8) | lpData[i];
+            if (++pCheck->dwSyncBytes >= 4 && (pCheck->dwShift & PRBS_MASK)) {
+                pCheck->dwState = pCheck->dwShift & PRBS_MASK;
+                pCheck->fSynced = TRUE;
+                pCheck->dwRight = 0;
+                pCheck->dwWrong = 0;
+            }
+            continue;
+        }
+
+        bExpected = PrbsByte(&pCheck->dwState);
+        if (pCheck->fLocked)
+            pCheck->ullChecked++;
+
+        if (lpData[i] == bExpected) {
+            pCheck->dwWrong = 0;
+            if (++pCheck->dwRight == PRBS_LOCK)
+                pCheck->fLocked = TRUE;
+            continue;
+        }
+
+        pCheck->dwRight = 0;
+        if (!pCheck->fLocked) {
+            pCheck->fSynced = FALSE;
+            pCheck->dwSyncBytes = 0;
+            continue;
+        }
+
+        pCheck->dwErrors++;
+        if (++pCheck->dwWrong < PRBS_SLIP)
+            continue;
+
+        //
+        // the wrong bytes were the slip, sync on what follows
+        //
+        pCheck->dwErrors -= pCheck->dwWrong;
+        pCheck->dwSlips++;
+        printf("slip at offset %I64u of %s\n",
+               pCheck->ullFilePos + 1 - pCheck->dwWrong, pCheck->szFile);
+        pCheck->fSynced = FALSE;
+        pCheck->dwSyncBytes = 0;
+    }
+}
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: PrbsByte(DWORD *)
+
+PURPOSE: Returns the next byte of the sequence
+
+PARAMETERS:
+    pdwState - generator state, advanced eight bits
+
+-----------------------------------------------------------------------------*/
+BYTE PrbsByte(DWORD * pdwState)
+{
+    DWORD dwState = *pdwState;
+    DWORD dwBit;
+    BYTE b = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        dwBit = ((dwState >> 30) ^ (dwState >> 27)) & 1;
+        dwState = ((dwState << 1) | dwBit) & PRBS_MASK;
+        b = (BYTE) ((b << 1) | dwBit);
+    }
+
+    *pdwState = dwState;
+    return b;
+}
@@ -0,0 +1,511 @@
+/*-----------------------------------------------------------------------------
+
+    MODULE: WrStress.c
+
+    PURPOSE: Stress test for the write queue.  Runs the real writer
+             thread (Writer.c, WrPool.c) against the NUL device or a
+             port, with three producer threads queueing WRITE_BLOCK
+             requests the way a paste does while aborts come through
+             the urgent queue.
+
+             wrstress [-n requests] [-s size] [-a ms] [port]
+
+                -n requests  requests per producer, default 20000
+                -s size      bytes per request, default 256
+                -a ms        abort every ms milliseconds, default 0
+                             (no aborts)
+                port         device to write to, default NUL
+
+             Every request starts with its producer number and a
+             sequence number, and the rest is a pattern made from
+             them.  The data the writer issues is checked as it is
+             issued: per producer the sequence numbers must go up
+             with no request sent twice or out of order, and
+             without aborts none may be missing.  An abort drops
+             whole requests, which are counted.
+
+             Reported are the time a producer waits for room in the
+             queue, the cost of queueing a request (mean, 99th
+             percentile and maximum), the abort latency from the
+             urgent request to the writer signalling it done, and
+             the throughput.  The exit code is 1 when a check
+             failed.
+
+    FUNCTIONS:
+        main            - parses the command line and runs the test
+        ProducerProc    - thread that queues requests
+        PrintTimes      - prints mean, 99th percentile and maximum
+        CompareDword    - qsort compare for the timings
+        TicksToUs       - converts performance counter ticks to us
+        CheckBlock      - checks one whole request
+        CapSinkRecord   - checks the data as the writer issues it
+        ErrorReporter   - counts errors from the writer
+        ErrorInComm     - reports a fatal writer error and exits
+        StatusLog       - ignored
+        UpdateStatus    - ignored
+
+-----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../MTTTY.h"
+
+#define PRODUCERS       3               // producer threads
+#define BLOCK_HEADER    5               // producer number and sequence
+#define MAX_ABORTS      4096            // abort latencies kept
+
+typedef struct PRODUCER
+{
+    DWORD      dwId;
+    HANDLE     hThread;
+    DWORD *    pdwEnqueue;          // ticks per WriterAddNewNode
+    DWORD *    pdwRoom;             // ticks waiting for room
+    DWORD      dwFailures;          // queueing failed, retried
+    DWORD      dwNext;              // next sequence expected by the checker
+    DWORD      dwReceived;          // requests seen by the checker
+} PRODUCER;
+
+PRODUCER gProducers[PRODUCERS];
+DWORD gdwRequests = 20000;
+DWORD gdwSize = 256;
+LARGE_INTEGER gliFreq;
+
+//
+// checker state, touched only by the writer thread
+//
+BYTE *  gpCheckBuf;
+DWORD   gdwCheckFill;
+DWORD   gdwBadBlocks;
+DWORD   gdwBytesIssued;
+
+LONG volatile glErrors;
+
+//
+// Prototypes for functions called only within this file
+//
+DWORD WINAPI ProducerProc( LPVOID );
+void PrintTimes( const char *, DWORD *, DWORD );
+int CompareDword( const void *, const void * );
+DWORD TicksToUs( LONGLONG );
+void CheckBlock( const BYTE * );
+
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: main(int, char **)
+
+PURPOSE: Parses the command line and runs the test
+
+RETURN: 0 if every check passed, 1 otherwise
+
+-----------------------------------------------------------------------------*/
+int main(int argc, char ** argv)
+{
+    const char * szPort = "NUL";
+    DWORD dwAbortGap = 0;
+    DWORD dwAborts = 0;
+    DWORD dwAbortTimeouts = 0;
+    DWORD * pdwAbort;
+    DWORD dwId;
+    DWORD dwDropped;
+    DWORD dwMissing = 0;
+    LARGE_INTEGER liStart, liEnd, liSent, liDone;
+    HANDLE hWriter;
+    HANDLE hThreads[PRODUCERS];
+    BOOL fFailed = FALSE;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (lstrcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            gdwRequests = strtoul(argv[++i], NULL, 0);
+        else if (lstrcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            gdwSize = strtoul(argv[++i], NULL, 0);
+        else if (lstrcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            dwAbortGap = strtoul(argv[++i], NULL, 0);
+        else if (argv[i][0] != '-')
+            szPort = argv[i];
+        else {
+            gdwRequests = 0;
+            break;
+        }
+    }
+
+    if (gdwRequests == 0 || gdwSize < BLOCK_HEADER + 1 || gdwSize > 0x10000) {
+        fprintf(stderr, "usage: wrstress [-n requests] [-s size] [-a ms] [port]\n");
+        return 1;
+    }
+
+    QueryPerformanceFrequency(&gliFreq);
+
+    //
+    // what the application sets up before it starts the writer
+    //
+    TXHIGHKB( TTYInfo ) = TXHIGHKB_DEFAULT;
+    TXLOWKB( TTYInfo )  = TXLOWKB_DEFAULT;
+    InitializeCriticalSection(&gcsDataHeap);
+    WrPoolCreate();
+
+    ghThreadExitEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    COMDEV( TTYInfo ) = CreateFile( szPort, GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+                                    FILE_FLAG_OVERLAPPED, NULL );
+    if (COMDEV( TTYInfo ) == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "wrstress: can't open %s\n", szPort);
+        return 1;
+    }
+
+    gpCheckBuf = (BYTE *) malloc(gdwSize);
+    pdwAbort = (DWORD *) malloc(MAX_ABORTS * sizeof(DWORD));
+    for (i = 0; i < PRODUCERS; i++) {
+        gProducers[i].dwId = i;
+        gProducers[i].pdwEnqueue = (DWORD *) malloc(gdwRequests * sizeof(DWORD));
+        gProducers[i].pdwRoom = (DWORD *) malloc(gdwRequests * sizeof(DWORD));
+        if (gProducers[i].pdwEnqueue == NULL || gProducers[i].pdwRoom == NULL) {
+            fprintf(stderr, "wrstress: out of memory\n");
+            return 1;
+        }
+    }
+
+    //
+    // the writer creates its events; the rest of its setup is
+    // done long before the first request can reach it
+    //
+    hWriter = CreateThread(NULL, 0, WriterProc, NULL, 0, &dwId);
+    while (ghWriterRoomEvent == NULL)
+        Sleep(1);
+    Sleep(50);
+
+    QueryPerformanceCounter(&liStart);
+    for (i = 0; i < PRODUCERS; i++) {
+        gProducers[i].hThread = CreateThread(NULL, 0, ProducerProc, &gProducers[i], 0, &dwId);
+        hThreads[i] = gProducers[i].hThread;
+    }
+
+    //
+    // abort through the urgent queue until the producers are done,
+    // timing each until the writer signals it
+    //
+    for ( ; ; ) {
+        if (WaitForMultipleObjects(PRODUCERS, hThreads, TRUE,
+                                   dwAbortGap ? dwAbortGap : INFINITE) != WAIT_TIMEOUT)
+            break;
+
+        ResetEvent(ghTransferCompleteEvent);
+        QueryPerformanceCounter(&liSent);
+        if (!WriterAddUrgentNodeTimeout(WRITE_ABORT, 0, 0, NULL, NULL, NULL, 100))
+            continue;
+        if (WaitForSingleObject(ghTransferCompleteEvent, 5000) != WAIT_OBJECT_0) {
+            dwAbortTimeouts++;
+            continue;
+        }
+        QueryPerformanceCounter(&liDone);
+        if (dwAborts < MAX_ABORTS)
+            pdwAbort[dwAborts++] = (DWORD) (liDone.QuadPart - liSent.QuadPart);
+    }
+
+    //
+    // a file end goes behind everything queued and is signalled
+    // once the writer has issued and completed all of it
+    //
+    ResetEvent(ghTransferCompleteEvent);
+    WriterAddNewNode(WRITE_FILEEND, 0, 0, NULL, NULL, NULL);
+    if (WaitForSingleObject(ghTransferCompleteEvent, 30000) != WAIT_OBJECT_0) {
+        fprintf(stderr, "wrstress: the writer did not drain the queue\n");
+        fFailed = TRUE;
+    }
+    QueryPerformanceCounter(&liEnd);
+
+    SetEvent(ghThreadExitEvent);
+    WaitForSingleObject(hWriter, INFINITE);
+    CloseHandle(hWriter);
+    CloseHandle(COMDEV( TTYInfo ));
+
+    //
+    // results
+    //
+    printf("%d producers, %lu requests of %lu bytes each, aborts every %lu ms\n",
+           PRODUCERS, gdwRequests, gdwSize, dwAbortGap);
+
+    for (i = 0; i < PRODUCERS; i++) {
+        CloseHandle(gProducers[i].hThread);
+        dwDropped = gdwRequests - gProducers[i].dwReceived;
+        if (!dwAbortGap)
+            dwMissing += dwDropped;
+        printf("producer %d: %lu sent, %lu dropped, %lu queueing failures\n",
+               i, gProducers[i].dwReceived, dwDropped, gProducers[i].dwFailures);
+    }
+
+    for (i = 0; i < PRODUCERS; i++) {
+        PrintTimes("room wait", gProducers[i].pdwRoom, gdwRequests);
+        PrintTimes("enqueue", gProducers[i].pdwEnqueue, gdwRequests);
+    }
+    if (dwAbortGap)
+        PrintTimes("abort", pdwAbort, dwAborts);
+
+    printf("%lu bytes issued in %lu ms, %.1f MB/s\n", gdwBytesIssued,
+           TicksToUs(liEnd.QuadPart - liStart.QuadPart) / 1000,
+           gdwBytesIssued / (double) TicksToUs(liEnd.QuadPart - liStart.QuadPart));
+
+    if (gdwBadBlocks) {
+        printf("FAILED: %lu requests sent twice, out of order or corrupted\n", gdwBadBlocks);
+        fFailed = TRUE;
+    }
+    if (dwMissing) {
+        printf("FAILED: %lu requests lost without an abort\n", dwMissing);
+        fFailed = TRUE;
+    }
+    if (gdwCheckFill) {
+        printf("FAILED: %lu bytes of a partial request issued\n", gdwCheckFill);
+        fFailed = TRUE;
+    }
+    if (dwAbortTimeouts) {
+        printf("FAILED: %lu aborts not signalled within 5 s\n", dwAbortTimeouts);
+        fFailed = TRUE;
+    }
+    if (glErrors)
+        printf("%ld errors reported by the writer\n", glErrors);
+
+    if (!fFailed)
+        printf("passed\n");
+
+    return fFailed ? 1 : 0;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ProducerProc(LPVOID)
+
+PURPOSE: Queues the requests of one producer
+
+PARAMETERS:
+    lpV - PRODUCER of the thread
+
+COMMENTS: Waits for room and queues like a paste does, with each
+          request in its own heap block that the writer frees.
+
+-----------------------------------------------------------------------------*/
+DWORD WINAPI ProducerProc(LPVOID lpV)
+{
+    PRODUCER * pProd = (PRODUCER *) lpV;
+    LARGE_INTEGER liStart, liRoom, liQueued;
+    BYTE * lpBuf;
+    DWORD dwSeq;
+    DWORD i;
+
+    for (dwSeq = 0; dwSeq < gdwRequests; dwSeq++) {
+        lpBuf = (BYTE *) HeapAlloc(GetProcessHeap(), 0, gdwSize);
+        if (lpBuf == NULL)
+            break;
+
+        lpBuf[0] = (BYTE) pProd->dwId;
+        CopyMemory(lpBuf + 1, &dwSeq, sizeof(DWORD));
+        for (i = BLOCK_HEADER; i < gdwSize; i++)
+            lpBuf[i] = (BYTE) (dwSeq + i + pProd->dwId);
+
+        QueryPerformanceCounter(&liStart);
+        WaitForSingleObject(ghWriterRoomEvent, INFINITE);
+        QueryPerformanceCounter(&liRoom);
+
+        //
+        // the pool ran dry: not a loss, try again
+        //
+        while (!WriterAddNewNode(WRITE_BLOCK, gdwSize, 0, (char *) lpBuf,
+                                 GetProcessHeap(), NULL)) {
+            pProd->dwFailures++;
+            Sleep(1);
+            QueryPerformanceCounter(&liRoom);
+        }
+        QueryPerformanceCounter(&liQueued);
+
+        pProd->pdwRoom[dwSeq] = (DWORD) (liRoom.QuadPart - liStart.QuadPart);
+        pProd->pdwEnqueue[dwSeq] = (DWORD) (liQueued.QuadPart - liRoom.QuadPart);
+    }
+
+    WrPoolThreadExit();
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: PrintTimes(const char *, DWORD *, DWORD)
+
+PURPOSE: Prints mean, 99th percentile and maximum of timings
+
+PARAMETERS:
+    szName  - what was timed
+    pdwTime - timings in performance counter ticks, sorted here
+    dwCount - number of timings
+
+-----------------------------------------------------------------------------*/
+void PrintTimes(const char * szName, DWORD * pdwTime, DWORD dwCount)
+{
+    LONGLONG llSum = 0;
+    DWORD i;
+
+    if (dwCount == 0) {
+        printf("%-10s none\n", szName);
+        return;
+    }
+
+    qsort(pdwTime, dwCount, sizeof(DWORD), CompareDword);
+    for (i = 0; i < dwCount; i++)
+        llSum += pdwTime[i];
+
+    printf("%-10s mean %lu us, p99 %lu us, max %lu us\n", szName,
+           TicksToUs(llSum / dwCount),
+           TicksToUs(pdwTime[(dwCount - 1) * 99 / 100]),
+           TicksToUs(pdwTime[dwCount - 1]));
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CompareDword(const void *, const void *)
+
+PURPOSE: qsort compare for the timings
+
+-----------------------------------------------------------------------------*/
+int CompareDword(const void * p1, const void * p2)
+{
+    DWORD dw1 = *(const DWORD *) p1;
+    DWORD dw2 = *(const DWORD *) p2;
+
+    return dw1 < dw2 ? -1 : dw1 > dw2;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: TicksToUs(LONGLONG)
+
+PURPOSE: Converts performance counter ticks to microseconds
+
+-----------------------------------------------------------------------------*/
+DWORD TicksToUs(LONGLONG llTicks)
+{
+    return (DWORD) (llTicks * 1000000 / gliFreq.QuadPart);
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CheckBlock(const BYTE *)
+
+PURPOSE: Checks one whole request as the writer issued it
+
+COMMENTS: A sequence number lower than expected means the request
+          was sent twice or out of order.  A higher one means an
+          abort dropped the ones between.
+
+-----------------------------------------------------------------------------*/
+void CheckBlock(const BYTE * lpBuf)
+{
+    PRODUCER * pProd;
+    DWORD dwSeq;
+    DWORD i;
+
+    if (lpBuf[0] >= PRODUCERS) {
+        gdwBadBlocks++;
+        return;
+    }
+
+    pProd = &gProducers[lpBuf[0]];
+    CopyMemory(&dwSeq, lpBuf + 1, sizeof(DWORD));
+
+    for (i = BLOCK_HEADER; i < gdwSize; i++)
+        if (lpBuf[i] != (BYTE) (dwSeq + i + pProd->dwId)) {
+            gdwBadBlocks++;
+            return;
+        }
+
+    if (dwSeq < pProd->dwNext || dwSeq >= gdwRequests) {
+        gdwBadBlocks++;
+        return;
+    }
+
+    pProd->dwNext = dwSeq + 1;
+    pProd->dwReceived++;
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: CapSinkRecord(DWORD, const char *, DWORD)
+
+PURPOSE: Stands in for the capture; sees the data of each write
+         slot as it is issued
+
+COMMENTS: A request larger than a write slot comes in pieces, and
+          the pieces are put back together before the check.
+
+-----------------------------------------------------------------------------*/
+void CapSinkRecord(DWORD dwType, const char * lpBuf, DWORD dwSize)
+{
+    DWORD dwCopy;
+
+    if (dwType != CAPREC_TX)
+        return;
+
+    gdwBytesIssued += dwSize;
+    while (dwSize) {
+        dwCopy = min(dwSize, gdwSize - gdwCheckFill);
+        CopyMemory(gpCheckBuf + gdwCheckFill, lpBuf, dwCopy);
+        gdwCheckFill += dwCopy;
+        lpBuf += dwCopy;
+        dwSize -= dwCopy;
+
+        if (gdwCheckFill == gdwSize) {
+            CheckBlock(gpCheckBuf);
+            gdwCheckFill = 0;
+        }
+    }
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ErrorReporter(const char *)
+
+PURPOSE: Counts errors the writer reports; an empty pool is one
+         and the producers retry it
+
+-----------------------------------------------------------------------------*/
+void ErrorReporter(const char * szMessage)
+{
+    UNREFERENCED_PARAMETER(szMessage);
+    InterlockedIncrement(&glErrors);
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: ErrorInComm(const char *)
+
+PURPOSE: Reports a fatal writer error and exits
+
+-----------------------------------------------------------------------------*/
+void ErrorInComm(const char * szMessage)
+{
+    fprintf(stderr, "wrstress: %s failed, error %lu\n", szMessage, GetLastError());
+    ExitProcess(1);
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: StatusLog(DWORD, DWORD, DWORD)
+
+PURPOSE: Stands in for the status log; ignored
+
+-----------------------------------------------------------------------------*/
+void StatusLog(DWORD dwType, DWORD dwParam1, DWORD dwParam2)
+{
+    UNREFERENCED_PARAMETER(dwType);
+    UNREFERENCED_PARAMETER(dwParam1);
+    UNREFERENCED_PARAMETER(dwParam2);
+}
+
+/*-----------------------------------------------------------------------------
+
+FUNCTION: UpdateStatus(const char *)
+
+PURPOSE: Stands in for the status window; ignored
+
+-----------------------------------------------------------------------------*/
+void UpdateStatus(const char * szText)
+{
+    UNREFERENCED_PARAMETER(szText);
+}